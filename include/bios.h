@@ -0,0 +1,31 @@
+#ifndef BIOS_H_INCLUDED
+#define BIOS_H_INCLUDED
+
+#include "common.h"
+#include "cpu.h"
+#include "memory.h"
+#include "savestate.h"
+
+#define print_bios_error(func, format, ...) print_error("bios.c", func, format, __VA_ARGS__)
+
+// the bios copies the shell here and jumps to it once the kernel is set up
+#define BIOS_SHELL_ENTRY 0X80030000
+
+// 64 bit fnv-1a
+#define BIOS_HASH_BASIS 0XCBF29CE484222325ULL
+#define BIOS_HASH_PRIME 0X00000100000001B3ULL
+
+struct BIOS {
+    uint64_t hash;       // of the loaded image, names the boot snapshot
+    char cache[4096];    // boot snapshot path, empty without a cache
+    bool capture;        // no usable snapshot yet, take one at the shell
+};
+
+/* public functions */
+extern struct BIOS *get_bios( void );
+extern uint64_t bios_hash( void );
+extern bool bios_at_shell( void );
+extern PSX_ERROR bios_cache_restore( const char *directory );
+extern void bios_cache_capture( void );
+
+#endif//BIOS_H_INCLUDED
@@ -3,15 +3,171 @@
 
 #include "common.h"
 #include "memory.h"
+#include "scheduler.h"
+#include "interrupts.h"
 
 #define print_cdrom_error(func, format, ...) print_error("cdrom.c", func, format,  __VA_ARGS__)
 
+#define ADDR_CDROM_END 0X1F801804
+
+// raw sectors as stored in a bin, sync and header included
+#define CDROM_SECTOR_SIZE 2352
+// lba 0 is at 00:02:00, the first two seconds are lead in
+#define CDROM_LEAD_IN 150
+#define CDROM_TRACKS_MAX 99
+#define CDROM_FIFO_SIZE 16
+// responses waiting for the cpu to acknowledge the one before
+#define CDROM_QUEUE_SIZE 4
+
+// timings in cpu cycles
+#define CDROM_ACK_CYCLES    25000               // command to first response
+#define CDROM_NEXT_CYCLES   1000                // acknowledge to the next queued response
+#define CDROM_GETID_CYCLES  0X4A00              // first to second response of GetID
+#define CDROM_SEEK_CYCLES   100000              // a fixed seek, whatever the distance
+#define CDROM_READ_CYCLES   (33868800 / 75)     // a sector at single speed, half that at double
+
+// stat byte, the first byte of most responses
+#define CDROM_STAT_ERROR      0X01
+#define CDROM_STAT_MOTOR      0X02
+#define CDROM_STAT_SEEK_ERROR 0X04
+#define CDROM_STAT_ID_ERROR   0X08
+#define CDROM_STAT_SHELL_OPEN 0X10
+#define CDROM_STAT_READING    0X20
+#define CDROM_STAT_SEEKING    0X40
+#define CDROM_STAT_PLAYING    0X80
+
+// mode set by Setmode
+#define CDROM_MODE_XA_ADPCM   0X40  // xa audio sectors go to the spu, not the cpu
+#define CDROM_MODE_WHOLE      0X20  // 0X924 bytes of each sector rather than 0X800
+#define CDROM_MODE_SPEED      0X80  // double speed
+
+// second error byte of an INT5
+#define CDROM_ERROR_PARAMETERS 0X20
+#define CDROM_ERROR_COMMAND    0X40
+#define CDROM_ERROR_NO_DISC    0X80
+
+enum CDROM_INTERRUPT {
+    CDROM_INT_NONE,
+    CDROM_INT1,     // data ready, a sector was read
+    CDROM_INT2,     // second response, the command completed
+    CDROM_INT3,     // first response, the command was acknowledged
+    CDROM_INT4,     // data end
+    CDROM_INT5      // error
+};
+
+enum CDROM_COMMAND {
+    CDROM_GETSTAT = 0X01,
+    CDROM_SETLOC  = 0X02,
+    CDROM_READN   = 0X06,
+    CDROM_PAUSE   = 0X09,
+    CDROM_INIT    = 0X0A,
+    CDROM_MUTE    = 0X0B,
+    CDROM_DEMUTE  = 0X0C,
+    CDROM_SETMODE = 0X0E,
+    CDROM_SEEKL   = 0X15,
+    CDROM_SEEKP   = 0X16,
+    CDROM_TEST    = 0X19,
+    CDROM_GETID   = 0X1A,
+    CDROM_READS   = 0X1B
+};
+
+// what the drive does when EVENT_CDROM_DRIVE fires
+enum CDROM_DRIVE {
+    CDROM_IDLE,
+    CDROM_SEEK,     // SeekL or SeekP finishing
+    CDROM_READ,     // the next sector of ReadN or ReadS
+    CDROM_ID,       // GetID second response
+    CDROM_PAUSING,  // Pause second response
+    CDROM_INITING   // Init second response
+};
+
+// status register at 0X1F801800, the low two bits select the bank of the other three
+union CDROM_STATUS {
+    uint8_t value;
+    struct {
+        uint8_t index: 2;
+        uint8_t adpcm_busy: 1;
+        uint8_t parameter_empty: 1;
+        uint8_t parameter_ready: 1;  // not full
+        uint8_t response_ready: 1;   // not empty
+        uint8_t data_ready: 1;       // not empty
+        uint8_t busy: 1;             // a command is waiting for its first response
+    };
+};
+
+struct CDROM_RESPONSE {
+    enum CDROM_INTERRUPT interrupt;
+    uint8_t bytes[CDROM_FIFO_SIZE];
+    uint8_t size;
+};
+
+// a bin is mapped whole, reading a sector is an offset into it
+struct CDROM_FILE {
+    const uint8_t *data;
+    size_t size;
+    uint32_t start;    // lba of the first sector
+    uint32_t sectors;
+};
+
+struct CDROM_TRACK {
+    uint32_t start;    // lba of index 1
+    bool audio;
+};
+
+struct CDROM_DISC {
+    bool present;
+    struct CDROM_FILE files[CDROM_TRACKS_MAX];
+    uint32_t file_count;
+    struct CDROM_TRACK tracks[CDROM_TRACKS_MAX];
+    uint32_t track_count;
+    uint32_t sectors;  // lba past the end of the last file
+    char region[4];    // license string of GetID
+};
+
 struct CDROM {
-    /** Registers */
-    union CDROM_INDEX_STATUS_REG idx_sts_reg;
-    union CDROM_COMMAND_REG      cmd_reg;
+    // the image stays with the host, loading a state keeps it
+    struct CDROM_DISC disc;
+
+    union CDROM_STATUS status;
+    uint8_t interrupt_enable;
+    uint8_t interrupt_flag;
+    bool irq;          // flag and enable overlap, I_STAT is set as this goes high
+
+    uint8_t parameters[CDROM_FIFO_SIZE];
+    uint8_t parameter_count;
+    struct CDROM_RESPONSE response;
+    uint8_t response_read;
 
+    // responses not delivered yet, the head goes once the flag is acknowledged
+    struct CDROM_RESPONSE queue[CDROM_QUEUE_SIZE];
+    uint32_t queue_head;
+    uint32_t queue_count;
 
+    uint8_t command;   // waiting for its first response while status.busy
+
+    enum CDROM_DRIVE drive;
+    uint8_t stat;
+    uint8_t mode;
+    uint32_t setloc;   // target of the next seek or read
+    bool setloc_pending;
+    uint32_t position; // lba under the head
+
+    // the last sector read, and the part of it the data fifo holds once requested
+    uint32_t sector;
+    bool sector_ready;
+    uint32_t data_lba;
+    uint32_t data_offset;
+    uint32_t data_size;
+    uint32_t data_read;
 };
 
+/* public functions */
+extern struct CDROM *get_cdrom( void );
+extern PSX_ERROR cdrom_open( const char *path );
+extern void cdrom_reset( void );
+extern uint32_t cdrom_read( uint32_t address, uint32_t width );
+extern void cdrom_write( uint32_t address, uint8_t value );
+extern void cdrom_dma_read( uint32_t *words, uint32_t count );
+extern const uint8_t *cdrom_sector( uint32_t lba );
+
 #endif // CDROM_H_INCLUDED
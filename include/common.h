@@ -12,8 +12,6 @@
 #include "error.h"
 
 #define DEBUG
-#define MAX_TRIANGLES 1024
-#define MAX_VERTICIES 3 * MAX_TRIANGLES
 
 #define WIN_NAME "PSX-Emulator"
 #define WIN_WIDTH 512
@@ -55,10 +53,18 @@ enum IO_PORT_ADDRESSES {
     ADDR_TIMER_0       = 0X1F801100,
     ADDR_TIMER_1       = 0X1F801110,
     ADDR_TIMER_2       = 0X1F801120,
+    ADDR_CDROM_STATUS  = 0X1F801800,
+    ADDR_CDROM_COMMAND = 0X1F801801,
+    ADDR_CDROM_PARAMS  = 0X1F801802,
+    ADDR_CDROM_REQUEST = 0X1F801803,
     ADDR_GP0           = 0X1F801810,
     ADDR_GP1           = 0X1F801814,
     ADDR_GPUREAD       = 0X1F801810,
     ADDR_GPUSTAT       = 0X1F801814,
+    ADDR_MDEC_COMMAND  = 0X1F801820,
+    ADDR_MDEC_DATA     = 0X1F801820,
+    ADDR_MDEC_CONTROL  = 0X1F801824,
+    ADDR_MDEC_STATUS   = 0X1F801824,
 };
 
 
@@ -1,9 +1,41 @@
 #ifndef COPROCESSOR2_H_INCLUDED
 #define COPROCESSOR2_H_INCLUDED
 
+#include <stdint.h>
+
+// the geometry transformation engine
 struct COPROCESSOR_2 {
-    uint32_t *R[32];
+    // DATA REGISTERS, held as MFC2 reads them (ORGB, SXYP and LZCR are worked out on access)
+    // r0-r5      VXY0, VZ0, VXY1, VZ1, VXY2, VZ2 - input vectors
+    // r6         RGBC - colour and gpu command code
+    // r7         OTZ - average z
+    // r8-r11     IR0-IR3 - 16 bit accumulators
+    // r12-r15    SXY0-SXY2, SXYP - screen xy fifo
+    // r16-r19    SZ0-SZ3 - screen z fifo
+    // r20-r22    RGB0-RGB2 - colour fifo
+    // r23        RES1 - prohibited
+    // r24-r27    MAC0-MAC3 - 32 bit accumulators
+    // r28-r29    IRGB, ORGB - 15 bit colour conversion
+    // r30-r31    LZCS, LZCR - leading zero count
+    uint32_t data[32];
+
+    // CONTROL REGISTERS, held as CFC2 reads them
+    // r32-r36    RT - rotation matrix
+    // r37-r39    TRX, TRY, TRZ - translation vector
+    // r40-r44    LLM - light matrix
+    // r45-r47    RBK, GBK, BBK - background colour
+    // r48-r52    LCM - light colour matrix
+    // r53-r55    RFC, GFC, BFC - far colour
+    // r56-r57    OFX, OFY - screen offset
+    // r58        H - projection plane distance
+    // r59-r60    DQA, DQB - depth cueing
+    // r61-r62    ZSF3, ZSF4 - average z scale
+    // r63        FLAG - saturation and overflow bits
+    uint32_t control[32];
+
+    // the matrices and vectors of the control registers unpacked as they are written
+    int16_t matrix[3][3][3];  // RT, LLM, LCM
+    int32_t vector[3][3];     // TR, BK, FC
 };
 
 #endif//COPROCESSOR2_H_INCLUDED
-
@@ -39,6 +39,15 @@
      CMD(s0) CMD(s1) CMD(s2) CMD(s3) CMD(s4) CMD(s5) CMD(s6) CMD(s7) \
      CMD(t8) CMD(t9) CMD(k0) CMD(k1) CMD(gp) CMD(sp) CMD(fp) CMD(ra)
 
+// longest run of instructions decoded into one cached block
+#define CPU_CACHE_BLOCK_MAX 256
+
+enum CPU_EXECUTION_MODE {
+    CPU_INTERPRETER,        // fetch and decode every instruction, the reference implementation
+    CPU_CACHED_INTERPRETER, // execute pre-decoded basic blocks
+    CPU_DYNAREC             // translate basic blocks to host code, x86-64 hosts only
+};
+
 struct delay {
     uint32_t value;
     enum {UNUSED, TRANSFER, DELAY} stage;
@@ -75,6 +84,25 @@ struct CPU {
     // COPROCESSORS
     struct COPROCESSOR_0 cop0;
     struct COPROCESSOR_2 cop2;
+
+    enum CPU_EXECUTION_MODE mode;
+    // set when a store drops cached blocks, the running block has to stop
+    bool cache_invalidated;
+};
+
+// an instruction decoded once by the cached interpreter
+struct CACHED_INSTRUCTION {
+    void (*execute)(void);
+    union INSTRUCTION instruction;
+};
+
+// a basic block, runs up to and including the delay slot of its branch
+struct CACHED_BLOCK {
+    uint32_t address;         // virtual address it was compiled from, blocks are shared by physical address
+    uint32_t length;
+    uint32_t (*native)(void); // translated block, returns the instructions executed
+
+    struct CACHED_INSTRUCTION instructions[];
 };
 
 // coprocessor functions
@@ -103,6 +131,11 @@ extern bool cop0_SR_CU2( void );
 extern bool cop0_SR_CU3( void );
 extern PSX_ERROR cpu_reset( void );
 extern PSX_ERROR cpu_step( void );
+extern uint32_t cpu_step_block( void );
+extern void cpu_cache_invalidate( uint32_t address );
+extern void cpu_cache_flush( void );
+extern void cpu_load_delay( void );
+extern bool cpu_decode_branch( union INSTRUCTION instruction );
 extern void cpu_exception( enum EXCEPTION_CAUSE cause );
 
 #endif//CPU_H_INCLUDED
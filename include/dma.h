@@ -5,6 +5,18 @@
 #include "cpu.h"
 #include "gpu.h"
 #include "memory.h"
+#include "mdec.h"
+#include "cdrom.h"
+#include "scheduler.h"
+
+// cycles between checks of a channel waiting on its device
+#define DMA_POLL_CYCLES 128
+// cycles to start a channel and hand the bus back, on top of one per word
+#define DMA_CHANNEL_OVERHEAD 16
+// packets followed before a linked list without a terminator is cut off
+#define DMA_LINKED_LIST_MAX 0X10000
+// channels address main ram only, word aligned
+#define DMA_RAM_MASK 0X1FFFFC
 
 enum DMA_Direction {
     DEV_TO_RAM = false,
@@ -138,14 +150,13 @@ struct DMA {
     union DPRC *DPRC;
     union DIRC *DIRC;
 
-    bool device_ready;
-    bool accessing_memory;
     bool interrupt_request;
 };
 
 /* public functions */
 extern struct DMA *get_dma( void );
 extern PSX_ERROR dma_reset(void);
-extern PSX_ERROR dma_step(void);
+extern void dma_notify(void);
+extern void dma_acknowledge(uint32_t previous);
 
 #endif // DMA_H_INCLUDED
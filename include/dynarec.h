@@ -0,0 +1,22 @@
+#ifndef DYNAREC_H_INCLUDED
+#define DYNAREC_H_INCLUDED
+
+#include "common.h"
+#include "cpu.h"
+
+#define print_dynarec_error(func, format, ...) print_error("dynarec.c", func, format, __VA_ARGS__)
+
+// host code buffer shared by every translated block
+#define DYNAREC_CODE_SIZE   (16 << 20)
+// worst case host code for one block, instructions are at most 256 bytes each
+#define DYNAREC_BLOCK_BYTES (CPU_CACHE_BLOCK_MAX * 256 + 256)
+
+// guest registers kept in host registers for the length of a block
+#define DYNAREC_HOST_REGISTERS 5
+
+extern bool dynarec_supported( void );
+extern bool dynarec_full( void );
+extern void dynarec_reset( void );
+extern uint32_t (*dynarec_compile( struct CACHED_BLOCK *block, uint32_t address ))( void );
+
+#endif//DYNAREC_H_INCLUDED
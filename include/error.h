@@ -25,6 +25,19 @@ typedef enum PSX_ERROR {
     // DMA
     UNSUPPORTED_DMA_TRANSFER_DIRECTION,
     UNSUPPORTED_DMA_SYNC_MODE,
+    // SAVESTATE
+    SAVESTATE_FILE_NOT_FOUND,
+    SAVESTATE_FILE_UNREADABLE,
+    SAVESTATE_INVALID,
+    SAVESTATE_VERSION_MISMATCH,
+    // EXE
+    EXE_FILE_NOT_FOUND,
+    EXE_FILE_UNREADABLE,
+    EXE_INVALID,
+    // CDROM
+    CDROM_FILE_NOT_FOUND,
+    CDROM_FILE_UNREADABLE,
+    CDROM_INVALID,
 
     // SDL
     SDL_INIT,
@@ -0,0 +1,41 @@
+#ifndef EXE_H_INCLUDED
+#define EXE_H_INCLUDED
+
+#include "common.h"
+#include "cpu.h"
+#include "memory.h"
+#include "bios.h"
+
+#define print_exe_error(func, format, ...) print_error("exe.c", func, format, __VA_ARGS__)
+
+#define EXE_MAGIC       "PS-X EXE"
+#define EXE_HEADER_SIZE 0X800
+
+// the first 0X800 bytes of a ps-x exe, the text follows
+struct EXE_HEADER {
+    char magic[8];
+    uint8_t _pad_magic[8];
+    uint32_t pc;
+    uint32_t gp;
+    uint32_t text_address;
+    uint32_t text_size;
+    uint32_t data_address; // unused by the bios
+    uint32_t data_size;
+    uint32_t bss_address;  // zero filled
+    uint32_t bss_size;
+    uint32_t stack_base;   // sp and fp, left alone when 0
+    uint32_t stack_offset;
+};
+
+struct EXE {
+    struct EXE_HEADER header;
+    uint8_t *text;
+    bool pending; // loaded but the bios has not reached the shell yet
+};
+
+/* public functions */
+extern struct EXE *get_exe( void );
+extern PSX_ERROR exe_load( const char *path );
+extern void exe_boot( void );
+
+#endif//EXE_H_INCLUDED
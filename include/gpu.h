@@ -4,11 +4,20 @@
 #include "common.h"
 #include "memory.h"
 #include "renderer.h"
+#include "scheduler.h"
 
 #define print_gpu_error(func, format, ...) print_error("gpu.c", func, format, __VA_ARGS__)
 
-#define VRAM_WIDTH 1024
-#define VRAM_ADDRESS(x, y) y * VRAM_WIDTH + x
+#define VRAM_WIDTH  1024
+#define VRAM_HEIGHT 512
+// byte address of a halfword pixel
+#define VRAM_ADDRESS(x, y) (((y) * VRAM_WIDTH + (x)) * 2)
+
+// video timing in cpu cycles
+#define GPU_NTSC_CYCLES_PER_SCANLINE 3414
+#define GPU_PAL_CYCLES_PER_SCANLINE  3407
+#define GPU_NTSC_SCANLINES           264
+#define GPU_PAL_SCANLINES            315
 
 enum GPU_RENDER_PHASE {
     RENDER,     // main renderering mode
@@ -75,17 +84,8 @@ union COMMAND_PACKET {
     };
 };
 
-// 64 byte fifos' and can queue upto 3 commands
-#define FIFO_SIZE 12
-#define MAX_COMMANDS 3
-
-typedef struct FIFO fifo_t;
-
-struct COMMAND_FIFO {
-    union COMMAND_PACKET commands[FIFO_SIZE];
-
-    int head, tail, size, len;
-};
+// longest fixed length gp0 command, a four point shaded textured polygon
+#define GP0_PACKET_MAX 12
 
 union VERTEX {
     uint32_t value;
@@ -163,7 +163,14 @@ union GPUREAD {
 };
 
 struct GP0 {
-    struct COMMAND_FIFO fifo;
+    union COMMAND_PACKET command; // last word stored by the cpu
+
+    // a command split across writes, collected until all its words arrived
+    uint32_t packet[GP0_PACKET_MAX];
+    uint32_t length;
+    uint32_t count;
+
+    bool polyline; // skipping polyline vertices up to the terminator
     bool write_occured;
 };
 
@@ -175,6 +182,7 @@ struct GP1 {
 struct GPU_COPY {
     uint32_t d_x, d_y, d_w, d_h; // destination
     uint32_t s_x, s_y, s_w, s_h; // source
+    uint32_t x, y;               // next pixel of a cpu to vram copy
 
     bool copying;
 
@@ -193,7 +201,6 @@ struct GPU {
     enum GPU_MODE previous_mode;
     bool vram_write;
 
-    uint32_t cycles;
     uint32_t scanlines;
 
     enum GPU_RENDER_PHASE render_phase;
@@ -225,7 +232,13 @@ struct GPU {
 /* public functions */
 extern struct GPU *get_gpu(void);
 extern void gpu_reset(void);
-extern void gpu_step(void);
+extern void gpu_execute(void);
+extern void gpu_write_gp0(uint32_t word);
+extern void gpu_gp0_write(const uint32_t *words, uint32_t count);
+extern void gpu_render(const uint32_t *packet);
+extern void gpu_vram_sync(void);
+extern void gpu_restore(void);
+extern uint32_t gpu_read(void);
 extern uint8_t *write_GP0(void);
 extern uint8_t *write_GP1(void);
 extern uint8_t *read_GPUSTAT(void);
@@ -239,5 +252,7 @@ extern bool gpustat_ready_send_vram_cpu(void);
 extern bool gpustat_ready_recieve_dma_block(void);
 extern uint32_t gpu_display_vram_x_start(void);
 extern uint32_t gpu_display_vram_y_start(void);
+extern uint32_t gpu_display_width(void);
+extern uint32_t gpu_display_height(void);
 
 #endif // GPU_H_INCLUDED
@@ -0,0 +1,68 @@
+#ifndef GPU_THREAD_H_INCLUDED
+#define GPU_THREAD_H_INCLUDED
+
+#include "common.h"
+#include "gpu.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdalign.h>
+
+#define print_gpu_thread_error(func, format, ...) print_error("gpu_thread.c", func, format, __VA_ARGS__)
+
+// words in the command ring, a power of two so positions wrap with a mask
+#define GPU_THREAD_RING_SIZE (1 << 20)
+#define GPU_THREAD_RING_MASK (GPU_THREAD_RING_SIZE - 1)
+// frames the core may queue before it waits for the render thread
+#define GPU_THREAD_FRAMES_AHEAD 1
+// polls of an empty ring before the render thread sleeps
+#define GPU_THREAD_SPIN 4096
+
+// each ring entry is a header word, type in the top byte and payload length below
+enum GPU_THREAD_COMMAND {
+    GPU_THREAD_DRAW,    // gp0 render packet
+    GPU_THREAD_FRAME,   // present the finished frame
+    GPU_THREAD_SYNC,    // finish pending draws, the core waits for it
+    GPU_THREAD_STOP
+};
+
+struct GPU_THREAD {
+    pthread_t thread;
+    bool running;
+
+    // single producer, single consumer, the core only moves tail and the
+    // render thread only moves head, both count words and never wrap back.
+    // each side keeps a stale copy of the other's index and only rereads it
+    // when the ring looks full or empty, every field a side writes sits on
+    // its own cache line
+    alignas(64) _Atomic uint32_t head;
+    uint32_t tail_seen;
+    alignas(64) _Atomic uint32_t tail;
+    uint32_t head_seen;
+    uint32_t tail_written; // ahead of tail until the next flush
+    alignas(64) uint32_t ring[GPU_THREAD_RING_SIZE];
+
+    uint32_t frames_queued;
+    _Atomic uint32_t frames_presented;
+
+    // the render thread parks here when the ring runs dry
+    _Atomic bool sleeping;
+    pthread_mutex_t lock;
+    pthread_cond_t  wake;
+
+    // run on the render thread, the gl context moves there with it
+    void (*make_current)(bool current);
+    void (*present)(void);
+};
+
+/* public functions */
+extern struct GPU_THREAD *get_gpu_thread( void );
+extern void gpu_thread_start( void (*make_current)(bool current), void (*present)(void) );
+extern void gpu_thread_stop( void );
+extern bool gpu_thread_running( void );
+extern void gpu_thread_draw( const uint32_t *packet, uint32_t length );
+extern void gpu_thread_frame( void );
+extern void gpu_thread_flush( void );
+extern void gpu_thread_sync( void );
+
+#endif//GPU_THREAD_H_INCLUDED
@@ -0,0 +1,66 @@
+#ifndef GTE_H_INCLUDED
+#define GTE_H_INCLUDED
+
+#include "common.h"
+#include "cpu.h"
+
+#define print_gte_error(func, format, ...) print_error("gte.c", func, format, __VA_ARGS__)
+
+// command word fields
+#define GTE_SF(command) (((command) >> 19) & 0X1) // shift the result right by 12
+#define GTE_MX(command) (((command) >> 17) & 0X3) // mvmva matrix, RT LLM LCM or garbage
+#define GTE_V(command)  (((command) >> 15) & 0X3) // mvmva vector, V0 V1 V2 or IR
+#define GTE_CV(command) (((command) >> 13) & 0X3) // mvmva translation, TR BK FC or none
+#define GTE_LM(command) (((command) >> 10) & 0X1) // clamp IR to 0 rather than -8000h
+#define GTE_OP(command) ((command) & 0X3F)
+
+// FLAG bits
+#define GTE_FLAG_MAC_POSITIVE(i) (1U << (31 - (i))) // MAC1-3 over 43 bits and positive
+#define GTE_FLAG_MAC_NEGATIVE(i) (1U << (28 - (i))) // MAC1-3 over 43 bits and negative
+#define GTE_FLAG_IR(i)           (1U << (25 - (i))) // IR1-3 saturated
+#define GTE_FLAG_COLOR(i)        (1U << (22 - (i))) // colour fifo R G B saturated
+#define GTE_FLAG_SZ              (1U << 18)         // SZ3 or OTZ saturated
+#define GTE_FLAG_DIVIDE          (1U << 17)         // divide overflow
+#define GTE_FLAG_MAC0_POSITIVE   (1U << 16)
+#define GTE_FLAG_MAC0_NEGATIVE   (1U << 15)
+#define GTE_FLAG_SX              (1U << 14)         // SX2 saturated
+#define GTE_FLAG_SY              (1U << 13)         // SY2 saturated
+#define GTE_FLAG_IR0             (1U << 12)
+#define GTE_FLAG_ERROR           (1U << 31)         // any of bits 30-23 or 18-13
+#define GTE_FLAG_ERROR_BITS      0X7F87E000
+#define GTE_FLAG_WRITABLE        0X7FFFF000
+
+// matrices and vectors unpacked from the control registers
+enum GTE_MATRIX { GTE_RT, GTE_LLM, GTE_LCM };
+enum GTE_VECTOR { GTE_TR, GTE_BK, GTE_FC };
+
+// the matrix product every transform and lighting command is built on, for
+// each of count vectors results = translation * 1000h + matrix * vector with
+// each partial sum checked and wrapped to 44 bits like the hardware adder,
+// returns the MAC overflow bits of FLAG
+typedef uint32_t (*gte_transform_t)(const int16_t matrix[3][3], const int32_t translation[3], const int16_t vectors[][3], uint32_t count, int64_t results[][3]);
+
+struct GTE {
+    struct COPROCESSOR_2 *regs;
+    uint32_t flag;               // FLAG of the command running
+    gte_transform_t transform;
+};
+
+/* public functions */
+extern struct GTE *get_gte( void );
+extern void gte_reset( void );
+extern uint32_t gte_read_data( uint32_t reg );
+extern void gte_write_data( uint32_t reg, uint32_t value );
+extern uint32_t gte_read_control( uint32_t reg );
+extern void gte_write_control( uint32_t reg, uint32_t value );
+extern void gte_execute( uint32_t command );
+
+/* transform kernels */
+extern gte_transform_t gte_transform_select( void );
+extern uint32_t gte_transform_scalar( const int16_t matrix[3][3], const int32_t translation[3], const int16_t vectors[][3], uint32_t count, int64_t results[][3] );
+#if defined(__x86_64__) || defined(__i386__)
+extern uint32_t gte_transform_sse41( const int16_t matrix[3][3], const int32_t translation[3], const int16_t vectors[][3], uint32_t count, int64_t results[][3] );
+extern uint32_t gte_transform_avx2( const int16_t matrix[3][3], const int32_t translation[3], const int16_t vectors[][3], uint32_t count, int64_t results[][3] );
+#endif
+
+#endif//GTE_H_INCLUDED
@@ -0,0 +1,37 @@
+#ifndef INTERRUPTS_H_INCLUDED
+#define INTERRUPTS_H_INCLUDED
+
+#include "common.h"
+#include "memory.h"
+
+#define ADDR_I_STAT 0X1F801070
+#define ADDR_I_MASK 0X1F801074
+
+// bit numbers in I_STAT and I_MASK
+enum IRQ {
+    IRQ_VBLANK     = 0,
+    IRQ_GPU        = 1,
+    IRQ_CDROM      = 2,
+    IRQ_DMA        = 3,
+    IRQ_TIMER0     = 4,
+    IRQ_TIMER1     = 5,
+    IRQ_TIMER2     = 6,
+    IRQ_CONTROLLER = 7,
+    IRQ_SIO        = 8,
+    IRQ_SPU        = 9,
+    IRQ_LIGHTPEN   = 10
+};
+
+struct INTERRUPTS {
+    uint32_t *I_STAT;
+    uint32_t *I_MASK;
+};
+
+/* public functions */
+extern struct INTERRUPTS *get_interrupts( void );
+extern void interrupts_reset( void );
+extern void interrupts_request( enum IRQ irq );
+extern void interrupts_acknowledge( uint32_t previous );
+extern void interrupts_update( void );
+
+#endif//INTERRUPTS_H_INCLUDED
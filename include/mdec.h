@@ -0,0 +1,99 @@
+#ifndef MDEC_H_INCLUDED
+#define MDEC_H_INCLUDED
+
+#include "common.h"
+#include "scheduler.h"
+
+#define print_mdec_error(func, format, ...) print_error("mdec.c", func, format, __VA_ARGS__)
+
+#define ADDR_MDEC_END 0X1F801828
+
+// the largest parameter count a command can give
+#define MDEC_INPUT_WORDS 0X10000
+// a 16x16 macroblock at 24 bits per pixel
+#define MDEC_MACROBLOCK_WORDS 192
+// decode time of one 8x8 block, a colour macroblock is six of them
+#define MDEC_BLOCK_CYCLES 448
+// halfword that pads the compressed data between blocks
+#define MDEC_PADDING 0XFE00
+
+enum MDEC_DEPTH {
+    MDEC_4BIT  = 0,
+    MDEC_8BIT  = 1,
+    MDEC_24BIT = 2,
+    MDEC_15BIT = 3
+};
+
+// block being decoded as shown in the status register
+enum MDEC_BLOCK {
+    MDEC_Y1, MDEC_Y2, MDEC_Y3, MDEC_Y4,
+    MDEC_CR, MDEC_CB
+};
+
+union MDEC_COMMAND {
+    uint32_t value;
+    struct {
+        uint32_t words: 16;            // parameter words that follow
+        uint32_t : 9;
+        uint32_t bit15: 1;             // set bit 15 of 15 bit pixels
+        uint32_t sign: 1;              // output signed rather than unsigned
+        enum MDEC_DEPTH depth: 2;
+        uint32_t op: 3;                // 1 decode, 2 quant tables, 3 scale table
+    };
+};
+
+// an 8x8 inverse dct in place, blocks come in natural order and leave clamped to -128..127
+typedef void (*mdec_idct_t)(int16_t block[64], const int16_t scale[64]);
+// a 16x16 macroblock from its Cr, Cb and four Y blocks to 24 or 15 bit pixels
+typedef void (*mdec_rgb_t)(const int16_t blocks[6][64], union MDEC_COMMAND command, uint32_t *output);
+
+struct MDEC {
+    union MDEC_COMMAND command;     // the command being fed or decoded
+    uint32_t expected;              // parameter words the command takes
+    uint32_t received;
+    bool dma_in, dma_out;           // data requests enabled by the control register
+
+    // compressed data is held whole and decoded a macroblock at a time as it is read
+    uint16_t input[MDEC_INPUT_WORDS * 2];
+    uint32_t position;              // next halfword to decode
+    enum MDEC_BLOCK block;
+
+    uint8_t quant[2][64];           // luma and chroma quantization, zigzag order
+    int16_t scale[64];              // idct matrix
+
+    // the macroblock being read out
+    uint32_t output[MDEC_MACROBLOCK_WORDS];
+    uint32_t output_size;
+    uint32_t output_read;
+
+    // a dma1 transfer is handed over once the macroblocks it reads would have been decoded
+    bool transfer_ready;
+
+    mdec_idct_t idct;
+    mdec_rgb_t rgb;
+};
+
+/* public functions */
+extern struct MDEC *get_mdec( void );
+extern void mdec_reset( void );
+extern uint32_t mdec_read( uint32_t address );
+extern void mdec_write( uint32_t address, uint32_t value );
+extern bool mdec_dma_in_ready( void );
+extern void mdec_dma_in( const uint32_t *words, uint32_t count );
+extern bool mdec_dma_out_ready( uint32_t count );
+extern void mdec_dma_out( uint32_t *words, uint32_t count );
+extern uint32_t mdec_decode_macroblock( uint32_t *position, uint32_t *output );
+
+/* idct and colour kernels */
+extern mdec_idct_t mdec_idct_select( void );
+extern mdec_rgb_t mdec_rgb_select( void );
+extern void mdec_idct_scalar( int16_t block[64], const int16_t scale[64] );
+extern void mdec_rgb_scalar( const int16_t blocks[6][64], union MDEC_COMMAND command, uint32_t *output );
+#if defined(__x86_64__) || defined(__i386__)
+extern void mdec_idct_sse41( int16_t block[64], const int16_t scale[64] );
+extern void mdec_idct_avx2( int16_t block[64], const int16_t scale[64] );
+extern void mdec_rgb_sse41( const int16_t blocks[6][64], union MDEC_COMMAND command, uint32_t *output );
+extern void mdec_rgb_avx2( const int16_t blocks[6][64], union MDEC_COMMAND command, uint32_t *output );
+#endif
+
+#endif//MDEC_H_INCLUDED
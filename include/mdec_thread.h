@@ -0,0 +1,54 @@
+#ifndef MDEC_THREAD_H_INCLUDED
+#define MDEC_THREAD_H_INCLUDED
+
+#include "common.h"
+#include "mdec.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+#define print_mdec_thread_error(func, format, ...) print_error("mdec_thread.c", func, format, __VA_ARGS__)
+
+// every block takes at least two halfwords, so a decode command has at most this many
+// macroblocks, and 12 halfwords of colour data give at most 192 words of output
+#define MDEC_THREAD_MACROBLOCKS  MDEC_INPUT_WORDS
+#define MDEC_THREAD_OUTPUT_WORDS (MDEC_INPUT_WORDS * 32)
+
+struct MDEC_THREAD {
+    pthread_t thread;
+    bool running;
+
+    // a decode command is handed over once all its data is in, the worker
+    // decodes every macroblock of it while the cpu runs on. the core takes
+    // them in order as the data out port or dma1 reads, so what it sees is
+    // the same as decoding each one on demand
+    pthread_mutex_t lock;
+    pthread_cond_t  wake;  // a job was handed over or the thread is stopping
+    pthread_cond_t  idle;  // the job was finished or cancelled
+    bool job;              // under lock, set while a job is queued or decoding
+    bool stop;
+    _Atomic bool cancel;
+
+    // written by the worker only, each macroblock is published by produced
+    uint32_t *output;
+    uint32_t positions[MDEC_THREAD_MACROBLOCKS]; // input position after each macroblock
+    uint32_t size;                               // words in each macroblock
+    _Atomic uint32_t produced;
+    _Atomic bool finished;                       // no macroblocks left in the input
+
+    // core side
+    bool active;           // the decode command being read was handed to the worker
+    uint32_t taken;
+};
+
+/* public functions */
+extern struct MDEC_THREAD *get_mdec_thread( void );
+extern void mdec_thread_start( void );
+extern void mdec_thread_stop( void );
+extern bool mdec_thread_running( void );
+extern bool mdec_thread_active( void );
+extern void mdec_thread_submit( void );
+extern void mdec_thread_cancel( void );
+extern uint32_t mdec_thread_take( uint32_t *output );
+
+#endif//MDEC_THREAD_H_INCLUDED
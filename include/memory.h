@@ -1,6 +1,8 @@
 #ifndef MEMORY_H_INCLUDED
 #define MEMORY_H_INCLUDED
 
+#include <stddef.h>
+
 #include "error.h"
 #include "common.h"
 #include "cpu.h"
@@ -8,6 +10,21 @@
 
 #define print_memory_error(func, format, ...) print_error("cpu.c", func, format, __VA_ARGS__)
 
+// CPU fast path page tables
+#define MEMORY_PAGE_SHIFT 16
+#define MEMORY_PAGE_SIZE  (1 << MEMORY_PAGE_SHIFT)
+#define MEMORY_PAGE_MASK  (MEMORY_PAGE_SIZE - 1)
+#define MEMORY_PAGE_COUNT (1 << (32 - MEMORY_PAGE_SHIFT))
+
+// RAM code tracking granularity for the cached interpreter
+#define MEMORY_CODE_PAGE_SHIFT 12
+#define MEMORY_CODE_PAGE_SIZE  (1 << MEMORY_CODE_PAGE_SHIFT)
+#define MEMORY_CODE_PAGE_MASK  (MEMORY_CODE_PAGE_SIZE - 1)
+
+// RAM and VRAM write tracking granularity for incremental snapshots
+#define MEMORY_DIRTY_PAGE_SHIFT 12
+#define MEMORY_DIRTY_PAGE_SIZE  (1 << MEMORY_DIRTY_PAGE_SHIFT)
+
 // CPU address space
 typedef union MEM_MAIN                  {uint8_t mem[0X200000];}   MEM_MAIN;                  // 2048K
 typedef union MEM_EXPANSION_1           {uint8_t mem[0X800000];}   MEM_EXPANSION_1;           // 8192K
@@ -218,9 +235,23 @@ struct MEMORY {
     uint32_t address_accessed; // used for debugging
 };
 
+// the avx2 span kernel of the software renderer reads two bytes past vram
+_Static_assert(offsetof(struct MEMORY, SOUND) == offsetof(struct MEMORY, VRAM) + sizeof(MEM_VRAM), "sound must follow vram");
+
+#define MEMORY_RAM_DIRTY_PAGES  (sizeof(MEM_MAIN) >> MEMORY_DIRTY_PAGE_SHIFT)
+#define MEMORY_VRAM_DIRTY_PAGES (sizeof(MEM_VRAM) >> MEMORY_DIRTY_PAGE_SHIFT)
+
 
 // external API function
 extern struct MEMORY *get_memory( void );
+extern PSX_ERROR memory_create(void);
+extern void memory_cpu_isolate_cache(bool isolate);
+extern void memory_cpu_watch_code(uint32_t address);
+extern void memory_ram_written(uint32_t address, uint32_t size);
+extern void memory_vram_written(uint32_t y, uint32_t h);
+extern bool *memory_ram_dirty(void);
+extern bool *memory_vram_dirty(void);
+extern void memory_dirty_all(void);
 extern PSX_ERROR memory_load_bios(const char *filebios);
 extern uint8_t *memory_VRAM_pointer(void);
 extern uint8_t *memory_pointer(uint32_t address);
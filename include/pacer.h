@@ -0,0 +1,52 @@
+#ifndef PACER_H_INCLUDED
+#define PACER_H_INCLUDED
+
+#include "common.h"
+
+#include <time.h>
+
+#define print_pacer_error(func, format, ...) print_error("pacer.c", func, format, __VA_ARGS__)
+
+// video refresh periods in nanoseconds
+#define PACER_NTSC_PERIOD 16683350ULL // 59.94 hz
+#define PACER_PAL_PERIOD  20000000ULL // 50 hz
+// further behind than this many frames and the pacer stops trying to catch up
+#define PACER_MAX_LAG 4
+// time between budget reports in nanoseconds
+#define PACER_REPORT_PERIOD 1000000000ULL
+
+enum PACER_MODE {
+    PACER_REALTIME, // one frame per video refresh
+    PACER_TURBO     // no waiting, frames run as fast as the host allows
+};
+
+struct PACER {
+    enum PACER_MODE mode;
+    bool report;
+
+    // one frame is drawn, then frame_skip frames only run the core
+    uint32_t frame_skip;
+    uint32_t position;
+    bool skipping;
+
+    uint64_t period;   // of the video mode the last frame ran in
+    uint64_t deadline; // when the current frame is due on screen
+    uint64_t mark;     // start of the phase being timed
+
+    // totals since the last report, nanoseconds
+    uint64_t report_start;
+    uint32_t frames;
+    uint32_t drawn;
+    uint64_t core;
+    uint64_t present;
+    uint64_t idle;
+};
+
+/* public functions */
+extern struct PACER *get_pacer( void );
+extern void pacer_reset( enum PACER_MODE mode, uint32_t frame_skip, bool report );
+extern bool pacer_skipping( void );
+extern void pacer_core_done( void );
+extern void pacer_end_frame( bool pal );
+
+#endif//PACER_H_INCLUDED
@@ -7,10 +7,21 @@
 
 // device headers
 #include "cpu.h"
+#include "dynarec.h"
 #include "gpu.h"
+#include "gpu_thread.h"
+#include "mdec_thread.h"
 #include "dma.h"
 #include "memory.h"
 #include "timers.h"
+#include "mdec.h"
+#include "cdrom.h"
+#include "scheduler.h"
+#include "pacer.h"
+#include "rewind.h"
+#include "bios.h"
+#include "exe.h"
+#include "interrupts.h"
 #include "renderer.h"
 
 #include <SDL2/SDL.h>
@@ -18,9 +29,26 @@
 // macros
 #define print_psx_error(func, format, ...) print_error("psx.c", func, format, __VA_ARGS__)
 
+// frames that can be picked for dumping with --dump
+#define PSX_DUMPS_MAX 64
+
 struct PSX {
     bool running;
     bool gdb_stub;
+    bool gpu_thread; // render on a separate thread
+    bool mdec_thread; // decode mdec frames ahead on a separate thread
+    bool headless;   // no window or gl context, vram is drawn in software
+    bool booting;    // a sideloaded exe or the boot snapshot waits for the bios to reach the shell
+    const char *boot_cache; // directory of boot snapshots, NULL to always boot
+
+    uint32_t frame;                 // frames finished since reset
+    uint32_t frames;                // stop after this many frames, 0 runs forever
+    uint32_t dumps[PSX_DUMPS_MAX];  // frames whose display area is saved as ppm
+    uint32_t dump_count;
+    const char *dump_prefix;
+
+    uint32_t rewind_interval;       // frames between rewind snapshots, 0 disables rewind
+    size_t rewind_budget;           // bytes of rewind history
 
     SDL_Window   *window;
     SDL_GLContext context;
@@ -30,6 +58,7 @@ struct PSX {
     struct DMA *dma;
     struct MEMORY *memory;
     struct TIMERS *timers;
+    struct SCHEDULER *scheduler;
 
     uint32_t system_clock;
 };
@@ -6,6 +6,8 @@
 #include "glad/glad.h"
 #include "gpu.h"
 
+#include <stdatomic.h>
+
 #define print_renderer_error(func, format, ...) print_error("renderer.c", func, format, __VA_ARGS__)
 #define FILETYPE(name, type, ret)               \
     do {                                        \
@@ -15,11 +17,11 @@
     } while (0)
 // #define PRINT_POS(p) printf("pos: %f, %f\n", (float) p.x / 512.0f - 1.0, 1.0 - (float) p.y / 256.0f);
 #define PRINT_POS(p) printf("pos: %d, %d\n", p.x, p.y);
-#define PRINT_COL(c) printf("col: %f, %f, %f\n", c.r, c.g, c.b);
+#define PRINT_COL(c) printf("col: %d, %d, %d\n", c.r, c.g, c.b);
 #define PRINT_VERTEX(v) printf("vertex\n" \
                                "\tdraw-textures:    %d\n" \
                                "\tpos:              %d, %d\n" \
-                               "\tcol:              %f, %f, %f\n" \
+                               "\tcol:              %d, %d, %d\n" \
                                "\ttexpos:           %d, %d\n" \
                                "\ttexpage:          %d, %d\n" \
                                "\tclutpos:          %d, %d\n" \
@@ -28,8 +30,24 @@
                                "\tsemi-transparent: %d\n",\
                                v.draw_texture,\
                                v.position.x, v.position.y, v.color.r, v.color.g, v.color.b,\
-                               v.texpos.x, v.texpos.y, v.texpage.x_base, v.texpage.y_base, \
-                               v.clutpos.x, v.clutpos.y, v.depth, v.blend, v.semi_transparent)
+                               v.texpos.x, v.texpos.y, (v.texpage & 0XF) * 64, ((v.texpage >> 4) & 0X1) * 256, \
+                               (v.clutpos & 0X3F) * 16, (v.clutpos >> 6) & 0X1FF, (v.texpage >> 7) & 0X3, v.blend, v.semi_transparent)
+
+// vram is uploaded in tiles, a texture page wide and 32 lines high,
+// each tile row keeps one dirty bit per column
+#define RENDERER_TILE_WIDTH   64
+#define RENDERER_TILE_HEIGHT  32
+#define RENDERER_TILE_COLUMNS (1024 / RENDERER_TILE_WIDTH)
+#define RENDERER_TILE_ROWS    (512 / RENDERER_TILE_HEIGHT)
+
+// starting size of the vertex arena, it doubles whenever a frame needs more
+#define RENDERER_VERTICES_MIN (3 * 1024)
+#define RENDERER_BATCHES_MIN  64
+
+enum RENDERER_BACKEND {
+    RENDERER_OPENGL,
+    RENDERER_SOFTWARE   // rasterized into vram on the cpu, gl only shows the result
+};
 
 enum OPENGL_OBJECT_TYPE {
     OPENGL_POLYGON,
@@ -55,9 +73,10 @@ typedef struct OPENGL_POSITION {
 } Position_t;
 
 typedef struct OPENGL_COLOR {
-    float r;
-    float g;
-    float b;
+    GLubyte r;
+    GLubyte g;
+    GLubyte b;
+    GLubyte a;
 } Color_t;
 
 typedef struct OPENGL_TEXPOS {
@@ -65,46 +84,77 @@ typedef struct OPENGL_TEXPOS {
     GLubyte y;
 } Texpos_t;
 
-typedef struct OPENGL_TEXPAGE {
-    GLushort x_base;
-    GLushort y_base;
-} Texpage_t;
-
-typedef struct OPENGL_CLUTPOS {
-    GLushort x;
-    GLushort y;
-} Clutpos_t;
-
+// 16 bytes, clut and texpage are kept as the gp0 attribute halfwords and
+// screen.vs.glsl unpacks them along with the flag bits in the last halfword
 typedef struct OPENGL_VERTEX {
     Position_t position;
     Color_t    color;
     Texpos_t   texpos;
-    Texpage_t  texpage;
-    Clutpos_t  clutpos;
-
-    GLuint type;
-    GLuint blend;
-    GLuint depth;
-    GLuint draw_texture;
-    GLuint semi_transparent;
+    GLushort   clutpos;    // x / 16 in bits 0-5, y in bits 6-14
+    GLushort   texpage;    // x base / 64 in bits 0-3, y base / 256 in bit 4, depth in bits 7-8
+
+    GLushort blend            : 2;
+    GLushort draw_texture     : 1;
+    GLushort semi_transparent : 1;
+    GLushort shaded           : 1;
 } vertex_t;
 
+_Static_assert(sizeof(vertex_t) == 16, "vertex_t must stay 16 bytes");
+
+// a run of triangles drawn with one call, split where gl state has to change
+struct RENDERER_BATCH {
+    uint32_t first;
+    uint32_t count;
+
+    uint32_t blend; // 0 opaque, else semi transparency mode + 1
+    uint16_t area_left, area_top, area_right, area_bottom;
+};
+
 struct 
 RENDERER_CONTEXT
 {
     GLint  offset;
     GLuint vao;
-    GLuint vbo;
-    GLuint pbo;
+    GLuint vbo;         // persistently mapped, sized to the arena
+    vertex_t *vbo_map;
+    uint32_t vbo_capacity;
+    GLsync vbo_fence;   // last frame drawn out of the vbo
+    GLuint pbo;         // persistently mapped staging copy of vram
+    uint8_t *pbo_map;
+    GLsync pbo_fence;   // last upload out of the pbo
     GLuint shader;
     GLuint texture;
+    GLuint framebuffer; // reads the vram texture back for the software backend
+
+    enum RENDERER_BACKEND backend;
+    uint32_t workers;   // software rasterizer threads
+    bool headless;      // no gl context, vram is the only output
+
+    // set by whoever writes vram, cleared by the upload on the render thread
+    _Atomic uint32_t dirty[RENDERER_TILE_ROWS];
+
+    // drawing state that splits batches, kept in step through the render path
+    uint8_t semi_mode;
+    uint16_t area_left, area_top, area_right, area_bottom;
+
+    // everything pushed this frame, in submission order
+    vertex_t *vertices;
+    uint32_t vertex_count;
+    uint32_t vertex_capacity;
 
-    vertex_t render_vertcies[MAX_VERTICIES];
-    uint32_t triangle_count;
+    struct RENDERER_BATCH *batches;
+    uint32_t batch_count;
+    uint32_t batch_capacity;
 };
 
 /** public functions */
+extern void renderer_configure(enum RENDERER_BACKEND backend, uint32_t workers, bool headless);
 extern void renderer_create(const char **shaders, uint32_t shader_count);
+extern void renderer_destroy(void);
+extern void renderer_flush(void);
+extern void renderer_attribute(uint32_t command);
+extern void renderer_texpage(uint32_t texpage);
+extern void renderer_vram_dirty(uint32_t x, uint32_t y, uint32_t w, uint32_t h);
 extern void renderer_start_frame(void);
 extern void renderer_end_frame(void);
 extern void renderer_push_triangle(vertex_t v1, vertex_t v2, vertex_t v3);
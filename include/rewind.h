@@ -0,0 +1,69 @@
+#ifndef REWIND_H_INCLUDED
+#define REWIND_H_INCLUDED
+
+#include "common.h"
+#include "savestate.h"
+
+#include <time.h>
+
+#define print_rewind_error(func, format, ...) print_error("rewind.c", func, format, __VA_ARGS__)
+
+// snapshots the ring can index, an hour at one capture every 6 frames fits
+#define REWIND_ENTRIES_MAX (1 << 16)
+// default size of the delta ring in MiB
+#define REWIND_BUDGET_DEFAULT 256
+
+// a delta is a list of runs over the snapshot in 64 bit words, each run is
+// skip unchanged words then xor the following count words
+struct REWIND_RUN {
+    uint32_t skip;
+    uint32_t count;
+};
+
+struct REWIND_ENTRY {
+    size_t offset;  // into the ring
+    size_t size;
+    uint32_t frame; // frame the older snapshot was taken at
+};
+
+struct REWIND {
+    uint32_t interval;   // frames between snapshots, 0 when rewind is off
+    uint32_t frames;     // since the last snapshot
+    uint32_t frame;      // frames seen since create
+    uint32_t head_frame; // frame the head snapshot was taken at
+
+    // the newest snapshot is kept whole, every older one is the xor delta to
+    // the snapshot after it, so stepping back is head ^= newest delta and the
+    // oldest deltas can be dropped without ever re-keying
+    size_t snapshot_size;  // rounded up to whole words
+    uint64_t *head;
+    uint64_t *previous;    // what the spans being updated held before, only those spans are valid
+    bool have_head;
+
+    // parts of the head the next capture rewrites, the written ram and vram pages
+    struct SAVESTATE_SPAN spans[SAVESTATE_SPANS_MAX];
+
+    // deltas are packed back to back in a byte ring, entries run oldest to newest
+    uint8_t *ring;
+    size_t ring_size;
+    size_t ring_end;   // where the next delta goes
+    uint8_t *scratch;  // a delta is encoded here first, then copied in
+
+    struct REWIND_ENTRY entries[REWIND_ENTRIES_MAX];
+    uint32_t first;    // oldest entry
+    uint32_t count;
+    size_t used;       // bytes of the ring held by entries
+
+    // capture cost, for the report at destroy
+    uint64_t captures;
+    uint64_t capture_ns;
+};
+
+/* public functions */
+extern struct REWIND *get_rewind( void );
+extern void rewind_create( uint32_t interval, size_t budget );
+extern void rewind_destroy( void );
+extern void rewind_frame( void );
+extern bool rewind_step( void );
+
+#endif//REWIND_H_INCLUDED
@@ -0,0 +1,73 @@
+#ifndef SAVESTATE_H_INCLUDED
+#define SAVESTATE_H_INCLUDED
+
+#include "common.h"
+#include "cpu.h"
+#include "gpu.h"
+#include "dma.h"
+#include "memory.h"
+#include "timers.h"
+#include "mdec.h"
+#include "cdrom.h"
+#include "scheduler.h"
+
+#define print_savestate_error(func, format, ...) print_error("savestate.c", func, format, __VA_ARGS__)
+
+// "PSXS" read as a little endian word
+#define SAVESTATE_MAGIC   0X53585350
+#define SAVESTATE_VERSION 1
+
+// a snapshot is a header followed by chunks, one per subsystem. each chunk
+// carries its own version so a subsystem can change its layout without
+// invalidating the others, chunks with an unknown id are skipped
+enum SAVESTATE_CHUNK_ID {
+    SAVESTATE_CPU,
+    SAVESTATE_GPU,
+    SAVESTATE_DMA,
+    SAVESTATE_TIMERS,
+    SAVESTATE_SCHEDULER,
+    SAVESTATE_MEMORY,
+    SAVESTATE_MDEC,
+    SAVESTATE_CDROM,
+    SAVESTATE_CHUNKS
+};
+
+struct SAVESTATE_HEADER {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t chunks;
+    uint32_t size; // of the whole snapshot, header included
+};
+
+struct SAVESTATE_CHUNK {
+    uint32_t id;
+    uint32_t version;
+    uint32_t size; // of the data after this header
+};
+
+// part of struct MEMORY that is written to the memory chunk, regions with a
+// dirty page map only have their written pages copied by savestate_update
+struct SAVESTATE_REGION {
+    size_t offset;
+    size_t size;
+    bool *(*dirty)(void);
+};
+
+// bytes of a snapshot that savestate_update may rewrite
+struct SAVESTATE_SPAN {
+    size_t offset;
+    size_t size;
+};
+// every ram and vram page on its own, plus the headers, chunks and untracked regions
+#define SAVESTATE_SPANS_MAX (MEMORY_RAM_DIRTY_PAGES + MEMORY_VRAM_DIRTY_PAGES + 32)
+
+/* public functions */
+extern size_t savestate_size( void );
+extern size_t savestate_save( uint8_t *buffer, size_t size );
+extern PSX_ERROR savestate_load( const uint8_t *buffer, size_t size );
+extern uint32_t savestate_spans( struct SAVESTATE_SPAN *spans );
+extern size_t savestate_update( uint8_t *buffer, size_t size );
+extern PSX_ERROR savestate_save_file( const char *path );
+extern PSX_ERROR savestate_load_file( const char *path );
+
+#endif//SAVESTATE_H_INCLUDED
@@ -0,0 +1,51 @@
+#ifndef SCHEDULER_H_INCLUDED
+#define SCHEDULER_H_INCLUDED
+
+#include "common.h"
+
+#define print_scheduler_error(func, format, ...) print_error("scheduler.c", func, format, __VA_ARGS__)
+
+// one pending slot per event, scheduling an event again moves it
+enum SCHEDULER_EVENT {
+    EVENT_SCANLINE,     // gpu reached the end of a scanline
+    EVENT_DMA,          // dma channel started or waiting on its device
+    EVENT_TIMER0,       // root counter reaching its target or 0XFFFF
+    EVENT_TIMER1,
+    EVENT_TIMER2,
+    EVENT_MDEC,         // mdec decoded the macroblocks a dma1 transfer reads
+    EVENT_CDROM,        // cdrom controller answering a command or the next queued response
+    EVENT_CDROM_DRIVE,  // cdrom drive finished a seek or read a sector
+    EVENT_COUNT
+};
+
+struct SCHEDULER_ENTRY {
+    uint64_t timestamp;
+    void (*callback)(uint64_t timestamp);
+    int32_t heap_index; // -1 when not scheduled
+};
+
+struct SCHEDULER {
+    // cpu cycles since reset, the time base of every event
+    uint64_t cycles;
+
+    struct SCHEDULER_ENTRY entries[EVENT_COUNT];
+
+    // min-heap of scheduled events ordered by timestamp
+    enum SCHEDULER_EVENT heap[EVENT_COUNT];
+    uint32_t heap_size;
+};
+
+/* public functions */
+extern struct SCHEDULER *get_scheduler( void );
+extern void scheduler_reset( void );
+extern void scheduler_register( enum SCHEDULER_EVENT event, void (*callback)(uint64_t timestamp) );
+extern void scheduler_schedule( enum SCHEDULER_EVENT event, uint64_t cycles );
+extern void scheduler_schedule_at( enum SCHEDULER_EVENT event, uint64_t timestamp );
+extern void scheduler_cancel( enum SCHEDULER_EVENT event );
+extern bool scheduler_pending( enum SCHEDULER_EVENT event );
+extern uint64_t scheduler_next_event( void );
+extern void scheduler_advance( uint32_t cycles );
+extern void scheduler_run_events( void );
+extern uint64_t scheduler_cycles( void );
+
+#endif//SCHEDULER_H_INCLUDED
@@ -0,0 +1,132 @@
+#ifndef SOFTWARE_H_INCLUDED
+#define SOFTWARE_H_INCLUDED
+
+#include "common.h"
+
+#include <pthread.h>
+
+#define print_software_error(func, format, ...) print_error("software.c", func, format, __VA_ARGS__)
+
+// triangles queued before the workers are woken up
+#define SOFTWARE_BATCH_MAX 4096
+#define SOFTWARE_WORKERS_MAX 16
+// rows are handed out in bands of 1 << SOFTWARE_BAND_SHIFT lines,
+// band n goes to worker n % workers so every worker gets a share of the screen
+#define SOFTWARE_BAND_SHIFT 3
+
+#define SOFTWARE_VRAM_WIDTH  1024
+#define SOFTWARE_VRAM_HEIGHT 512
+
+// vram drawn by the batch is tracked in tiles of 64x16 halfwords, 64 being the texpage step
+#define SOFTWARE_TILE_X_SHIFT 6
+#define SOFTWARE_TILE_Y_SHIFT 4
+
+// interpolated attributes, 16.16 fixed point
+enum SOFTWARE_ATTRIBUTE {
+    SOFTWARE_R,
+    SOFTWARE_G,
+    SOFTWARE_B,
+    SOFTWARE_U,
+    SOFTWARE_V,
+    SOFTWARE_ATTRIBUTES
+};
+
+enum SOFTWARE_FLAGS {
+    SOFTWARE_TEXTURED   = 1 << 0,
+    SOFTWARE_RAW        = 1 << 1, // texel used as is, no color modulation
+    SOFTWARE_SEMI       = 1 << 2,
+    SOFTWARE_DITHER     = 1 << 3,
+    SOFTWARE_MASK_SET   = 1 << 4,
+    SOFTWARE_MASK_CHECK = 1 << 5
+};
+
+struct SOFTWARE_VERTEX {
+    int32_t x, y;
+    uint8_t r, g, b;
+    uint8_t u, v;
+};
+
+// a triangle after setup, everything a worker needs to fill its rows
+struct SOFTWARE_TRIANGLE {
+    int32_t min_x, min_y, max_x, max_y; // bounding box clipped to the drawing area
+
+    // edge functions a * x + b * y + c, inside when all three are >= 0
+    int32_t edge_a[3], edge_b[3], edge_c[3];
+
+    // attribute planes relative to the first vertex
+    int32_t origin_x, origin_y;
+    int32_t attribute[SOFTWARE_ATTRIBUTES];
+    int32_t ddx[SOFTWARE_ATTRIBUTES];
+    int32_t ddy[SOFTWARE_ATTRIBUTES];
+
+    uint16_t texpage_x, texpage_y;
+    uint16_t clut_x, clut_y;
+    uint8_t depth;
+    uint8_t semi_mode;
+    uint8_t window_and_u, window_or_u;
+    uint8_t window_and_v, window_or_v;
+    uint32_t flags;
+};
+
+// drawing state, kept in step with the draws through the render path
+struct SOFTWARE_STATE {
+    uint16_t texpage_x, texpage_y;
+    uint8_t semi_mode;
+    uint8_t depth;
+    bool dither;
+
+    uint8_t window_mask_x, window_mask_y;
+    uint8_t window_offset_x, window_offset_y;
+
+    int32_t area_left, area_top, area_right, area_bottom;
+    int32_t offset_x, offset_y;
+
+    bool mask_set;
+    bool mask_check;
+};
+
+// fills pixels x0..x1 of line y, one kernel per instruction set. the sse4.1
+// kernel fetches texels one lane at a time, the avx2 kernel gathers them 32 bits
+// per halfword so vram needs two bytes of slack after it
+typedef void (*software_span_t)(const struct SOFTWARE_TRIANGLE *triangle, uint16_t *vram, int32_t y, int32_t x0, int32_t x1);
+
+struct SOFTWARE {
+    uint16_t *vram;
+    software_span_t span;
+    struct SOFTWARE_STATE state;
+
+    struct SOFTWARE_TRIANGLE *batch;
+    uint32_t batch_count;
+    // tiles the batch draws to, one bit per column of tiles. a textured triangle
+    // sampling one of them flushes first, the workers draw bands out of order
+    uint16_t drawn[SOFTWARE_VRAM_HEIGHT >> SOFTWARE_TILE_Y_SHIFT];
+
+    // worker 0 is the thread that flushes, the others wait for a new generation
+    uint32_t workers;
+    pthread_t threads[SOFTWARE_WORKERS_MAX];
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    uint32_t generation;
+    uint32_t pending;
+    bool stopping;
+};
+
+/* public functions */
+extern struct SOFTWARE *get_software( void );
+extern void software_create( uint16_t *vram, uint32_t workers );
+extern void software_destroy( void );
+extern void software_attribute( uint32_t command );
+extern void software_texpage( uint32_t texpage );
+extern void software_push_triangle( const struct SOFTWARE_VERTEX *v1, const struct SOFTWARE_VERTEX *v2, const struct SOFTWARE_VERTEX *v3, bool textured, bool raw, bool semi, bool shaded, uint16_t clut );
+extern void software_flush( void );
+
+/* span kernels */
+extern software_span_t software_span_select( void );
+extern void software_span_scalar( const struct SOFTWARE_TRIANGLE *triangle, uint16_t *vram, int32_t y, int32_t x0, int32_t x1 );
+#if defined(__x86_64__) || defined(__i386__)
+extern void software_span_sse41( const struct SOFTWARE_TRIANGLE *triangle, uint16_t *vram, int32_t y, int32_t x0, int32_t x1 );
+extern void software_span_avx2( const struct SOFTWARE_TRIANGLE *triangle, uint16_t *vram, int32_t y, int32_t x0, int32_t x1 );
+#endif
+
+#endif//SOFTWARE_H_INCLUDED
@@ -3,6 +3,14 @@
 
 #include "common.h"
 #include "memory.h"
+#include "scheduler.h"
+#include "interrupts.h"
+
+#define ADDR_TIMERS_END 0X1F801130
+
+// dot clock in 320 pixel mode, 11/7 of the cpu clock divided by 8
+#define TIMER_DOTCLOCK_CYCLES      56
+#define TIMER_DOTCLOCK_TICKS       11
 
 enum SYNCRONIZATION_ENABLE {
     FREE_RUN = 0,
@@ -65,7 +73,15 @@ struct TIMER {
     union TIMER_MODE    *mode;
     union TIMER_TARGET  *target;
 
-    uint32_t old_mode;
+    // the count is sync_count at sync_cycles and advances with the clock source from there
+    uint64_t sync_cycles;
+    uint32_t sync_count;
+
+    // one shot timers only interrupt once per mode write
+    bool irq_fired;
+
+    enum SCHEDULER_EVENT event;
+    enum IRQ irq;
 };
 
 struct TIMERS {
@@ -76,7 +92,8 @@ struct TIMERS {
 
 /* public functions */
 extern struct TIMERS *get_timers( void );
-extern PSX_ERROR timers_step(void);
 extern PSX_ERROR timers_create(void);
+extern uint32_t timers_read(uint32_t address);
+extern void timers_write(uint32_t address);
 
 #endif // !TIMER_H_INCLUDED
@@ -4,7 +4,6 @@ layout(location = 0) in vec3 fColor;
 layout(location = 1) flat in uvec2 fTexpos;
 layout(location = 2) flat in uvec2 fTexpage;
 layout(location = 3) flat in uvec2 fClut;
-layout(location = 4) flat in uint  fType;
 layout(location = 5) flat in uint  fBlend;
 layout(location = 6) flat in uint  fDepth;
 layout(location = 7) flat in uint  fDrawtextures;
@@ -0,0 +1,52 @@
+#include "bios.h"
+
+static struct BIOS bios;
+
+struct BIOS *get_bios(void) { return &bios; }
+
+uint64_t bios_hash(void) {
+    const uint8_t *image = get_memory()->BIOS.mem;
+    uint64_t hash = BIOS_HASH_BASIS;
+
+    for (size_t i = 0; i < sizeof(MEM_BIOS); i++)
+        hash = (hash ^ image[i]) * BIOS_HASH_PRIME;
+
+    return hash;
+}
+
+bool bios_at_shell(void) {
+    // the interpreters stop with the jump to the shell in flight,
+    // translated blocks finish it and stop on the shell itself
+    struct CPU *cpu = get_cpu();
+
+    if (cpu->branch.stage == TRANSFER)
+        return cpu->branch.value == BIOS_SHELL_ENTRY;
+    return cpu->branch.stage == UNUSED && cpu->PC == BIOS_SHELL_ENTRY;
+}
+
+PSX_ERROR bios_cache_restore(const char *directory) {
+    // everything up to the shell only depends on the bios image, so a run
+    // with the same image starts from the snapshot taken at the shell
+    bios.hash = bios_hash();
+    snprintf(bios.cache, sizeof(bios.cache), "%s/%016llx.boot", directory, (unsigned long long) bios.hash);
+
+    PSX_ERROR error = savestate_load_file(bios.cache);
+    bios.capture = error != NO_ERROR;
+
+    if (!bios.capture)
+        printf("[LOG]: boot restored from %s\n", bios.cache);
+    return error;
+}
+
+void bios_cache_capture(void) {
+    // called once the bios reaches the shell
+    if (!bios.capture)
+        return;
+
+    bios.capture = false;
+    if (savestate_save_file(bios.cache) != NO_ERROR) {
+        print_bios_error("bios_cache_capture", "Cannot write the boot snapshot %s", bios.cache);
+        return;
+    }
+    printf("[LOG]: boot saved to %s\n", bios.cache);
+}
@@ -0,0 +1,565 @@
+#include "cdrom.h"
+
+#include <fcntl.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static struct CDROM cdrom;
+
+// image helpers
+static PSX_ERROR cdrom_map(const char *path, struct CDROM_FILE *file);
+static PSX_ERROR cdrom_parse_cue(const char *path);
+static bool cdrom_parse_msf(const char *text, uint32_t *sectors);
+static void cdrom_detect_region(void);
+
+// controller helpers
+static uint8_t cdrom_register(uint32_t address);
+static uint8_t cdrom_data_byte(void);
+static void cdrom_command(uint8_t value);
+static void cdrom_request(uint8_t value);
+static void cdrom_acknowledge(uint8_t value);
+static void cdrom_execute(void);
+static void cdrom_respond(enum CDROM_INTERRUPT interrupt, const uint8_t *bytes, uint8_t size);
+static void cdrom_ack(void);
+static void cdrom_error(uint8_t error);
+static void cdrom_deliver(void);
+static void cdrom_update_irq(void);
+static void cdrom_read_start(void);
+static void cdrom_read_sector(void);
+static void cdrom_stop(void);
+static uint32_t cdrom_sector_cycles(void);
+static uint8_t cdrom_bcd(uint8_t value);
+static void cdrom_event(uint64_t timestamp);
+static void cdrom_drive_event(uint64_t timestamp);
+
+struct CDROM *get_cdrom(void) { return &cdrom; }
+
+PSX_ERROR cdrom_open(const char *path) {
+    // a cue sheet, or a bare bin taken as one mode 2 data track
+    size_t length = strlen(path);
+    PSX_ERROR error;
+
+    memset(&cdrom.disc, 0, sizeof(cdrom.disc));
+    if (length > 4 && strcasecmp(path + length - 4, ".cue") == 0)
+        error = cdrom_parse_cue(path);
+    else {
+        error = cdrom_map(path, &cdrom.disc.files[0]);
+        cdrom.disc.file_count  = 1;
+        cdrom.disc.track_count = 1;
+    }
+    if (error != NO_ERROR)
+        return error;
+
+    struct CDROM_FILE *last = &cdrom.disc.files[cdrom.disc.file_count - 1];
+    cdrom.disc.sectors = last->start + last->sectors;
+    cdrom.disc.present = true;
+    cdrom_detect_region();
+
+    printf("[LOG]: disc %s, %u tracks, %u sectors, %.4s\n", path, cdrom.disc.track_count, cdrom.disc.sectors, cdrom.disc.region);
+    return set_PSX_error(NO_ERROR);
+}
+
+void cdrom_reset(void) {
+    // the inserted disc outlives a reset
+    struct CDROM_DISC disc = cdrom.disc;
+
+    memset(&cdrom, 0, sizeof(cdrom));
+    cdrom.disc = disc;
+    cdrom.stat = (disc.present) ? CDROM_STAT_MOTOR: 0;
+
+    scheduler_register(EVENT_CDROM, cdrom_event);
+    scheduler_register(EVENT_CDROM_DRIVE, cdrom_drive_event);
+    scheduler_cancel(EVENT_CDROM);
+    scheduler_cancel(EVENT_CDROM_DRIVE);
+}
+
+const uint8_t *cdrom_sector(uint32_t lba) {
+    // NULL outside the image, a sector is never copied out of the mapping
+    for (uint32_t i = 0; i < cdrom.disc.file_count; i++) {
+        const struct CDROM_FILE *file = &cdrom.disc.files[i];
+        if (lba >= file->start && lba - file->start < file->sectors)
+            return file->data + (size_t) (lba - file->start) * CDROM_SECTOR_SIZE;
+    }
+    return NULL;
+}
+
+uint32_t cdrom_read(uint32_t address, uint32_t width) {
+    // wider reads of the data fifo take that many bytes from it
+    uint32_t value = 0;
+
+    for (uint32_t i = 0; i < width; i++) {
+        uint32_t byte = ((address & 0X3) == 2) ? cdrom_data_byte(): cdrom_register(address + i);
+        value |= byte << (i * 8);
+    }
+    return value;
+}
+
+void cdrom_write(uint32_t address, uint8_t value) {
+    // index 0 to 3 picks what 0X1F801801 to 0X1F801803 are
+    switch ((cdrom.status.index << 2) | (address & 0X3)) {
+        case 0X0: case 0X4: case 0X8: case 0XC:
+            cdrom.status.index = value & 0X3;
+            break;
+        case 0X1:
+            cdrom_command(value);
+            break;
+        case 0X2:
+            if (cdrom.parameter_count < CDROM_FIFO_SIZE)
+                cdrom.parameters[cdrom.parameter_count++] = value;
+            break;
+        case 0X3:
+            cdrom_request(value);
+            break;
+        case 0X6:
+            cdrom.interrupt_enable = value & 0X1F;
+            cdrom_update_irq();
+            break;
+        case 0X7:
+            cdrom_acknowledge(value);
+            break;
+        default:
+            // sound map and audio volume, there is no spu to hear them
+            break;
+    }
+}
+
+void cdrom_dma_read(uint32_t *words, uint32_t count) {
+    // straight from the mapped sector into ram
+    const uint8_t *sector = cdrom_sector(cdrom.data_lba);
+    uint32_t size = count * 4;
+    uint32_t left = (cdrom.data_read < cdrom.data_size) ? cdrom.data_size - cdrom.data_read: 0;
+    uint32_t copy = (size < left) ? size: left;
+
+    if (sector == NULL)
+        copy = 0;
+    else
+        memcpy(words, sector + cdrom.data_offset + cdrom.data_read, copy);
+    memset((uint8_t *) words + copy, 0, size - copy);
+    cdrom.data_read += (size < left) ? size: left;
+}
+
+// image helpers
+PSX_ERROR cdrom_map(const char *path, struct CDROM_FILE *file) {
+    struct stat info;
+    int fd;
+
+    if ((fd = open(path, O_RDONLY)) < 0)
+        return set_PSX_error(CDROM_FILE_NOT_FOUND);
+
+    if (fstat(fd, &info) != 0 || info.st_size < CDROM_SECTOR_SIZE) {
+        close(fd);
+        return set_PSX_error(CDROM_INVALID);
+    }
+
+    // the mapping holds the file open, pages come in as sectors are touched
+    void *data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        return set_PSX_error(CDROM_FILE_UNREADABLE);
+
+    if (info.st_size % CDROM_SECTOR_SIZE != 0)
+        printf("[LOG]: %s is not a whole number of %d byte sectors\n", path, CDROM_SECTOR_SIZE);
+
+    file->data    = data;
+    file->size    = info.st_size;
+    file->sectors = info.st_size / CDROM_SECTOR_SIZE;
+    return set_PSX_error(NO_ERROR);
+}
+
+PSX_ERROR cdrom_parse_cue(const char *path) {
+    // FILE, TRACK and INDEX 01 are all that is needed, each file follows the last
+    // on the disc. PREGAP sectors are not in the files and are left out
+    struct CDROM_DISC *disc = &cdrom.disc;
+    char line[1024], directory[1024], name[2048];
+    FILE *fp;
+
+    if ((fp = fopen(path, "r")) == NULL)
+        return set_PSX_error(CDROM_FILE_NOT_FOUND);
+
+    // bins are named relative to the sheet
+    const char *slash = strrchr(path, '/');
+    snprintf(directory, sizeof(directory), "%.*s", (slash) ? (int) (slash - path + 1): 0, path);
+
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        char keyword[16] = "", type[32] = "", msf[16] = "";
+        uint32_t number = 0;
+
+        if (sscanf(line, " %15s", keyword) != 1)
+            continue;
+
+        if (strcmp(keyword, "FILE") == 0) {
+            const char *first = strchr(line, '"'), *last = strrchr(line, '"');
+            char file_name[1024];
+
+            if (first != NULL && last > first)
+                snprintf(file_name, sizeof(file_name), "%.*s", (int) (last - first - 1), first + 1);
+            else if (sscanf(line, " FILE %1023s", file_name) != 1)
+                break;
+
+            if (disc->file_count == CDROM_TRACKS_MAX)
+                break;
+
+            struct CDROM_FILE *file = &disc->files[disc->file_count];
+            snprintf(name, sizeof(name), "%s%s", directory, file_name);
+            if (cdrom_map(name, file) != NO_ERROR) {
+                fclose(fp);
+                print_cdrom_error("cdrom_parse_cue", "Cannot map %s", name);
+                return set_PSX_error(CDROM_FILE_UNREADABLE);
+            }
+            if (disc->file_count > 0)
+                file->start = disc->files[disc->file_count - 1].start + disc->files[disc->file_count - 1].sectors;
+            disc->file_count++;
+        }
+        else if (strcmp(keyword, "TRACK") == 0) {
+            if (sscanf(line, " TRACK %u %31s", &number, type) != 2 || disc->file_count == 0 || disc->track_count == CDROM_TRACKS_MAX)
+                break;
+
+            // only raw sectors can be read as the drive would see them
+            if (strcmp(type, "AUDIO") != 0 && strcmp(type, "MODE1/2352") != 0 && strcmp(type, "MODE2/2352") != 0) {
+                fclose(fp);
+                print_cdrom_error("cdrom_parse_cue", "Track %u is %s, only 2352 byte sectors are supported", number, type);
+                return set_PSX_error(CDROM_INVALID);
+            }
+            disc->tracks[disc->track_count].audio = strcmp(type, "AUDIO") == 0;
+            disc->tracks[disc->track_count].start = disc->files[disc->file_count - 1].start;
+            disc->track_count++;
+        }
+        else if (strcmp(keyword, "INDEX") == 0) {
+            uint32_t offset;
+            if (sscanf(line, " INDEX %u %15s", &number, msf) != 2 || !cdrom_parse_msf(msf, &offset) || disc->track_count == 0)
+                break;
+            if (number == 1)
+                disc->tracks[disc->track_count - 1].start = disc->files[disc->file_count - 1].start + offset;
+        }
+    }
+    fclose(fp);
+
+    if (disc->file_count == 0 || disc->track_count == 0 || disc->tracks[0].audio)
+        return set_PSX_error(CDROM_INVALID);
+    return set_PSX_error(NO_ERROR);
+}
+
+bool cdrom_parse_msf(const char *text, uint32_t *sectors) {
+    uint32_t minutes, seconds, frames;
+
+    if (sscanf(text, "%u:%u:%u", &minutes, &seconds, &frames) != 3 || seconds >= 60 || frames >= 75)
+        return false;
+
+    *sectors = (minutes * 60 + seconds) * 75 + frames;
+    return true;
+}
+
+void cdrom_detect_region(void) {
+    // the license text of sector 4 names the region GetID reports
+    const uint8_t *sector = cdrom_sector(4);
+    const char *region = "SCEI";
+
+    for (uint32_t i = 24; sector != NULL && i + 4 <= 24 + 0X800; i++) {
+        if (memcmp(sector + i, "Amer", 4) == 0) { region = "SCEA"; break; }
+        if (memcmp(sector + i, "Euro", 4) == 0) { region = "SCEE"; break; }
+    }
+    memcpy(cdrom.disc.region, region, 4);
+}
+
+// controller helpers
+uint8_t cdrom_register(uint32_t address) {
+    switch (address & 0X3) {
+        case 0X0:
+            cdrom.status.parameter_empty = cdrom.parameter_count == 0;
+            cdrom.status.parameter_ready = cdrom.parameter_count < CDROM_FIFO_SIZE;
+            cdrom.status.response_ready  = cdrom.response_read < cdrom.response.size;
+            cdrom.status.data_ready      = cdrom.data_read < cdrom.data_size;
+            return cdrom.status.value;
+        case 0X1:
+            if (cdrom.response_read < cdrom.response.size)
+                return cdrom.response.bytes[cdrom.response_read++];
+            return 0;
+        case 0X2:
+            return cdrom_data_byte();
+        default:
+            // the unused top bits read as set
+            return ((cdrom.status.index & 1) ? cdrom.interrupt_flag: cdrom.interrupt_enable) | 0XE0;
+    }
+}
+
+uint8_t cdrom_data_byte(void) {
+    if (cdrom.data_read >= cdrom.data_size)
+        return 0;
+
+    const uint8_t *sector = cdrom_sector(cdrom.data_lba);
+    uint32_t offset = cdrom.data_offset + cdrom.data_read++;
+    return (sector) ? sector[offset]: 0;
+}
+
+void cdrom_command(uint8_t value) {
+    // the first response comes after the controller has looked at it
+    cdrom.command = value;
+    cdrom.status.busy = 1;
+    scheduler_schedule(EVENT_CDROM, CDROM_ACK_CYCLES);
+}
+
+void cdrom_request(uint8_t value) {
+    // bit 7 loads the last sector read into the data fifo, clear empties it
+    if (!(value & 0X80)) {
+        cdrom.data_size = 0;
+        cdrom.data_read = 0;
+        return;
+    }
+    if (cdrom.data_read < cdrom.data_size || !cdrom.sector_ready)
+        return;
+
+    bool whole = cdrom.mode & CDROM_MODE_WHOLE;
+    cdrom.data_lba    = cdrom.sector;
+    cdrom.data_offset = (whole) ? 12: 24;     // after the sync, or after the header and subheader too
+    cdrom.data_size   = (whole) ? 0X924: 0X800;
+    cdrom.data_read   = 0;
+    cdrom.sector_ready = false;
+}
+
+void cdrom_acknowledge(uint8_t value) {
+    cdrom.interrupt_flag &= ~(value & 0X1F);
+    if (value & 0X40)
+        cdrom.parameter_count = 0;
+    cdrom_update_irq();
+
+    // the next queued response follows shortly, unless a command is about to answer anyway
+    if ((cdrom.interrupt_flag & 0X7) == 0 && cdrom.queue_count > 0 && !scheduler_pending(EVENT_CDROM))
+        scheduler_schedule(EVENT_CDROM, CDROM_NEXT_CYCLES);
+}
+
+void cdrom_execute(void) {
+    static const uint8_t minimum[0X20] = { [CDROM_SETLOC] = 3, [CDROM_SETMODE] = 1, [CDROM_TEST] = 1 };
+    uint8_t command = cdrom.command;
+
+    if (command < 0X20 && cdrom.parameter_count < minimum[command]) {
+        cdrom_error(CDROM_ERROR_PARAMETERS);
+        cdrom.parameter_count = 0;
+        return;
+    }
+
+    switch (command) {
+        case CDROM_GETSTAT:
+            cdrom_ack();
+            cdrom.stat &= ~CDROM_STAT_SHELL_OPEN;
+            break;
+        case CDROM_SETLOC:
+            cdrom.setloc = ((cdrom_bcd(cdrom.parameters[0]) * 60 + cdrom_bcd(cdrom.parameters[1])) * 75 +
+                            cdrom_bcd(cdrom.parameters[2])) - CDROM_LEAD_IN;
+            cdrom.setloc_pending = true;
+            cdrom_ack();
+            break;
+        case CDROM_READN:
+        case CDROM_READS:
+            if (!cdrom.disc.present) {
+                cdrom_error(CDROM_ERROR_NO_DISC);
+                break;
+            }
+            cdrom_ack();
+            cdrom_read_start();
+            break;
+        case CDROM_PAUSE: {
+            // stopping a read takes about a sector
+            uint32_t cycles = (cdrom.stat & CDROM_STAT_READING) ? cdrom_sector_cycles(): CDROM_NEXT_CYCLES;
+            cdrom_ack();
+            cdrom_stop();
+            cdrom.drive = CDROM_PAUSING;
+            scheduler_schedule(EVENT_CDROM_DRIVE, cycles);
+            break;
+        }
+        case CDROM_INIT:
+            cdrom_ack();
+            cdrom_stop();
+            cdrom.mode = 0;
+            cdrom.stat = (cdrom.disc.present) ? CDROM_STAT_MOTOR: 0;
+            cdrom.drive = CDROM_INITING;
+            scheduler_schedule(EVENT_CDROM_DRIVE, CDROM_ACK_CYCLES);
+            break;
+        case CDROM_MUTE:
+        case CDROM_DEMUTE:
+            cdrom_ack();
+            break;
+        case CDROM_SETMODE:
+            cdrom.mode = cdrom.parameters[0];
+            cdrom_ack();
+            break;
+        case CDROM_SEEKL:
+        case CDROM_SEEKP:
+            if (!cdrom.disc.present) {
+                cdrom_error(CDROM_ERROR_NO_DISC);
+                break;
+            }
+            cdrom_stop();
+            cdrom.stat |= CDROM_STAT_SEEKING;
+            cdrom_ack();
+            cdrom.drive = CDROM_SEEK;
+            scheduler_schedule(EVENT_CDROM_DRIVE, CDROM_SEEK_CYCLES);
+            break;
+        case CDROM_TEST: {
+            // only 20h, the controller firmware date
+            static const uint8_t version[4] = { 0X94, 0X09, 0X19, 0XC0 };
+            if (cdrom.parameters[0] == 0X20)
+                cdrom_respond(CDROM_INT3, version, sizeof(version));
+            else
+                cdrom_error(CDROM_ERROR_COMMAND);
+            break;
+        }
+        case CDROM_GETID:
+            cdrom_ack();
+            cdrom.drive = CDROM_ID;
+            scheduler_schedule(EVENT_CDROM_DRIVE, CDROM_GETID_CYCLES);
+            break;
+        default:
+            printf("[LOG]: cdrom command 0X%02X not supported\n", command);
+            cdrom_error(CDROM_ERROR_COMMAND);
+            break;
+    }
+    cdrom.parameter_count = 0;
+}
+
+void cdrom_respond(enum CDROM_INTERRUPT interrupt, const uint8_t *bytes, uint8_t size) {
+    // a sector waiting to be announced is replaced by the newer one
+    struct CDROM_RESPONSE *last = &cdrom.queue[(cdrom.queue_head + cdrom.queue_count - 1) % CDROM_QUEUE_SIZE];
+    struct CDROM_RESPONSE *response;
+
+    if (cdrom.queue_count > 0 && interrupt == CDROM_INT1 && last->interrupt == CDROM_INT1)
+        response = last;
+    else if (cdrom.queue_count < CDROM_QUEUE_SIZE)
+        response = &cdrom.queue[(cdrom.queue_head + cdrom.queue_count++) % CDROM_QUEUE_SIZE];
+    else {
+        printf("[LOG]: cdrom response queue full, INT%d dropped\n", interrupt);
+        return;
+    }
+
+    response->interrupt = interrupt;
+    response->size = size;
+    memcpy(response->bytes, bytes, size);
+
+    cdrom_deliver();
+}
+
+void cdrom_ack(void) {
+    cdrom_respond(CDROM_INT3, &cdrom.stat, 1);
+}
+
+void cdrom_error(uint8_t error) {
+    uint8_t bytes[2] = { cdrom.stat | CDROM_STAT_ERROR, error };
+    cdrom_respond(CDROM_INT5, bytes, sizeof(bytes));
+}
+
+void cdrom_deliver(void) {
+    // one response at a time, the cpu acknowledges it before the next is seen
+    if ((cdrom.interrupt_flag & 0X7) != 0 || cdrom.queue_count == 0)
+        return;
+
+    cdrom.response      = cdrom.queue[cdrom.queue_head];
+    cdrom.response_read = 0;
+    cdrom.queue_head    = (cdrom.queue_head + 1) % CDROM_QUEUE_SIZE;
+    cdrom.queue_count--;
+
+    cdrom.interrupt_flag = (cdrom.interrupt_flag & ~0X7) | cdrom.response.interrupt;
+    cdrom_update_irq();
+}
+
+void cdrom_update_irq(void) {
+    bool irq = (cdrom.interrupt_flag & cdrom.interrupt_enable & 0X1F) != 0;
+
+    if (irq && !cdrom.irq)
+        interrupts_request(IRQ_CDROM);
+    cdrom.irq = irq;
+}
+
+void cdrom_read_start(void) {
+    // the seek to a new setloc comes before the first sector
+    uint32_t cycles = cdrom_sector_cycles();
+
+    if (cdrom.setloc_pending) {
+        cdrom.position = cdrom.setloc;
+        cdrom.setloc_pending = false;
+        cycles += CDROM_SEEK_CYCLES;
+    }
+    cdrom.stat = (cdrom.stat & ~(CDROM_STAT_SEEKING | CDROM_STAT_PLAYING)) | CDROM_STAT_READING;
+    cdrom.drive = CDROM_READ;
+    scheduler_schedule(EVENT_CDROM_DRIVE, cycles);
+}
+
+void cdrom_read_sector(void) {
+    const uint8_t *sector = cdrom_sector(cdrom.position);
+
+    if (sector == NULL) {
+        cdrom_stop();
+        cdrom_respond(CDROM_INT4, &cdrom.stat, 1);
+        return;
+    }
+
+    uint32_t lba = cdrom.position++;
+    scheduler_schedule(EVENT_CDROM_DRIVE, cdrom_sector_cycles());
+
+    // real time xa audio goes to the spu and never reaches the cpu
+    if ((cdrom.mode & CDROM_MODE_XA_ADPCM) && sector[15] == 2 && (sector[18] & 0X44) == 0X44)
+        return;
+
+    cdrom.sector = lba;
+    cdrom.sector_ready = true;
+    cdrom_respond(CDROM_INT1, &cdrom.stat, 1);
+}
+
+void cdrom_stop(void) {
+    cdrom.stat &= ~(CDROM_STAT_READING | CDROM_STAT_SEEKING | CDROM_STAT_PLAYING);
+    cdrom.drive = CDROM_IDLE;
+    scheduler_cancel(EVENT_CDROM_DRIVE);
+}
+
+uint32_t cdrom_sector_cycles(void) {
+    return (cdrom.mode & CDROM_MODE_SPEED) ? CDROM_READ_CYCLES / 2: CDROM_READ_CYCLES;
+}
+
+uint8_t cdrom_bcd(uint8_t value) {
+    return (value >> 4) * 10 + (value & 0XF);
+}
+
+void cdrom_event(uint64_t timestamp) {
+    if (cdrom.status.busy) {
+        cdrom.status.busy = 0;
+        cdrom_execute();
+    }
+    cdrom_deliver();
+}
+
+void cdrom_drive_event(uint64_t timestamp) {
+    switch (cdrom.drive) {
+        case CDROM_SEEK:
+            if (cdrom.setloc_pending)
+                cdrom.position = cdrom.setloc;
+            cdrom.setloc_pending = false;
+            cdrom.stat &= ~CDROM_STAT_SEEKING;
+            cdrom.drive = CDROM_IDLE;
+            cdrom_respond(CDROM_INT2, &cdrom.stat, 1);
+            break;
+        case CDROM_READ:
+            cdrom_read_sector();
+            break;
+        case CDROM_ID: {
+            // a licensed mode 2 disc, or the no disc error
+            uint8_t id[8] = { cdrom.stat, 0X00, 0X20, 0X00 };
+            static const uint8_t none[8] = { 0X08, 0X40 };
+
+            cdrom.drive = CDROM_IDLE;
+            if (!cdrom.disc.present) {
+                cdrom_respond(CDROM_INT5, none, sizeof(none));
+                break;
+            }
+            memcpy(id + 4, cdrom.disc.region, 4);
+            cdrom_respond(CDROM_INT2, id, sizeof(id));
+            break;
+        }
+        case CDROM_PAUSING:
+        case CDROM_INITING:
+            cdrom.drive = CDROM_IDLE;
+            cdrom_respond(CDROM_INT2, &cdrom.stat, 1);
+            break;
+        default:
+            break;
+    }
+}
@@ -1,4 +1,6 @@
 #include "cpu.h"
+#include "dynarec.h"
+#include "gte.h"
 
 // main cpu struct
 static struct CPU cpu;
@@ -6,6 +8,27 @@ static struct CPU cpu;
 // instruction type execution functions
 static void cpu_execute_op(void);
 
+// cached interpreter
+typedef void (*CPU_OP)(void);
+
+// blocks by physical word address, main RAM followed by the BIOS
+#define CACHE_RAM_WORDS  (0X200000 >> 2)
+#define CACHE_BIOS_WORDS (0X80000  >> 2)
+
+static struct CACHED_BLOCK *cache_blocks[CACHE_RAM_WORDS + CACHE_BIOS_WORDS];
+// 4K pages that have had a block compiled in them, so a flush only walks those
+#define CACHE_PAGE_WORDS (MEMORY_CODE_PAGE_SIZE >> 2)
+static bool cache_pages[(CACHE_RAM_WORDS + CACHE_BIOS_WORDS) / CACHE_PAGE_WORDS];
+// only the block running can still be in use once invalidated, it is freed on the next step
+static struct CACHED_BLOCK *cache_running;
+static struct CACHED_BLOCK *cache_retired;
+
+static int32_t cpu_cache_index(uint32_t address);
+static struct CACHED_BLOCK *cpu_cache_compile(uint32_t address);
+static void cpu_cache_retire(struct CACHED_BLOCK *block);
+static void cpu_cache_drop_native(void);
+static CPU_OP cpu_decode_op(union INSTRUCTION instruction);
+
 // Main OPCODES for the cpu
 // I-TYPE instruction     R-TYPE instructions      J-TYPE instructions    COP0 specific        COPn generic
 static void BEQ(void);    static void SLL(void);     static void J(void);   static void TLBR();  static void MFCn(int cop_n);
@@ -73,9 +96,11 @@ bool cop0_SR_CU3() {return cpu.cop0.SR.CU3;}
 
 // misc/helpers
 void cpu_exception(enum EXCEPTION_CAUSE cause);
+static PSX_ERROR cpu_step_instruction(void);
+static bool cpu_interrupt_pending(void);
+static void cpu_interrupt(void);
 
 static void cpu_branch(void);
-static void cpu_load_delay(void);
 static void cpu_branch_delay(void);
 static void COPn_reg(int n, int reg, uint32_t **refrence);
 
@@ -102,11 +127,22 @@ PSX_ERROR cpu_reset(void) {
     // main instruction execution functions
     cpu.cop0.R[15] = &cpu.cop0.PIRD.value;
 
+    gte_reset();
+    cpu_cache_flush();
+
     return set_PSX_error(NO_ERROR);
 }
 
 PSX_ERROR cpu_step(void) {
     cpu_branch_delay();
+
+    if (cpu_interrupt_pending())
+        cpu_interrupt();
+
+    return cpu_step_instruction();
+}
+
+PSX_ERROR cpu_step_instruction(void) {
     memory_cpu_load_32bit(cpu.PC, &cpu.instruction.value);
     cpu_load_delay();
     cpu_execute_op();
@@ -115,12 +151,111 @@ PSX_ERROR cpu_step(void) {
     return set_PSX_error(NO_ERROR);
 }
 
+/* Runs one cached basic block, with the same per instruction delay handling as cpu_step.  *
+ * The block is left early when an exception moves the PC or a branch is about to transfer *
+ * returns the number of instructions executed                                             */
+uint32_t cpu_step_block(void) {
+    // release the block invalidated while it was running
+    free(cache_retired);
+    cache_retired = NULL;
+    cpu.cache_invalidated = false;
+
+    cpu_branch_delay();
+
+    if (cpu_interrupt_pending())
+        cpu_interrupt();
+
+    uint32_t pc = cpu.PC;
+    int32_t index = cpu_cache_index(pc);
+
+    // uncached regions and isolated cache run through the interpreter
+    if (index < 0 || cpu.cop0.SR.Isc) {
+        cpu_step_instruction();
+        return 1;
+    }
+
+    struct CACHED_BLOCK *block = cache_blocks[index];
+    if (block == NULL) {
+        block = cache_blocks[index] = cpu_cache_compile(pc);
+        cache_pages[index / CACHE_PAGE_WORDS] = true;
+    }
+
+    // translated blocks expect no branch in flight, a block entered
+    // through a delay slot runs its one instruction below instead. the
+    // native code holds the virtual PC it was compiled at, a block reached
+    // through another segment (KUSEG, KSEG0, KSEG1) is interpreted as well
+    if (cpu.mode == CPU_DYNAREC && cpu.branch.stage == UNUSED && block->address == pc) {
+        if (block->native == NULL) {
+            if (dynarec_full()) {
+                dynarec_reset();
+                cpu_cache_drop_native();
+            }
+            block->native = dynarec_compile(block, pc);
+        }
+        cache_running = block;
+        uint32_t executed = block->native();
+        cache_running = NULL;
+        return executed;
+    }
+
+    cache_running = block;
+    uint32_t executed = 0;
+    for (;;) {
+        struct CACHED_INSTRUCTION *op = &block->instructions[executed];
+
+        cpu.instruction = op->instruction;
+        cpu_load_delay();
+        op->execute();
+        cpu.PC += 4;
+        reg(0) = 0;
+
+        executed++;
+        if (executed == block->length || cpu.cache_invalidated)  break;
+        if (cpu.PC != pc + (executed << 2))                  break;
+        if (cpu.branch.stage == TRANSFER)                     break;
+
+        cpu_branch_delay();
+    }
+    cache_running = NULL;
+    return executed;
+}
+
+void cpu_cache_invalidate(uint32_t address) {
+    // drop every block starting inside the 4K page, blocks never cross a page
+    int32_t index = cpu_cache_index(address & ~MEMORY_CODE_PAGE_MASK);
+    if (index < 0)
+        return;
+
+    for (int32_t i = index; i < index + (MEMORY_CODE_PAGE_SIZE >> 2); i++) {
+        if (cache_blocks[i] != NULL) {
+            cpu_cache_retire(cache_blocks[i]);
+            cache_blocks[i] = NULL;
+        }
+    }
+    cpu.cache_invalidated = true;
+}
+
+void cpu_cache_flush(void) {
+    for (uint32_t page = 0; page < sizeof(cache_pages); page++) {
+        if (!cache_pages[page])
+            continue;
+
+        for (uint32_t i = page * CACHE_PAGE_WORDS; i < (page + 1) * CACHE_PAGE_WORDS; i++) {
+            free(cache_blocks[i]);
+            cache_blocks[i] = NULL;
+        }
+        cache_pages[page] = false;
+    }
+    free(cache_retired);
+    cache_retired = NULL;
+    cpu.cache_invalidated = true;
+}
+
 
 // simple helper functions
 void COPn_reg(int n, int reg, uint32_t **refrence) {
     switch (n) {
         case 0X00: *refrence = cpu.cop0.R[reg]; break;
-        case 0X02: *refrence = cpu.cop2.R[reg]; break;
     }
 }
 
@@ -150,6 +285,17 @@ void cpu_exception(enum EXCEPTION_CAUSE cause) {
     cpu.PC = handler - 4;
 }
 
+bool cpu_interrupt_pending(void) {
+    // taken between instructions, but never with a branch in flight so EPC stays exact
+    return cpu.cop0.SR.IEc && (cpu.cop0.SR.value & cpu.cop0.CAUSE.value & 0XFF00) && cpu.branch.stage == UNUSED;
+}
+
+void cpu_interrupt(void) {
+    // taken before the fetch, EPC is the instruction about to run
+    cpu_exception(INT);
+    cpu.PC += 4;
+}
+
 void cpu_branch_delay(void) {
     switch (cpu.branch.stage) {
         case UNUSED: break;
@@ -185,6 +331,162 @@ void cpu_branch(void) {
     cpu.branch.stage = DELAY;
 }
 
+// cached interpreter helpers
+int32_t cpu_cache_index(uint32_t address) {
+    // KSEG2 and unaligned addresses are never cached
+    if (address >= 0XC0000000 || (address & 0X3))
+        return -1;
+
+    uint32_t physical = address & 0X1FFFFFFF;
+    if (physical < 0X00200000)
+        return physical >> 2;
+    if (physical >= 0X1FC00000 && physical < 0X1FC80000)
+        return CACHE_RAM_WORDS + ((physical - 0X1FC00000) >> 2);
+    return -1;
+}
+
+struct CACHED_BLOCK *cpu_cache_compile(uint32_t address) {
+    struct CACHED_INSTRUCTION instructions[CPU_CACHE_BLOCK_MAX];
+    uint32_t length = 0;
+    bool delay_slot = false;
+
+    // decode up to the delay slot of the first branch, without crossing a 4K page
+    do {
+        union INSTRUCTION instruction;
+        memory_cpu_load_32bit(address + (length << 2), &instruction.value);
+
+        instructions[length].instruction = instruction;
+        instructions[length].execute     = cpu_decode_op(instruction);
+        length++;
+
+        if (delay_slot)
+            break;
+        delay_slot = cpu_decode_branch(instruction);
+
+        // coprocessor 0 writes can change how memory is mapped, end the block
+        if (instruction.op == 0X10)
+            break;
+    } while (length < CPU_CACHE_BLOCK_MAX && ((address + (length << 2)) & MEMORY_CODE_PAGE_MASK) != 0);
+
+    struct CACHED_BLOCK *block = malloc(sizeof(struct CACHED_BLOCK) + length * sizeof(struct CACHED_INSTRUCTION));
+    assert(block != NULL);
+
+    block->address = address;
+    block->length = length;
+    block->native = NULL;
+    memcpy(block->instructions, instructions, length * sizeof(struct CACHED_INSTRUCTION));
+
+    // stores to this page now have to invalidate the block
+    memory_cpu_watch_code(address);
+
+    return block;
+}
+
+void cpu_cache_retire(struct CACHED_BLOCK *block) {
+    // the block executing is freed on the next cpu_step_block, any other right away
+    if (block == cache_running)
+        cache_retired = block;
+    else
+        free(block);
+}
+
+void cpu_cache_drop_native(void) {
+    for (uint32_t i = 0; i < CACHE_RAM_WORDS + CACHE_BIOS_WORDS; i++) {
+        if (cache_blocks[i] != NULL)
+            cache_blocks[i]->native = NULL;
+    }
+}
+
+bool cpu_decode_branch(union INSTRUCTION instruction) {
+    switch (instruction.op) {
+        case 0X00: return instruction.funct == 0X08 || instruction.funct == 0X09; // JR, JALR
+        case 0X01:                                                                // BcondZ
+        case 0X02: case 0X03:                                                     // J, JAL
+        case 0X04: case 0X05: case 0X06: case 0X07:                               // BEQ, BNE, BLEZ, BGTZ
+            return true;
+        default:
+            return false;
+    }
+}
+
+CPU_OP cpu_decode_op(union INSTRUCTION instruction) {
+    // mirrors cpu_execute_op, anything that needs further decoding
+    // (coprocessor 0 instructions) is handed back to cpu_execute_op
+    switch (instruction.op) {
+        case 0X00: 
+            // RTYPE
+            switch (instruction.funct) {
+                case 0X00: return SLL;
+                case 0X02: return SRL;
+                case 0X03: return SRA;
+                case 0X04: return SLLV;
+                case 0X06: return SRLV;
+                case 0X07: return SRAV;
+                case 0X08: return JR;
+                case 0X09: return JALR;
+                case 0X0C: return SYSCALL;
+                case 0X0D: return BREAK;
+                case 0X10: return MFHI;
+                case 0X11: return MTHI;
+                case 0X12: return MFLO;
+                case 0X13: return MTLO;
+                case 0X18: return MULT;
+                case 0X19: return MULTU;
+                case 0X1A: return DIV;
+                case 0X1B: return DIVU;
+                case 0X20: return ADD;
+                case 0X21: return ADDU;
+                case 0X22: return SUB;
+                case 0X23: return SUBU;
+                case 0X24: return AND;
+                case 0X25: return OR;
+                case 0X26: return XOR;
+                case 0X27: return NOR;
+                case 0X2A: return SLT;
+                case 0X2B: return SLTU;
+            } 
+            break;
+        case 0X01: 
+            switch (instruction.rt) {
+                case 0b00000: return BLTZ;
+                case 0b00001: return BGEZ;
+                case 0b10000: return BLTZAL;
+                case 0b10001: return BGEZAL;
+            }
+            break;
+        case 0X02: return J;
+        case 0X03: return JAL;
+        case 0X04: return BEQ;
+        case 0X05: return BNE;
+        case 0X06: return BLEZ;
+        case 0X07: return BGTZ;
+        case 0X08: return ADDI;
+        case 0X09: return ADDIU;
+        case 0X0A: return SLTI;
+        case 0X0B: return SLTIU;
+        case 0X0C: return ANDI;
+        case 0X0D: return ORI;
+        case 0X0E: return XORI;
+        case 0X0F: return LUI;
+        case 0X20: return LB;
+        case 0X21: return LH;
+        case 0X22: return LWL;
+        case 0X23: return LW;
+        case 0X24: return LBU;
+        case 0X25: return LHU;
+        case 0X26: return LWR;
+        case 0X28: return SB;
+        case 0X29: return SH;
+        case 0X2A: return SWL;
+        case 0X2B: return SW;
+        case 0X2E: return SWR;
+        case 0X12: return COP2;
+        case 0X32: return LWC2;
+        case 0X3A: return SWC2;
+    }
+    return cpu_execute_op;
+}
+
 // main instruction execution functions
 void cpu_execute_op(void) {
     switch (OP) {
@@ -392,9 +694,7 @@ void COP1(void)    {
     cpu_exception(CPU);
 }   
 void COP2(void)    {
-    // Coprocessor2 instructions TODO: create the GTE
-    print_cpu_error("COP2", "GTE instruction", NULL);
-    exit(1);
+    // Coprocessor2 instructions, the GTE
     switch (COP_TYPE) {
         case 0X00:
             switch (COP_FUNCT) {
@@ -561,9 +861,10 @@ void LWC1(void)    {
 }   
 void LWC2(void)    {
     // Load Word Coprocessor 2
-    uint32_t *reg, address = reg(RS) + IMM25;
-    COPn_reg(2, RD, &reg);
-    memory_cpu_load_32bit(address, reg);
+    uint32_t value, address = reg(RS) + sign16(IMM16);
+
+    memory_cpu_load_32bit(address, &value);
+    gte_write_data(RT, value);
 }   
 void LWC3(void)    {
     // Load Word Coprocessor 3
@@ -579,9 +880,8 @@ void SWC1(void)    {
 }   
 void SWC2(void)    {
     // Store Word Coprocessor 2
-    uint32_t *value, address = reg(RS) + IMM25;
-    COPn_reg(2, RD, &value);
-    memory_cpu_store_32bit(address, *value);
+    uint32_t address = reg(RS) + sign16(IMM16);
+    memory_cpu_store_32bit(address, gte_read_data(RT));
 }
 void SWC3(void)    {
     // Store Word Coprocessor 3
@@ -747,24 +1047,77 @@ void JAL(void)     {
 void MFCn(int cop_n) {
     // Move From Coprocessor n
     uint32_t *result;
+
+    // gte reads go through the load delay like a memory load
+    if (cop_n == 2) {
+        cpu.load[RT].value = gte_read_data(RD);
+        cpu.load[RT].stage = DELAY;
+        return;
+    }
     COPn_reg(cop_n, RD, &result);
 
     reg(RT) = *result; 
 }
-void CFCn(int cop_n) {print_cpu_error("OP", "UNIMPLEMENTED %x", cop_n); exit(1);}
+void CFCn(int cop_n) {
+    // Move Control From Coprocessor n
+    if (cop_n != 2) {
+        print_cpu_error("OP", "UNIMPLEMENTED %x", cop_n);
+        exit(1);
+    }
+    cpu.load[RT].value = gte_read_control(RD);
+    cpu.load[RT].stage = DELAY;
+}
 void MTCn(int cop_n) {
     // Move To Coprocessor n
     uint32_t *destination;
+
+    if (cop_n == 2) {
+        gte_write_data(RD, reg(RT));
+        return;
+    }
     COPn_reg(cop_n, RD, &destination);
     
     *destination = reg(RT);
+
+    // SR.Isc decides whether RAM is reachable through the memory fast path
+    if (cop_n == 0 && RD == 12) {
+        memory_cpu_isolate_cache(cpu.cop0.SR.Isc);
+    }
+}
+void CTCn(int cop_n) {
+    // Move Control To Coprocessor n
+    if (cop_n != 2) {
+        print_cpu_error("OP", "UNIMPLEMENTED %x", cop_n);
+        exit(1);
+    }
+    gte_write_control(RD, reg(RT));
+}
+void COPn(int cop_n) {
+    // Coprocessor n command
+    if (cop_n != 2) {
+        print_cpu_error("OP", "UNIMPLEMENTED %x", cop_n);
+        exit(1);
+    }
+    gte_execute(IMM25);
 }
-void CTCn(int cop_n) {print_cpu_error("OP", "UNIMPLEMENTED %x", cop_n); exit(1);}
-void COPn(int cop_n) {print_cpu_error("OP", "UNIMPLEMENTED %x", cop_n); exit(1);}
 void BCnF(int cop_n) {print_cpu_error("OP", "UNIMPLEMENTED %x", cop_n); exit(1);}
 void BCnT(int cop_n) {print_cpu_error("OP", "UNIMPLEMENTED %x", cop_n); exit(1);}
-void LWCn(int cop_n) {print_cpu_error("OP", "UNIMPLEMENTED %x", cop_n); exit(1);}
-void SWCn(int cop_n) {print_cpu_error("OP", "UNIMPLEMENTED %x", cop_n); exit(1);}
+void LWCn(int cop_n) {
+    switch (cop_n) {
+        case 0X00: LWC0(); break;
+        case 0X01: LWC1(); break;
+        case 0X02: LWC2(); break;
+        case 0X03: LWC3(); break;
+    }
+}
+void SWCn(int cop_n) {
+    switch (cop_n) {
+        case 0X00: SWC0(); break;
+        case 0X01: SWC1(); break;
+        case 0X02: SWC2(); break;
+        case 0X03: SWC3(); break;
+    }
+}
 
 // COP0
 void TLBR()  {print_cpu_error("OP", "UNIMPLEMENTED", NULL); exit(1);}
@@ -773,7 +1126,7 @@ void TLBWR() {print_cpu_error("OP", "UNIMPLEMENTED", NULL); exit(1);}
 void TLBP()  {print_cpu_error("OP", "UNIMPLEMENTED", NULL); exit(1);}
 void RFE()   {
     // Return From Exception
-    if ((cpu.instruction.value & 0b11111) == 0b01000) {
+    if ((cpu.instruction.value & 0X3F) == 0X10) {
         cpu.cop0.SR.value = (cpu.cop0.SR.value & ~0X3F) |
                             ((cpu.cop0.SR.value & 0X3F) >> 2); // increment exception stack
     }
@@ -1,14 +1,32 @@
 #include "dma.h"
+#include "interrupts.h"
 
 static struct DMA dma;
 
 struct DMA *get_dma(void) { return &dma; }
 
 // helpers
-static int dma_get_channel_to_service(void);
+static struct DMAn *dma_channel(int channel);
+static bool dma_channel_active(int channel);
+static uint32_t dma_transfer(int channel);
+static void dma_channel_done(int channel);
 static void dma_process_interrupts(void);
-static void dma_gpu(void);
-static void dma_otc(void);
+static void dma_event(uint64_t timestamp);
+
+// ram access, transfers bypass the cpu memory map
+static uint32_t dma_ram_load(uint32_t address);
+static void dma_ram_store(uint32_t address, uint32_t data);
+static void dma_ram_to_gp0(uint32_t address, uint32_t words, int32_t step);
+
+// channel transfers, each returns the cycles it took or 0 if its device is not ready
+static uint32_t dma_mdec_in(void);
+static uint32_t dma_mdec_out(void);
+static uint32_t dma_gpu(void);
+static uint32_t dma_cdrom(void);
+static uint32_t dma_otc(void);
+static uint32_t dma_gpu_request(union D_MADR madr, union D_BRC brc, union D_CHCR chcr);
+static uint32_t dma_gpu_linked_list(union D_MADR madr, union D_BRC brc, union D_CHCR chcr);
+static uint32_t dma_otc_manual(union D_MADR madr, union D_BRC brc, union D_CHCR chcr);
 
 // external interfaces
 PSX_ERROR dma_reset(void) {
@@ -54,26 +72,90 @@ PSX_ERROR dma_reset(void) {
     dma.DPRC->pio_priority      = 6;
     dma.DPRC->otc_priority      = 7;
 
-    dma.accessing_memory = false;
-    dma.device_ready     = false;
+    dma.interrupt_request = false;
+
+    scheduler_register(EVENT_DMA, dma_event);
 
     return set_PSX_error(NO_ERROR);
 }
 
-PSX_ERROR dma_step(void) {
-    int dev = dma_get_channel_to_service();
-
-    switch (dev) {
-        case MDEC_IN: break;
-        case MDEC_OUT: break;
-        case GPU: dma_gpu(); break;
-        case CDROM: break;
-        case SPU: break;
-        case PIO: break;
-        case OTC: dma_otc(); break;
-        default: break;
+void dma_notify(void) {
+    // service the channels as soon as the cpu yields
+    scheduler_schedule(EVENT_DMA, 0);
+}
+
+void dma_acknowledge(uint32_t previous) {
+    // flags are cleared by writing 1, the signal bit is read only
+    union DIRC written = *dma.DIRC;
+    dma.DIRC->value = (written.value & 0X00FFFFFF) | (previous & 0X7F000000 & ~written.value);
+    dma_process_interrupts();
+}
+
+void dma_event(uint64_t timestamp) {
+    // a channel runs to completion in one go, the cpu is off the bus meanwhile
+    uint32_t cycles = 0;
+    bool waiting = false;
+
+    for (int priority = 0; priority < 8; priority++) {
+        for (int i = 6; i >= 0; i--) {
+            if (!dma_channel_active(i) || ((dma.DPRC->value >> i*4) & 0b0111) != priority)
+                continue;
+
+            uint32_t used = dma_transfer(i);
+            if (used == 0) {
+                waiting = true;
+                continue;
+            }
+            cycles += used;
+            dma_channel_done(i);
+        }
+    }
+    scheduler_advance(cycles);
+
+    // channels still waiting on their device are polled
+    if (waiting)
+        scheduler_schedule(EVENT_DMA, DMA_POLL_CYCLES);
+}
+
+// helpers
+struct DMAn *dma_channel(int channel) {
+    switch (channel) {
+        case MDEC_IN:  return &dma.DMA0_MDEC_IN;
+        case MDEC_OUT: return &dma.DMA1_MDEC_OUT;
+        case GPU:      return &dma.DMA2_GPU;
+        case CDROM:    return &dma.DMA3_CDROM;
+        case SPU:      return &dma.DMA4_SPU;
+        case PIO:      return &dma.DMA5_PIO;
+        default:       return &dma.DMA6_OTC;
     }
-    return set_PSX_error(NO_ERROR);
+}
+
+bool dma_channel_active(int channel) {
+    bool enabled = (dma.DPRC->value >> channel*4) & 0b1000;
+    return enabled && dma_channel(channel)->CHCR->start_busy;
+}
+
+uint32_t dma_transfer(int channel) {
+    switch (channel) {
+        case MDEC_IN:  return dma_mdec_in();
+        case MDEC_OUT: return dma_mdec_out();
+        case GPU:      return dma_gpu();
+        case CDROM:    return dma_cdrom();
+        case OTC:      return dma_otc();
+        default:       return 0; // SPU and PIO are not connected yet
+    }
+}
+
+void dma_channel_done(int channel) {
+    struct DMAn *dmaN = dma_channel(channel);
+    dmaN->CHCR->start_busy    = 0;
+    dmaN->CHCR->start_trigger = 0;
+
+    // completion flags the channel only if its irq is enabled
+    if (dma.DIRC->irq_enable_sum & (1 << channel))
+        dma.DIRC->irq_flag_sum |= 1 << channel;
+
+    dma_process_interrupts();
 }
 
 void dma_process_interrupts(void) {
@@ -82,247 +164,274 @@ void dma_process_interrupts(void) {
     
     uint32_t irq_sum = dma.DIRC->irq_flag_sum & dma.DIRC->irq_enable_sum;
 
+    bool previous = dma.interrupt_request;
     dma.interrupt_request = forced || (master && (irq_sum> 0));
+    dma.DIRC->irq_signal  = dma.interrupt_request;
+
+    // I_STAT is edge triggered on the signal going high
+    if (dma.interrupt_request && !previous)
+        interrupts_request(IRQ_DMA);
 }
 
-int dma_get_channel_to_service(void) {
-    // reverse iterate over all dma channels
-    // until a channel has the following:
-    //  - enabled in DPRC
-    //  - enabled in its own CHCR
-    //  - highest priority
-    int dev = -1, dev_priority = 10;
-    union D_CHCR chcr;
-    uint32_t address = ADDR_DMA6_OTC + 8;
-    
-    for (int i = 6, priority, enabled; i >= 0; i--, address -= 0X10) {
-        priority = (dma.DPRC->value >> i*4) & 0b0111;
-        enabled  = (dma.DPRC->value >> i*4) & 0b1000;
-        memory_cpu_load_32bit(address, &chcr.value);
-        
-        if (enabled && chcr.start_busy && priority < dev_priority) {
-            dev_priority = priority;
-            dev = i;
-        }
-    }
+uint32_t dma_ram_load(uint32_t address) {
+    uint32_t data;
+    memcpy(&data, get_memory()->MAIN.mem + (address & DMA_RAM_MASK), 4);
+    return data;
+}
 
-    return dev;
+void dma_ram_store(uint32_t address, uint32_t data) {
+    memcpy(get_memory()->MAIN.mem + (address & DMA_RAM_MASK), &data, 4);
 }
 
-static void dma_gpu_request(union D_MADR madr, union D_BRC brc, union D_CHCR chcr);
-static void dma_gpu_linked_list(union D_MADR madr, union D_BRC brc, union D_CHCR chcr);
-static void dma_otc_manual(union D_MADR madr, union D_BRC brc, union D_CHCR chcr);
+void dma_ram_to_gp0(uint32_t address, uint32_t words, int32_t step) {
+    address &= DMA_RAM_MASK;
 
-void dma_mdec_in(void) {
+    // hand the gpu whole packets straight out of ram when the block does not wrap
+    if (step > 0 && address + words * 4 <= sizeof(get_memory()->MAIN.mem)) {
+        gpu_gp0_write((const uint32_t *) (get_memory()->MAIN.mem + address), words);
+        return;
+    }
+
+    for (uint32_t i = 0; i < words; i++, address += step)
+        gpu_write_gp0(dma_ram_load(address));
+}
+
+uint32_t dma_mdec_in(void) {
     union D_MADR madr = *dma.DMA0_MDEC_IN.MADR;
     union D_BRC  brc  = *dma.DMA0_MDEC_IN.BRC;
     union D_CHCR chcr = *dma.DMA0_MDEC_IN.CHCR;
-    
-    if (!chcr.start_busy)
-        return;
-    
-    switch (chcr.sync_mode) {
-        case MANUAL:      break; 
-        case REQUEST:     break; 
-        case LINKED_LIST: break; 
+
+    if (chcr.sync_mode != REQUEST) {
+        set_PSX_error(UNSUPPORTED_DMA_SYNC_MODE);
+        return DMA_CHANNEL_OVERHEAD;
+    }
+    if (chcr.transfer_direction != RAM_TO_DEV) {
+        set_PSX_error(UNSUPPORTED_DMA_TRANSFER_DIRECTION);
+        return DMA_CHANNEL_OVERHEAD;
+    }
+    if (!mdec_dma_in_ready())
+        return 0;
+
+    int32_t  step  = (chcr.address_step) ? -4: +4;
+    uint32_t words = brc.BS * brc.BA;
+    uint32_t address = madr.base_address & DMA_RAM_MASK;
+
+    // the command and its compressed data go over in one piece when the block does not wrap
+    if (step > 0 && address + words * 4 <= sizeof(get_memory()->MAIN.mem)) {
+        mdec_dma_in((const uint32_t *) (get_memory()->MAIN.mem + address), words);
+        address += words * 4;
+    }
+    else {
+        for (uint32_t i = 0; i < words; i++, address += step) {
+            uint32_t word = dma_ram_load(address);
+            mdec_dma_in(&word, 1);
+        }
     }
+
+    dma.DMA0_MDEC_IN.MADR->base_address = address & DMA_RAM_MASK;
+    dma.DMA0_MDEC_IN.BRC->BA = 0;
+
+    return words + DMA_CHANNEL_OVERHEAD;
+}
+
+uint32_t dma_mdec_out(void) {
+    union D_MADR madr = *dma.DMA1_MDEC_OUT.MADR;
+    union D_BRC  brc  = *dma.DMA1_MDEC_OUT.BRC;
+    union D_CHCR chcr = *dma.DMA1_MDEC_OUT.CHCR;
+
+    if (chcr.sync_mode != REQUEST) {
+        set_PSX_error(UNSUPPORTED_DMA_SYNC_MODE);
+        return DMA_CHANNEL_OVERHEAD;
+    }
+    if (chcr.transfer_direction != DEV_TO_RAM) {
+        set_PSX_error(UNSUPPORTED_DMA_TRANSFER_DIRECTION);
+        return DMA_CHANNEL_OVERHEAD;
+    }
+
+    int32_t  step  = (chcr.address_step) ? -4: +4;
+    uint32_t words = brc.BS * brc.BA;
+    uint32_t address = madr.base_address & DMA_RAM_MASK;
+
+    // waits until the decoder would have finished the macroblocks being read
+    if (!mdec_dma_out_ready(words))
+        return 0;
+
+    // macroblocks are decoded straight into ram when the block does not wrap
+    if (step > 0 && address + words * 4 <= sizeof(get_memory()->MAIN.mem)) {
+        mdec_dma_out((uint32_t *) (get_memory()->MAIN.mem + address), words);
+        memory_ram_written(address, words * 4);
+        address += words * 4;
+    }
+    else {
+        for (uint32_t i = 0; i < words; i++, address += step) {
+            uint32_t word;
+            mdec_dma_out(&word, 1);
+            dma_ram_store(address, word);
+            memory_ram_written(address & DMA_RAM_MASK, 4);
+        }
+    }
+
+    dma.DMA1_MDEC_OUT.MADR->base_address = address & DMA_RAM_MASK;
+    dma.DMA1_MDEC_OUT.BRC->BA = 0;
+
+    return words + DMA_CHANNEL_OVERHEAD;
 }
 
-void dma_gpu(void) {
+uint32_t dma_gpu(void) {
     union D_MADR madr = *dma.DMA2_GPU.MADR;
     union D_BRC  brc  = *dma.DMA2_GPU.BRC;
     union D_CHCR chcr = *dma.DMA2_GPU.CHCR;
     
-    if (!chcr.start_busy)
-        return;
-    
     switch (chcr.sync_mode) {
-        case MANUAL:      set_PSX_error(UNSUPPORTED_DMA_SYNC_MODE); break;
-        case REQUEST:     dma_gpu_request(madr, brc, chcr); break;
-        case LINKED_LIST: dma_gpu_linked_list(madr, brc, chcr); break;
+        case REQUEST:     return dma_gpu_request(madr, brc, chcr);
+        case LINKED_LIST: return dma_gpu_linked_list(madr, brc, chcr);
+        default:
+            set_PSX_error(UNSUPPORTED_DMA_SYNC_MODE);
+            return DMA_CHANNEL_OVERHEAD;
     }
 }
 
-void dma_otc(void) {
-    union D_MADR madr = *dma.DMA6_OTC.MADR;
-    union D_BRC  brc  = *dma.DMA6_OTC.BRC;
-    union D_CHCR chcr = *dma.DMA6_OTC.CHCR;
+uint32_t dma_cdrom(void) {
+    union D_MADR madr = *dma.DMA3_CDROM.MADR;
+    union D_BRC  brc  = *dma.DMA3_CDROM.BRC;
+    union D_CHCR chcr = *dma.DMA3_CDROM.CHCR;
+    uint32_t words;
 
-    switch (chcr.sync_mode) {
-        case MANUAL:      dma_otc_manual(madr, brc, chcr); break;
-        case REQUEST:     set_PSX_error(UNSUPPORTED_DMA_SYNC_MODE); break;
-        case LINKED_LIST: set_PSX_error(UNSUPPORTED_DMA_SYNC_MODE); break;
+    if (chcr.transfer_direction != DEV_TO_RAM) {
+        set_PSX_error(UNSUPPORTED_DMA_TRANSFER_DIRECTION);
+        return DMA_CHANNEL_OVERHEAD;
     }
-}
 
-void dma_gpu_request(union D_MADR madr, union D_BRC brc, union D_CHCR chcr) {
-    switch (chcr.transfer_direction) {
-        case DEV_TO_RAM: {
-            static uint32_t address;
-            static  int32_t step, block_count, block_size;
+    // the bios starts it in manual mode, games also use request mode
+    switch (chcr.sync_mode) {
+        case MANUAL:
+            if (!chcr.start_trigger)
+                return 0;
+            words = (brc.BC == 0) ? 0X10000: brc.BC;
+            break;
+        case REQUEST:
+            words = brc.BS * brc.BA;
+            break;
+        default:
+            set_PSX_error(UNSUPPORTED_DMA_SYNC_MODE);
+            return DMA_CHANNEL_OVERHEAD;
+    }
 
-            if (!gpustat_ready_send_vram_cpu())
-                return;
+    int32_t  step = (chcr.address_step) ? -4: +4;
+    uint32_t address = madr.base_address & DMA_RAM_MASK;
 
-            if (!dma.accessing_memory) {
-                dma.accessing_memory = true;
+    // sector data is copied out of the mapped image in one go when the block does not wrap
+    if (step > 0 && address + words * 4 <= sizeof(get_memory()->MAIN.mem)) {
+        cdrom_dma_read((uint32_t *) (get_memory()->MAIN.mem + address), words);
+        memory_ram_written(address, words * 4);
+        address += words * 4;
+    }
+    else {
+        for (uint32_t i = 0; i < words; i++, address += step) {
+            uint32_t word;
+            cdrom_dma_read(&word, 1);
+            dma_ram_store(address, word);
+            memory_ram_written(address & DMA_RAM_MASK, 4);
+        }
+    }
 
-                block_count = brc.BA;
-                block_size  = brc.BS;
+    if (chcr.sync_mode == REQUEST) {
+        dma.DMA3_CDROM.MADR->base_address = address & DMA_RAM_MASK;
+        dma.DMA3_CDROM.BRC->BA = 0;
+    }
+    return words + DMA_CHANNEL_OVERHEAD;
+}
 
-                address = madr.base_address;
+uint32_t dma_otc(void) {
+    union D_MADR madr = *dma.DMA6_OTC.MADR;
+    union D_BRC  brc  = *dma.DMA6_OTC.BRC;
+    union D_CHCR chcr = *dma.DMA6_OTC.CHCR;
 
-                step = (chcr.address_step) ? -4: +4;
-            }
+    switch (chcr.sync_mode) {
+        case MANUAL: return dma_otc_manual(madr, brc, chcr);
+        default:
+            set_PSX_error(UNSUPPORTED_DMA_SYNC_MODE);
+            return DMA_CHANNEL_OVERHEAD;
+    }
+}
 
-            if (block_count == 0) {
-                dma.DMA2_GPU.CHCR->start_busy = false;
-                dma.accessing_memory = false;
-                return;
-            }
+uint32_t dma_gpu_request(union D_MADR madr, union D_BRC brc, union D_CHCR chcr) {
+    int32_t  step  = (chcr.address_step) ? -4: +4;
+    uint32_t words = brc.BS * brc.BA;
+    uint32_t address = madr.base_address & DMA_RAM_MASK;
 
-            if (block_size == 0) {
-                block_size = brc.BS;
-                block_count--;
-            }
+    switch (chcr.transfer_direction) {
+        case DEV_TO_RAM:
+            if (!gpustat_ready_send_vram_cpu())
+                return 0;
 
-            uint32_t data;
-            
-            memory_cpu_load_32bit(ADDR_GPUREAD, &data);
-            memory_cpu_store_32bit(address, data);
+            for (uint32_t i = 0; i < words; i++, address += step)
+                dma_ram_store(address, gpu_read());
 
-            address += step;
-            block_size--;
+            // cached code in the pages just written is stale
+            if (step > 0) memory_ram_written(madr.base_address & DMA_RAM_MASK, words * 4);
+            else          memory_ram_written((address - step) & DMA_RAM_MASK, words * 4);
             break;
-        }
-        case RAM_TO_DEV: {
-            static uint32_t address;
-            static  int32_t step, block_count, block_size; 
-            
+        case RAM_TO_DEV:
             if (!gpustat_dma_data_request())
-                 return;
-
-            // if dma starting
-            if (!dma.accessing_memory) {
-                dma.accessing_memory = true;
-
-                block_count = brc.BA;
-                block_size  = brc.BS;
-
-                address = madr.base_address;
+                return 0;
 
-                step = (chcr.address_step) ? -4: +4;
-            }
-            
-            // reached end of dma transfer
-            if (block_count == 0) {
-                dma.DMA2_GPU.CHCR->start_busy = false;
-                dma.accessing_memory = false;
-                return;
-            }
-
-            // get the next block
-            if (block_size == 0) {
-                block_size = brc.BS;
-                block_count--;
-            }
-
-            uint32_t data;
-
-            memory_cpu_load_32bit(address, &data);
-            memory_cpu_store_32bit(ADDR_GP0, data);
-            
-            address += step;
-            block_size--;
+            dma_ram_to_gp0(address, words, step);
+            address += words * step;
             break;
-        }
     }
-}
 
-void dma_gpu_linked_list(union D_MADR madr, union D_BRC brc, union D_CHCR chcr) {
-    static  int32_t size = 0;
-    static uint32_t header, next, address;
+    // madr follows the transfer in request mode, brc counts down to zero
+    dma.DMA2_GPU.MADR->base_address = address & DMA_RAM_MASK;
+    dma.DMA2_GPU.BRC->BA = 0;
 
-    if (!gpustat_dma_data_request())
-        return;
-
-    if (!gpustat_ready_recieve_dma_block())
-        return;
+    return words + DMA_CHANNEL_OVERHEAD;
+}
 
-    if (!dma.accessing_memory) {
-        dma.accessing_memory = true;
-        next    = madr.base_address;
-    }
+uint32_t dma_gpu_linked_list(union D_MADR madr, union D_BRC brc, union D_CHCR chcr) {
+    if (!gpustat_dma_data_request() || !gpustat_ready_recieve_dma_block())
+        return 0;
 
-    if (size == 0) {
-        // move to next packet
-        address = next;
+    uint32_t cycles  = DMA_CHANNEL_OVERHEAD;
+    uint32_t address = madr.base_address;
 
-        // check for terminator
-        if (address == 0XFFFFFF) {
-            dma.DMA2_GPU.CHCR->start_busy = 0;
-            dma.accessing_memory = false;
-            return;
-        }
+    // bit 23 marks the end, the bios uses 0XFFFFFF
+    for (uint32_t packets = 0; !(address & 0X800000) && packets < DMA_LINKED_LIST_MAX; packets++) {
+        uint32_t header = dma_ram_load(address);
+        uint32_t size   = (header >> 24) & 0X000000FF;
 
-        // get packet header
-        memory_cpu_load_32bit(address, &header);
-        next = (header >>  0) & 0X00FFFFFF;
-        size = (header >> 24) & 0X000000FF;
+        dma_ram_to_gp0(address + 4, size, +4);
 
-        // skip packet header
-        address += 4;
-    } else {
-        uint32_t command;
+        cycles += size + 1;
+        address = header & 0X00FFFFFF;
+    }
 
-        memory_cpu_load_32bit(address, &command);  // read ram bytes
-        memory_cpu_store_32bit(ADDR_GP0, command); // send to gpu 
+    dma.DMA2_GPU.MADR->base_address = 0XFFFFFF;
+    return cycles;
+}
 
-        address += 4;
-        size    -= 1;
+uint32_t dma_otc_manual(union D_MADR madr, union D_BRC brc, union D_CHCR chcr) {
+    // no$psx docs "automatically cleared on beginning of transfer"
+    if (!chcr.start_trigger)
+        return 0;
+    
+    if (chcr.transfer_direction == RAM_TO_DEV) {
+        set_PSX_error(UNSUPPORTED_DMA_TRANSFER_DIRECTION);
+        return DMA_CHANNEL_OVERHEAD;
     }
-}
 
-void dma_otc_manual(union D_MADR madr, union D_BRC brc, union D_CHCR chcr) {
-    static  int32_t step, size;
-    static uint32_t address;
-    // if dma has just started, load all new values 
-    // for further clock cycles 
-    if (!chcr.start_trigger && !dma.accessing_memory)
-        return;
+    // a count of zero is the maximum
+    uint32_t size    = (brc.BC == 0) ? 0X10000: brc.BC;
+    uint32_t address = madr.base_address & DMA_RAM_MASK;
 
-    if (!dma.accessing_memory) {
-        dma.accessing_memory = true;
+    // each entry links to the one below it, the last one terminates the table
+    for (uint32_t i = 1; i < size; i++, address -= 4)
+        dma_ram_store(address, (address - 4) & DMA_RAM_MASK);
+    dma_ram_store(address, 0XFFFFFF);
 
-        size    = brc.BC;
-        address = madr.base_address;
+    memory_ram_written(address, size * 4);
 
-        step = (chcr.address_step) ? -4: +4;
-        
-        // no$psx docs "automatically cleared on beginning of transfer"
-        dma.DMA6_OTC.CHCR->start_trigger = 0;
-    }
-    
-    switch(chcr.transfer_direction) {
-        case RAM_TO_DEV: set_PSX_error(UNSUPPORTED_DMA_TRANSFER_DIRECTION); break;
-        case DEV_TO_RAM: 
-            if (size <= 1) {
-                // set last double word as the terminator
-                memory_cpu_store_32bit(address, 0XFFFFFF);
-                
-                // let system know dma transfer completed
-                dma.DMA6_OTC.MADR->base_address = 0XFFFFFF;
-                dma.DMA6_OTC.CHCR->start_busy = 0;
-
-                // dma.DPRC->otc_enable = DISABLE;
-                // free bus for cpu
-                dma.accessing_memory = 0;
-            } else {
-                memory_cpu_store_32bit(address, address - 4);
-                address += step;
-                size -= 1;
-            }
-            break;
-    }
+    // let system know dma transfer completed
+    dma.DMA6_OTC.MADR->base_address = 0XFFFFFF;
+    return size + DMA_CHANNEL_OVERHEAD;
 }
-
@@ -0,0 +1,563 @@
+#include "dynarec.h"
+
+#if defined(__x86_64__)
+
+#include <stddef.h>
+#include <sys/mman.h>
+
+/* Translates the blocks decoded by the cached interpreter into x86-64 code.                    *
+ * Simple ALU, shift, jump and branch instructions are emitted inline, everything else calls    *
+ * the interpreter function with cpu.PC and cpu.instruction set, so COP0, GTE, loads, stores    *
+ * and exceptions keep a single implementation.                                                 *
+ *                                                                                              *
+ * A translated block behaves exactly like one run of the cached interpreter loop               *
+ *  - cpu_load_delay is called for the first two instructions and the two following any        *
+ *    instruction that can start a load delay, the slots are empty everywhere else             *
+ *  - branches go straight to TRANSFER, as cpu_branch_delay would before the delay slot        *
+ *  - an interpreter function moving the PC (exception) or dropping cached code leaves the     *
+ *    block, with the PC advanced as cpu_step would                                            *
+ *                                                                                              *
+ * The most used guest registers of a block live in callee saved host registers, they are      *
+ * loaded on first use and written back before every call and at the block exits.              */
+
+// host registers, numbered as in the instruction encoding
+enum HOST_REGISTER {
+    EAX = 0, ECX = 1, EDX = 2, EBX = 3, ESP = 4, EBP = 5, ESI = 6, EDI = 7,
+    R8  = 8, R9  = 9, R10 = 10, R11 = 11, R12 = 12, R13 = 13, R14 = 14, R15 = 15
+};
+
+// "op eax, r/m32" opcodes, the "op eax, imm32" form is the opcode + 2
+enum HOST_ALU {
+    ALU_ADD = 0X03,
+    ALU_OR  = 0X0B,
+    ALU_AND = 0X23,
+    ALU_SUB = 0X2B,
+    ALU_XOR = 0X33,
+    ALU_CMP = 0X3B
+};
+
+// shift group extensions
+enum HOST_SHIFT {
+    SHIFT_SHL = 4,
+    SHIFT_SHR = 5,
+    SHIFT_SAR = 7
+};
+
+// condition codes for jcc (0X0F 0X8x) and setcc (0X0F 0X9x)
+enum HOST_CONDITION {
+    CC_B  = 0X2,
+    CC_E  = 0X4,
+    CC_NE = 0X5,
+    CC_L  = 0XC,
+    CC_LE = 0XE,
+    CC_G  = 0XF
+};
+
+struct HOST_ALLOCATION {
+    uint32_t guest;
+    bool loaded;
+    bool dirty;
+};
+
+// a jump out of the block after instruction number executed - 1
+struct DYNAREC_EXIT {
+    uint8_t *patch;
+    uint32_t executed;
+};
+
+static struct {
+    uint8_t *code;
+    uint8_t *emit;
+
+    struct HOST_ALLOCATION allocation[DYNAREC_HOST_REGISTERS];
+    uint32_t allocated;
+
+    struct DYNAREC_EXIT exits[CPU_CACHE_BLOCK_MAX * 2];
+    uint32_t exit_count;
+} dynarec;
+
+static const uint8_t host_registers[DYNAREC_HOST_REGISTERS] = {EBX, R12, R13, R14, R15};
+
+#define CPU_OFFSET(field) ((int32_t) offsetof(struct CPU, field))
+#define REG_OFFSET(r)     (CPU_OFFSET(R) + 4 * (int32_t) (r))
+
+// block translation
+static void dynarec_allocate(struct CACHED_BLOCK *block);
+static bool dynarec_native(union INSTRUCTION instruction);
+static bool dynarec_starts_load(union INSTRUCTION instruction);
+static void dynarec_emit_native(union INSTRUCTION instruction, uint32_t pc, bool last);
+static void dynarec_emit_call(void (*execute)(void), union INSTRUCTION instruction, uint32_t pc, uint32_t executed, bool last);
+static void dynarec_emit_branch(uint32_t target, bool last);
+
+// guest register access
+static int  guest_host(uint32_t guest);
+static void guest_load(int allocation);
+static void guest_read(uint8_t host, uint32_t guest);
+static void guest_alu(uint8_t op, uint32_t guest);
+static void guest_write(uint32_t guest);
+static void guest_flush(void);
+
+// x86-64 encoding
+static void emit8(uint8_t value);
+static void emit32(uint32_t value);
+static void emit64(uint64_t value);
+static void emit_rex(bool wide, uint8_t reg, uint8_t rm);
+static void emit_mov_reg_cpu(uint8_t host, int32_t offset);
+static void emit_mov_cpu_reg(int32_t offset, uint8_t host);
+static void emit_mov_cpu_imm(int32_t offset, uint32_t imm);
+static void emit_mov_reg_reg(uint8_t dst, uint8_t src);
+static void emit_mov_reg_imm(uint8_t dst, uint32_t imm);
+static void emit_alu_eax_imm(uint8_t op, uint32_t imm);
+static void emit_shift_eax(uint8_t shift, int32_t amount);
+static void emit_setcc_eax(uint8_t condition);
+static void emit_call(void *function);
+static uint8_t *emit_jcc(uint8_t condition);
+static void emit_patch(uint8_t *patch, uint8_t *target);
+
+bool dynarec_supported(void) {
+    return true;
+}
+
+bool dynarec_full(void) {
+    return dynarec.code == NULL || dynarec.emit + DYNAREC_BLOCK_BYTES > dynarec.code + DYNAREC_CODE_SIZE;
+}
+
+void dynarec_reset(void) {
+    if (dynarec.code == NULL) {
+        dynarec.code = mmap(NULL, DYNAREC_CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (dynarec.code == MAP_FAILED) {
+            print_dynarec_error("dynarec_reset", "Cannot map %d bytes for host code", DYNAREC_CODE_SIZE);
+            exit(1);
+        }
+    }
+    dynarec.emit = dynarec.code;
+}
+
+uint32_t (*dynarec_compile(struct CACHED_BLOCK *block, uint32_t address))(void) {
+    uint8_t *entry = dynarec.emit;
+
+    dynarec_allocate(block);
+    dynarec.exit_count = 0;
+
+    // push rbp, rbx, r12-r15, keep the stack 16 byte aligned for calls
+    emit8(0X55); emit8(0X53);
+    emit8(0X41); emit8(0X54);
+    emit8(0X41); emit8(0X55);
+    emit8(0X41); emit8(0X56);
+    emit8(0X41); emit8(0X57);
+    emit8(0X48); emit8(0X83); emit8(0XEC); emit8(0X08);
+
+    // mov rbp, &cpu
+    emit8(0X48); emit8(0XB8 + EBP); emit64((uintptr_t) get_cpu());
+
+    uint32_t load_delay_until = 1;
+    for (uint32_t i = 0; i < block->length; i++) {
+        union INSTRUCTION instruction = block->instructions[i].instruction;
+        uint32_t pc = address + (i << 2);
+        bool last = i == block->length - 1;
+        bool called = false;
+
+        if (i <= load_delay_until) {
+            guest_flush();
+            emit_call((void *) cpu_load_delay);
+            called = true;
+        }
+
+        if (dynarec_native(instruction)) {
+            dynarec_emit_native(instruction, pc, last);
+        } else {
+            dynarec_emit_call(block->instructions[i].execute, instruction, pc, i + 1, last);
+            called = true;
+
+            if (dynarec_starts_load(instruction))
+                load_delay_until = i + 2;
+        }
+
+        // the load delay or the interpreter can leave a value in R0
+        if (called)
+            emit_mov_cpu_imm(REG_OFFSET(0), 0);
+    }
+
+    guest_flush();
+    emit_mov_cpu_imm(CPU_OFFSET(PC), address + (block->length << 2));
+    emit_mov_cpu_imm(CPU_OFFSET(instruction), block->instructions[block->length - 1].instruction.value);
+    emit_mov_reg_imm(EAX, block->length);
+
+    uint8_t *epilogue = dynarec.emit;
+    emit8(0X48); emit8(0X83); emit8(0XC4); emit8(0X08);
+    emit8(0X41); emit8(0X5F);
+    emit8(0X41); emit8(0X5E);
+    emit8(0X41); emit8(0X5D);
+    emit8(0X41); emit8(0X5C);
+    emit8(0X5B); emit8(0X5D);
+    emit8(0XC3);
+
+    // early exits, guest registers were written back before the call
+    for (uint32_t i = 0; i < dynarec.exit_count; i++) {
+        emit_patch(dynarec.exits[i].patch, dynarec.emit);
+
+        // add dword [rbp + PC], 4
+        emit8(0X81); emit8(0X80 | EBP); emit32(CPU_OFFSET(PC)); emit32(4);
+        emit_mov_reg_imm(EAX, dynarec.exits[i].executed);
+
+        emit8(0XE9); emit32(0);
+        emit_patch(dynarec.emit - 4, epilogue);
+    }
+
+    assert(dynarec.emit <= entry + DYNAREC_BLOCK_BYTES);
+    return (uint32_t (*)(void)) (void *) entry;
+}
+
+// block translation
+void dynarec_allocate(struct CACHED_BLOCK *block) {
+    uint32_t uses[32] = {0};
+
+    for (uint32_t i = 0; i < block->length; i++) {
+        union INSTRUCTION instruction = block->instructions[i].instruction;
+        if (!dynarec_native(instruction))
+            continue;
+
+        switch (instruction.op) {
+            case 0X00: uses[instruction.rs]++; uses[instruction.rt]++; uses[instruction.rd]++; break;
+            case 0X02: break;
+            case 0X03: uses[31]++; break;
+            default:   uses[instruction.rs]++; uses[instruction.rt]++; break;
+        }
+    }
+
+    // R0 always goes through memory, see dynarec_compile
+    uses[0] = 0;
+
+    dynarec.allocated = 0;
+    while (dynarec.allocated < DYNAREC_HOST_REGISTERS) {
+        uint32_t best = 0;
+        for (uint32_t r = 1; r < 32; r++) {
+            if (uses[r] > uses[best])
+                best = r;
+        }
+        if (uses[best] == 0)
+            break;
+
+        dynarec.allocation[dynarec.allocated++] = (struct HOST_ALLOCATION) {.guest = best};
+        uses[best] = 0;
+    }
+}
+
+bool dynarec_native(union INSTRUCTION instruction) {
+    switch (instruction.op) {
+        case 0X00:
+            switch (instruction.funct) {
+                case 0X00: case 0X02: case 0X03:            // SLL, SRL, SRA
+                case 0X04: case 0X06: case 0X07:            // SLLV, SRLV, SRAV
+                case 0X08:                                  // JR
+                case 0X21: case 0X23:                       // ADDU, SUBU
+                case 0X24: case 0X25: case 0X26: case 0X27: // AND, OR, XOR, NOR
+                case 0X2A: case 0X2B:                       // SLT, SLTU
+                    return true;
+            }
+            return false;
+        case 0X02: case 0X03:                               // J, JAL
+        case 0X04: case 0X05: case 0X06: case 0X07:         // BEQ, BNE, BLEZ, BGTZ
+        case 0X09: case 0X0A: case 0X0B:                    // ADDIU, SLTI, SLTIU
+        case 0X0C: case 0X0D: case 0X0E: case 0X0F:         // ANDI, ORI, XORI, LUI
+            return true;
+    }
+    return false;
+}
+
+bool dynarec_starts_load(union INSTRUCTION instruction) {
+    // loads, and coprocessor moves which go through the load delay slots
+    return (instruction.op >= 0X20 && instruction.op <= 0X26) || (instruction.op >= 0X10 && instruction.op <= 0X13);
+}
+
+void dynarec_emit_native(union INSTRUCTION instruction, uint32_t pc, bool last) {
+    uint8_t *skip;
+
+    switch (instruction.op) {
+        case 0X00:
+            switch (instruction.funct) {
+                case 0X00: case 0X02: case 0X03:
+                    if (instruction.rd == 0)
+                        break;
+                    guest_read(EAX, instruction.rt);
+                    if (instruction.shamt != 0) {
+                        uint8_t shift = (instruction.funct == 0X00) ? SHIFT_SHL: (instruction.funct == 0X02) ? SHIFT_SHR: SHIFT_SAR;
+                        emit_shift_eax(shift, instruction.shamt);
+                    }
+                    guest_write(instruction.rd);
+                    break;
+                case 0X04: case 0X06: case 0X07:
+                    if (instruction.rd == 0)
+                        break;
+                    // the host masks the shift amount to 5 bits like the interpreter
+                    guest_read(ECX, instruction.rs);
+                    guest_read(EAX, instruction.rt);
+                    emit_shift_eax((instruction.funct == 0X04) ? SHIFT_SHL: (instruction.funct == 0X06) ? SHIFT_SHR: SHIFT_SAR, -1);
+                    guest_write(instruction.rd);
+                    break;
+                case 0X08:
+                    guest_read(EAX, instruction.rs);
+                    emit_mov_cpu_reg(CPU_OFFSET(branch.value), EAX);
+                    emit_mov_cpu_imm(CPU_OFFSET(branch.stage), last ? DELAY: TRANSFER);
+                    break;
+                case 0X21: case 0X23: case 0X24: case 0X25: case 0X26: case 0X27: {
+                    if (instruction.rd == 0)
+                        break;
+                    static const uint8_t ops[] = {ALU_ADD, 0, ALU_SUB, ALU_AND, ALU_OR, ALU_XOR, ALU_OR};
+                    guest_read(EAX, instruction.rs);
+                    guest_alu(ops[instruction.funct - 0X21], instruction.rt);
+                    if (instruction.funct == 0X27) {
+                        emit8(0XF7); emit8(0XD0); // not eax
+                    }
+                    guest_write(instruction.rd);
+                    break;
+                }
+                case 0X2A: case 0X2B:
+                    if (instruction.rd == 0)
+                        break;
+                    guest_read(EAX, instruction.rs);
+                    guest_alu(ALU_CMP, instruction.rt);
+                    emit_setcc_eax((instruction.funct == 0X2A) ? CC_L: CC_B);
+                    guest_write(instruction.rd);
+                    break;
+            }
+            break;
+        case 0X03:
+            emit_mov_reg_imm(EAX, pc + 8);
+            guest_write(31);
+            // fallthrough
+        case 0X02:
+            dynarec_emit_branch((pc & 0XF0000000) + (instruction.target << 2), last);
+            break;
+        case 0X04: case 0X05:
+            guest_read(EAX, instruction.rs);
+            guest_alu(ALU_CMP, instruction.rt);
+            skip = emit_jcc((instruction.op == 0X04) ? CC_NE: CC_E);
+            dynarec_emit_branch(pc + 4 + (sign16(instruction.immediate16) << 2), last);
+            emit_patch(skip, dynarec.emit);
+            break;
+        case 0X06: case 0X07:
+            guest_read(EAX, instruction.rs);
+            emit_alu_eax_imm(ALU_CMP, 0);
+            skip = emit_jcc((instruction.op == 0X06) ? CC_G: CC_LE);
+            dynarec_emit_branch(pc + 4 + (sign16(instruction.immediate16) << 2), last);
+            emit_patch(skip, dynarec.emit);
+            break;
+        case 0X09: case 0X0A: case 0X0B: case 0X0C: case 0X0D: case 0X0E:
+            if (instruction.rt == 0)
+                break;
+            guest_read(EAX, instruction.rs);
+            switch (instruction.op) {
+                case 0X09: emit_alu_eax_imm(ALU_ADD, sign16(instruction.immediate16)); break;
+                case 0X0A: emit_alu_eax_imm(ALU_CMP, sign16(instruction.immediate16)); emit_setcc_eax(CC_L); break;
+                case 0X0B: emit_alu_eax_imm(ALU_CMP, sign16(instruction.immediate16)); emit_setcc_eax(CC_B); break;
+                case 0X0C: emit_alu_eax_imm(ALU_AND, instruction.immediate16); break;
+                case 0X0D: emit_alu_eax_imm(ALU_OR,  instruction.immediate16); break;
+                case 0X0E: emit_alu_eax_imm(ALU_XOR, instruction.immediate16); break;
+            }
+            guest_write(instruction.rt);
+            break;
+        case 0X0F:
+            if (instruction.rt == 0)
+                break;
+            emit_mov_reg_imm(EAX, instruction.immediate16 << 16);
+            guest_write(instruction.rt);
+            break;
+    }
+}
+
+void dynarec_emit_call(void (*execute)(void), union INSTRUCTION instruction, uint32_t pc, uint32_t executed, bool last) {
+    guest_flush();
+    emit_mov_cpu_imm(CPU_OFFSET(instruction), instruction.value);
+    emit_mov_cpu_imm(CPU_OFFSET(PC), pc);
+    emit_call((void *) execute);
+
+    // an exception moved the PC
+    emit8(0X81); emit8(0X80 | (7 << 3) | EBP); emit32(CPU_OFFSET(PC)); emit32(pc);
+    dynarec.exits[dynarec.exit_count++] = (struct DYNAREC_EXIT) {.patch = emit_jcc(CC_NE), .executed = executed};
+
+    // a store, SWC2 included, dropped cached code, the rest of the block may be stale
+    if ((instruction.op >= 0X28 && instruction.op <= 0X2E) || instruction.op == 0X3A) {
+        emit8(0X80); emit8(0X80 | (7 << 3) | EBP); emit32(CPU_OFFSET(cache_invalidated)); emit8(0);
+        dynarec.exits[dynarec.exit_count++] = (struct DYNAREC_EXIT) {.patch = emit_jcc(CC_NE), .executed = executed};
+    }
+
+    // JALR, BcondZ, move a taken branch on to TRANSFER unless the delay slot is in the next block
+    if (cpu_decode_branch(instruction) && !last) {
+        emit8(0X81); emit8(0X80 | (7 << 3) | EBP); emit32(CPU_OFFSET(branch.stage)); emit32(DELAY);
+        uint8_t *skip = emit_jcc(CC_NE);
+        emit_mov_cpu_imm(CPU_OFFSET(branch.stage), TRANSFER);
+        emit_patch(skip, dynarec.emit);
+    }
+}
+
+void dynarec_emit_branch(uint32_t target, bool last) {
+    emit_mov_cpu_imm(CPU_OFFSET(branch.value), target);
+    emit_mov_cpu_imm(CPU_OFFSET(branch.stage), last ? DELAY: TRANSFER);
+}
+
+// guest register access
+int guest_host(uint32_t guest) {
+    for (uint32_t i = 0; i < dynarec.allocated; i++) {
+        if (dynarec.allocation[i].guest == guest)
+            return i;
+    }
+    return -1;
+}
+
+void guest_load(int allocation) {
+    struct HOST_ALLOCATION *a = &dynarec.allocation[allocation];
+    if (!a->loaded) {
+        emit_mov_reg_cpu(host_registers[allocation], REG_OFFSET(a->guest));
+        a->loaded = true;
+    }
+}
+
+void guest_read(uint8_t host, uint32_t guest) {
+    int allocation = guest_host(guest);
+    if (allocation < 0) {
+        emit_mov_reg_cpu(host, REG_OFFSET(guest));
+        return;
+    }
+    guest_load(allocation);
+    emit_mov_reg_reg(host, host_registers[allocation]);
+}
+
+void guest_alu(uint8_t op, uint32_t guest) {
+    int allocation = guest_host(guest);
+    if (allocation < 0) {
+        // op eax, [rbp + R]
+        emit8(op); emit8(0X80 | (EAX << 3) | EBP); emit32(REG_OFFSET(guest));
+        return;
+    }
+    guest_load(allocation);
+    uint8_t host = host_registers[allocation];
+    emit_rex(false, EAX, host);
+    emit8(op); emit8(0XC0 | (EAX << 3) | (host & 7));
+}
+
+void guest_write(uint32_t guest) {
+    // writes to R0 are dropped, it is reset after every instruction anyway
+    if (guest == 0)
+        return;
+
+    int allocation = guest_host(guest);
+    if (allocation < 0) {
+        emit_mov_cpu_reg(REG_OFFSET(guest), EAX);
+        return;
+    }
+    emit_mov_reg_reg(host_registers[allocation], EAX);
+    dynarec.allocation[allocation].loaded = true;
+    dynarec.allocation[allocation].dirty  = true;
+}
+
+void guest_flush(void) {
+    for (uint32_t i = 0; i < dynarec.allocated; i++) {
+        struct HOST_ALLOCATION *a = &dynarec.allocation[i];
+        if (a->dirty)
+            emit_mov_cpu_reg(REG_OFFSET(a->guest), host_registers[i]);
+        a->loaded = false;
+        a->dirty  = false;
+    }
+}
+
+// x86-64 encoding
+void emit8(uint8_t value) {
+    *dynarec.emit++ = value;
+}
+
+void emit32(uint32_t value) {
+    memcpy(dynarec.emit, &value, 4);
+    dynarec.emit += 4;
+}
+
+void emit64(uint64_t value) {
+    memcpy(dynarec.emit, &value, 8);
+    dynarec.emit += 8;
+}
+
+void emit_rex(bool wide, uint8_t reg, uint8_t rm) {
+    uint8_t rex = 0X40 | (wide << 3) | ((reg >> 3) << 2) | (rm >> 3);
+    if (rex != 0X40)
+        emit8(rex);
+}
+
+void emit_mov_reg_cpu(uint8_t host, int32_t offset) {
+    emit_rex(false, host, EBP);
+    emit8(0X8B); emit8(0X80 | ((host & 7) << 3) | EBP); emit32(offset);
+}
+
+void emit_mov_cpu_reg(int32_t offset, uint8_t host) {
+    emit_rex(false, host, EBP);
+    emit8(0X89); emit8(0X80 | ((host & 7) << 3) | EBP); emit32(offset);
+}
+
+void emit_mov_cpu_imm(int32_t offset, uint32_t imm) {
+    emit8(0XC7); emit8(0X80 | EBP); emit32(offset); emit32(imm);
+}
+
+void emit_mov_reg_reg(uint8_t dst, uint8_t src) {
+    emit_rex(false, src, dst);
+    emit8(0X89); emit8(0XC0 | ((src & 7) << 3) | (dst & 7));
+}
+
+void emit_mov_reg_imm(uint8_t dst, uint32_t imm) {
+    emit_rex(false, 0, dst);
+    emit8(0XB8 + (dst & 7)); emit32(imm);
+}
+
+void emit_alu_eax_imm(uint8_t op, uint32_t imm) {
+    emit8(op + 2); emit32(imm);
+}
+
+void emit_shift_eax(uint8_t shift, int32_t amount) {
+    // a negative amount shifts by cl
+    if (amount < 0) {
+        emit8(0XD3); emit8(0XC0 | (shift << 3) | EAX);
+    } else {
+        emit8(0XC1); emit8(0XC0 | (shift << 3) | EAX); emit8(amount);
+    }
+}
+
+void emit_setcc_eax(uint8_t condition) {
+    // setcc al, movzx eax, al
+    emit8(0X0F); emit8(0X90 | condition); emit8(0XC0);
+    emit8(0X0F); emit8(0XB6); emit8(0XC0);
+}
+
+void emit_call(void *function) {
+    // mov rax, function, call rax
+    emit8(0X48); emit8(0XB8); emit64((uintptr_t) function);
+    emit8(0XFF); emit8(0XD0);
+}
+
+uint8_t *emit_jcc(uint8_t condition) {
+    emit8(0X0F); emit8(0X80 | condition); emit32(0);
+    return dynarec.emit - 4;
+}
+
+void emit_patch(uint8_t *patch, uint8_t *target) {
+    int32_t relative = (int32_t) (target - (patch + 4));
+    memcpy(patch, &relative, 4);
+}
+
+#else
+
+// other hosts only have the interpreters
+
+bool dynarec_supported(void) {
+    return false;
+}
+
+bool dynarec_full(void) {
+    return false;
+}
+
+void dynarec_reset(void) {}
+
+uint32_t (*dynarec_compile(struct CACHED_BLOCK *block, uint32_t address))(void) {
+    print_dynarec_error("dynarec_compile", "No recompiler for this host", NULL);
+    exit(1);
+}
+
+#endif
@@ -12,6 +12,15 @@ static void get_PSX_error() {
         case BIOS_FILE_NOT_FOUND:  error_msg = "BIOS_FILE_NOT_FOUND"; break;
         case BIOS_FILE_UNREADABLE: error_msg = "BIOS_FILE_UNREADABLE"; break;
         case MEMORY_CPU_UNMAPPED_ADDRESS: error_msg = "MEMORY_CPU_UNMAPPED_ADDRESS"; break;
+        // SAVESTATE
+        case SAVESTATE_FILE_NOT_FOUND:   error_msg = "SAVESTATE_FILE_NOT_FOUND"; break;
+        case SAVESTATE_FILE_UNREADABLE:  error_msg = "SAVESTATE_FILE_UNREADABLE"; break;
+        case SAVESTATE_INVALID:          error_msg = "SAVESTATE_INVALID"; break;
+        case SAVESTATE_VERSION_MISMATCH: error_msg = "SAVESTATE_VERSION_MISMATCH"; break;
+        // EXE
+        case EXE_FILE_NOT_FOUND:  error_msg = "EXE_FILE_NOT_FOUND"; break;
+        case EXE_FILE_UNREADABLE: error_msg = "EXE_FILE_UNREADABLE"; break;
+        case EXE_INVALID:         error_msg = "EXE_INVALID"; break;
         default: error_msg = "UNEXPECTED ERROR"; break;
     }
 }
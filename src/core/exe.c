@@ -0,0 +1,86 @@
+#include "exe.h"
+
+static struct EXE exe;
+
+// load helpers
+static bool exe_in_ram(uint32_t address, uint32_t size);
+
+struct EXE *get_exe(void) { return &exe; }
+
+PSX_ERROR exe_load(const char *path) {
+    FILE *fp;
+
+    if ((fp = fopen(path, "rb")) == NULL)
+        return set_PSX_error(EXE_FILE_NOT_FOUND);
+
+    if (fread(&exe.header, 1, sizeof(exe.header), fp) != sizeof(exe.header) ||
+        memcmp(exe.header.magic, EXE_MAGIC, sizeof(exe.header.magic)) != 0) {
+        fclose(fp);
+        return set_PSX_error(EXE_INVALID);
+    }
+
+    if (exe.header.text_size == 0 || !exe_in_ram(exe.header.text_address, exe.header.text_size) ||
+        (exe.header.bss_size != 0 && !exe_in_ram(exe.header.bss_address, exe.header.bss_size))) {
+        fclose(fp);
+        return set_PSX_error(EXE_INVALID);
+    }
+
+    free(exe.text);
+    if ((exe.text = malloc(exe.header.text_size)) == NULL) {
+        print_exe_error("exe_load", "Cannot allocate %u bytes", exe.header.text_size);
+        exit(1);
+    }
+
+    // the size is a multiple of 2K in the header, the file may end before it
+    memset(exe.text, 0, exe.header.text_size);
+    if (fseek(fp, EXE_HEADER_SIZE, SEEK_SET) != 0 || fread(exe.text, 1, exe.header.text_size, fp) == 0) {
+        fclose(fp);
+        return set_PSX_error(EXE_FILE_UNREADABLE);
+    }
+    fclose(fp);
+
+    exe.pending = true;
+    return set_PSX_error(NO_ERROR);
+}
+
+void exe_boot(void) {
+    // called once the bios reaches the shell
+    if (!exe.pending)
+        return;
+
+    struct CPU *cpu = get_cpu();
+    uint8_t *ram = get_memory()->MAIN.mem;
+    uint32_t text = exe.header.text_address & 0X1FFFFF;
+    uint32_t bss  = exe.header.bss_address  & 0X1FFFFF;
+
+    memcpy(ram + text, exe.text, exe.header.text_size);
+    memory_ram_written(text, exe.header.text_size);
+    if (exe.header.bss_size != 0) {
+        memset(ram + bss, 0, exe.header.bss_size);
+        memory_ram_written(bss, exe.header.bss_size);
+    }
+
+    // jump straight to the exe instead of the shell
+    cpu->branch.stage = UNUSED;
+    cpu->branch.value = 0;
+    cpu->PC    = exe.header.pc;
+    cpu->R[28] = exe.header.gp;
+    if (exe.header.stack_base != 0) {
+        cpu->R[29] = exe.header.stack_base + exe.header.stack_offset;
+        cpu->R[30] = exe.header.stack_base + exe.header.stack_offset;
+    }
+
+    printf("[LOG]: exe loaded at 0X%08X, %u bytes, entry 0X%08X\n", exe.header.text_address, exe.header.text_size, exe.header.pc);
+
+    free(exe.text);
+    exe.text    = NULL;
+    exe.pending = false;
+}
+
+// load helpers
+
+bool exe_in_ram(uint32_t address, uint32_t size) {
+    // kuseg, kseg0 or kseg1 addresses inside the 2M of ram
+    uint32_t physical = address & 0X1FFFFFFF;
+    return physical < sizeof(MEM_MAIN) && size <= sizeof(MEM_MAIN) - physical;
+}
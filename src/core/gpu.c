@@ -1,37 +1,59 @@
 #include "gpu.h"
+#include "interrupts.h"
+#include "gpu_thread.h"
+#include "pacer.h"
 
 static struct GPU gpu;
 
-// GPU command fifo helpers
-static int                   fifo_len(void);
-static bool                  fifo_full(void);
-static bool                  fifo_empty(void);
-static void                  reset_fifo(void);
-static union COMMAND_PACKET *push_fifo(void);
-static union COMMAND_PACKET  peek_fifo(void);
-static union COMMAND_PACKET  pop_fifo(void);
+// words in each gp0 command including the command word, polylines are the
+// length of their first segment and run on until the terminator
+static const uint8_t gp0_command_length[256] = {
+     1,  1,  3,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  // 00 misc, 02 fill rectangle
+     1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  // 10 misc
+     4,  4,  4,  4,  7,  7,  7,  7,  5,  5,  5,  5,  9,  9,  9,  9,  // 20 polygons, monochrome and textured
+     6,  6,  6,  6,  9,  9,  9,  9,  8,  8,  8,  8, 12, 12, 12, 12,  // 30 polygons, shaded
+     3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  // 40 lines, monochrome
+     4,  4,  4,  4,  4,  4,  4,  4,  4,  4,  4,  4,  4,  4,  4,  4,  // 50 lines, shaded
+     3,  3,  3,  3,  4,  4,  4,  4,  2,  2,  2,  2,  3,  3,  3,  3,  // 60 rectangles, variable and 1x1
+     2,  2,  2,  2,  3,  3,  3,  3,  2,  2,  2,  2,  3,  3,  3,  3,  // 70 rectangles, 8x8 and 16x16
+     4,  4,  4,  4,  4,  4,  4,  4,  4,  4,  4,  4,  4,  4,  4,  4,  // 80 vram to vram copy
+     4,  4,  4,  4,  4,  4,  4,  4,  4,  4,  4,  4,  4,  4,  4,  4,  // 90 vram to vram copy
+     3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  // A0 cpu to vram copy
+     3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  // B0 cpu to vram copy
+     3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  // C0 vram to cpu copy
+     3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  // D0 vram to cpu copy
+     1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  // E0 rendering attributes
+     1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  // F0 rendering attributes
+};
+
+// GP0 packet helpers
+static void     gpu_gp0_reset(void);
+static uint32_t gpu_gp0_collect(const uint32_t *words, uint32_t count);
+static uint32_t gpu_gp0_polyline(const uint32_t *words, uint32_t count);
+static void     gpu_gp0_dispatch(const uint32_t *packet);
+static void     gpu_gp0_render(const uint32_t *packet, uint32_t length);
 
 // gpu operation helpers
-static void gpu_tick(void);
-static void gpu_handle_gp0(void);
+static void gpu_scanline(uint64_t timestamp);
+static uint32_t gpu_cycles_per_scanline(void);
 static void gpu_handle_gp1(void);
 static void gpu_handle_memory_access(void);
 static void gpu_execute_op(void);
 static void gpu_set_mode(enum GPU_MODE mode);
 
 // gpu copy helpers
-static void gpu_copy_cpu_to_vram(void);
+static uint32_t gpu_copy_cpu_to_vram(const uint32_t *words, uint32_t count);
 static void gpu_copy_vram_to_cpu(void);
 
 // gp0 instructions
-static void GP0_NOP(union COMMAND_PACKET packet);
-static void GP0_DIRECT_VRAM_ACCESS(union COMMAND_PACKET packet);
-static void GP0_INTERRUPT_REQUEST(union COMMAND_PACKET packet);
-static void GP0_RENDER_POLYGONS(union COMMAND_PACKET packet);
-static void GP0_RENDER_LINES(union COMMAND_PACKET packet);
-static void GP0_RENDER_RECTANGLES(union COMMAND_PACKET packet);
-static void GP0_RENDERING_ATTRIBUTES(union COMMAND_PACKET packet);
-static void GP0_DISPLAY_CONTROL(union COMMAND_PACKET packet);
+static void GP0_NOP(const uint32_t *packet);
+static void GP0_DIRECT_VRAM_ACCESS(const uint32_t *packet);
+static void GP0_INTERRUPT_REQUEST(const uint32_t *packet);
+static void GP0_RENDER_POLYGONS(const uint32_t *packet);
+static void GP0_RENDER_LINES(const uint32_t *packet);
+static void GP0_RENDER_RECTANGLES(const uint32_t *packet);
+static void GP0_RENDERING_ATTRIBUTES(const uint32_t *packet);
+static void GP0_DISPLAY_CONTROL(const uint32_t *packet);
 
 // gp1 instructions
 static void GP1_RESET(union COMMAND_PACKET packet);
@@ -49,10 +71,10 @@ static void GP1_DISPLAY_INFO(union COMMAND_PACKET packet);
 
 // external interface
 struct GPU *get_gpu(void)   { return &gpu; }
-uint8_t *write_GP0(void)    { gpu_set_mode(GP0); return (uint8_t *) push_fifo(); }
+uint8_t *write_GP0(void)    { return (uint8_t *) &gpu.gp0.command.value; }
 uint8_t *write_GP1(void)    { gpu_set_mode(GP1); return (uint8_t *) &gpu.gp1.command.value; }
 uint8_t *read_GPUSTAT(void) { return (uint8_t *) &gpu.gpustat.value; }
-uint8_t *read_GPUREAD(void) { return (uint8_t *) &gpu.gpustat.value; }
+uint8_t *read_GPUREAD(void) { return (uint8_t *) &gpu.gpuread.value; }
 
 bool gpu_vram_write(void) { return gpu.vram_write; }
 
@@ -66,6 +88,15 @@ bool gpustat_ready_recieve_dma_block(void)    { return gpu.gpustat.ready_recieve
 uint32_t gpu_display_vram_x_start(void)       { return gpu.drawing_offset_x; }
 uint32_t gpu_display_vram_y_start(void)       { return gpu.drawing_offset_y; }
 
+uint32_t gpu_display_width(void) {
+    static const uint32_t widths[4] = { 256, 320, 512, 640 };
+    return (gpu.gpustat.horizontal_resolution_2) ? 368: widths[gpu.gpustat.horizontal_resolution_1];
+}
+
+uint32_t gpu_display_height(void) {
+    return (gpu.gpustat.vertical_resolution && gpu.gpustat.vertical_interlace) ? 480: 240;
+}
+
 void gpu_reset(void) {
     // set gpustat starting values
     gpu.gpustat.value = 0;
@@ -75,46 +106,70 @@ void gpu_reset(void) {
     gpu.gpustat.drawing_even_odd_interlace = ODD;
 
     // set gp0 and gp1 starting values
-    reset_fifo();
+    gpu_gp0_reset();
+
+    gpu.scanlines    = 0;
+    gpu.render_phase = RENDER;
+
+    scheduler_register(EVENT_SCANLINE, gpu_scanline);
+    scheduler_schedule(EVENT_SCANLINE, gpu_cycles_per_scanline());
 }
 
-void gpu_step(void) {
-    gpu_tick();
+void gpu_write_gp0(uint32_t word) {
+    gpu_gp0_write(&word, 1);
+}
+
+void gpu_gp0_write(const uint32_t *words, uint32_t count) {
+    // commands complete in the input are dispatched straight from it, only
+    // a command split across writes is collected into the packet buffer
+    while (count > 0) {
+        uint32_t used;
+        uint32_t length = gp0_command_length[words[0] >> 24];
+
+        if (gpu.copy.copying && gpu.copy.direction == CPU_TO_VRAM)
+            used = gpu_copy_cpu_to_vram(words, count);
+        else if (gpu.gp0.polyline)
+            used = gpu_gp0_polyline(words, count);
+        else if (gpu.gp0.count == 0 && count >= length) {
+            gpu_gp0_dispatch(words);
+            used = length;
+        }
+        else
+            used = gpu_gp0_collect(words, count);
 
+        words += used;
+        count -= used;
+    }
+
+    // the render thread sees the whole burst at once
+    if (gpu_thread_running())
+        gpu_thread_flush();
+}
+
+uint32_t gpu_read(void) {
+    gpu_execute();
+    return gpu.gpuread.value;
+}
+
+void gpu_render(const uint32_t *packet) {
+    // runs on the render thread when the gpu is threaded
+    switch (packet[0] >> 29) {
+        case 0X01: GP0_RENDER_POLYGONS(packet); break;
+        case 0X02: GP0_RENDER_LINES(packet); break;
+        case 0X03: GP0_RENDER_RECTANGLES(packet); break;
+        case 0X07: renderer_attribute(packet[0]); break;
+    }
+}
+
+void gpu_execute(void) {
     switch (gpu.current_mode) {
         case IDLE: break;
-        case GP0:  gpu_handle_gp0(); break;
+        case GP0:  break; // gp0 words are decoded as they are written
         case GP1:  gpu_handle_gp1(); break;
         case COPY: gpu_handle_memory_access(); break;
     }
 }
 
-void gpu_handle_gp0(void) {
-    gpu_set_mode(IDLE);
-    union COMMAND_PACKET command = peek_fifo();
-
-    switch (command.number) {
-        case 0X00: GP0_NOP(command); break;
-        case 0X01: 
-        case 0X02: 
-        case 0X80: 
-        case 0XA0: 
-        case 0XC0: GP0_DIRECT_VRAM_ACCESS(command); break;
-        case 0X1F: GP0_INTERRUPT_REQUEST(command); break;
-        case 0X03: break; // UNKNOWN
-        default:
-            switch (command.number >> 4) {
-                case 0X02: case 0X03: GP0_RENDER_POLYGONS(command); break;
-                case 0X04: case 0X05: GP0_RENDER_LINES(command); break;
-                case 0X06: case 0X07: GP0_RENDER_RECTANGLES(command); break;
-                case 0X0E:            GP0_RENDERING_ATTRIBUTES(command); break;
-                default:
-                    break;
-            }
-            break;
-    };
-}
-
 void gpu_handle_gp1(void) {
     gpu_set_mode(IDLE);
     union COMMAND_PACKET command = gpu.gp1.command;
@@ -139,45 +194,28 @@ void gpu_handle_gp1(void) {
 }
 
 void gpu_handle_memory_access(void) {
-    switch (gpu.copy.direction) {
-        case VRAM_TO_VRAM: exit(-1);
-        case VRAM_TO_CPU:  gpu_copy_vram_to_cpu(); break;
-        case CPU_TO_VRAM:  gpu_copy_cpu_to_vram(); break;
-    }
-    assert(fifo_empty());
+    // cpu to vram data arrives through gp0, only reads are driven from here
+    if (gpu.copy.direction == VRAM_TO_CPU)
+        gpu_copy_vram_to_cpu();
 }
 
-void gpu_tick(void) {
-    gpu.cycles++;
+void gpu_scanline(uint64_t timestamp) {
+    gpu.scanlines++;
+    gpu.render_phase = HBLANK;
 
-    switch (gpu.gpustat.video_mode) {
-        case NTSC60HZ: 
-            if (gpu.cycles > 3413) {
-                gpu.scanlines++;
-                gpu.cycles       = 0;
-                gpu.render_phase = HBLANK;
-            }
+    uint32_t scanlines = (gpu.gpustat.video_mode == PAL50HZ) ? GPU_PAL_SCANLINES: GPU_NTSC_SCANLINES;
+    if (gpu.scanlines >= scanlines) {
+        gpu.scanlines    = 0;
+        gpu.render_phase = VBLANK;
+        interrupts_request(IRQ_VBLANK);
+    }
 
-            if (gpu.scanlines > 263) {
-                gpu.scanlines    = 0;
-                gpu.cycles       = 0;
-                gpu.render_phase = VBLANK;
-            }
-            break;
-        case PAL50HZ: 
-            if (gpu.cycles > 3406) {
-                gpu.scanlines++;
-                gpu.cycles       = 0;
-                gpu.render_phase = HBLANK;
-            }
+    // relative to when the line was due, so late events do not drift
+    scheduler_schedule_at(EVENT_SCANLINE, timestamp + gpu_cycles_per_scanline());
+}
 
-            if (gpu.scanlines > 314) {
-                gpu.scanlines    = 0;
-                gpu.cycles       = 0;
-                gpu.render_phase = VBLANK;
-            }
-            break;
-    }
+uint32_t gpu_cycles_per_scanline(void) {
+    return (gpu.gpustat.video_mode == PAL50HZ) ? GPU_PAL_CYCLES_PER_SCANLINE: GPU_NTSC_CYCLES_PER_SCANLINE;
 }
 
 void gpu_set_mode(enum GPU_MODE mode) {
@@ -203,10 +241,6 @@ void gpu_set_mode(enum GPU_MODE mode) {
     }
 }
 
-bool gpu_wait_parameters(int param_num) {
-    return !(fifo_len() < param_num);
-}
-
 void gpu_copy_vram_to_cpu(void) {
     static uint32_t x, y;
     static uint32_t min_x, max_x;
@@ -254,590 +288,188 @@ void gpu_copy_vram_to_cpu(void) {
     gpu.gpuread.read = (top << 16) | bot;
 }
 
-void gpu_copy_cpu_to_vram(void) {
-    if (fifo_empty())
-        return;
+uint32_t gpu_copy_cpu_to_vram(const uint32_t *words, uint32_t count) {
+    uint32_t min_x = gpu.copy.d_x, max_x = gpu.copy.d_x + gpu.copy.d_w;
+    uint32_t max_y = gpu.copy.d_y + gpu.copy.d_h;
+    uint32_t first = gpu.copy.y;
+    uint32_t used  = 0;
 
-    static uint32_t x, y;
-    static uint32_t min_x, max_x;
-    static uint32_t min_y, max_y;
+    // each word carries two pixels, a row may end between them
+    while (used < count && gpu.copy.y < max_y) {
+        uint32_t data = words[used++];
 
-    if (!gpu.copy.copying) {
-        min_x = gpu.copy.d_x; 
-        max_x = gpu.copy.d_x + gpu.copy.d_w;
-        min_y = gpu.copy.d_y;
-        max_y = gpu.copy.d_y + gpu.copy.d_h;
-
-        x = min_x;
-        y = min_y;
+        for (int half = 0; half < 2 && gpu.copy.y < max_y; half++, data >>= 16) {
+            memory_gpu_store_16bit(VRAM_ADDRESS(gpu.copy.x, gpu.copy.y), data & 0XFFFF);
 
-        gpu.copy.copying = true;
+            if (++gpu.copy.x == max_x) {
+                gpu.copy.x = min_x;
+                gpu.copy.y++;
+            }
+        }
     }
 
-    uint32_t data = pop_fifo().value;
+    // lines touched by this part of the copy
+    renderer_vram_dirty(min_x, first, gpu.copy.d_w, gpu.copy.y - first + (gpu.copy.x != min_x));
 
-    if (y == max_y) {
+    if (gpu.copy.y == max_y) {
         gpu.copy.copying = false;
         gpu.vram_write = true;
-        gpu_set_mode(IDLE);
-        return;
     }
+    return used;
+}
 
-    uint16_t bot = (data >>  0) & 0XFFFF;
-    uint16_t top = (data >> 16) & 0XFFFF;
+// gp0 packet helpers
+void gpu_gp0_reset(void) {
+    gpu.gp0.length   = 0;
+    gpu.gp0.count    = 0;
+    gpu.gp0.polyline = false;
+}
 
-    uint32_t bot_address = VRAM_ADDRESS(x++, y);
+uint32_t gpu_gp0_collect(const uint32_t *words, uint32_t count) {
+    if (gpu.gp0.count == 0)
+        gpu.gp0.length = gp0_command_length[words[0] >> 24];
 
-    if (x == max_x) {
-        x = min_x;
-        y++;
-    }
+    uint32_t used = gpu.gp0.length - gpu.gp0.count;
+    if (used > count)
+        used = count;
 
-    uint32_t top_address = VRAM_ADDRESS(x++, y);
+    memcpy(&gpu.gp0.packet[gpu.gp0.count], words, used * sizeof(uint32_t));
+    gpu.gp0.count += used;
 
-    if (x == max_x) {
-        x = min_x;
-        y++;
+    if (gpu.gp0.count == gpu.gp0.length) {
+        gpu.gp0.count = 0;
+        gpu_gp0_dispatch(gpu.gp0.packet);
     }
-
-    memory_gpu_store_16bit(bot_address, bot);
-    memory_gpu_store_16bit(top_address, top);
+    return used;
 }
 
-// command fifo helpers
-void reset_fifo(void) {
-    gpu.gp0.fifo.head = 0;
-    gpu.gp0.fifo.tail = 0;
-    gpu.gp0.fifo.len  = 0;
+uint32_t gpu_gp0_polyline(const uint32_t *words, uint32_t count) {
+    // further vertices until the 5XXX5XXXh terminator
+    for (uint32_t i = 0; i < count; i++) {
+        if ((words[i] & 0XF000F000) == 0X50005000) {
+            gpu.gp0.polyline = false;
+            return i + 1;
+        }
+    }
+    return count;
 }
 
-int  fifo_len(void)   { return gpu.gp0.fifo.len; }
-bool fifo_full(void)  { return (gpu.gp0.fifo.len == FIFO_SIZE); }
-bool fifo_empty(void) { return (gpu.gp0.fifo.len == 0); }
+void gpu_gp0_dispatch(const uint32_t *packet) {
+    union COMMAND_PACKET command = { .value = packet[0] };
 
-union COMMAND_PACKET *push_fifo(void) {
-    assert(!fifo_full()); 
-    union COMMAND_PACKET *refrence = &gpu.gp0.fifo.commands[gpu.gp0.fifo.tail];
-    
-    // reserve the next command space 
-    // by incrementing the tail of fifo
-    gpu.gp0.fifo.tail++;
-    gpu.gp0.fifo.tail %= FIFO_SIZE;
-    gpu.gp0.fifo.len++;
-    
-    if (fifo_full())
-        gpu.gpustat.dma_data_request = FIFO_FULL;
+    switch (command.number >> 5) {
+        case 0X00:
+            switch (command.number) {
+                case 0X01:
+                case 0X02: GP0_DIRECT_VRAM_ACCESS(packet); break;
+                case 0X1F: GP0_INTERRUPT_REQUEST(packet); break;
+                default:   GP0_NOP(packet); break;
+            }
+            break;
+        case 0X01:
+        case 0X02:
+        case 0X03:
+            // polylines keep going past the first segment
+            if ((command.number >> 3) == 0X09 || (command.number >> 3) == 0X0B)
+                gpu.gp0.polyline = true;
+
+            // skipped frames still run the core, only the drawing is dropped
+            if (!pacer_skipping())
+                gpu_gp0_render(packet, gp0_command_length[command.number]);
+            break;
+        case 0X04:
+        case 0X05:
+        case 0X06: GP0_DIRECT_VRAM_ACCESS(packet); break;
+        case 0X07:
+            // the renderer keeps its own copy, ordered with the draws around it
+            GP0_RENDERING_ATTRIBUTES(packet);
+            gpu_gp0_render(packet, 1);
+            break;
+    }
+}
 
-    return refrence;
+void gpu_gp0_render(const uint32_t *packet, uint32_t length) {
+    if (gpu_thread_running()) gpu_thread_draw(packet, length);
+    else                      gpu_render(packet);
 }
 
-union COMMAND_PACKET peek_fifo(void) {
-    assert(!fifo_empty());
-    return gpu.gp0.fifo.commands[gpu.gp0.fifo.head];
+void gpu_vram_sync(void) {
+    // vram has to hold everything drawn so far before the core touches it
+    if (gpu_thread_running()) gpu_thread_sync();
+    else                      renderer_flush();
 }
 
-union COMMAND_PACKET pop_fifo(void) {
-    assert(!fifo_empty());
-    union COMMAND_PACKET command = gpu.gp0.fifo.commands[gpu.gp0.fifo.head];
+void gpu_restore(void) {
+    // the gpu and vram were replaced wholesale, hand the renderer the drawing
+    // attributes again as gp0(E1h..E6h) and have it upload all of vram
+    uint32_t attributes[6] = {
+        0XE1000000 | (gpu.gpustat.value & 0X7FF) | (gpu.gpustat.texture_disable << 11) |
+                     (gpu.texture_rectangle_x_flip << 12) | (gpu.texture_rectangle_y_flip << 13),
+        0XE2000000 | (gpu.texture_window_mask_x   <<  0) | (gpu.texture_window_mask_y   <<  5) |
+                     (gpu.texture_window_offset_x << 10) | (gpu.texture_window_offset_y << 15),
+        0XE3000000 | (gpu.drawing_area_left  << 0) | (gpu.drawing_area_top    << 10),
+        0XE4000000 | (gpu.drawing_area_right << 0) | (gpu.drawing_area_bottom << 10),
+        0XE5000000 | ((gpu.drawing_offset_x & 0X7FF) << 0) | ((gpu.drawing_offset_y & 0X7FF) << 11),
+        0XE6000000 | (gpu.gpustat.set_mask_when_drawing << 0) | (gpu.gpustat.draw_pixels << 1)
+    };
 
-    gpu.gp0.fifo.head++;
-    gpu.gp0.fifo.head %= FIFO_SIZE;
-    gpu.gp0.fifo.len--;
+    for (int i = 0; i < 6; i++)
+        gpu_gp0_render(&attributes[i], 1);
 
-    if (!fifo_full())
-        gpu.gpustat.dma_data_request = FIFO_NOT_FULL;
-    
-    return command;
+    renderer_vram_dirty(0, 0, 1024, 512);
 }
 
 // vram helpers
 static void VRAM_CLEAR_CACHE(void);
-static void VRAM_FILL_RECTANGLE(void);
+static void VRAM_FILL_RECTANGLE(const uint32_t *packet);
 static void VRAM_TO_VRAM_COPY_RECTANGLE(void);
-static void CPU_TO_VRAM_COPY_RECTANGLE(void);
-static void VRAM_TO_CPU_COPY_RECTANGLE(void);
+static void CPU_TO_VRAM_COPY_RECTANGLE(const uint32_t *packet);
+static void VRAM_TO_CPU_COPY_RECTANGLE(const uint32_t *packet);
 
 // rendering helpers
 // gp0 functions
-void GP0_NOP(union COMMAND_PACKET packet) {
-    if (!gpu_wait_parameters(1))
-        return;
-
-    pop_fifo();
-}
-void GP0_DIRECT_VRAM_ACCESS(union COMMAND_PACKET packet) {
-    switch(packet.number) {
-        case 0X01: VRAM_CLEAR_CACHE(); break;
-        case 0X02: VRAM_FILL_RECTANGLE(); break;
-        case 0X80: VRAM_TO_VRAM_COPY_RECTANGLE(); break;
-        case 0XA0: CPU_TO_VRAM_COPY_RECTANGLE(); break;
-        case 0XC0: VRAM_TO_CPU_COPY_RECTANGLE(); break;
+void GP0_NOP(const uint32_t *packet) {}
+void GP0_DIRECT_VRAM_ACCESS(const uint32_t *packet) {
+    switch(packet[0] >> 29) {
+        case 0X00: 
+            if ((packet[0] >> 24) == 0X01) VRAM_CLEAR_CACHE();
+            else                           VRAM_FILL_RECTANGLE(packet);
+            break;
+        case 0X04: VRAM_TO_VRAM_COPY_RECTANGLE(); break;
+        case 0X05: CPU_TO_VRAM_COPY_RECTANGLE(packet); break;
+        case 0X06: VRAM_TO_CPU_COPY_RECTANGLE(packet); break;
     }
 }
-void GP0_INTERRUPT_REQUEST(union COMMAND_PACKET packet) { print_gpu_error("GP0 INTERRUPT REQUEST", "Unimplemented function OP:%x\n", packet.number); }
-void GP0_RENDER_POLYGONS(union COMMAND_PACKET packet) {
-    switch (packet.number) {
-        case 0X20: {
-            if (!gpu_wait_parameters(4))
-                return;
-
-            #ifdef DEBUG
-            printf("RENDER_THREE_POINT_POLYGON_MONOCHROME\n");
-            #endif
-
-            uint32_t c, v1, v2, v3;
-
-            c  = pop_fifo().value;
-            v1 = pop_fifo().value;
-            v2 = pop_fifo().value; 
-            v3 = pop_fifo().value; 
-
-            RENDER_THREE_POINT_POLYGON_MONOCHROME(c, v1, v2, v3, false);
-
-            break;
-        }
-        case 0X22: {
-            if (!gpu_wait_parameters(4))
-                return;
-
-            #ifdef DEBUG
-            printf("RENDER_THREE_POINT_POLYGON_MONOCHROME\n");
-            #endif
-
-            uint32_t c, v1, v2, v3;
-
-            c  = pop_fifo().value;
-            v1 = pop_fifo().value;
-            v2 = pop_fifo().value; 
-            v3 = pop_fifo().value; 
-
-            RENDER_THREE_POINT_POLYGON_MONOCHROME(c, v1, v2, v3, true);
-
-            break;
-        }
-        case 0X28: {
-            if (!gpu_wait_parameters(5))
-                return;
-            
-            #ifdef DEBUG
-            printf("RENDER_FOUR_POINT_POLYGON_MONOCHROME\n");
-            #endif
-
-            uint32_t c, v1, v2, v3, v4;
-
-            c  = pop_fifo().value;
-            v1 = pop_fifo().value;
-            v2 = pop_fifo().value; 
-            v3 = pop_fifo().value; 
-            v4 = pop_fifo().value; 
-            
-            RENDER_FOUR_POINT_POLYGON_MONOCHROME(c, v1, v2, v3, v4, false);
-
-            break;
-        }
-        case 0X2A: {
-            if (!gpu_wait_parameters(5))
-                return;
-
-            #ifdef DEBUG
-            printf("RENDER_FOUR_POINT_POLYGON_MONOCHROME\n");
-            #endif
-
-            uint32_t c, v1, v2, v3, v4;
-
-            c  = pop_fifo().value;
-            v1 = pop_fifo().value;
-            v2 = pop_fifo().value; 
-            v3 = pop_fifo().value; 
-            v4 = pop_fifo().value; 
-
-            RENDER_FOUR_POINT_POLYGON_MONOCHROME(c, v1, v2, v3, v4, true);
-
-            break;
-        }
-        case 0X24: {
-            if (!gpu_wait_parameters(7))
-                return;
-
-            #ifdef DEBUG
-            printf("RENDER_THREE_POINT_POLYGON_TEXTURED\n");
-            #endif
-            
-            uint32_t c, v1, v2, v3, t1, t2, t3;
-
-            c  = pop_fifo().value;
-            v1 = pop_fifo().value;
-            t1 = pop_fifo().value;
-            v2 = pop_fifo().value;
-            t2 = pop_fifo().value;
-            v3 = pop_fifo().value;
-            t3 = pop_fifo().value;
-
-            RENDER_THREE_POINT_POLYGON_TEXTURED(c, v1, t1, v2, t2, v3, t3, false, true);
-
-            break;
-        }
-        case 0X25: {
-            if (!gpu_wait_parameters(7))
-                return;
-
-            #ifdef DEBUG
-            printf("RENDER_THREE_POINT_POLYGON_TEXTURED\n");
-            #endif
-            
-            uint32_t c, v1, v2, v3, t1, t2, t3;
-
-            c  = pop_fifo().value;
-            v1 = pop_fifo().value;
-            t1 = pop_fifo().value;
-            v2 = pop_fifo().value;
-            t2 = pop_fifo().value;
-            v3 = pop_fifo().value;
-            t3 = pop_fifo().value;
-
-            RENDER_THREE_POINT_POLYGON_TEXTURED(c, v1, t1, v2, t2, v3, t3, false, false);
-
-            break;
-        }
-        case 0X26: {
-            if (!gpu_wait_parameters(7))
-                return;
-
-            #ifdef DEBUG
-            printf("RENDER_THREE_POINT_POLYGON_TEXTURED\n");
-            #endif
-            
-            uint32_t c, v1, v2, v3, t1, t2, t3;
-
-            c  = pop_fifo().value;
-            v1 = pop_fifo().value;
-            t1 = pop_fifo().value;
-            v2 = pop_fifo().value;
-            t2 = pop_fifo().value;
-            v3 = pop_fifo().value;
-            t3 = pop_fifo().value;
-
-            RENDER_THREE_POINT_POLYGON_TEXTURED(c, v1, t1, v2, t2, v3, t3, true, true);
-
-            break;
-        }
-        case 0X27: {
-            if (!gpu_wait_parameters(7))
-                return;
-
-            #ifdef DEBUG
-            printf("RENDER_THREE_POINT_POLYGON_TEXTURED\n");
-            #endif
-            
-            uint32_t c, v1, v2, v3, t1, t2, t3;
-
-            c  = pop_fifo().value;
-            v1 = pop_fifo().value;
-            t1 = pop_fifo().value;
-            v2 = pop_fifo().value;
-            t2 = pop_fifo().value;
-            v3 = pop_fifo().value;
-            t3 = pop_fifo().value;
-
-            RENDER_THREE_POINT_POLYGON_TEXTURED(c, v1, t1, v2, t2, v3, t3, true, false);
-
-            break;
-        }
-        case 0X2C: {
-            if (!gpu_wait_parameters(9))
-                return;
-
-            #ifdef DEBUG
-            printf("RENDER_FOUR_POINT_POLYGON_TEXTURED\n");
-            #endif
-            
-            uint32_t c, v1, v2, v3, v4, t1, t2, t3, t4;
-
-            c  = pop_fifo().value;
-            v1 = pop_fifo().value;
-            t1 = pop_fifo().value;
-            v2 = pop_fifo().value;
-            t2 = pop_fifo().value;
-            v3 = pop_fifo().value;
-            t3 = pop_fifo().value;
-            v4 = pop_fifo().value;
-            t4 = pop_fifo().value;
-
-            RENDER_FOUR_POINT_POLYGON_TEXTURED(c, v1, t1, v2, t2, v3, t3, v4, t4, false, true);
-
-            break;
-        }
-        case 0X2D: {
-            if (!gpu_wait_parameters(9))
-                return;
-
-            #ifdef DEBUG
-            printf("RENDER_FOUR_POINT_POLYGON_TEXTURED\n");
-            #endif
-            
-            uint32_t c, v1, v2, v3, v4, t1, t2, t3, t4;
-
-            c  = pop_fifo().value;
-            v1 = pop_fifo().value;
-            t1 = pop_fifo().value;
-            v2 = pop_fifo().value;
-            t2 = pop_fifo().value;
-            v3 = pop_fifo().value;
-            t3 = pop_fifo().value;
-            v4 = pop_fifo().value;
-            t4 = pop_fifo().value;
-
-            RENDER_FOUR_POINT_POLYGON_TEXTURED(c, v1, t1, v2, t2, v3, t3, v4, t4, false, false);
-
-            break;
-        }
-        case 0X2E: {
-            if (!gpu_wait_parameters(9))
-                return;
-
-            #ifdef DEBUG
-            printf("RENDER_FOUR_POINT_POLYGON_TEXTURED\n");
-            #endif
-            
-            uint32_t c, v1, v2, v3, v4, t1, t2, t3, t4;
-
-            c  = pop_fifo().value;
-            v1 = pop_fifo().value;
-            t1 = pop_fifo().value;
-            v2 = pop_fifo().value;
-            t2 = pop_fifo().value;
-            v3 = pop_fifo().value;
-            t3 = pop_fifo().value;
-            v4 = pop_fifo().value;
-            t4 = pop_fifo().value;
-
-            RENDER_FOUR_POINT_POLYGON_TEXTURED(c, v1, t1, v2, t2, v3, t3, v4, t4, true, true);
-
-            break;
-        }
-        case 0X2F: {
-            if (!gpu_wait_parameters(9))
-                return;
-            
-            #ifdef DEBUG
-            printf("RENDER_FOUR_POINT_POLYGON_TEXTURED\n");
-            #endif
-            
-            uint32_t c, v1, v2, v3, v4, t1, t2, t3, t4;
-
-            c  = pop_fifo().value;
-            v1 = pop_fifo().value;
-            t1 = pop_fifo().value;
-            v2 = pop_fifo().value;
-            t2 = pop_fifo().value;
-            v3 = pop_fifo().value;
-            t3 = pop_fifo().value;
-            v4 = pop_fifo().value;
-            t4 = pop_fifo().value;
-
-            RENDER_FOUR_POINT_POLYGON_TEXTURED(c, v1, t1, v2, t2, v3, t3, v4, t4, true, false);
-
-            break;
-        }
-        case 0X30: {
-            if (!gpu_wait_parameters(6))
-                return;
-
-            #ifdef DEBUG
-            printf("RENDER_THREE_POINT_POLYGON_SHADED\n");
-            #endif
-
-            uint32_t c1, v1, v2, c2, v3, c3;
-
-            c1 = pop_fifo().value;
-            v1 = pop_fifo().value;
-            c2 = pop_fifo().value;
-            v2 = pop_fifo().value; 
-            c3 = pop_fifo().value;
-            v3 = pop_fifo().value; 
-
-            RENDER_THREE_POINT_POLYGON_SHADED(c1, v1, c2, v2, c3, v3, false);
-
-            break;
-        }
-        case 0X32: {
-            if (!gpu_wait_parameters(6))
-                return;
-
-            #ifdef DEBUG
-            printf("RENDER_THREE_POINT_POLYGON_SHADED\n");
-            #endif
-
-            uint32_t c1, v1, v2, c2, v3, c3;
-
-            c1 = pop_fifo().value;
-            v1 = pop_fifo().value;
-            c2 = pop_fifo().value;
-            v2 = pop_fifo().value; 
-            c3 = pop_fifo().value;
-            v3 = pop_fifo().value; 
-
-            RENDER_THREE_POINT_POLYGON_SHADED(c1, v1, c2, v2, c3, v3, true);
-
-            break;
-        }
-        case 0X38: {
-            if (!gpu_wait_parameters(8))
-                return;
-
-            #ifdef DEBUG
-            printf("RENDER_FOUR_POINT_POLYGON_SHADED\n");
-            #endif
-
-            uint32_t c1, c2, c3, c4, v1, v2, v3, v4;
-
-            c1 = pop_fifo().value;
-            v1 = pop_fifo().value;
-            c2 = pop_fifo().value;
-            v2 = pop_fifo().value;
-            c3 = pop_fifo().value;
-            v3 = pop_fifo().value;
-            c4 = pop_fifo().value;
-            v4 = pop_fifo().value;
-
-            RENDER_FOUR_POINT_POLYGON_SHADED(c1, v1, c2, v2, c3, v3, c4, v4, false);
-
-            break;
-        }
-        case 0X3A: {
-            if (!gpu_wait_parameters(8))
-                return;
-
-            #ifdef DEBUG
-            printf("RENDER_FOUR_POINT_POLYGON_SHADED\n");
-            #endif
-
-            uint32_t c1, c2, c3, c4, v1, v2, v3, v4;
-
-            c1 = pop_fifo().value;
-            v1 = pop_fifo().value;
-            c2 = pop_fifo().value;
-            v2 = pop_fifo().value;
-            c3 = pop_fifo().value;
-            v3 = pop_fifo().value;
-            c4 = pop_fifo().value;
-            v4 = pop_fifo().value;
-
-            RENDER_FOUR_POINT_POLYGON_SHADED(c1, v1, c2, v2, c3, v3, c4, v4, true);
-
-            break;
-        }
-        case 0X34: {
-            if (!gpu_wait_parameters(9))
-                return;
-
-            #ifdef DEBUG
-            printf("RENDER_THREE_POINT_POLYGON_SHADED_TEXTURED\n");
-            #endif
-            
-            uint32_t c1, c2, c3, v1, v2, v3, t1, t2, t3;
-
-            c1 = pop_fifo().value;
-            v1 = pop_fifo().value;
-            t1 = pop_fifo().value;
-            c2 = pop_fifo().value;
-            v2 = pop_fifo().value;
-            t2 = pop_fifo().value;
-            c3 = pop_fifo().value;
-            v3 = pop_fifo().value;
-            t3 = pop_fifo().value;
-
-            RENDER_THREE_POINT_POLYGON_SHADED_TEXTURED(c1, v1, t1, c2, v2, t2, c3, v3, t3, false, true);
-
-            break;
-        }
-        case 0X36: {
-            if (!gpu_wait_parameters(9))
-                return;
-
-            #ifdef DEBUG
-            printf("RENDER_THREE_POINT_POLYGON_SHADED_TEXTURED\n");
-            #endif
-            
-            uint32_t c1, c2, c3, v1, v2, v3, t1, t2, t3;
-
-            c1 = pop_fifo().value;
-            v1 = pop_fifo().value;
-            t1 = pop_fifo().value;
-            c2 = pop_fifo().value;
-            v2 = pop_fifo().value;
-            t2 = pop_fifo().value;
-            c3 = pop_fifo().value;
-            v3 = pop_fifo().value;
-            t3 = pop_fifo().value;
-
-            RENDER_THREE_POINT_POLYGON_SHADED_TEXTURED(c1, v1, t1, c2, v2, t2, c3, v3, t3, true, true);
-
-            break;
-        }
-        case 0X3C: {
-            if (!gpu_wait_parameters(12))
-                return;
-            
-            #ifdef DEBUG
-            printf("RENDER_FOUR_POINT_POLYGON_SHADED_TEXTURED\n");
-            #endif
-
-            uint32_t c1, c2, c3, v1, v2, v3, t1, t2, t3, c4, v4, t4;
-
-            c1 = pop_fifo().value;
-            v1 = pop_fifo().value;
-            t1 = pop_fifo().value;
-            c2 = pop_fifo().value;
-            v2 = pop_fifo().value;
-            t2 = pop_fifo().value;
-            c3 = pop_fifo().value;
-            v3 = pop_fifo().value;
-            t3 = pop_fifo().value;
-            c4 = pop_fifo().value;
-            v4 = pop_fifo().value;
-            t4 = pop_fifo().value;
-            
-
-            RENDER_FOUR_POINT_POLYGON_SHADED_TEXTURED(c1, v1, t1, c2, v2, t2, c3, v3, t3, c4, v4, t4, false, true);
-
-            break;
-        }
-        case 0X3E: {
-            if (!gpu_wait_parameters(12))
-                return;
-
-            #ifdef DEBUG
-            printf("RENDER_FOUR_POINT_POLYGON_SHADED_TEXTURED\n");
-            #endif
-
-            uint32_t c1, c2, c3, v1, v2, v3, t1, t2, t3, c4, v4, t4;
-
-            c1 = pop_fifo().value;
-            v1 = pop_fifo().value;
-            t1 = pop_fifo().value;
-            c2 = pop_fifo().value;
-            v2 = pop_fifo().value;
-            t2 = pop_fifo().value;
-            c3 = pop_fifo().value;
-            v3 = pop_fifo().value;
-            t3 = pop_fifo().value;
-            c4 = pop_fifo().value;
-            v4 = pop_fifo().value;
-            t4 = pop_fifo().value;
-            
-
-            RENDER_FOUR_POINT_POLYGON_SHADED_TEXTURED(c1, v1, t1, c2, v2, t2, c3, v3, t3, c4, v4, t4, true, true);
-
-            break;
-        }
+void GP0_INTERRUPT_REQUEST(const uint32_t *packet) { print_gpu_error("GP0 INTERRUPT REQUEST", "Unimplemented function OP:%x\n", packet[0] >> 24); }
+void GP0_RENDER_POLYGONS(const uint32_t *packet) {
+    //  bit 4 shaded, bit 3 four point, bit 2 textured
+    //  bit 1 semi transparent, bit 0 raw texture (no blending with the color)
+    const uint32_t *p = packet;
+    uint32_t number  = p[0] >> 24;
+    bool transparent = (number >> 1) & 1;
+    bool blend       = !(number & 1);
+
+    #ifdef DEBUG
+    printf("RENDER_POLYGON %02X\n", number);
+    #endif
+
+    switch (number & 0X1C) {
+        case 0X00: RENDER_THREE_POINT_POLYGON_MONOCHROME(p[0], p[1], p[2], p[3], transparent); break;
+        case 0X04: RENDER_THREE_POINT_POLYGON_TEXTURED(p[0], p[1], p[2], p[3], p[4], p[5], p[6], transparent, blend); break;
+        case 0X08: RENDER_FOUR_POINT_POLYGON_MONOCHROME(p[0], p[1], p[2], p[3], p[4], transparent); break;
+        case 0X0C: RENDER_FOUR_POINT_POLYGON_TEXTURED(p[0], p[1], p[2], p[3], p[4], p[5], p[6], p[7], p[8], transparent, blend); break;
+        case 0X10: RENDER_THREE_POINT_POLYGON_SHADED(p[0], p[1], p[2], p[3], p[4], p[5], transparent); break;
+        case 0X14: RENDER_THREE_POINT_POLYGON_SHADED_TEXTURED(p[0], p[1], p[2], p[3], p[4], p[5], p[6], p[7], p[8], transparent, blend); break;
+        case 0X18: RENDER_FOUR_POINT_POLYGON_SHADED(p[0], p[1], p[2], p[3], p[4], p[5], p[6], p[7], transparent); break;
+        case 0X1C: RENDER_FOUR_POINT_POLYGON_SHADED_TEXTURED(p[0], p[1], p[2], p[3], p[4], p[5], p[6], p[7], p[8], p[9], p[10], p[11], transparent, blend); break;
     }
 }
-void GP0_RENDER_LINES(union COMMAND_PACKET packet) { print_gpu_error("GP0 OP", "Unimplemented function OP: %x\n", packet.number); }
-void GP0_RENDER_RECTANGLES(union COMMAND_PACKET packet) { print_gpu_error("GP0 OP", "Unimplemented function OP: %x\n", packet.number); }
-void GP0_RENDERING_ATTRIBUTES(union COMMAND_PACKET packet) {
-    // pop current command as it doesnt need more arguments
-    pop_fifo();
+void GP0_RENDER_LINES(const uint32_t *packet) {
+    print_gpu_error("GP0 OP", "Unimplemented function OP: %x\n", packet[0] >> 24);
+}
+void GP0_RENDER_RECTANGLES(const uint32_t *packet) { print_gpu_error("GP0 OP", "Unimplemented function OP: %x\n", packet[0] >> 24); }
+void GP0_RENDERING_ATTRIBUTES(const uint32_t *words) {
+    union COMMAND_PACKET packet = { .value = words[0] };
     switch (packet.number & 0b1111) {
         case 0X01: {
             /* DRAWMODE SETTING */
@@ -929,7 +561,7 @@ void GP0_RENDERING_ATTRIBUTES(union COMMAND_PACKET packet) {
     }
 
 }
-void GP0_DISPLAY_CONTROL(union COMMAND_PACKET packet) { print_gpu_error("GP0 OP", "Unimplemented function OP: %x\n", packet.number); }
+void GP0_DISPLAY_CONTROL(const uint32_t *packet) { print_gpu_error("GP0 OP", "Unimplemented function OP: %x\n", packet[0] >> 24); }
 
 // gp1 functions
 void GP1_RESET(union COMMAND_PACKET packet) {
@@ -949,7 +581,7 @@ void GP1_RESET(union COMMAND_PACKET packet) {
     // Note that GP1(09h) is NOT affected by the reset command.
     
     // clear the fifo
-    reset_fifo();
+    gpu_gp0_reset();
 
     gpu.gpustat.value = 0X14802000;
     
@@ -979,7 +611,7 @@ void GP1_RESET_COMMAND_BUFFER(union COMMAND_PACKET packet) {
     // 0-23  Not used (zero)
     // Clears the command FIFO, and aborts the current rendering command 
     // (eg. this may end up with an incompletely drawn triangle).
-    
+    gpu_gp0_reset();
 }
 void GP1_ACKNOWLEDGE_INTERRUPT(union COMMAND_PACKET packet) { print_gpu_error("GP1 OP", "Unimplemented function OP: %x\n", packet.number); }
 void GP1_DISPLAY_ENABLE(union COMMAND_PACKET packet) { 
@@ -993,7 +625,7 @@ void GP1_DMA_DIRECTION_OR_DATA_REQUEST(union COMMAND_PACKET packet) {
     gpu.gpustat.dma_direction = packet.parameters & 0b11;
     switch (packet.parameters & 0b11) {
         case 0: gpu.gpustat.dma_data_request = 0; break;
-        case 1: gpu.gpustat.dma_data_request = !fifo_full(); break;
+        case 1: gpu.gpustat.dma_data_request = FIFO_NOT_FULL; break; // commands never back up
         case 2: gpu.gpustat.dma_data_request = gpu.gpustat.ready_recieve_dma_block; break;
         case 3: gpu.gpustat.dma_data_request = gpu.gpustat.ready_send_vram_cpu; break;
     }
@@ -1045,26 +677,44 @@ void GP1_DISPLAY_INFO(union COMMAND_PACKET packet) { print_gpu_error("GP1 OP", "
 
 void VRAM_CLEAR_CACHE(void) {
     // clear texture cache
-    pop_fifo();
 }
-void VRAM_FILL_RECTANGLE(void) { print_gpu_error("COPY", "Unimplemented function", NULL); }
+void VRAM_FILL_RECTANGLE(const uint32_t *packet) {
+    //  1st  Color+Command     (CcBbGgRrh)  ;24bit RGB value (see note)
+    //  2nd  Top Left Corner   (YyyyXxxxh)  ;Xpos counted in halfwords, steps of 10h
+    //  3rd  Width+Height      (YsizXsizh)  ;Xsiz counted in halfwords, steps of 10h
+    //
+    //  Fills the area in the frame buffer with the value in RGB. Horizontally the filling is done in 16-pixel (32-bytes) units.
+    //  The fill is not affected by the mask settings or the drawing area, and wraps around the edges of vram.
+    uint32_t color = packet[0];
+    uint32_t pixel = ((color >> 3) & 0X1F) | (((color >> 11) & 0X1F) << 5) | (((color >> 19) & 0X1F) << 10);
+
+    uint32_t x = (packet[1] >>  0) & 0X3F0;
+    uint32_t y = (packet[1] >> 16) & 0X1FF;
+    uint32_t w = (((packet[2] >> 0) & 0X3FF) + 0XF) & ~0XF;
+    uint32_t h = (packet[2] >> 16) & 0X1FF;
+
+    gpu_vram_sync();
+
+    for (uint32_t row = 0; row < h; row++)
+        for (uint32_t column = 0; column < w; column++)
+            memory_gpu_store_16bit(VRAM_ADDRESS((x + column) & 0X3FF, (y + row) & 0X1FF), pixel);
+
+    renderer_vram_dirty(x, y, w, h);
+}
 void VRAM_TO_VRAM_COPY_RECTANGLE(void) {}
-void CPU_TO_VRAM_COPY_RECTANGLE(void) {
+void CPU_TO_VRAM_COPY_RECTANGLE(const uint32_t *packet) {
     //  1st  Command           (Cc000000h)
     //  2nd  Destination Coord (YyyyXxxxh)  ;Xpos counted in halfwords
     //  3rd  Width+Height      (YsizXsizh)  ;Xsiz counted in halfwords
     //  ...  Data              (...)      <--- usually transferred via DMA
     //
     //  Transfers data from CPU to frame buffer. If the number of halfwords to be sent is odd, an extra halfword should be sent (packets consist of 32bit units). The transfer is affected by Mask setting.
-    if (!gpu_wait_parameters(3))
-        return;
-
-    pop_fifo(); // command
-
     uint32_t destination, dimensions;
 
-    destination = (uint32_t) pop_fifo().value;
-    dimensions  = (uint32_t) pop_fifo().value;
+    gpu_vram_sync();
+
+    destination = packet[1];
+    dimensions  = packet[2];
 
     uint32_t x, y, w, h;
     x = (destination >>  0) & 0XFFFF;
@@ -1081,23 +731,23 @@ void CPU_TO_VRAM_COPY_RECTANGLE(void) {
     gpu.copy.d_w = w;
     gpu.copy.d_h = h;
 
-    gpu_set_mode(COPY);
+    // the following gp0 words are image data until the rectangle is filled
+    gpu.copy.x = x;
+    gpu.copy.y = y;
+    gpu.copy.copying   = (w > 0 && h > 0);
     gpu.copy.direction = CPU_TO_VRAM;
 }
-void VRAM_TO_CPU_COPY_RECTANGLE(void) {
+void VRAM_TO_CPU_COPY_RECTANGLE(const uint32_t *packet) {
     //  1st  Command           (Cc000000h) ;
     //  2nd  Source Coord      (YyyyXxxxh) ; write to GP0 port (as usually)
     //  3rd  Width+Height      (YsizXsizh) ;
     //  ...  Data              (...)       ;<--- read from GPUREAD port (or via DMA)
-    if (!gpu_wait_parameters(3))
-        return;
-
-    pop_fifo(); // command
-
     uint32_t source, dimensions;
+
+    gpu_vram_sync();
     
-    source     = pop_fifo().value;
-    dimensions = pop_fifo().value;
+    source     = packet[1];
+    dimensions = packet[2];
 
     uint32_t x, y, w, h;
     x = (source >>  0) & 0XFFFF;
@@ -0,0 +1,166 @@
+#include "gpu_thread.h"
+#include <sched.h>
+
+static struct GPU_THREAD gpu_thread;
+
+// ring helpers
+static void gpu_thread_push(enum GPU_THREAD_COMMAND type, const uint32_t *words, uint32_t count);
+static uint32_t gpu_thread_wait(uint32_t head);
+static void *gpu_thread_main(void *arg);
+
+struct GPU_THREAD *get_gpu_thread(void) { return &gpu_thread; }
+
+bool gpu_thread_running(void) { return gpu_thread.running; }
+
+void gpu_thread_start(void (*make_current)(bool current), void (*present)(void)) {
+    atomic_store(&gpu_thread.head, 0);
+    atomic_store(&gpu_thread.tail, 0);
+    gpu_thread.head_seen = 0;
+    gpu_thread.tail_seen = 0;
+    gpu_thread.tail_written = 0;
+    atomic_store(&gpu_thread.sleeping, false);
+    atomic_store(&gpu_thread.frames_presented, 0);
+    gpu_thread.frames_queued = 0;
+
+    gpu_thread.make_current = make_current;
+    gpu_thread.present      = present;
+
+    pthread_mutex_init(&gpu_thread.lock, NULL);
+    pthread_cond_init(&gpu_thread.wake, NULL);
+
+    if (pthread_create(&gpu_thread.thread, NULL, gpu_thread_main, NULL) != 0) {
+        print_gpu_thread_error("gpu_thread_start", "Cannot create the render thread", NULL);
+        exit(1);
+    }
+    gpu_thread.running = true;
+}
+
+void gpu_thread_stop(void) {
+    if (!gpu_thread.running)
+        return;
+
+    gpu_thread_push(GPU_THREAD_STOP, NULL, 0);
+    gpu_thread_flush();
+    pthread_join(gpu_thread.thread, NULL);
+    gpu_thread.running = false;
+
+    pthread_cond_destroy(&gpu_thread.wake);
+    pthread_mutex_destroy(&gpu_thread.lock);
+}
+
+void gpu_thread_draw(const uint32_t *packet, uint32_t length) {
+    gpu_thread_push(GPU_THREAD_DRAW, packet, length);
+}
+
+void gpu_thread_frame(void) {
+    gpu_thread_push(GPU_THREAD_FRAME, NULL, 0);
+    gpu_thread_flush();
+    gpu_thread.frames_queued++;
+
+    // keep the core at most a frame ahead of what is on screen
+    while (gpu_thread.frames_queued - atomic_load_explicit(&gpu_thread.frames_presented, memory_order_acquire) > GPU_THREAD_FRAMES_AHEAD)
+        sched_yield();
+}
+
+void gpu_thread_sync(void) {
+    // wait until every queued command has been executed
+    if (!gpu_thread.running)
+        return;
+
+    gpu_thread_push(GPU_THREAD_SYNC, NULL, 0);
+    gpu_thread_flush();
+    while (atomic_load_explicit(&gpu_thread.head, memory_order_acquire) != gpu_thread.tail_written)
+        sched_yield();
+}
+
+void gpu_thread_flush(void) {
+    // publish everything pushed since the last flush in one go
+    if (atomic_load_explicit(&gpu_thread.tail, memory_order_relaxed) == gpu_thread.tail_written)
+        return;
+
+    // seq_cst pairs with the sleeping flag so a wakeup is never lost
+    atomic_store(&gpu_thread.tail, gpu_thread.tail_written);
+
+    if (atomic_load(&gpu_thread.sleeping)) {
+        pthread_mutex_lock(&gpu_thread.lock);
+        pthread_cond_signal(&gpu_thread.wake);
+        pthread_mutex_unlock(&gpu_thread.lock);
+    }
+}
+
+// ring helpers
+void gpu_thread_push(enum GPU_THREAD_COMMAND type, const uint32_t *words, uint32_t count) {
+    uint32_t tail = gpu_thread.tail_written;
+
+    // full, the render thread is behind
+    while (tail + count + 1 - gpu_thread.head_seen > GPU_THREAD_RING_SIZE) {
+        gpu_thread.head_seen = atomic_load_explicit(&gpu_thread.head, memory_order_acquire);
+        if (tail + count + 1 - gpu_thread.head_seen > GPU_THREAD_RING_SIZE) {
+            gpu_thread_flush();
+            sched_yield();
+        }
+    }
+
+    gpu_thread.ring[tail & GPU_THREAD_RING_MASK] = (type << 24) | count;
+    for (uint32_t i = 0; i < count; i++)
+        gpu_thread.ring[(tail + 1 + i) & GPU_THREAD_RING_MASK] = words[i];
+
+    gpu_thread.tail_written = tail + count + 1;
+}
+
+uint32_t gpu_thread_wait(uint32_t head) {
+    uint32_t tail;
+
+    if (gpu_thread.tail_seen != head)
+        return gpu_thread.tail_seen;
+
+    for (int spin = 0; spin < GPU_THREAD_SPIN; spin++) {
+        if ((tail = atomic_load_explicit(&gpu_thread.tail, memory_order_acquire)) != head)
+            return gpu_thread.tail_seen = tail;
+    }
+
+    pthread_mutex_lock(&gpu_thread.lock);
+    atomic_store(&gpu_thread.sleeping, true);
+    while ((tail = atomic_load(&gpu_thread.tail)) == head)
+        pthread_cond_wait(&gpu_thread.wake, &gpu_thread.lock);
+    atomic_store(&gpu_thread.sleeping, false);
+    pthread_mutex_unlock(&gpu_thread.lock);
+
+    return gpu_thread.tail_seen = tail;
+}
+
+void *gpu_thread_main(void *arg) {
+    uint32_t packet[GP0_PACKET_MAX];
+
+    gpu_thread.make_current(true);
+
+    for (;;) {
+        uint32_t head = atomic_load_explicit(&gpu_thread.head, memory_order_relaxed);
+        gpu_thread_wait(head);
+
+        uint32_t header = gpu_thread.ring[head & GPU_THREAD_RING_MASK];
+        uint32_t count  = header & 0X00FFFFFF;
+
+        for (uint32_t i = 0; i < count; i++)
+            packet[i] = gpu_thread.ring[(head + 1 + i) & GPU_THREAD_RING_MASK];
+
+        switch (header >> 24) {
+            case GPU_THREAD_DRAW:
+                gpu_render(packet);
+                break;
+            case GPU_THREAD_FRAME:
+                gpu_thread.present();
+                atomic_fetch_add_explicit(&gpu_thread.frames_presented, 1, memory_order_release);
+                break;
+            case GPU_THREAD_SYNC:
+                renderer_flush();
+                break;
+            case GPU_THREAD_STOP:
+                gpu_thread.make_current(false);
+                atomic_store_explicit(&gpu_thread.head, head + count + 1, memory_order_release);
+                return NULL;
+        }
+
+        atomic_store_explicit(&gpu_thread.head, head + count + 1, memory_order_release);
+    }
+}
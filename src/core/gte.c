@@ -0,0 +1,664 @@
+#include "gte.h"
+
+static struct GTE gte;
+
+// data register views
+#define DATA        gte.regs->data
+#define CONTROL     gte.regs->control
+#define VX(n)       ((int16_t) DATA[(n) * 2])
+#define VY(n)       ((int16_t) (DATA[(n) * 2] >> 16))
+#define VZ(n)       ((int16_t) DATA[(n) * 2 + 1])
+#define RGBC        DATA[6]
+#define OTZ         DATA[7]
+#define IR(i)       ((int16_t) DATA[8 + (i)])
+#define SXY(n)      DATA[12 + (n)]
+#define SX(n)       ((int16_t) DATA[12 + (n)])
+#define SY(n)       ((int16_t) (DATA[12 + (n)] >> 16))
+#define SZ(n)       DATA[16 + (n)]
+#define RGB(n)      DATA[20 + (n)]
+#define MAC(i)      ((int32_t) DATA[24 + (i)])
+#define LZCS        DATA[30]
+#define LZCR        DATA[31]
+// control register views
+#define OFX         ((int32_t) CONTROL[24])
+#define OFY         ((int32_t) CONTROL[25])
+#define H           ((uint16_t) CONTROL[26]) // unsigned, though CFC2 reads it sign extended
+#define DQA         ((int16_t) CONTROL[27])
+#define DQB         ((int32_t) CONTROL[28])
+#define ZSF3        ((int16_t) CONTROL[29])
+#define ZSF4        ((int16_t) CONTROL[30])
+#define FLAG        CONTROL[31]
+
+// register helpers
+static void gte_unpack_matrix(enum GTE_MATRIX matrix);
+static void gte_unpack_vector(enum GTE_VECTOR vector);
+static uint32_t gte_orgb(void);
+
+// arithmetic helpers
+static int64_t gte_mac_check(int i, int64_t value);
+static void gte_set_mac(int i, int64_t value, int shift);
+static void gte_set_ir(int i, int32_t value, bool lm);
+static void gte_set_mac_ir(int i, int64_t value, int shift, bool lm);
+static void gte_mac0_check(int64_t value);
+static void gte_set_mac0(int64_t value);
+static void gte_set_ir0(int32_t value);
+static void gte_set_otz(int32_t value);
+static void gte_push_sz(int32_t value);
+static void gte_push_sxy(int32_t x, int32_t y);
+static void gte_push_rgb(void);
+static uint32_t gte_divide(uint32_t h, uint32_t sz3);
+
+// command helpers
+static void gte_vector(int n, int16_t vector[3]);
+static void gte_ir_vector(int16_t vector[3]);
+static void gte_multiply(enum GTE_MATRIX matrix, const int32_t translation[3], const int16_t vector[3], int shift, bool lm);
+static void gte_rtp(int first, int count, int shift, bool lm);
+static void gte_interpolate(int64_t mac1, int64_t mac2, int64_t mac3, int shift, bool lm);
+static void gte_color_ir(int shift, bool lm);
+static void gte_lighting(int n, int shift, bool lm);
+static void gte_nclip(void);
+static void gte_op(int shift, bool lm);
+static void gte_dpcs(uint32_t color, int shift, bool lm);
+static void gte_intpl(int shift, bool lm);
+static void gte_mvmva(uint32_t command, int shift, bool lm);
+static void gte_ncds(int n, int shift, bool lm);
+static void gte_cdp(int shift, bool lm);
+static void gte_nccs(int n, int shift, bool lm);
+static void gte_cc(int shift, bool lm);
+static void gte_ncs(int n, int shift, bool lm);
+static void gte_sqr(int shift, bool lm);
+static void gte_dcpl(int shift, bool lm);
+static void gte_avsz3(void);
+static void gte_avsz4(void);
+static void gte_gpf(int shift, bool lm);
+static void gte_gpl(int shift, bool lm);
+
+static const int32_t gte_zero[3] = { 0, 0, 0 };
+
+// seeds of the reciprocal in the perspective divide, as the gte holds them in rom,
+// entry i is max(0, (40000h / (i + 100h) + 1) / 2 - 101h)
+static const uint8_t gte_unr_table[257] = {
+    0XFF, 0XFD, 0XFB, 0XF9, 0XF7, 0XF5, 0XF3, 0XF1, 0XEF, 0XEE, 0XEC, 0XEA, 0XE8, 0XE6, 0XE4, 0XE3,
+    0XE1, 0XDF, 0XDD, 0XDC, 0XDA, 0XD8, 0XD6, 0XD5, 0XD3, 0XD1, 0XD0, 0XCE, 0XCD, 0XCB, 0XC9, 0XC8,
+    0XC6, 0XC5, 0XC3, 0XC1, 0XC0, 0XBE, 0XBD, 0XBB, 0XBA, 0XB8, 0XB7, 0XB5, 0XB4, 0XB2, 0XB1, 0XB0,
+    0XAE, 0XAD, 0XAB, 0XAA, 0XA9, 0XA7, 0XA6, 0XA4, 0XA3, 0XA2, 0XA0, 0X9F, 0X9E, 0X9C, 0X9B, 0X9A,
+    0X99, 0X97, 0X96, 0X95, 0X94, 0X92, 0X91, 0X90, 0X8F, 0X8D, 0X8C, 0X8B, 0X8A, 0X89, 0X87, 0X86,
+    0X85, 0X84, 0X83, 0X82, 0X81, 0X7F, 0X7E, 0X7D, 0X7C, 0X7B, 0X7A, 0X79, 0X78, 0X77, 0X75, 0X74,
+    0X73, 0X72, 0X71, 0X70, 0X6F, 0X6E, 0X6D, 0X6C, 0X6B, 0X6A, 0X69, 0X68, 0X67, 0X66, 0X65, 0X64,
+    0X63, 0X62, 0X61, 0X60, 0X5F, 0X5E, 0X5D, 0X5D, 0X5C, 0X5B, 0X5A, 0X59, 0X58, 0X57, 0X56, 0X55,
+    0X54, 0X53, 0X53, 0X52, 0X51, 0X50, 0X4F, 0X4E, 0X4D, 0X4D, 0X4C, 0X4B, 0X4A, 0X49, 0X48, 0X48,
+    0X47, 0X46, 0X45, 0X44, 0X43, 0X43, 0X42, 0X41, 0X40, 0X3F, 0X3F, 0X3E, 0X3D, 0X3C, 0X3C, 0X3B,
+    0X3A, 0X39, 0X39, 0X38, 0X37, 0X36, 0X36, 0X35, 0X34, 0X33, 0X33, 0X32, 0X31, 0X31, 0X30, 0X2F,
+    0X2E, 0X2E, 0X2D, 0X2C, 0X2C, 0X2B, 0X2A, 0X2A, 0X29, 0X28, 0X28, 0X27, 0X26, 0X26, 0X25, 0X24,
+    0X24, 0X23, 0X22, 0X22, 0X21, 0X20, 0X20, 0X1F, 0X1E, 0X1E, 0X1D, 0X1D, 0X1C, 0X1B, 0X1B, 0X1A,
+    0X19, 0X19, 0X18, 0X18, 0X17, 0X16, 0X16, 0X15, 0X15, 0X14, 0X14, 0X13, 0X12, 0X12, 0X11, 0X11,
+    0X10, 0X0F, 0X0F, 0X0E, 0X0E, 0X0D, 0X0D, 0X0C, 0X0C, 0X0B, 0X0A, 0X0A, 0X09, 0X09, 0X08, 0X08,
+    0X07, 0X07, 0X06, 0X06, 0X05, 0X05, 0X04, 0X04, 0X03, 0X03, 0X02, 0X02, 0X01, 0X01, 0X00, 0X00,
+    0X00
+};
+
+struct GTE *get_gte(void) { return &gte; }
+
+void gte_reset(void) {
+    gte.regs = &get_cpu()->cop2;
+    memset(gte.regs, 0, sizeof(struct COPROCESSOR_2));
+    gte.flag = 0;
+    gte.transform = gte_transform_select();
+}
+
+uint32_t gte_read_data(uint32_t reg) {
+    switch (reg) {
+        case 15:         return SXY(2);       // SXYP mirrors SXY2
+        case 28:
+        case 29:         return gte_orgb();   // IRGB reads back as ORGB
+        default:         return DATA[reg];
+    }
+}
+
+void gte_write_data(uint32_t reg, uint32_t value) {
+    switch (reg) {
+        case 1: case 3: case 5:
+        case 8: case 9: case 10: case 11:
+            // VZ0-2 and IR0-3 are 16 bit and read sign extended
+            DATA[reg] = (int16_t) value;
+            break;
+        case 7: case 16: case 17: case 18: case 19:
+            // OTZ and SZ0-3 are 16 bit unsigned
+            DATA[reg] = value & 0XFFFF;
+            break;
+        case 15:
+            // SXYP pushes onto the screen xy fifo
+            SXY(0) = SXY(1);
+            SXY(1) = SXY(2);
+            SXY(2) = value;
+            break;
+        case 28:
+            // IRGB expands 5:5:5 colour into IR1-3
+            DATA[28] = value & 0X7FFF;
+            DATA[9]  = (value & 0X001F) << 7;
+            DATA[10] = (value & 0X03E0) << 2;
+            DATA[11] = (value & 0X7C00) >> 3;
+            break;
+        case 29: case 31:
+            // ORGB and LZCR are read only
+            break;
+        case 30:
+            // LZCR counts the leading bits equal to the sign of LZCS
+            LZCS = value;
+            value = ((int32_t) value < 0) ? ~value: value;
+            LZCR = (value) ? __builtin_clz(value): 32;
+            break;
+        default:
+            DATA[reg] = value;
+            break;
+    }
+}
+
+uint32_t gte_read_control(uint32_t reg) {
+    return CONTROL[reg];
+}
+
+void gte_write_control(uint32_t reg, uint32_t value) {
+    switch (reg) {
+        case 4: case 12: case 20:
+        case 26: case 27: case 29: case 30:
+            // RT33, L33, LB3, H, DQA, ZSF3 and ZSF4 are 16 bit and read sign extended
+            CONTROL[reg] = (int16_t) value;
+            break;
+        case 31:
+            // the error bit is worked out from the others
+            FLAG = value & GTE_FLAG_WRITABLE;
+            if (FLAG & GTE_FLAG_ERROR_BITS)
+                FLAG |= GTE_FLAG_ERROR;
+            break;
+        default:
+            CONTROL[reg] = value;
+            break;
+    }
+
+    // RT TR, LLM BK and LCM FC each take eight registers, five of matrix then three of vector
+    if (reg < 24) {
+        if (reg % 8 < 5)
+            gte_unpack_matrix(reg / 8);
+        else
+            gte_unpack_vector(reg / 8);
+    }
+}
+
+void gte_execute(uint32_t command) {
+    int shift = GTE_SF(command) * 12;
+    bool lm = GTE_LM(command);
+
+    gte.flag = 0;
+
+    switch (GTE_OP(command)) {
+        case 0X01: gte_rtp(0, 1, shift, lm);   break; // RTPS
+        case 0X06: gte_nclip();                break; // NCLIP
+        case 0X0C: gte_op(shift, lm);          break; // OP
+        case 0X10: gte_dpcs(RGBC, shift, lm);  break; // DPCS
+        case 0X11: gte_intpl(shift, lm);       break; // INTPL
+        case 0X12: gte_mvmva(command, shift, lm); break; // MVMVA
+        case 0X13: gte_ncds(0, shift, lm);     break; // NCDS
+        case 0X14: gte_cdp(shift, lm);         break; // CDP
+        case 0X16:                                    // NCDT
+            for (int n = 0; n < 3; n++)
+                gte_ncds(n, shift, lm);
+            break;
+        case 0X1B: gte_nccs(0, shift, lm);     break; // NCCS
+        case 0X1C: gte_cc(shift, lm);          break; // CC
+        case 0X1E: gte_ncs(0, shift, lm);      break; // NCS
+        case 0X20:                                    // NCT
+            for (int n = 0; n < 3; n++)
+                gte_ncs(n, shift, lm);
+            break;
+        case 0X28: gte_sqr(shift, lm);         break; // SQR
+        case 0X29: gte_dcpl(shift, lm);        break; // DCPL
+        case 0X2A:                                    // DPCT
+            for (int n = 0; n < 3; n++)
+                gte_dpcs(RGB(0), shift, lm);
+            break;
+        case 0X2D: gte_avsz3();                break; // AVSZ3
+        case 0X2E: gte_avsz4();                break; // AVSZ4
+        case 0X30: gte_rtp(0, 3, shift, lm);   break; // RTPT
+        case 0X3D: gte_gpf(shift, lm);         break; // GPF
+        case 0X3E: gte_gpl(shift, lm);         break; // GPL
+        case 0X3F:                                    // NCCT
+            for (int n = 0; n < 3; n++)
+                gte_nccs(n, shift, lm);
+            break;
+        default:
+            print_gte_error("gte_execute", "unknown command %08X", command);
+            break;
+    }
+
+    FLAG = gte.flag;
+    if (FLAG & GTE_FLAG_ERROR_BITS)
+        FLAG |= GTE_FLAG_ERROR;
+}
+
+// register helpers
+void gte_unpack_matrix(enum GTE_MATRIX matrix) {
+    // nine 16 bit elements packed in pairs over five registers
+    const uint32_t *packed = &CONTROL[matrix * 8];
+    int16_t *element = &gte.regs->matrix[matrix][0][0];
+
+    for (int i = 0; i < 9; i++)
+        element[i] = (int16_t) (packed[i / 2] >> ((i & 1) * 16));
+}
+
+void gte_unpack_vector(enum GTE_VECTOR vector) {
+    for (int i = 0; i < 3; i++)
+        gte.regs->vector[vector][i] = (int32_t) CONTROL[vector * 8 + 5 + i];
+}
+
+uint32_t gte_orgb(void) {
+    // IR1-3 / 80h saturated to 5 bits
+    uint32_t orgb = 0;
+
+    for (int i = 0; i < 3; i++) {
+        int32_t c = IR(i + 1) >> 7;
+        orgb |= ((c < 0) ? 0: (c > 0X1F) ? 0X1F: c) << (i * 5);
+    }
+    return orgb;
+}
+
+// arithmetic helpers
+int64_t gte_mac_check(int i, int64_t value) {
+    // MAC1-3 hold 44 bits, the excess is flagged and dropped
+    if (value > 0X7FFFFFFFFFFLL)
+        gte.flag |= GTE_FLAG_MAC_POSITIVE(i);
+    else if (value < -0X80000000000LL)
+        gte.flag |= GTE_FLAG_MAC_NEGATIVE(i);
+
+    return (int64_t) ((uint64_t) value << 20) >> 20;
+}
+
+void gte_set_mac(int i, int64_t value, int shift) {
+    DATA[24 + i] = (uint32_t) (gte_mac_check(i, value) >> shift);
+}
+
+void gte_set_ir(int i, int32_t value, bool lm) {
+    int32_t min = (lm) ? 0: -0X8000;
+
+    if (value < min) {
+        value = min;
+        gte.flag |= GTE_FLAG_IR(i);
+    } else if (value > 0X7FFF) {
+        value = 0X7FFF;
+        gte.flag |= GTE_FLAG_IR(i);
+    }
+    DATA[8 + i] = (uint32_t) value;
+}
+
+void gte_set_mac_ir(int i, int64_t value, int shift, bool lm) {
+    gte_set_mac(i, value, shift);
+    gte_set_ir(i, MAC(i), lm);
+}
+
+void gte_mac0_check(int64_t value) {
+    if (value > 0X7FFFFFFFLL)
+        gte.flag |= GTE_FLAG_MAC0_POSITIVE;
+    else if (value < -0X80000000LL)
+        gte.flag |= GTE_FLAG_MAC0_NEGATIVE;
+}
+
+void gte_set_mac0(int64_t value) {
+    gte_mac0_check(value);
+    DATA[24] = (uint32_t) value;
+}
+
+void gte_set_ir0(int32_t value) {
+    if (value < 0) {
+        value = 0;
+        gte.flag |= GTE_FLAG_IR0;
+    } else if (value > 0X1000) {
+        value = 0X1000;
+        gte.flag |= GTE_FLAG_IR0;
+    }
+    DATA[8] = (uint32_t) value;
+}
+
+void gte_set_otz(int32_t value) {
+    if (value < 0) {
+        value = 0;
+        gte.flag |= GTE_FLAG_SZ;
+    } else if (value > 0XFFFF) {
+        value = 0XFFFF;
+        gte.flag |= GTE_FLAG_SZ;
+    }
+    OTZ = value;
+}
+
+void gte_push_sz(int32_t value) {
+    if (value < 0) {
+        value = 0;
+        gte.flag |= GTE_FLAG_SZ;
+    } else if (value > 0XFFFF) {
+        value = 0XFFFF;
+        gte.flag |= GTE_FLAG_SZ;
+    }
+    SZ(0) = SZ(1);
+    SZ(1) = SZ(2);
+    SZ(2) = SZ(3);
+    SZ(3) = value;
+}
+
+void gte_push_sxy(int32_t x, int32_t y) {
+    if (x < -0X400) {
+        x = -0X400;
+        gte.flag |= GTE_FLAG_SX;
+    } else if (x > 0X3FF) {
+        x = 0X3FF;
+        gte.flag |= GTE_FLAG_SX;
+    }
+    if (y < -0X400) {
+        y = -0X400;
+        gte.flag |= GTE_FLAG_SY;
+    } else if (y > 0X3FF) {
+        y = 0X3FF;
+        gte.flag |= GTE_FLAG_SY;
+    }
+    SXY(0) = SXY(1);
+    SXY(1) = SXY(2);
+    SXY(2) = (x & 0XFFFF) | ((uint32_t) y << 16);
+}
+
+void gte_push_rgb(void) {
+    // MAC1-3 / 16 saturated to bytes, the code byte of RGBC carries over
+    uint32_t rgb = RGBC & 0XFF000000;
+
+    for (int i = 1; i <= 3; i++) {
+        int32_t c = MAC(i) >> 4;
+
+        if (c < 0) {
+            c = 0;
+            gte.flag |= GTE_FLAG_COLOR(i);
+        } else if (c > 0XFF) {
+            c = 0XFF;
+            gte.flag |= GTE_FLAG_COLOR(i);
+        }
+        rgb |= c << ((i - 1) * 8);
+    }
+    RGB(0) = RGB(1);
+    RGB(1) = RGB(2);
+    RGB(2) = rgb;
+}
+
+uint32_t gte_divide(uint32_t h, uint32_t sz3) {
+    // H / SZ3 as the hardware does it, a reciprocal seeded from the table and
+    // refined by one newton raphson step, in 1.16 fixed point
+    if (h >= sz3 * 2) {
+        gte.flag |= GTE_FLAG_DIVIDE;
+        return 0X1FFFF;
+    }
+
+    int shift = __builtin_clz(sz3) - 16;
+    uint32_t n = h << shift;
+    uint32_t d = sz3 << shift;
+
+    int32_t u = gte_unr_table[(d - 0X7FC0) >> 7] + 0X101;
+    d = (0X2000080 - (d * u)) >> 8;
+    d = (0X0000080 + (d * u)) >> 8;
+
+    uint32_t result = ((uint64_t) n * d + 0X8000) >> 16;
+    return (result > 0X1FFFF) ? 0X1FFFF: result;
+}
+
+// command helpers
+void gte_vector(int n, int16_t vector[3]) {
+    vector[0] = VX(n);
+    vector[1] = VY(n);
+    vector[2] = VZ(n);
+}
+
+void gte_ir_vector(int16_t vector[3]) {
+    vector[0] = IR(1);
+    vector[1] = IR(2);
+    vector[2] = IR(3);
+}
+
+void gte_multiply(enum GTE_MATRIX matrix, const int32_t translation[3], const int16_t vector[3], int shift, bool lm) {
+    // [MAC1,MAC2,MAC3] = (translation * 1000h + matrix * vector) SAR shift, IR1-3 saturated from them
+    int64_t result[1][3];
+
+    gte.flag |= gte.transform(gte.regs->matrix[matrix], translation, (const int16_t (*)[3]) vector, 1, result);
+    for (int i = 0; i < 3; i++)
+        gte_set_mac_ir(i + 1, result[0][i], shift, lm);
+}
+
+void gte_rtp(int first, int count, int shift, bool lm) {
+    // perspective transformation of V0 (RTPS) or V0-V2 (RTPT), the rotations
+    // of all the vertices are done in one kernel call
+    int16_t vectors[3][3];
+    int64_t results[3][3];
+
+    for (int n = 0; n < count; n++)
+        gte_vector(first + n, vectors[n]);
+
+    gte.flag |= gte.transform(gte.regs->matrix[GTE_RT], gte.regs->vector[GTE_TR], (const int16_t (*)[3]) vectors, count, results);
+
+    for (int n = 0; n < count; n++) {
+        int64_t z = results[n][2];
+
+        gte_set_mac(1, results[n][0], shift);
+        gte_set_mac(2, results[n][1], shift);
+        gte_set_mac(3, z, shift);
+        gte_set_ir(1, MAC(1), lm);
+        gte_set_ir(2, MAC(2), lm);
+
+        // IR3 is saturated from MAC3 but flagged from z SAR 12 whatever sf says
+        int32_t z12 = (int32_t) (z >> 12);
+        if (z12 < -0X8000 || z12 > 0X7FFF)
+            gte.flag |= GTE_FLAG_IR(3);
+
+        int32_t ir3 = MAC(3), min = (lm) ? 0: -0X8000;
+        DATA[11] = (ir3 < min) ? min: (ir3 > 0X7FFF) ? 0X7FFF: ir3;
+
+        gte_push_sz(z12);
+
+        // screen position, only the MAC0 flags of these sums are kept
+        int64_t ratio = gte_divide(H, SZ(3));
+        int64_t x = ratio * IR(1) + OFX;
+        int64_t y = ratio * IR(2) + OFY;
+
+        gte_mac0_check(x);
+        gte_mac0_check(y);
+        gte_push_sxy((int32_t) (x >> 16), (int32_t) (y >> 16));
+
+        // depth cueing is only worked out for the last vertex
+        if (n == count - 1) {
+            int64_t depth = ratio * DQA + DQB;
+
+            gte_set_mac0(depth);
+            gte_set_ir0((int32_t) (depth >> 12));
+        }
+    }
+}
+
+void gte_interpolate(int64_t mac1, int64_t mac2, int64_t mac3, int shift, bool lm) {
+    // [MAC1,MAC2,MAC3] = MAC + (FC - MAC) * IR0
+    const int32_t *fc = gte.regs->vector[GTE_FC];
+    int64_t mac[3] = { mac1, mac2, mac3 };
+
+    for (int i = 0; i < 3; i++)
+        gte_set_mac_ir(i + 1, ((int64_t) fc[i] << 12) - mac[i], shift, false);
+    for (int i = 0; i < 3; i++)
+        gte_set_mac_ir(i + 1, (int64_t) IR(i + 1) * IR(0) + mac[i], shift, lm);
+}
+
+void gte_color_ir(int shift, bool lm) {
+    // [MAC1,MAC2,MAC3] = [R*IR1,G*IR2,B*IR3] SHL 4 SAR shift
+    for (int i = 1; i <= 3; i++)
+        gte_set_mac_ir(i, ((int64_t) ((RGBC >> ((i - 1) * 8)) & 0XFF) * IR(i)) << 4, shift, lm);
+}
+
+void gte_lighting(int n, int shift, bool lm) {
+    // IR = LLM * V, then IR = BK * 1000h + LCM * IR
+    int16_t vector[3];
+
+    gte_vector(n, vector);
+    gte_multiply(GTE_LLM, gte_zero, vector, shift, lm);
+    gte_ir_vector(vector);
+    gte_multiply(GTE_LCM, gte.regs->vector[GTE_BK], vector, shift, lm);
+}
+
+void gte_nclip(void) {
+    // MAC0 = the z of the cross product of the screen triangle's edges
+    int64_t value = (int64_t) SX(0) * SY(1) + (int64_t) SX(1) * SY(2) + (int64_t) SX(2) * SY(0) -
+                    (int64_t) SX(0) * SY(2) - (int64_t) SX(1) * SY(0) - (int64_t) SX(2) * SY(1);
+    gte_set_mac0(value);
+}
+
+void gte_op(int shift, bool lm) {
+    // outer product of IR and the diagonal of RT
+    const int16_t (*rt)[3] = gte.regs->matrix[GTE_RT];
+    int32_t d1 = rt[0][0], d2 = rt[1][1], d3 = rt[2][2];
+
+    gte_set_mac_ir(1, (int64_t) IR(3) * d2 - (int64_t) IR(2) * d3, shift, lm);
+    gte_set_mac_ir(2, (int64_t) IR(1) * d3 - (int64_t) IR(3) * d1, shift, lm);
+    gte_set_mac_ir(3, (int64_t) IR(2) * d1 - (int64_t) IR(1) * d2, shift, lm);
+}
+
+void gte_dpcs(uint32_t color, int shift, bool lm) {
+    // depth cue a colour towards FC
+    gte_interpolate((int64_t) (color & 0XFF) << 16, (int64_t) ((color >> 8) & 0XFF) << 16, (int64_t) ((color >> 16) & 0XFF) << 16, shift, lm);
+    gte_push_rgb();
+}
+
+void gte_intpl(int shift, bool lm) {
+    gte_interpolate((int64_t) IR(1) << 12, (int64_t) IR(2) << 12, (int64_t) IR(3) << 12, shift, lm);
+    gte_push_rgb();
+}
+
+void gte_mvmva(uint32_t command, int shift, bool lm) {
+    int16_t matrix[3][3], vector[3];
+    const int32_t *translation = (GTE_CV(command) == 3) ? gte_zero: gte.regs->vector[GTE_CV(command)];
+
+    if (GTE_MX(command) == 3) {
+        // there is no fourth matrix, the hardware picks up whatever is on the bus
+        const int16_t (*rt)[3] = gte.regs->matrix[GTE_RT];
+        int16_t r = (int16_t) ((RGBC & 0XFF) << 4);
+
+        matrix[0][0] = -r;       matrix[0][1] = r;        matrix[0][2] = IR(0);
+        matrix[1][0] = rt[0][2]; matrix[1][1] = rt[0][2]; matrix[1][2] = rt[0][2];
+        matrix[2][0] = rt[1][1]; matrix[2][1] = rt[1][1]; matrix[2][2] = rt[1][1];
+    } else
+        memcpy(matrix, gte.regs->matrix[GTE_MX(command)], sizeof(matrix));
+
+    if (GTE_V(command) == 3)
+        gte_ir_vector(vector);
+    else
+        gte_vector(GTE_V(command), vector);
+
+    if (GTE_CV(command) == 2) {
+        // translating by FC is broken, the first column is summed with the
+        // translation and only sets flags, the result is the other two columns
+        for (int i = 0; i < 3; i++) {
+            int64_t first = gte_mac_check(i + 1, ((int64_t) translation[i] << 12) + matrix[i][0] * vector[0]);
+            int64_t rest  = gte_mac_check(i + 1, matrix[i][1] * vector[1]) + matrix[i][2] * vector[2];
+
+            gte_set_ir(i + 1, (int32_t) (first >> shift), false);
+            gte_set_mac_ir(i + 1, rest, shift, lm);
+        }
+        return;
+    }
+
+    int64_t result[1][3];
+
+    gte.flag |= gte.transform((const int16_t (*)[3]) matrix, translation, (const int16_t (*)[3]) vector, 1, result);
+    for (int i = 0; i < 3; i++)
+        gte_set_mac_ir(i + 1, result[0][i], shift, lm);
+}
+
+void gte_ncds(int n, int shift, bool lm) {
+    // normal colour depth cue
+    gte_lighting(n, shift, lm);
+
+    int64_t mac[3];
+    for (int i = 1; i <= 3; i++)
+        mac[i - 1] = ((int64_t) ((RGBC >> ((i - 1) * 8)) & 0XFF) * IR(i)) << 4;
+
+    gte_interpolate(mac[0], mac[1], mac[2], shift, lm);
+    gte_push_rgb();
+}
+
+void gte_cdp(int shift, bool lm) {
+    // colour depth cue
+    int16_t vector[3];
+
+    gte_ir_vector(vector);
+    gte_multiply(GTE_LCM, gte.regs->vector[GTE_BK], vector, shift, lm);
+
+    int64_t mac[3];
+    for (int i = 1; i <= 3; i++)
+        mac[i - 1] = ((int64_t) ((RGBC >> ((i - 1) * 8)) & 0XFF) * IR(i)) << 4;
+
+    gte_interpolate(mac[0], mac[1], mac[2], shift, lm);
+    gte_push_rgb();
+}
+
+void gte_nccs(int n, int shift, bool lm) {
+    // normal colour colour
+    gte_lighting(n, shift, lm);
+    gte_color_ir(shift, lm);
+    gte_push_rgb();
+}
+
+void gte_cc(int shift, bool lm) {
+    // colour colour
+    int16_t vector[3];
+
+    gte_ir_vector(vector);
+    gte_multiply(GTE_LCM, gte.regs->vector[GTE_BK], vector, shift, lm);
+    gte_color_ir(shift, lm);
+    gte_push_rgb();
+}
+
+void gte_ncs(int n, int shift, bool lm) {
+    // normal colour
+    gte_lighting(n, shift, lm);
+    gte_push_rgb();
+}
+
+void gte_sqr(int shift, bool lm) {
+    for (int i = 1; i <= 3; i++)
+        gte_set_mac_ir(i, (int64_t) IR(i) * IR(i), shift, lm);
+}
+
+void gte_dcpl(int shift, bool lm) {
+    // depth cue the light colour in IR by RGBC
+    int64_t mac[3];
+    for (int i = 1; i <= 3; i++)
+        mac[i - 1] = ((int64_t) ((RGBC >> ((i - 1) * 8)) & 0XFF) * IR(i)) << 4;
+
+    gte_interpolate(mac[0], mac[1], mac[2], shift, lm);
+    gte_push_rgb();
+}
+
+void gte_avsz3(void) {
+    int64_t value = (int64_t) ZSF3 * (int32_t) (SZ(1) + SZ(2) + SZ(3));
+
+    gte_set_mac0(value);
+    gte_set_otz((int32_t) (value >> 12));
+}
+
+void gte_avsz4(void) {
+    int64_t value = (int64_t) ZSF4 * (int32_t) (SZ(0) + SZ(1) + SZ(2) + SZ(3));
+
+    gte_set_mac0(value);
+    gte_set_otz((int32_t) (value >> 12));
+}
+
+void gte_gpf(int shift, bool lm) {
+    // general purpose interpolation, MAC = IR0 * IR
+    for (int i = 1; i <= 3; i++)
+        gte_set_mac_ir(i, (int64_t) IR(0) * IR(i), shift, lm);
+    gte_push_rgb();
+}
+
+void gte_gpl(int shift, bool lm) {
+    // MAC = MAC + IR0 * IR
+    for (int i = 1; i <= 3; i++)
+        gte_set_mac_ir(i, ((int64_t) MAC(i) << shift) + (int64_t) IR(0) * IR(i), shift, lm);
+    gte_push_rgb();
+}
@@ -0,0 +1,130 @@
+#include "gte.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+// the 44 bit adder range, sums are biased by 2^43 so any bit over 44 is an overflow
+#define GTE_MAC_BIAS (1LL << 43)
+#define GTE_MAC_MASK ((1LL << 44) - 1)
+
+// kernel helpers
+static inline int64_t gte_wrap(int64_t sum, int row, uint32_t *flag);
+
+gte_transform_t gte_transform_select(void) {
+    // picked once at reset, every kernel gives the same sums and flags
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        printf("[LOG]: gte using avx2 transforms\n");
+        return gte_transform_avx2;
+    }
+    if (__builtin_cpu_supports("sse4.1")) {
+        printf("[LOG]: gte using sse4.1 transforms\n");
+        return gte_transform_sse41;
+    }
+#endif
+    printf("[LOG]: gte using scalar transforms\n");
+    return gte_transform_scalar;
+}
+
+uint32_t gte_transform_scalar(const int16_t matrix[3][3], const int32_t translation[3], const int16_t vectors[][3], uint32_t count, int64_t results[][3]) {
+    uint32_t flag = 0;
+
+    for (uint32_t n = 0; n < count; n++) {
+        for (int i = 0; i < 3; i++) {
+            int64_t sum = (int64_t) translation[i] * 0X1000;
+
+            for (int j = 0; j < 3; j++)
+                sum = gte_wrap(sum + matrix[i][j] * vectors[n][j], i, &flag);
+
+            results[n][i] = sum;
+        }
+    }
+    return flag;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+// the vector kernels carry every sum biased by 2^43 so a partial sum is in range
+// exactly when nothing is set above bit 43, the partial sums are or'd together
+// and tested once at the end. an overflow is rare (a huge translation) and
+// takes the scalar path, which wraps and flags each partial sum in turn
+
+__attribute__((target("sse4.1")))
+uint32_t gte_transform_sse41(const int16_t matrix[3][3], const int32_t translation[3], const int16_t vectors[][3], uint32_t count, int64_t results[][3]) {
+    // rows 0 and 1 share a register and row 2 sits alone, one 64 bit lane per row.
+    // the column loop is outside the vector loop so all vertices of an RTPT go
+    // through each column together as independent accumulators
+    const __m128i bias = _mm_set1_epi64x(GTE_MAC_BIAS);
+    __m128i column01[3], column2[3], sum01[3], sum2[3];
+    __m128i partial = _mm_setzero_si128();
+
+    for (int j = 0; j < 3; j++) {
+        column01[j] = _mm_set_epi64x(matrix[1][j], matrix[0][j]);
+        column2[j]  = _mm_set_epi64x(0, matrix[2][j]);
+    }
+    for (uint32_t n = 0; n < count; n++) {
+        sum01[n] = _mm_add_epi64(_mm_set_epi64x((int64_t) translation[1] * 0X1000, (int64_t) translation[0] * 0X1000), bias);
+        sum2[n]  = _mm_add_epi64(_mm_set_epi64x(0, (int64_t) translation[2] * 0X1000), bias);
+    }
+    for (int j = 0; j < 3; j++) {
+        for (uint32_t n = 0; n < count; n++) {
+            __m128i v = _mm_set1_epi64x(vectors[n][j]);
+
+            sum01[n] = _mm_add_epi64(sum01[n], _mm_mul_epi32(column01[j], v));
+            sum2[n]  = _mm_add_epi64(sum2[n],  _mm_mul_epi32(column2[j],  v));
+            partial  = _mm_or_si128(partial, _mm_or_si128(sum01[n], sum2[n]));
+        }
+    }
+    if (!_mm_testz_si128(partial, _mm_set1_epi64x(~GTE_MAC_MASK)))
+        return gte_transform_scalar(matrix, translation, vectors, count, results);
+
+    for (uint32_t n = 0; n < count; n++) {
+        _mm_storeu_si128((__m128i *) &results[n][0], _mm_sub_epi64(sum01[n], bias));
+        results[n][2] = _mm_cvtsi128_si64(sum2[n]) - GTE_MAC_BIAS;
+    }
+    return 0;
+}
+
+__attribute__((target("avx2")))
+uint32_t gte_transform_avx2(const int16_t matrix[3][3], const int32_t translation[3], const int16_t vectors[][3], uint32_t count, int64_t results[][3]) {
+    // all three rows in one register, lane 3 idles at the bias
+    const __m256i bias = _mm256_set1_epi64x(GTE_MAC_BIAS);
+    __m256i column[3], sum[3];
+    __m256i partial = _mm256_setzero_si256();
+    __m256i start = _mm256_add_epi64(_mm256_set_epi64x(0, (int64_t) translation[2] * 0X1000, (int64_t) translation[1] * 0X1000, (int64_t) translation[0] * 0X1000), bias);
+
+    for (int j = 0; j < 3; j++)
+        column[j] = _mm256_set_epi64x(0, matrix[2][j], matrix[1][j], matrix[0][j]);
+    for (uint32_t n = 0; n < count; n++)
+        sum[n] = start;
+
+    for (int j = 0; j < 3; j++) {
+        for (uint32_t n = 0; n < count; n++) {
+            sum[n]  = _mm256_add_epi64(sum[n], _mm256_mul_epi32(column[j], _mm256_set1_epi64x(vectors[n][j])));
+            partial = _mm256_or_si256(partial, sum[n]);
+        }
+    }
+    if (!_mm256_testz_si256(partial, _mm256_set1_epi64x(~GTE_MAC_MASK)))
+        return gte_transform_scalar(matrix, translation, vectors, count, results);
+
+    for (uint32_t n = 0; n < count; n++) {
+        __m256i result = _mm256_sub_epi64(sum[n], bias);
+
+        _mm_storeu_si128((__m128i *) &results[n][0], _mm256_castsi256_si128(result));
+        results[n][2] = _mm256_extract_epi64(result, 2);
+    }
+    return 0;
+}
+#endif
+
+// kernel helpers
+int64_t gte_wrap(int64_t sum, int row, uint32_t *flag) {
+    if (sum > GTE_MAC_BIAS - 1)
+        *flag |= GTE_FLAG_MAC_POSITIVE(row + 1);
+    else if (sum < -GTE_MAC_BIAS)
+        *flag |= GTE_FLAG_MAC_NEGATIVE(row + 1);
+
+    return (int64_t) ((uint64_t) sum << 20) >> 20;
+}
+
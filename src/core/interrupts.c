@@ -0,0 +1,34 @@
+#include "interrupts.h"
+
+static struct INTERRUPTS interrupts;
+
+struct INTERRUPTS *get_interrupts(void) { return &interrupts; }
+
+void interrupts_reset(void) {
+    interrupts.I_STAT = (uint32_t *) memory_pointer(ADDR_I_STAT);
+    interrupts.I_MASK = (uint32_t *) memory_pointer(ADDR_I_MASK);
+
+    *interrupts.I_STAT = 0;
+    *interrupts.I_MASK = 0;
+
+    interrupts_update();
+}
+
+void interrupts_request(enum IRQ irq) {
+    *interrupts.I_STAT |= 1 << irq;
+    interrupts_update();
+}
+
+void interrupts_acknowledge(uint32_t previous) {
+    // I_STAT bits are cleared by writing 0, writing 1 leaves them unchanged
+    *interrupts.I_STAT &= previous;
+    interrupts_update();
+}
+
+void interrupts_update(void) {
+    // the controller drives cop0 CAUSE bit 10, the cpu checks it against SR between instructions
+    struct CPU *cpu = get_cpu();
+    bool pending = (*interrupts.I_STAT & *interrupts.I_MASK & 0X7FF) != 0;
+
+    cpu->cop0.CAUSE.InterruptsPending = (cpu->cop0.CAUSE.InterruptsPending & ~1) | pending;
+}
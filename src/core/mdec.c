@@ -0,0 +1,334 @@
+#include "mdec.h"
+#include "dma.h"
+#include "mdec_thread.h"
+
+static struct MDEC mdec;
+
+// natural position of each coefficient in the zigzag order the data arrives in
+static const uint8_t mdec_zagzig[64] = {
+     0,  1,  8, 16,  9,  2,  3, 10, 17, 24, 32, 25, 18, 11,  4,  5,
+    12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13,  6,  7, 14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63
+};
+
+// helpers
+static void mdec_command(uint32_t value);
+static void mdec_command_done(void);
+static bool mdec_decoding(void);
+static uint32_t mdec_status(void);
+static uint32_t mdec_macroblock_words(void);
+static uint32_t mdec_macroblock(uint32_t *output);
+static bool mdec_decode_block(uint32_t *position, int16_t block[64], const uint8_t quant[64]);
+static void mdec_skip_padding(uint32_t *position);
+static void mdec_mono(const int16_t block[64], uint32_t *output);
+static void mdec_event(uint64_t timestamp);
+
+struct MDEC *get_mdec(void) { return &mdec; }
+
+void mdec_reset(void) {
+    mdec_idct_t idct = (mdec.idct) ? mdec.idct: mdec_idct_select();
+    mdec_rgb_t  rgb  = (mdec.rgb)  ? mdec.rgb:  mdec_rgb_select();
+
+    mdec_thread_cancel();
+    memset(&mdec, 0, sizeof(mdec));
+    mdec.block = MDEC_CR;
+    mdec.idct  = idct;
+    mdec.rgb   = rgb;
+
+    scheduler_register(EVENT_MDEC, mdec_event);
+    scheduler_cancel(EVENT_MDEC);
+}
+
+uint32_t mdec_read(uint32_t address) {
+    if (address == ADDR_MDEC_STATUS)
+        return mdec_status();
+
+    // data out, the next word of the macroblock being read
+    if (!mdec_decoding())
+        return 0;
+
+    if (mdec.output_read == mdec.output_size) {
+        mdec.output_size = mdec_macroblock(mdec.output);
+        mdec.output_read = 0;
+        if (mdec.output_size == 0)
+            return 0;
+    }
+    return mdec.output[mdec.output_read++];
+}
+
+void mdec_write(uint32_t address, uint32_t value) {
+    if (address == ADDR_MDEC_COMMAND) {
+        mdec_dma_in(&value, 1);
+        return;
+    }
+
+    // control, bit 31 aborts whatever is running, the tables are kept
+    if (value & (1U << 31)) {
+        mdec_thread_cancel();
+        mdec.command.value = 0;
+        mdec.expected = mdec.received = 0;
+        mdec.position = 0;
+        mdec.output_size = mdec.output_read = 0;
+        mdec.block = MDEC_CR;
+        mdec.transfer_ready = false;
+        scheduler_cancel(EVENT_MDEC);
+    }
+    mdec.dma_in  = (value >> 30) & 1;
+    mdec.dma_out = (value >> 29) & 1;
+
+    if (mdec.dma_in || mdec.dma_out)
+        dma_notify();
+}
+
+bool mdec_dma_in_ready(void) {
+    // takes the next command or its parameters, not while a decode is being read out
+    return mdec.dma_in && !mdec_decoding();
+}
+
+void mdec_dma_in(const uint32_t *words, uint32_t count) {
+    while (count > 0) {
+        if (mdec.received == mdec.expected) {
+            mdec_command(*words++);
+            count--;
+            continue;
+        }
+
+        // parameters are copied in bulk
+        uint32_t size = mdec.expected - mdec.received;
+        if (size > count)
+            size = count;
+
+        memcpy(&mdec.input[mdec.received * 2], words, size * 4);
+        mdec.received += size;
+        words += size;
+        count -= size;
+
+        if (mdec.received == mdec.expected)
+            mdec_command_done();
+    }
+}
+
+bool mdec_dma_out_ready(uint32_t count) {
+    if (!mdec.dma_out || !mdec_decoding())
+        return false;
+    if (mdec.transfer_ready)
+        return true;
+
+    // the transfer goes once the decoder would have got through the macroblocks it reads
+    if (!scheduler_pending(EVENT_MDEC)) {
+        uint32_t size   = mdec_macroblock_words();
+        uint32_t blocks = (mdec.command.depth >= MDEC_24BIT) ? 6: 1;
+        scheduler_schedule(EVENT_MDEC, (uint64_t) (count + size - 1) / size * blocks * MDEC_BLOCK_CYCLES);
+    }
+    return false;
+}
+
+void mdec_dma_out(uint32_t *words, uint32_t count) {
+    uint32_t size = mdec_macroblock_words();
+
+    // the rest of a macroblock an earlier read started
+    while (count > 0 && mdec.output_read < mdec.output_size) {
+        *words++ = mdec.output[mdec.output_read++];
+        count--;
+    }
+
+    // whole macroblocks are decoded straight into the destination
+    while (count >= size) {
+        if (mdec_macroblock(words) == 0)
+            break;
+        words += size;
+        count -= size;
+    }
+
+    // one split by the end of the transfer is kept for the next read
+    if (count > 0 && count < size) {
+        mdec.output_size = mdec_macroblock(mdec.output);
+        mdec.output_read = 0;
+        while (count > 0 && mdec.output_read < mdec.output_size) {
+            *words++ = mdec.output[mdec.output_read++];
+            count--;
+        }
+    }
+
+    // reading past the end of the data gives nothing useful
+    memset(words, 0, count * 4);
+    mdec.transfer_ready = false;
+}
+
+uint32_t mdec_decode_macroblock(uint32_t *position, uint32_t *output) {
+    // colour takes Cr, Cb then the four Y blocks, mono a single Y block. only the
+    // decode command's input and the tables are read, the worker thread runs this too
+    static const enum MDEC_BLOCK order[6] = { MDEC_CR, MDEC_CB, MDEC_Y1, MDEC_Y2, MDEC_Y3, MDEC_Y4 };
+    int16_t blocks[6][64];
+
+    if (mdec.command.depth < MDEC_24BIT) {
+        if (!mdec_decode_block(position, blocks[MDEC_Y4], mdec.quant[0])) {
+            *position = mdec.received * 2;
+            return 0;
+        }
+        mdec.idct(blocks[MDEC_Y4], mdec.scale);
+        mdec_mono(blocks[MDEC_Y4], output);
+        mdec_skip_padding(position);
+        return mdec_macroblock_words();
+    }
+
+    for (int i = 0; i < 6; i++) {
+        if (!mdec_decode_block(position, blocks[order[i]], mdec.quant[i < 2])) {
+            *position = mdec.received * 2;
+            return 0;
+        }
+        mdec.idct(blocks[order[i]], mdec.scale);
+    }
+    mdec_skip_padding(position);
+
+    mdec.rgb((const int16_t (*)[64]) blocks, mdec.command, output);
+    return mdec_macroblock_words();
+}
+
+// helpers
+void mdec_command(uint32_t value) {
+    mdec_thread_cancel();
+    mdec.command.value = value;
+    mdec.received    = 0;
+    mdec.position    = 0;
+    mdec.output_size = 0;
+    mdec.output_read = 0;
+    mdec.transfer_ready = false;
+    scheduler_cancel(EVENT_MDEC);
+
+    switch (mdec.command.op) {
+        case 1:  mdec.expected = mdec.command.words; break;
+        case 2:  mdec.expected = (value & 1) ? 32: 16; break;
+        case 3:  mdec.expected = 32; break;
+        default:
+            printf("[LOG]: mdec command %u not supported\n", mdec.command.op);
+            mdec.expected = 0;
+            break;
+    }
+
+    if (mdec.expected == 0)
+        mdec_command_done();
+}
+
+void mdec_command_done(void) {
+    switch (mdec.command.op) {
+        case 1:
+            // data is decoded as it is read out, or from here on by the worker
+            mdec.block = MDEC_CR;
+            if (mdec_thread_running())
+                mdec_thread_submit();
+            if (mdec.dma_out)
+                dma_notify();
+            break;
+        case 2:
+            // luma table, then chroma for colour
+            memcpy(mdec.quant[0], mdec.input, 64);
+            if (mdec.command.value & 1)
+                memcpy(mdec.quant[1], (uint8_t *) mdec.input + 64, 64);
+            break;
+        case 3:
+            memcpy(mdec.scale, mdec.input, sizeof(mdec.scale));
+            break;
+    }
+}
+
+bool mdec_decoding(void) {
+    // a decode command with all its data in and output left to read
+    return mdec.command.op == 1 && mdec.received == mdec.expected &&
+           (mdec.output_read < mdec.output_size || mdec.position < mdec.received * 2);
+}
+
+uint32_t mdec_status(void) {
+    bool decoding = mdec_decoding();
+    uint32_t status = 0;
+
+    if (!decoding)                                     status |= 1U << 31; // data out fifo empty
+    if (decoding || mdec.received < mdec.expected)     status |= 1U << 29; // busy
+    if (mdec.dma_in && !decoding)                      status |= 1U << 28; // data in request
+    if (mdec.dma_out && decoding)                      status |= 1U << 27; // data out request
+
+    status |= ((mdec.command.value >> 25) & 0XF) << 23;  // depth, sign and bit 15
+    status |= mdec.block << 16;
+    status |= (mdec.expected - mdec.received - 1) & 0XFFFF;
+    return status;
+}
+
+uint32_t mdec_macroblock_words(void) {
+    switch (mdec.command.depth) {
+        case MDEC_4BIT:  return 8;
+        case MDEC_8BIT:  return 16;
+        case MDEC_24BIT: return 192;
+        default:         return 128;
+    }
+}
+
+uint32_t mdec_macroblock(uint32_t *output) {
+    // the worker has decoded ahead when it was handed the command
+    if (mdec_thread_active())
+        return mdec_thread_take(output);
+    return mdec_decode_macroblock(&mdec.position, output);
+}
+
+bool mdec_decode_block(uint32_t *position, int16_t block[64], const uint8_t quant[64]) {
+    // run length coded, a dc term with the quantizer scale then run and level pairs
+    // with 10 bit signed levels, until the 63rd coefficient is passed
+    uint32_t end = mdec.received * 2;
+
+    mdec_skip_padding(position);
+    if (*position >= end)
+        return false;
+
+    memset(block, 0, 64 * sizeof(int16_t));
+
+    uint16_t halfword = mdec.input[(*position)++];
+    int32_t q_scale = (halfword >> 10) & 0X3F;
+    int32_t level   = (int32_t) ((uint32_t) halfword << 22) >> 22;
+    int32_t value   = (q_scale) ? level * quant[0]: level * 2;
+    block[0] = (value < -0X400) ? -0X400: (value > 0X3FF) ? 0X3FF: value;
+
+    for (uint32_t k = 0; *position < end;) {
+        halfword = mdec.input[(*position)++];
+        k += (halfword >> 10) + 1;
+        if (k > 63)
+            return true;
+
+        level = (int32_t) ((uint32_t) halfword << 22) >> 22;
+        value = (q_scale) ? (level * quant[k] * q_scale + 4) / 8: level * 2;
+        block[(q_scale) ? mdec_zagzig[k]: k] = (value < -0X400) ? -0X400: (value > 0X3FF) ? 0X3FF: value;
+
+        if (k == 63)
+            return true;
+    }
+    return false;
+}
+
+void mdec_skip_padding(uint32_t *position) {
+    // so the decode is seen to end with the last macroblock rather than the padding after it
+    while (*position < mdec.received * 2 && mdec.input[*position] == MDEC_PADDING)
+        (*position)++;
+}
+
+void mdec_mono(const int16_t block[64], uint32_t *output) {
+    uint8_t offset = (mdec.command.sign) ? 0: 0X80;
+    uint8_t bytes[64];
+
+    for (int i = 0; i < 64; i++)
+        bytes[i] = block[i] + offset;
+
+    if (mdec.command.depth == MDEC_8BIT) {
+        memcpy(output, bytes, 64);
+        return;
+    }
+
+    // 4 bits, the upper nibbles two to a byte
+    uint8_t nibbles[32];
+    for (int i = 0; i < 32; i++)
+        nibbles[i] = (bytes[i * 2] >> 4) | (bytes[i * 2 + 1] & 0XF0);
+    memcpy(output, nibbles, 32);
+}
+
+void mdec_event(uint64_t timestamp) {
+    mdec.transfer_ready = true;
+    dma_notify();
+}
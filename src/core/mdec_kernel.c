@@ -0,0 +1,305 @@
+#include "mdec.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+// colour conversion in 8.8 fixed point, R = Y + 1.402 Cr, G = Y - 0.3437 Cb - 0.7143 Cr, B = Y + 1.772 Cb
+#define MDEC_CR_R   359
+#define MDEC_CB_G  -88
+#define MDEC_CR_G  -183
+#define MDEC_CB_B   454
+
+// kernel helpers
+static inline int32_t mdec_clamp(int32_t value, int32_t min, int32_t max);
+static inline int32_t mdec_idct_round(int64_t sum);
+
+mdec_idct_t mdec_idct_select(void) {
+    // picked once at reset, every kernel gives the same pixels
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        printf("[LOG]: mdec using avx2 idct\n");
+        return mdec_idct_avx2;
+    }
+    if (__builtin_cpu_supports("sse4.1")) {
+        printf("[LOG]: mdec using sse4.1 idct\n");
+        return mdec_idct_sse41;
+    }
+#endif
+    printf("[LOG]: mdec using scalar idct\n");
+    return mdec_idct_scalar;
+}
+
+mdec_rgb_t mdec_rgb_select(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        printf("[LOG]: mdec using avx2 colour conversion\n");
+        return mdec_rgb_avx2;
+    }
+    if (__builtin_cpu_supports("sse4.1")) {
+        printf("[LOG]: mdec using sse4.1 colour conversion\n");
+        return mdec_rgb_sse41;
+    }
+#endif
+    printf("[LOG]: mdec using scalar colour conversion\n");
+    return mdec_rgb_scalar;
+}
+
+void mdec_idct_scalar(int16_t block[64], const int16_t scale[64]) {
+    // block = scale' * block * scale. the first pass fits 32 bits, the second
+    // needs 46 and keeps bits 32-40 rounded, sign extended from 9 bits
+    int32_t temp[64];
+
+    for (int y = 0; y < 8; y++) {
+        for (int x = 0; x < 8; x++) {
+            int32_t sum = 0;
+            for (int u = 0; u < 8; u++)
+                sum += block[u * 8 + x] * scale[u * 8 + y];
+            temp[y * 8 + x] = sum;
+        }
+    }
+    for (int y = 0; y < 8; y++) {
+        for (int x = 0; x < 8; x++) {
+            int64_t sum = 0;
+            for (int u = 0; u < 8; u++)
+                sum += (int64_t) temp[y * 8 + u] * scale[u * 8 + x];
+            block[y * 8 + x] = mdec_idct_round(sum);
+        }
+    }
+}
+
+void mdec_rgb_scalar(const int16_t blocks[6][64], union MDEC_COMMAND command, uint32_t *output) {
+    uint8_t pixels[16 * 16 * 3];
+    uint16_t *pixels15 = (uint16_t *) pixels;
+    int32_t offset = (command.sign) ? 0: 0X80;
+
+    for (int y = 0; y < 16; y++) {
+        for (int x = 0; x < 16; x++) {
+            const int16_t *luma = blocks[MDEC_Y1 + (y / 8) * 2 + x / 8];
+            int32_t cr = blocks[MDEC_CR][(y / 2) * 8 + x / 2];
+            int32_t cb = blocks[MDEC_CB][(y / 2) * 8 + x / 2];
+            int32_t l  = luma[(y % 8) * 8 + x % 8];
+
+            uint8_t r = mdec_clamp(l + ((MDEC_CR_R * cr) >> 8), -128, 127) + offset;
+            uint8_t g = mdec_clamp(l + ((MDEC_CB_G * cb + MDEC_CR_G * cr) >> 8), -128, 127) + offset;
+            uint8_t b = mdec_clamp(l + ((MDEC_CB_B * cb) >> 8), -128, 127) + offset;
+
+            if (command.depth == MDEC_24BIT) {
+                pixels[(y * 16 + x) * 3 + 0] = r;
+                pixels[(y * 16 + x) * 3 + 1] = g;
+                pixels[(y * 16 + x) * 3 + 2] = b;
+            } else
+                pixels15[y * 16 + x] = (r >> 3) | (g >> 3) << 5 | (b >> 3) << 10 | command.bit15 << 15;
+        }
+    }
+    memcpy(output, pixels, (command.depth == MDEC_24BIT) ? 16 * 16 * 3: 16 * 16 * 2);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("sse4.1")))
+void mdec_idct_sse41(int16_t block[64], const int16_t scale[64]) {
+    // the first pass pairs rows of the block for pmaddwd, 32 bit sums. the second
+    // multiplies 32x16 into 64 bit lanes two at a time and keeps the high halves
+    int32_t temp[64];
+    __m128i pairs[4][2], wide[8][4];
+    const __m128i round = _mm_set1_epi64x(1LL << 31);
+
+    for (int k = 0; k < 4; k++) {
+        __m128i a = _mm_loadu_si128((const __m128i *) &block[k * 16]);
+        __m128i b = _mm_loadu_si128((const __m128i *) &block[k * 16 + 8]);
+        pairs[k][0] = _mm_unpacklo_epi16(a, b);
+        pairs[k][1] = _mm_unpackhi_epi16(a, b);
+    }
+    for (int y = 0; y < 8; y++) {
+        __m128i lo = _mm_setzero_si128(), hi = _mm_setzero_si128();
+        for (int k = 0; k < 4; k++) {
+            __m128i coefficients = _mm_set1_epi32((uint16_t) scale[k * 16 + y] | (uint32_t) scale[k * 16 + 8 + y] << 16);
+            lo = _mm_add_epi32(lo, _mm_madd_epi16(pairs[k][0], coefficients));
+            hi = _mm_add_epi32(hi, _mm_madd_epi16(pairs[k][1], coefficients));
+        }
+        _mm_storeu_si128((__m128i *) &temp[y * 8 + 0], lo);
+        _mm_storeu_si128((__m128i *) &temp[y * 8 + 4], hi);
+    }
+
+    for (int u = 0; u < 8; u++) {
+        __m128i row = _mm_loadu_si128((const __m128i *) &scale[u * 8]);
+        wide[u][0] = _mm_cvtepi16_epi64(row);
+        wide[u][1] = _mm_cvtepi16_epi64(_mm_srli_si128(row, 4));
+        wide[u][2] = _mm_cvtepi16_epi64(_mm_srli_si128(row, 8));
+        wide[u][3] = _mm_cvtepi16_epi64(_mm_srli_si128(row, 12));
+    }
+    for (int y = 0; y < 8; y++) {
+        __m128i sum[4] = { round, round, round, round };
+        for (int u = 0; u < 8; u++) {
+            __m128i t = _mm_set1_epi32(temp[y * 8 + u]);
+            for (int j = 0; j < 4; j++)
+                sum[j] = _mm_add_epi64(sum[j], _mm_mul_epi32(t, wide[u][j]));
+        }
+
+        // high halves of the rounded sums back in order, then bits 32-40 sign extended
+        __m128i lo = _mm_shuffle_epi32(_mm_blend_epi16(_mm_srli_epi64(sum[0], 32), sum[1], 0XCC), _MM_SHUFFLE(3, 1, 2, 0));
+        __m128i hi = _mm_shuffle_epi32(_mm_blend_epi16(_mm_srli_epi64(sum[2], 32), sum[3], 0XCC), _MM_SHUFFLE(3, 1, 2, 0));
+        lo = _mm_srai_epi32(_mm_slli_epi32(lo, 23), 23);
+        hi = _mm_srai_epi32(_mm_slli_epi32(hi, 23), 23);
+        lo = _mm_min_epi32(_mm_max_epi32(lo, _mm_set1_epi32(-128)), _mm_set1_epi32(127));
+        hi = _mm_min_epi32(_mm_max_epi32(hi, _mm_set1_epi32(-128)), _mm_set1_epi32(127));
+
+        _mm_storeu_si128((__m128i *) &block[y * 8], _mm_packs_epi32(lo, hi));
+    }
+}
+
+__attribute__((target("avx2")))
+void mdec_idct_avx2(int16_t block[64], const int16_t scale[64]) {
+    // as the sse4.1 kernel with a whole row of eight in each register
+    int32_t temp[64];
+    __m256i pairs[4], wide[8][2];
+    const __m256i round = _mm256_set1_epi64x(1LL << 31);
+    const __m256i order = _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);
+
+    for (int k = 0; k < 4; k++) {
+        __m128i a = _mm_loadu_si128((const __m128i *) &block[k * 16]);
+        __m128i b = _mm_loadu_si128((const __m128i *) &block[k * 16 + 8]);
+        pairs[k] = _mm256_set_m128i(_mm_unpackhi_epi16(a, b), _mm_unpacklo_epi16(a, b));
+    }
+    for (int y = 0; y < 8; y++) {
+        __m256i sum = _mm256_setzero_si256();
+        for (int k = 0; k < 4; k++) {
+            __m256i coefficients = _mm256_set1_epi32((uint16_t) scale[k * 16 + y] | (uint32_t) scale[k * 16 + 8 + y] << 16);
+            sum = _mm256_add_epi32(sum, _mm256_madd_epi16(pairs[k], coefficients));
+        }
+        _mm256_storeu_si256((__m256i *) &temp[y * 8], sum);
+    }
+
+    for (int u = 0; u < 8; u++) {
+        __m128i row = _mm_loadu_si128((const __m128i *) &scale[u * 8]);
+        wide[u][0] = _mm256_cvtepi16_epi64(row);
+        wide[u][1] = _mm256_cvtepi16_epi64(_mm_srli_si128(row, 8));
+    }
+    for (int y = 0; y < 8; y++) {
+        __m256i lo = round, hi = round;
+        for (int u = 0; u < 8; u++) {
+            __m256i t = _mm256_set1_epi32(temp[y * 8 + u]);
+            lo = _mm256_add_epi64(lo, _mm256_mul_epi32(t, wide[u][0]));
+            hi = _mm256_add_epi64(hi, _mm256_mul_epi32(t, wide[u][1]));
+        }
+
+        __m256i value = _mm256_permutevar8x32_epi32(_mm256_blend_epi32(_mm256_srli_epi64(lo, 32), hi, 0XAA), order);
+        value = _mm256_srai_epi32(_mm256_slli_epi32(value, 23), 23);
+        value = _mm256_min_epi32(_mm256_max_epi32(value, _mm256_set1_epi32(-128)), _mm256_set1_epi32(127));
+
+        __m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi32(value, value), 0X08);
+        _mm_storeu_si128((__m128i *) &block[y * 8], _mm256_castsi256_si128(packed));
+    }
+}
+
+__attribute__((target("sse4.1")))
+static inline void mdec_chroma_sse41(const int16_t blocks[6][64], int row, __m128i *r, __m128i *g, __m128i *b) {
+    // the colour differences of a chroma row, 8 pixels wide before doubling.
+    // 359 Cr and 454 Cb are split as 256 + the rest to stay in 16 bits, G needs pmaddwd
+    __m128i cr = _mm_loadu_si128((const __m128i *) &blocks[MDEC_CR][row * 8]);
+    __m128i cb = _mm_loadu_si128((const __m128i *) &blocks[MDEC_CB][row * 8]);
+    __m128i g_weights = _mm_set1_epi32((uint16_t) MDEC_CB_G | (uint32_t) (uint16_t) MDEC_CR_G << 16);
+
+    *r = _mm_add_epi16(cr, _mm_srai_epi16(_mm_mullo_epi16(cr, _mm_set1_epi16(MDEC_CR_R - 256)), 8));
+    *b = _mm_add_epi16(cb, _mm_srai_epi16(_mm_mullo_epi16(cb, _mm_set1_epi16(MDEC_CB_B - 256)), 8));
+    *g = _mm_packs_epi32(_mm_srai_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(cb, cr), g_weights), 8),
+                         _mm_srai_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(cb, cr), g_weights), 8));
+}
+
+__attribute__((target("sse4.1")))
+static inline __m128i mdec_channel_sse41(__m128i luma, __m128i difference, __m128i offset) {
+    return _mm_add_epi16(_mm_min_epi16(_mm_max_epi16(_mm_add_epi16(luma, difference), _mm_set1_epi16(-128)), _mm_set1_epi16(127)), offset);
+}
+
+__attribute__((target("sse4.1")))
+static inline void mdec_store_sse41(__m128i r, __m128i g, __m128i b, union MDEC_COMMAND command, uint8_t *output) {
+    // eight pixels, 16 bit lanes holding 0-255 (or the signed bytes)
+    const __m128i low = _mm_set1_epi16(0XFF);
+    r = _mm_and_si128(r, low);
+    g = _mm_and_si128(g, low);
+    b = _mm_and_si128(b, low);
+
+    if (command.depth == MDEC_15BIT) {
+        __m128i pixels = _mm_or_si128(_mm_or_si128(_mm_srli_epi16(r, 3), _mm_slli_epi16(_mm_srli_epi16(g, 3), 5)),
+                                      _mm_or_si128(_mm_slli_epi16(_mm_srli_epi16(b, 3), 10), _mm_set1_epi16(command.bit15 << 15)));
+        _mm_storeu_si128((__m128i *) output, pixels);
+        return;
+    }
+
+    // r and g bytes in one register, b in another, shuffled into R G B order
+    __m128i rg = _mm_packus_epi16(r, g);
+    __m128i bb = _mm_packus_epi16(b, b);
+    __m128i first  = _mm_or_si128(_mm_shuffle_epi8(rg, _mm_setr_epi8(0, 8, -1, 1, 9, -1, 2, 10, -1, 3, 11, -1, 4, 12, -1, 5)),
+                                  _mm_shuffle_epi8(bb, _mm_setr_epi8(-1, -1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1)));
+    __m128i second = _mm_or_si128(_mm_shuffle_epi8(rg, _mm_setr_epi8(13, -1, 6, 14, -1, 7, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1)),
+                                  _mm_shuffle_epi8(bb, _mm_setr_epi8(-1, 5, -1, -1, 6, -1, -1, 7, -1, -1, -1, -1, -1, -1, -1, -1)));
+    _mm_storeu_si128((__m128i *) output, first);
+    _mm_storel_epi64((__m128i *) (output + 16), second);
+}
+
+__attribute__((target("sse4.1")))
+void mdec_rgb_sse41(const int16_t blocks[6][64], union MDEC_COMMAND command, uint32_t *output) {
+    // a row of 16 pixels is two halves of 8, each chroma value covers two pixels across
+    const __m128i offset = _mm_set1_epi16((command.sign) ? 0: 0X80);
+    uint32_t pixel_size = (command.depth == MDEC_24BIT) ? 3: 2;
+    uint8_t *bytes = (uint8_t *) output;
+
+    for (int y = 0; y < 16; y++) {
+        __m128i r, g, b;
+        mdec_chroma_sse41(blocks, y / 2, &r, &g, &b);
+
+        for (int half = 0; half < 2; half++) {
+            const int16_t *luma = blocks[MDEC_Y1 + (y / 8) * 2 + half];
+            __m128i l = _mm_loadu_si128((const __m128i *) &luma[(y % 8) * 8]);
+            __m128i r2 = (half) ? _mm_unpackhi_epi16(r, r): _mm_unpacklo_epi16(r, r);
+            __m128i g2 = (half) ? _mm_unpackhi_epi16(g, g): _mm_unpacklo_epi16(g, g);
+            __m128i b2 = (half) ? _mm_unpackhi_epi16(b, b): _mm_unpacklo_epi16(b, b);
+
+            mdec_store_sse41(mdec_channel_sse41(l, r2, offset), mdec_channel_sse41(l, g2, offset), mdec_channel_sse41(l, b2, offset),
+                             command, bytes + (y * 16 + half * 8) * pixel_size);
+        }
+    }
+}
+
+__attribute__((target("avx2")))
+void mdec_rgb_avx2(const int16_t blocks[6][64], union MDEC_COMMAND command, uint32_t *output) {
+    // a whole row of 16 pixels in each register, stored as two halves
+    const __m256i offset = _mm256_set1_epi16((command.sign) ? 0: 0X80);
+    const __m256i min = _mm256_set1_epi16(-128), max = _mm256_set1_epi16(127);
+    uint32_t pixel_size = (command.depth == MDEC_24BIT) ? 3: 2;
+    uint8_t *bytes = (uint8_t *) output;
+
+    for (int y = 0; y < 16; y++) {
+        __m128i r, g, b;
+        mdec_chroma_sse41(blocks, y / 2, &r, &g, &b);
+
+        const int16_t *left  = blocks[MDEC_Y1 + (y / 8) * 2];
+        const int16_t *right = blocks[MDEC_Y2 + (y / 8) * 2];
+        __m256i l  = _mm256_set_m128i(_mm_loadu_si128((const __m128i *) &right[(y % 8) * 8]), _mm_loadu_si128((const __m128i *) &left[(y % 8) * 8]));
+        __m256i r2 = _mm256_set_m128i(_mm_unpackhi_epi16(r, r), _mm_unpacklo_epi16(r, r));
+        __m256i g2 = _mm256_set_m128i(_mm_unpackhi_epi16(g, g), _mm_unpacklo_epi16(g, g));
+        __m256i b2 = _mm256_set_m128i(_mm_unpackhi_epi16(b, b), _mm_unpacklo_epi16(b, b));
+
+        r2 = _mm256_add_epi16(_mm256_min_epi16(_mm256_max_epi16(_mm256_add_epi16(l, r2), min), max), offset);
+        g2 = _mm256_add_epi16(_mm256_min_epi16(_mm256_max_epi16(_mm256_add_epi16(l, g2), min), max), offset);
+        b2 = _mm256_add_epi16(_mm256_min_epi16(_mm256_max_epi16(_mm256_add_epi16(l, b2), min), max), offset);
+
+        uint8_t *row = bytes + y * 16 * pixel_size;
+        mdec_store_sse41(_mm256_castsi256_si128(r2), _mm256_castsi256_si128(g2), _mm256_castsi256_si128(b2), command, row);
+        mdec_store_sse41(_mm256_extracti128_si256(r2, 1), _mm256_extracti128_si256(g2, 1), _mm256_extracti128_si256(b2, 1), command, row + 8 * pixel_size);
+    }
+}
+#endif
+
+// kernel helpers
+int32_t mdec_clamp(int32_t value, int32_t min, int32_t max) {
+    return (value < min) ? min: (value > max) ? max: value;
+}
+
+int32_t mdec_idct_round(int64_t sum) {
+    // bits 32-40 of the sum rounded at bit 31, as a signed 9 bit value clamped to a byte
+    int32_t value = (int32_t) ((uint64_t) (sum + (1LL << 31)) >> 32);
+    return mdec_clamp((int32_t) ((uint32_t) value << 23) >> 23, -128, 127);
+}
@@ -0,0 +1,140 @@
+#include "mdec_thread.h"
+#include <sched.h>
+
+static struct MDEC_THREAD mdec_thread;
+
+// worker helpers
+static void *mdec_thread_main(void *arg);
+
+struct MDEC_THREAD *get_mdec_thread(void) { return &mdec_thread; }
+
+bool mdec_thread_running(void) { return mdec_thread.running; }
+
+bool mdec_thread_active(void) { return mdec_thread.active; }
+
+void mdec_thread_start(void) {
+    mdec_thread.output = malloc(MDEC_THREAD_OUTPUT_WORDS * sizeof(uint32_t));
+    if (mdec_thread.output == NULL) {
+        print_mdec_thread_error("mdec_thread_start", "Cannot allocate %u words of output", MDEC_THREAD_OUTPUT_WORDS);
+        exit(1);
+    }
+
+    mdec_thread.job    = false;
+    mdec_thread.stop   = false;
+    mdec_thread.active = false;
+    atomic_store(&mdec_thread.cancel, false);
+
+    pthread_mutex_init(&mdec_thread.lock, NULL);
+    pthread_cond_init(&mdec_thread.wake, NULL);
+    pthread_cond_init(&mdec_thread.idle, NULL);
+
+    if (pthread_create(&mdec_thread.thread, NULL, mdec_thread_main, NULL) != 0) {
+        print_mdec_thread_error("mdec_thread_start", "Cannot create the mdec thread", NULL);
+        exit(1);
+    }
+    mdec_thread.running = true;
+}
+
+void mdec_thread_stop(void) {
+    if (!mdec_thread.running)
+        return;
+
+    mdec_thread_cancel();
+
+    pthread_mutex_lock(&mdec_thread.lock);
+    mdec_thread.stop = true;
+    pthread_cond_signal(&mdec_thread.wake);
+    pthread_mutex_unlock(&mdec_thread.lock);
+
+    pthread_join(mdec_thread.thread, NULL);
+    mdec_thread.running = false;
+
+    pthread_cond_destroy(&mdec_thread.idle);
+    pthread_cond_destroy(&mdec_thread.wake);
+    pthread_mutex_destroy(&mdec_thread.lock);
+
+    free(mdec_thread.output);
+    mdec_thread.output = NULL;
+}
+
+void mdec_thread_submit(void) {
+    // the input and tables stay untouched until the job is cancelled
+    atomic_store_explicit(&mdec_thread.produced, 0, memory_order_relaxed);
+    atomic_store_explicit(&mdec_thread.finished, false, memory_order_relaxed);
+    atomic_store_explicit(&mdec_thread.cancel, false, memory_order_relaxed);
+    mdec_thread.active = true;
+    mdec_thread.taken  = 0;
+
+    pthread_mutex_lock(&mdec_thread.lock);
+    mdec_thread.job = true;
+    pthread_cond_signal(&mdec_thread.wake);
+    pthread_mutex_unlock(&mdec_thread.lock);
+}
+
+void mdec_thread_cancel(void) {
+    // a new command, reset or loaded state replaces what the worker reads from
+    if (!mdec_thread.active)
+        return;
+
+    atomic_store_explicit(&mdec_thread.cancel, true, memory_order_relaxed);
+
+    pthread_mutex_lock(&mdec_thread.lock);
+    while (mdec_thread.job)
+        pthread_cond_wait(&mdec_thread.idle, &mdec_thread.lock);
+    pthread_mutex_unlock(&mdec_thread.lock);
+
+    mdec_thread.active = false;
+}
+
+uint32_t mdec_thread_take(uint32_t *output) {
+    // the next macroblock in order, waiting on the worker if it is not there yet
+    struct MDEC *mdec = get_mdec();
+    uint32_t index = mdec_thread.taken;
+
+    while (atomic_load_explicit(&mdec_thread.produced, memory_order_acquire) <= index) {
+        if (atomic_load_explicit(&mdec_thread.finished, memory_order_acquire) &&
+            atomic_load_explicit(&mdec_thread.produced, memory_order_acquire) <= index) {
+            mdec->position = mdec->received * 2;
+            return 0;
+        }
+        sched_yield();
+    }
+
+    memcpy(output, mdec_thread.output + index * mdec_thread.size, mdec_thread.size * sizeof(uint32_t));
+    mdec->position = mdec_thread.positions[index];
+    mdec_thread.taken++;
+    return mdec_thread.size;
+}
+
+// worker helpers
+void *mdec_thread_main(void *arg) {
+    for (;;) {
+        pthread_mutex_lock(&mdec_thread.lock);
+        while (!mdec_thread.job && !mdec_thread.stop)
+            pthread_cond_wait(&mdec_thread.wake, &mdec_thread.lock);
+        if (mdec_thread.stop) {
+            pthread_mutex_unlock(&mdec_thread.lock);
+            break;
+        }
+        pthread_mutex_unlock(&mdec_thread.lock);
+
+        uint32_t position = 0, count = 0, offset = 0;
+        while (!atomic_load_explicit(&mdec_thread.cancel, memory_order_relaxed)) {
+            uint32_t size = mdec_decode_macroblock(&position, mdec_thread.output + offset);
+            if (size == 0)
+                break;
+
+            mdec_thread.size = size;
+            mdec_thread.positions[count] = position;
+            offset += size;
+            atomic_store_explicit(&mdec_thread.produced, ++count, memory_order_release);
+        }
+        atomic_store_explicit(&mdec_thread.finished, true, memory_order_release);
+
+        pthread_mutex_lock(&mdec_thread.lock);
+        mdec_thread.job = false;
+        pthread_cond_signal(&mdec_thread.idle);
+        pthread_mutex_unlock(&mdec_thread.lock);
+    }
+    return NULL;
+}
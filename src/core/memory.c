@@ -1,4 +1,9 @@
 #include "memory.h"
+#include "dma.h"
+#include "timers.h"
+#include "mdec.h"
+#include "cdrom.h"
+#include "interrupts.h"
 
 static struct MEMORY memory;
 
@@ -10,10 +15,87 @@ static uint32_t segment_lookup[] = {
     (uint32_t) 0XFFFFFFFF, (uint32_t) 0XFFFFFFFF               // KSEG2
 };
 
+/* CPU fast path page tables, one host pointer per 64K page of the virtual address space      *
+ * pages holding RAM, BIOS and the expansion regions point straight at the backing array,     *
+ * a NULL entry sends the access down the memory_cpu_map slow path (IO ports, scratchpad e.t.c.) */
+static uint8_t *page_table_read[MEMORY_PAGE_COUNT];
+static uint8_t *page_table_write[MEMORY_PAGE_COUNT];
+
+/* 4K pages of RAM that hold cached CPU code, their 64K page is write protected so stores reach the slow path */
+static bool code_pages[sizeof(((struct MEMORY *) 0)->MAIN.mem) >> MEMORY_CODE_PAGE_SHIFT];
+
+/* 4K pages of RAM and VRAM written since the last incremental snapshot, set on every store path    *
+ * (including dma and the software rasterizer) and cleared by whoever takes the snapshot            */
+static bool ram_dirty[MEMORY_RAM_DIRTY_PAGES];
+static bool vram_dirty[MEMORY_VRAM_DIRTY_PAGES];
+
 static PSX_ERROR memory_cpu_map(uint8_t **segment, uint32_t *address, uint32_t *mask, uint32_t aligned, bool load);
+static void memory_cpu_load_io(uint32_t address, uint32_t *result, uint32_t width, const char *caller);
+static void memory_cpu_store_io(uint32_t address, uint32_t data, uint32_t width, const char *caller);
+static void memory_cpu_code_written(uint32_t address);
+static void memory_cpu_map_pages(uint8_t **page_table, uint32_t region, uint32_t size, uint8_t *segment);
+static void memory_cpu_unmap_pages(uint8_t **page_table, uint32_t region, uint32_t size);
 
 struct MEMORY *get_memory() {return &memory;}
 
+PSX_ERROR memory_create(void) {
+    memset(page_table_read,  0, sizeof(page_table_read));
+    memset(page_table_write, 0, sizeof(page_table_write));
+    memset(code_pages, 0, sizeof(code_pages));
+
+    // nothing is known about what the last snapshot holds
+    memory_dirty_all();
+
+    // KUSEG, KSEG0 and KSEG1 all mirror the same physical regions
+    memory_cpu_map_pages(page_table_read,  0X00000000, sizeof(memory.MAIN.mem),        memory.MAIN.mem);
+    memory_cpu_map_pages(page_table_write, 0X00000000, sizeof(memory.MAIN.mem),        memory.MAIN.mem);
+    memory_cpu_map_pages(page_table_read,  0X1F000000, sizeof(memory.EXPANSION_1.mem), memory.EXPANSION_1.mem);
+    memory_cpu_map_pages(page_table_write, 0X1F000000, sizeof(memory.EXPANSION_1.mem), memory.EXPANSION_1.mem);
+    memory_cpu_map_pages(page_table_read,  0X1FC00000, sizeof(memory.BIOS.mem),        memory.BIOS.mem);
+
+    // KSEG2, only the cache control register lives here
+    for (uint32_t page = 0XC0000000 >> MEMORY_PAGE_SHIFT; page < MEMORY_PAGE_COUNT; page++) {
+        uint8_t *segment = memory.KSEG2.mem + ((page << MEMORY_PAGE_SHIFT) - 0XC0000000);
+        page_table_read[page]  = segment;
+        page_table_write[page] = segment;
+    }
+
+    memory_cpu_isolate_cache(cop0_SR_Isc());
+
+    return NO_ERROR;
+}
+
+void memory_cpu_isolate_cache(bool isolate) {
+    // with the cache isolated, RAM accesses land in the cache (scratchpad),
+    // so take RAM out of the fast path and let memory_cpu_map redirect them
+    if (isolate) {
+        memory_cpu_unmap_pages(page_table_read,  0X00000000, sizeof(memory.MAIN.mem));
+        memory_cpu_unmap_pages(page_table_write, 0X00000000, sizeof(memory.MAIN.mem));
+    } else {
+        memory_cpu_map_pages(page_table_read, 0X00000000, sizeof(memory.MAIN.mem), memory.MAIN.mem);
+
+        // pages holding cached code stay write protected
+        for (uint32_t page = 0; page < sizeof(memory.MAIN.mem); page += MEMORY_PAGE_SIZE) {
+            bool code = false;
+            for (uint32_t i = 0; i < MEMORY_PAGE_SIZE; i += MEMORY_CODE_PAGE_SIZE) {
+                code |= code_pages[(page + i) >> MEMORY_CODE_PAGE_SHIFT];
+            }
+            if (!code) {
+                memory_cpu_map_pages(page_table_write, page, MEMORY_PAGE_SIZE, memory.MAIN.mem + page);
+            }
+        }
+    }
+}
+
+void memory_cpu_watch_code(uint32_t address) {
+    uint32_t physical = address & 0X1FFFFFFF;
+    if (physical >= sizeof(memory.MAIN.mem) || code_pages[physical >> MEMORY_CODE_PAGE_SHIFT])
+        return;
+
+    code_pages[physical >> MEMORY_CODE_PAGE_SHIFT] = true;
+    memory_cpu_unmap_pages(page_table_write, physical & ~MEMORY_PAGE_MASK, MEMORY_PAGE_SIZE);
+}
+
 PSX_ERROR memory_load_bios(const char *filebios) {
     FILE *fp;
     if ((fp = fopen(filebios, "rb")) == NULL) {
@@ -27,6 +109,14 @@ PSX_ERROR memory_load_bios(const char *filebios) {
     return set_PSX_error(NO_ERROR);
 }
 
+bool *memory_ram_dirty(void)  { return ram_dirty; }
+bool *memory_vram_dirty(void) { return vram_dirty; }
+
+void memory_dirty_all(void) {
+    memset(ram_dirty,  true, sizeof(ram_dirty));
+    memset(vram_dirty, true, sizeof(vram_dirty));
+}
+
 uint8_t *memory_VRAM_pointer(void) {
     return memory.VRAM.mem;
 }
@@ -40,12 +130,37 @@ uint8_t *memory_pointer(uint32_t address) {
     return segment + address;
 }
 
+/* resolves a virtual address for the load/store routines, RAM/BIOS pages are a single table *
+ * lookup. Returns NULL when the page has no direct mapping and needs the slow path          */
+static inline uint8_t *memory_cpu_lookup(uint8_t **page_table, uint32_t *address, uint32_t alignment, bool load) {
+    #ifdef DEBUG
+    memory.address_accessed = *address; // used for debugging
+    #endif
+
+    if (*address & (alignment - 1)) {
+        if (load) cpu_exception(ADEL);
+        else      cpu_exception(ADES);
+    }
+
+    uint8_t *segment = page_table[*address >> MEMORY_PAGE_SHIFT];
+    if (segment != NULL) {
+        *address &= MEMORY_PAGE_MASK;
+    }
+    return segment;
+}
+
+/* fast path stores only know the host pointer, RAM is told apart from the other direct pages by range */
+static inline void memory_cpu_touch(const uint8_t *byte) {
+    uintptr_t offset = (uintptr_t) byte - (uintptr_t) memory.MAIN.mem;
+    if (offset < sizeof(memory.MAIN.mem))
+        ram_dirty[offset >> MEMORY_DIRTY_PAGE_SHIFT] = true;
+}
 
 void memory_cpu_load_8bit(uint32_t address, uint32_t *result) {
-    uint8_t *segment = NULL;
-    if (memory_cpu_map(&segment, &address, NULL, 1, true) != NO_ERROR) {
-        print_memory_error("memory_cpu_load_8bit", "ADDRESS: 0X%08x", address);
-        exit(1);
+    uint8_t *segment = memory_cpu_lookup(page_table_read, &address, 1, true);
+    if (segment == NULL) {
+        memory_cpu_load_io(address, result, 1, "memory_cpu_load_8bit");
+        return;
     }
 
     uint8_t b0 = *(segment + address + 0);
@@ -54,25 +169,22 @@ void memory_cpu_load_8bit(uint32_t address, uint32_t *result) {
 }
 
 void memory_cpu_store_8bit(uint32_t address, uint32_t data) {
-    uint8_t *segment = NULL;
-    uint32_t mask = 0XFFFFFFFF;
-    if (memory_cpu_map(&segment, &address, &mask, 1, false) != NO_ERROR) {
-        print_memory_error("memory_cpu_store_8bit", "ADDRESS: 0X%08x", address);
-        printf("%x\n", address);
-        exit(1);
+    uint8_t *segment = memory_cpu_lookup(page_table_write, &address, 1, false);
+    if (segment == NULL) {
+        memory_cpu_store_io(address, data, 1, "memory_cpu_store_8bit");
+        return;
     }
-    
-    data &= mask;
 
     uint8_t b0 = (data >> 0) & 0X000000FF;
     *(segment + address + 0) = b0;
+    memory_cpu_touch(segment + address);
 }
 
 void memory_cpu_load_16bit(uint32_t address, uint32_t *result) {
-    uint8_t *segment = NULL;
-    if (memory_cpu_map(&segment, &address, NULL, 2, true) != NO_ERROR) {
-        print_memory_error("memory_cpu_load_16bit", "ADDRESS: 0X%08x", address);
-        exit(1);
+    uint8_t *segment = memory_cpu_lookup(page_table_read, &address, 2, true);
+    if (segment == NULL) {
+        memory_cpu_load_io(address, result, 2, "memory_cpu_load_16bit");
+        return;
     }
 
     uint8_t b0 = *(segment + address + 0);
@@ -83,26 +195,25 @@ void memory_cpu_load_16bit(uint32_t address, uint32_t *result) {
 }
 
 void memory_cpu_store_16bit(uint32_t address, uint32_t data) {
-    uint8_t *segment = NULL;
-    uint32_t mask = 0XFFFFFFFF;
-    if (memory_cpu_map(&segment, &address, &mask, 2, false) != NO_ERROR) {
-        print_memory_error("memory_cpu_store_16bit", "ADDRESS: 0X%08x", address);
-        exit(1);
+    uint8_t *segment = memory_cpu_lookup(page_table_write, &address, 2, false);
+    if (segment == NULL) {
+        memory_cpu_store_io(address, data, 2, "memory_cpu_store_16bit");
+        return;
     }
-    data &=mask;
 
     uint8_t b0 = (data >> 0) & 0X000000FF;
     uint8_t b1 = (data >> 8) & 0X000000FF;
 
     *(segment + address + 0) = b0;
     *(segment + address + 1) = b1;
+    memory_cpu_touch(segment + address);
 }
 
 void memory_cpu_load_32bit(uint32_t address, uint32_t *result) {
-    uint8_t *segment = NULL;
-    if (memory_cpu_map(&segment, &address, NULL, 4, true) != NO_ERROR) {
-        print_memory_error("memory_cpu_load_32bit", "ADDRESS: 0X%08x", address);
-        exit(1);
+    uint8_t *segment = memory_cpu_lookup(page_table_read, &address, 4, true);
+    if (segment == NULL) {
+        memory_cpu_load_io(address, result, 4, "memory_cpu_load_32bit");
+        return;
     }
 
     uint8_t b0 = *(segment + address + 0);
@@ -115,13 +226,11 @@ void memory_cpu_load_32bit(uint32_t address, uint32_t *result) {
 }
 
 void memory_cpu_store_32bit(uint32_t address, uint32_t data) {
-    uint8_t *segment = NULL;
-    uint32_t mask = 0XFFFFFFFF;
-    if (memory_cpu_map(&segment, &address, &mask, 4, false) != NO_ERROR) {
-        print_memory_error("memory_cpu_store_32bit", "ADDRESS: 0X%08x\n", address);
-        exit(1);
+    uint8_t *segment = memory_cpu_lookup(page_table_write, &address, 4, false);
+    if (segment == NULL) {
+        memory_cpu_store_io(address, data, 4, "memory_cpu_store_32bit");
+        return;
     }
-    data &= mask;
 
     uint8_t b0 = (data >>  0) & 0X000000FF;
     uint8_t b1 = (data >>  8) & 0X000000FF;
@@ -133,7 +242,131 @@ void memory_cpu_store_32bit(uint32_t address, uint32_t data) {
     segment[address + 1] = b1;
     segment[address + 2] = b2;
     segment[address + 3] = b3;
+    memory_cpu_touch(segment + address);
+}
+
+/* Slow path for pages without a direct mapping, resolves the address through memory_cpu_map *
+ * and lets devices react to their registers being written                                  */
+void memory_cpu_load_io(uint32_t address, uint32_t *result, uint32_t width, const char *caller) {
+    uint8_t *segment = NULL;
+    uint32_t virtual = address;
+    if (memory_cpu_map(&segment, &address, NULL, width, true) != NO_ERROR) {
+        print_memory_error(caller, "ADDRESS: 0X%08x", virtual);
+        exit(1);
+    }
 
+    // vram to cpu copies produce the next word as GPUREAD is read
+    uint32_t region = virtual & segment_lookup[virtual >> 29];
+    if (region >= 0X1F801810 && region < 0X1F801814) {
+        gpu_execute();
+    }
+    // root counters are only brought up to date when read
+    else if (region >= ADDR_TIMER_0 && region < ADDR_TIMERS_END) {
+        uint32_t value = timers_read(region & ~0X3) >> ((region & 0X3) * 8);
+        *result = (width == 4) ? value: value & ((1 << (width * 8)) - 1);
+        return;
+    }
+    // cdrom registers depend on the index and reading the fifos pops them
+    else if (region >= ADDR_CDROM_STATUS && region < ADDR_CDROM_END) {
+        *result = cdrom_read(region, width);
+        return;
+    }
+    // mdec data out is decoded as it is read
+    else if (region >= ADDR_MDEC_DATA && region < ADDR_MDEC_END) {
+        uint32_t value = mdec_read(region & ~0X3) >> ((region & 0X3) * 8);
+        *result = (width == 4) ? value: value & ((1 << (width * 8)) - 1);
+        return;
+    }
+
+    *result = 0;
+    for (uint32_t i = 0; i < width; i++) {
+        *result |= segment[address + i] << (i * 8);
+    }
+}
+
+void memory_cpu_store_io(uint32_t address, uint32_t data, uint32_t width, const char *caller) {
+    uint8_t *segment = NULL;
+    uint32_t mask = 0XFFFFFFFF, virtual = address;
+    if (memory_cpu_map(&segment, &address, &mask, width, false) != NO_ERROR) {
+        print_memory_error(caller, "ADDRESS: 0X%08x", virtual);
+        exit(1);
+    }
+    data &= mask;
+
+    uint32_t i_stat = memory.IO_PORTS.i_stat;
+    uint32_t dicr   = memory.IO_PORTS.dicr;
+
+    for (uint32_t i = 0; i < width; i++) {
+        segment[address + i] = (data >> (i * 8)) & 0X000000FF;
+    }
+
+    uint32_t region = virtual & segment_lookup[virtual >> 29];
+
+    // written code invalidates the cached blocks decoded from it
+    if (segment == memory.MAIN.mem) {
+        ram_dirty[address >> MEMORY_DIRTY_PAGE_SHIFT] = true;
+        memory_cpu_code_written(address);
+    }
+    // GP0 words go to the packet decoder, GP1 commands run as they are written
+    else if (region >= 0X1F801810 && region < 0X1F801814) {
+        gpu_write_gp0(data);
+    }
+    else if (region >= 0X1F801814 && region < 0X1F801818) {
+        gpu_execute();
+    }
+    else if (region >= ADDR_DMA_DIRC && region < ADDR_DMA_DIRC + 4) {
+        dma_acknowledge(dicr);
+    }
+    // a channel may have been started
+    else if (region >= ADDR_DMA0_MDEC_IN && region < ADDR_DMA_DIRC) {
+        dma_notify();
+    }
+    else if (region >= ADDR_TIMER_0 && region < ADDR_TIMERS_END) {
+        timers_write(region);
+    }
+    else if (region >= ADDR_CDROM_STATUS && region < ADDR_CDROM_END) {
+        for (uint32_t i = 0; i < width && region + i < ADDR_CDROM_END; i++)
+            cdrom_write(region + i, data >> (i * 8));
+    }
+    else if (region >= ADDR_MDEC_COMMAND && region < ADDR_MDEC_END) {
+        mdec_write(region & ~0X3, data);
+    }
+    else if (region >= ADDR_I_STAT && region < ADDR_I_STAT + 4) {
+        interrupts_acknowledge(i_stat);
+    }
+    else if (region >= ADDR_I_MASK && region < ADDR_I_MASK + 4) {
+        interrupts_update();
+    }
+}
+
+void memory_ram_written(uint32_t address, uint32_t size) {
+    // dma writes main ram behind the cpu, drop any code cached from it
+    uint32_t first = address & ~MEMORY_CODE_PAGE_MASK;
+    for (uint32_t page = first; page < address + size && page < sizeof(memory.MAIN.mem); page += MEMORY_CODE_PAGE_SIZE)
+        memory_cpu_code_written(page);
+
+    first = address & ~(MEMORY_DIRTY_PAGE_SIZE - 1);
+    for (uint32_t page = first; page < address + size && page < sizeof(memory.MAIN.mem); page += MEMORY_DIRTY_PAGE_SIZE)
+        ram_dirty[page >> MEMORY_DIRTY_PAGE_SHIFT] = true;
+}
+
+void memory_vram_written(uint32_t y, uint32_t h) {
+    // the rasterizer writes vram behind the store functions, a 4K page is two whole lines
+    const uint32_t lines = MEMORY_DIRTY_PAGE_SIZE / (VRAM_WIDTH * 2);
+    for (uint32_t line = y - y % lines; line < y + h && line < y + VRAM_HEIGHT; line += lines)
+        vram_dirty[(line % VRAM_HEIGHT) / lines] = true;
+}
+
+void memory_cpu_code_written(uint32_t address) {
+    uint32_t page = address >> MEMORY_CODE_PAGE_SHIFT;
+    if (!code_pages[page])
+        return;
+
+    code_pages[page] = false;
+    cpu_cache_invalidate(address & ~MEMORY_CODE_PAGE_MASK);
+
+    // give the 64K page back to the fast path once no cached code is left in it
+    memory_cpu_isolate_cache(cop0_SR_Isc());
 }
 
 /* GPU and VRAM memory map */
@@ -168,17 +401,20 @@ void memory_gpu_load_24bit(uint32_t address, uint32_t *data) {
 void memory_gpu_store_4bit(uint32_t address, uint8_t data) {
     data &= 0X0000000F;
     memory.VRAM.mem[address] = data;
+    vram_dirty[address >> MEMORY_DIRTY_PAGE_SHIFT] = true;
 }
 
 void memory_gpu_store_8bit(uint32_t address, uint32_t data) {
     data &= 0X000000FF;
     memory.VRAM.mem[address] = data;
+    vram_dirty[address >> MEMORY_DIRTY_PAGE_SHIFT] = true;
 }
 
 void memory_gpu_store_16bit(uint32_t address, uint32_t data) {
     data &= 0X0000FFFF;
     memory.VRAM.mem[address + 0] = (data >> 0);
     memory.VRAM.mem[address + 1] = (data >> 8);
+    vram_dirty[address >> MEMORY_DIRTY_PAGE_SHIFT] = true;
 }
 
 void memory_gpu_store_24bit(uint32_t address, uint32_t data) {
@@ -186,23 +422,34 @@ void memory_gpu_store_24bit(uint32_t address, uint32_t data) {
     memory.VRAM.mem[address + 0] = (data >>  0);
     memory.VRAM.mem[address + 1] = (data >>  8);
     memory.VRAM.mem[address + 2] = (data >> 16);
+    vram_dirty[(address + 0) >> MEMORY_DIRTY_PAGE_SHIFT] = true;
+    vram_dirty[(address + 2) >> MEMORY_DIRTY_PAGE_SHIFT] = true;
+}
+
+/* Page table helpers, regions are given as physical addresses and mapped into KUSEG, KSEG0 and KSEG1      */
+void memory_cpu_map_pages(uint8_t **page_table, uint32_t region, uint32_t size, uint8_t *segment) {
+    static const uint32_t mirrors[] = {0X00000000, 0X80000000, 0XA0000000};
+
+    for (int i = 0; i < 3; i++) {
+        for (uint32_t offset = 0; offset < size; offset += MEMORY_PAGE_SIZE) {
+            page_table[(mirrors[i] + region + offset) >> MEMORY_PAGE_SHIFT] = segment + offset;
+        }
+    }
 }
 
-/* This is the main mapping function for each of the memory accessing routines                              *
+void memory_cpu_unmap_pages(uint8_t **page_table, uint32_t region, uint32_t size) {
+    memory_cpu_map_pages(page_table, region, size, NULL);
+}
+
+/* This is the slow mapping function for each of the memory accessing routines, used when the page tables  *
+ * have no direct mapping for an address                                                                    *
  * segment   -> the memory array is being accessed, e.g. main RAM, IO ports, e.t.c.                         *
  * address   -> the virtual address that is being accessed, this is transformed into a real address         *
  * mask      -> the mask when writing to io ports, this is because some ports have "always zero" bits       *
  *                  for information on why the mask is a given value check the no$psx docs                  *
- * alignment -> stores the number of bytes being accessed and checks if the address is aligned accordingly  *
+ * alignment -> the number of bytes being accessed, alignment is checked by memory_cpu_lookup               *
  * load      -> specifies if the address is being loaded from or stored to                                  */
 PSX_ERROR memory_cpu_map(uint8_t **segment, uint32_t *address, uint32_t *mask, uint32_t alignment, bool load) {
-    memory.address_accessed = *address; // used for debugging
-
-    if (*address % alignment != 0) {
-        if (load) cpu_exception(ADEL);
-        else      cpu_exception(ADES);
-    }
-
     uint32_t region = *address & segment_lookup[*address >> 29];
 
     // KUSEG, KSEG0, KSEG1
@@ -230,5 +477,5 @@ PSX_ERROR memory_cpu_map(uint8_t **segment, uint32_t *address, uint32_t *mask, u
     else if (region >= 0XC0000000) {*address = region - 0XC0000000; *segment = memory.KSEG2.mem;}
     else                           {return set_PSX_error(MEMORY_CPU_UNMAPPED_ADDRESS);}
 
-    return set_PSX_error(NO_ERROR);
+    return NO_ERROR;
 }
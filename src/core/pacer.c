@@ -0,0 +1,109 @@
+#include "pacer.h"
+
+static struct PACER pacer;
+
+// timing helpers
+static uint64_t pacer_now(void);
+static void pacer_sleep_until(uint64_t deadline);
+static void pacer_report(uint64_t now);
+
+struct PACER *get_pacer(void) { return &pacer; }
+
+bool pacer_skipping(void) { return pacer.skipping; }
+
+void pacer_reset(enum PACER_MODE mode, uint32_t frame_skip, bool report) {
+    uint64_t now = pacer_now();
+
+    pacer.mode       = mode;
+    pacer.report     = report;
+    pacer.frame_skip = frame_skip;
+    pacer.position   = 0;
+    pacer.skipping   = false;
+
+    pacer.period       = PACER_NTSC_PERIOD;
+    pacer.deadline     = now;
+    pacer.mark         = now;
+    pacer.report_start = now;
+
+    pacer.frames  = 0;
+    pacer.drawn   = 0;
+    pacer.core    = 0;
+    pacer.present = 0;
+    pacer.idle    = 0;
+}
+
+void pacer_core_done(void) {
+    // the core reached vblank, everything since the last frame was emulation
+    uint64_t now = pacer_now();
+
+    pacer.core += now - pacer.mark;
+    pacer.mark  = now;
+}
+
+void pacer_end_frame(bool pal) {
+    uint64_t now = pacer_now();
+
+    pacer.present += now - pacer.mark;
+    pacer.period   = (pal) ? PACER_PAL_PERIOD: PACER_NTSC_PERIOD;
+
+    if (pacer.mode == PACER_REALTIME) {
+        pacer.deadline += pacer.period;
+
+        // too far behind to catch up, run on from now rather than rushing frames
+        if (now > pacer.deadline + PACER_MAX_LAG * pacer.period)
+            pacer.deadline = now;
+        else if (now < pacer.deadline) {
+            pacer_sleep_until(pacer.deadline);
+            uint64_t woken = pacer_now();
+            pacer.idle += woken - now;
+            now = woken;
+        }
+    }
+
+    pacer.frames++;
+    pacer.drawn += !pacer.skipping;
+
+    // decide whether the next frame is drawn
+    pacer.position = (pacer.position + 1) % (pacer.frame_skip + 1);
+    pacer.skipping = pacer.position != 0;
+
+    if (pacer.report && now - pacer.report_start >= PACER_REPORT_PERIOD)
+        pacer_report(now);
+
+    pacer.mark = now;
+}
+
+// timing helpers
+uint64_t pacer_now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void pacer_sleep_until(uint64_t deadline) {
+    struct timespec ts = {
+        .tv_sec  = deadline / 1000000000ULL,
+        .tv_nsec = deadline % 1000000000ULL
+    };
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) != 0);
+}
+
+void pacer_report(uint64_t now) {
+    double elapsed = (now - pacer.report_start) / 1e9;
+    double frames  = pacer.frames;
+
+    // speed is emulated time over wall time, 1.00x is full speed
+    printf("[LOG]: %u frames (%u drawn) in %.2fs, %.1f fps, %.2fx speed, "
+           "per frame: core %.2fms, present %.2fms, idle %.2fms of %.2fms\n",
+           pacer.frames, pacer.drawn, elapsed, frames / elapsed, frames * pacer.period / 1e9 / elapsed,
+           pacer.core / frames / 1e6, pacer.present / frames / 1e6, pacer.idle / frames / 1e6, pacer.period / 1e6);
+
+    pacer.report_start = now;
+    pacer.frames  = 0;
+    pacer.drawn   = 0;
+    pacer.core    = 0;
+    pacer.present = 0;
+    pacer.idle    = 0;
+}
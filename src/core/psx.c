@@ -1,5 +1,6 @@
 #include "psx.h"
 #include <SDL2/SDL.h>
+#include <getopt.h>
 
 #define SDL_CHECK_ZERO(expr) {assert((expr) == 0);}
 #define SDL_CHECK_NULL(expr) {assert((expr) != NULL);}
@@ -8,19 +9,45 @@ struct PSX psx;
 
 struct PSX *get_psx(void) { return &psx; }
 
-/** create a psx instance */
-void 
-psx_create
-( int argc, char **argv )
+/** bind or release the gl context on the calling thread */
+static void
+psx_make_current
+( bool current )
 {
-    if (argc != 3) 
-    { 
-        print_psx_error("main", "USEAGE: ./psx <bios.bin> game.psx", NULL); exit(-1); 
-    }
+    SDL_GL_MakeCurrent( psx.window, (current) ? psx.context: NULL );
+}
 
-    if (memory_load_bios(*(++argv)) != NO_ERROR) 
-    { 
-        print_psx_error("main", "Cannot load BIOS file", NULL); exit(1); 
+/** draw the finished frame to the window, on the render thread when the gpu is threaded */
+static void
+psx_present
+( void )
+{
+    renderer_end_frame();
+    SDL_GL_SwapWindow( psx.window );
+    glClearColor( 0.0f , 0.0f , 0.0f , 1.0f );
+    renderer_start_frame();
+}
+
+/** hand the gl context to the render thread if it was asked for */
+static void
+psx_start_gpu_thread
+( void )
+{
+    if ( !psx.gpu_thread ) { return; }
+
+    psx_make_current( false );
+    gpu_thread_start( psx_make_current, psx_present );
+}
+
+/** open the window and gl context and create the renderer, only the renderer in headless mode */
+static void
+psx_create_window
+( void )
+{
+    if ( psx.headless )
+    {
+        renderer_create( NULL, 0 );
+        return;
     }
 
     // create psx SDL context
@@ -37,6 +64,9 @@ psx_create
     SDL_CHECK_NULL(psx.context = SDL_GL_CreateContext(psx.window));
     gladLoadGLLoader(SDL_GL_GetProcAddress);
 
+    // the pacer keeps time, vsync would make every frame wait twice
+    SDL_GL_SetSwapInterval(0);
+
     glViewport(0, 0, WIN_WIDTH, WIN_HEIGHT);
     
     // create the renderer context and load the shaders
@@ -46,17 +76,154 @@ psx_create
         "./shaders/screen.fs.glsl"
     };
     renderer_create(shaders, 2);
+    psx_start_gpu_thread();
+}
+
+/** close the window and gl context */
+static void
+psx_destroy_window
+( void )
+{
+    renderer_destroy();
+    if ( psx.headless ) { return; }
+
+    SDL_GL_DeleteContext(psx.context);
+    SDL_DestroyWindow(psx.window);
+    SDL_Quit();
+}
+
+/** write the displayed part of vram to <prefix><frame>.ppm */
+static void
+psx_dump_frame
+( uint32_t frame )
+{
+    const uint8_t *vram = memory_VRAM_pointer();
+    uint32_t x = psx.gpu->display_vram_x_start, y = psx.gpu->display_vram_y_start;
+    uint32_t w = gpu_display_width(), h = gpu_display_height();
+    bool rgb24 = psx.gpu->gpustat.display_area_color_depth == _24BIT;
+    char path[1024];
+    FILE *fp;
+
+    snprintf( path, sizeof(path), "%s%05u.ppm", psx.dump_prefix, frame );
+    if ( (fp = fopen(path, "wb")) == NULL )
+    {
+        print_psx_error("psx_dump_frame", "Cannot open %s", path); exit(1);
+    }
+
+    fprintf( fp, "P6\n%u %u\n255\n", w, h );
+    for ( uint32_t line = 0; line < h; line++ )
+    {
+        const uint8_t *row = vram + ((y + line) & 0X1FF) * 2048;
+
+        for ( uint32_t column = 0; column < w; column++ )
+        {
+            uint8_t rgb[3];
+
+            if ( rgb24 )
+            {
+                // three bytes a pixel, packed across the halfwords
+                for ( int i = 0; i < 3; i++ ) { rgb[i] = row[(x * 2 + column * 3 + i) & 0X7FF]; }
+            }
+            else
+            {
+                uint32_t offset = ((x + column) & 0X3FF) * 2;
+                uint16_t pixel  = row[offset] | (row[offset + 1] << 8);
+
+                rgb[0] = ((pixel >>  0) & 0X1F) << 3;
+                rgb[1] = ((pixel >>  5) & 0X1F) << 3;
+                rgb[2] = ((pixel >> 10) & 0X1F) << 3;
+            }
+            fwrite( rgb, 1, 3, fp );
+        }
+    }
+    fclose( fp );
+
+    printf("[LOG]: dumped frame %u to %s\n", frame, path);
+}
+
+/** count the finished frame, dump it if it was asked for and stop once enough have run */
+static void
+psx_end_frame
+( void )
+{
+    for ( uint32_t i = 0; i < psx.dump_count; i++ )
+    {
+        if ( psx.dumps[i] == psx.frame ) { psx_dump_frame( psx.frame ); }
+    }
+
+    rewind_frame();
+
+    psx.frame++;
+    if ( psx.frames != 0 && psx.frame >= psx.frames ) { psx.running = false; }
+}
+
+/** a ps-x exe given as the game is sideloaded when the bios reaches the shell, anything else is a disc image */
+static void
+psx_load_game
+( const char *path )
+{
+    PSX_ERROR error = exe_load(path);
+
+    if ( error == NO_ERROR )    { psx.booting = true; }
+    else if ( error != EXE_INVALID )
+    {
+        print_psx_error("main", "Cannot load game file %s", path); exit(1);
+    }
+    // anything that is not an exe goes in the drive as a bin or cue
+    else if ( cdrom_open(path) != NO_ERROR )
+    {
+        print_psx_error("main", "Cannot load disc image %s", path); exit(1);
+    }
+}
+
+/** start from the boot snapshot of this bios when there is one, otherwise take it at the shell */
+static void
+psx_boot
+( void )
+{
+    if ( psx.boot_cache == NULL ) { return; }
+
+    bios_cache_restore( psx.boot_cache );
+    psx.booting = true;
+}
+
+/** create a psx instance */
+void 
+psx_create
+( int argc, char **argv )
+{
+    if (argc != 3) 
+    { 
+        print_psx_error("main", "USEAGE: ./psx <bios.bin> game.psx", NULL); exit(-1); 
+    }
+
+    if (memory_load_bios(*(++argv)) != NO_ERROR) 
+    { 
+        print_psx_error("main", "Cannot load BIOS file", NULL); exit(1); 
+    }
+    psx_load_game(argv[1]);
+
+    psx_create_window();
     
     psx.cpu     = get_cpu();
     psx.gpu     = get_gpu();
     psx.dma     = get_dma();
     psx.memory  = get_memory();
     psx.timers  = get_timers();
+    psx.scheduler = get_scheduler();
 
+    memory_create();
+    scheduler_reset();
+    interrupts_reset();
     cpu_reset();
     gpu_reset();
     dma_reset();
+    mdec_reset();
+    if ( psx.mdec_thread ) { mdec_thread_start(); }
+    cdrom_reset();
     timers_create();
+    psx_boot();
+    rewind_create( psx.rewind_interval, psx.rewind_budget );
 
     #ifdef DEBUG
         // debugger_reset();
@@ -80,41 +247,29 @@ psx_debug_create
     { 
         print_psx_error("main", "Cannot load BIOS file", NULL); exit(1); 
     }
+    psx_load_game(argv[1]);
 
-    // create psx SDL context
-    SDL_CHECK_ZERO(SDL_Init(SDL_INIT_VIDEO));
-    SDL_CHECK_NULL(psx.window = SDL_CreateWindow(WIN_NAME, 0, 0, WIN_WIDTH, WIN_HEIGHT, WIN_FLAGS));
-    
-    SDL_GL_SetAttribute(SDL_GL_DOUBLEBUFFER, 1);
-    SDL_GL_SetAttribute(SDL_GL_DEPTH_SIZE, 24);
-
-    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 3);
-    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 3);
-    SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
-
-    SDL_CHECK_NULL(psx.context = SDL_GL_CreateContext(psx.window));
-    gladLoadGLLoader(SDL_GL_GetProcAddress);
-
-    glViewport(0, 0, WIN_WIDTH, WIN_HEIGHT);
-    
-    // create the renderer context and load the shaders
-    
-    const char *shaders[] = {
-        "./shaders/screen.vs.glsl",
-        "./shaders/screen.fs.glsl"
-    };
-    renderer_create(shaders, 2);
+    psx_create_window();
     
     psx.cpu     = get_cpu();
     psx.gpu     = get_gpu();
     psx.dma     = get_dma();
     psx.memory  = get_memory();
     psx.timers  = get_timers();
+    psx.scheduler = get_scheduler();
 
+    memory_create();
+    scheduler_reset();
+    interrupts_reset();
     cpu_reset();
     gpu_reset();
     dma_reset();
+    mdec_reset();
+    if ( psx.mdec_thread ) { mdec_thread_start(); }
+    cdrom_reset();
     timers_create();
+    psx_boot();
+    rewind_create( psx.rewind_interval, psx.rewind_budget );
     
     gdb_stub_init();
 
@@ -122,7 +277,29 @@ psx_debug_create
     psx.running = true;
 }
 
-/** step the internal components of the psx */
+/** run the cpu for one instruction, or one block in the faster modes, returns the cycles used */
+uint32_t
+psx_step_cpu
+( void )
+{
+    uint32_t cycles = 1;
+
+    // checked before every step until the bios hands over to the shell
+    if ( psx.booting && bios_at_shell() )
+    {
+        psx.booting = false;
+        bios_cache_capture();
+        exe_boot();
+    }
+
+    if ( psx.cpu->mode == CPU_INTERPRETER ) { cpu_step(); }
+    else                                    { cycles = cpu_step_block(); }
+
+    scheduler_advance( cycles );
+    return cycles;
+}
+
+/** step the internal components of the psx, the cpu runs until the next event is due */
 void 
 psx_step_components
 ( void ) 
@@ -131,12 +308,19 @@ psx_step_components
     // debugger_exec();
     #endif
 
-    timers_step();
+    // the deadline is read each step, the cpu may schedule something sooner
+    while ( scheduler_cycles() < scheduler_next_event() ) { psx_step_cpu(); }
 
-    if ( !psx.dma->accessing_memory ) { cpu_step(); }
+    scheduler_run_events();
+}
 
-    gpu_step();
-    dma_step();
+/** step the cpu by one instruction and run any events that are due, used by the debugger */
+void
+psx_step_instruction
+( void )
+{
+    psx_step_cpu();
+    scheduler_run_events();
 }
 
 /** step the external user interface of the psx */
@@ -144,18 +328,38 @@ void
 psx_step_interface
 ( void )
 {
-    renderer_end_frame();
-    SDL_GL_SwapWindow( psx.window );
+    pacer_core_done();
 
-    SDL_Event e;
-    while ( SDL_PollEvent( &e ) )
+    if ( psx.headless )
     {
-        if ( e.type == SDL_QUIT ) { exit(0); }
+        // nothing to show, the software rasterizer just has to be done with vram
+        renderer_end_frame();
+        renderer_start_frame();
     }
-    glClearColor( 0.0f , 0.0f , 0.0f , 1.0f );
+    else
+    {
+        // a skipped frame drew nothing, what is on screen stays up
+        if ( !pacer_skipping() )
+        {
+            if ( gpu_thread_running() ) { gpu_thread_frame(); }
+            else                        { psx_present(); }
+        }
+
+        SDL_Event e;
+        while ( SDL_PollEvent( &e ) )
+        {
+            if ( e.type == SDL_QUIT ) { exit(0); }
+            // held down, key repeat keeps stepping further back
+            if ( e.type == SDL_KEYDOWN && e.key.keysym.sym == SDLK_BACKSPACE ) { rewind_step(); }
+        }
+
+        // the dump reads vram, which the render thread may still be drawing into
+        if ( psx.dump_count > 0 ) { gpu_thread_sync(); }
+    }
+    psx_end_frame();
+    pacer_end_frame( psx.gpu->gpustat.video_mode == PAL50HZ );
 
     psx.gpu->render_phase = RENDER;
-    renderer_start_frame();
 }
 
 /** run the psx */
@@ -185,7 +389,7 @@ psx_debug_main
         {
             psx_step_interface();
         }
-        psx_step_components();
+        psx_step_instruction();
     }
 }
 
@@ -194,9 +398,10 @@ void
 psx_destroy
 ( void ) 
 {
-    SDL_GL_DeleteContext(psx.context);
-    SDL_DestroyWindow(psx.window);
-    SDL_Quit();
+    rewind_destroy();
+    gpu_thread_stop();
+    mdec_thread_stop();
+    psx_destroy_window();
 }
 
 /* destroy the psx instance */
@@ -205,9 +410,131 @@ psx_debug_destroy
 ( void ) 
 {
     gdb_stub_deinit();
-    SDL_GL_DeleteContext(psx.context);
-    SDL_DestroyWindow(psx.window);
-    SDL_Quit();
+    rewind_destroy();
+    gpu_thread_stop();
+    mdec_thread_stop();
+    psx_destroy_window();
+}
+
+/** parse the command line options, leaving the positional arguments at optind */
+void
+psx_parse_options
+( int argc , char **argv )
+{
+    static const struct option options[] = {
+        { "cpu"            , required_argument , NULL , 'c' },
+        { "gpu-thread"     , no_argument       , NULL , 'g' },
+        { "mdec-thread"    , no_argument       , NULL , 'm' },
+        { "renderer"       , required_argument , NULL , 'r' },
+        { "raster-threads" , required_argument , NULL , 'w' },
+        { "headless"       , no_argument       , NULL , 'H' },
+        { "frames"         , required_argument , NULL , 'f' },
+        { "dump"           , required_argument , NULL , 'd' },
+        { "dump-prefix"    , required_argument , NULL , 'o' },
+        { "turbo"          , no_argument       , NULL , 't' },
+        { "frame-skip"     , required_argument , NULL , 's' },
+        { "report"         , no_argument       , NULL , 'R' },
+        { "rewind"         , required_argument , NULL , 'z' },
+        { "rewind-budget"  , required_argument , NULL , 'Z' },
+        { "boot-cache"     , required_argument , NULL , 'b' },
+        { NULL             , 0                 , NULL ,  0  }
+    };
+    enum RENDERER_BACKEND backend = RENDERER_OPENGL;
+    uint32_t workers = 0;
+    enum PACER_MODE pacing = PACER_REALTIME;
+    uint32_t frame_skip = 0;
+    bool report = false;
+
+    for ( int opt; (opt = getopt_long(argc, argv, "c:gmr:w:Hf:d:o:ts:Rz:Z:b:", options, NULL)) != -1; )
+    {
+        switch ( opt )
+        {
+            case 'c':
+                if      ( strcmp(optarg, "interpreter") == 0 ) { get_cpu()->mode = CPU_INTERPRETER; }
+                else if ( strcmp(optarg, "cached")      == 0 ) { get_cpu()->mode = CPU_CACHED_INTERPRETER; }
+                else if ( strcmp(optarg, "dynarec")     == 0 ) { get_cpu()->mode = CPU_DYNAREC; }
+                else 
+                { 
+                    print_psx_error("main", "Unknown cpu mode %s (interpreter, cached, dynarec)", optarg); exit(-1); 
+                }
+                if ( get_cpu()->mode == CPU_DYNAREC && !dynarec_supported() )
+                {
+                    print_psx_error("main", "The dynarec is not available on this host", NULL); exit(-1);
+                }
+                break;
+            case 'g':
+                psx.gpu_thread = true;
+                break;
+            case 'm':
+                psx.mdec_thread = true;
+                break;
+            case 'r':
+                if      ( strcmp(optarg, "opengl")   == 0 ) { backend = RENDERER_OPENGL; }
+                else if ( strcmp(optarg, "software") == 0 ) { backend = RENDERER_SOFTWARE; }
+                else 
+                { 
+                    print_psx_error("main", "Unknown renderer %s (opengl, software)", optarg); exit(-1); 
+                }
+                break;
+            case 'w':
+                workers = strtoul(optarg, NULL, 10);
+                break;
+            case 'H':
+                psx.headless = true;
+                break;
+            case 'f':
+                psx.frames = strtoul(optarg, NULL, 10);
+                break;
+            case 'd':
+                // comma separated frame numbers, counted from 0
+                for ( char *frame = strtok(optarg, ","); frame != NULL; frame = strtok(NULL, ",") )
+                {
+                    if ( psx.dump_count == PSX_DUMPS_MAX )
+                    {
+                        print_psx_error("main", "At most %d frames can be dumped", PSX_DUMPS_MAX); exit(-1);
+                    }
+                    psx.dumps[psx.dump_count++] = strtoul(frame, NULL, 10);
+                }
+                break;
+            case 'o':
+                psx.dump_prefix = optarg;
+                break;
+            case 't':
+                pacing = PACER_TURBO;
+                break;
+            case 's':
+                frame_skip = strtoul(optarg, NULL, 10);
+                break;
+            case 'R':
+                report = true;
+                break;
+            case 'z':
+                psx.rewind_interval = strtoul(optarg, NULL, 10);
+                break;
+            case 'Z':
+                psx.rewind_budget = (size_t) strtoul(optarg, NULL, 10) << 20;
+                break;
+            case 'b':
+                psx.boot_cache = optarg;
+                break;
+            default:
+                print_psx_error("main", "USEAGE: ./psx [--cpu=interpreter|cached|dynarec] [--gpu-thread] [--mdec-thread] [--renderer=opengl|software] [--raster-threads=N] "
+                                        "[--headless] [--frames=N] [--dump=F,F,...] [--dump-prefix=PATH] [--turbo] [--frame-skip=N] [--report] "
+                                        "[--rewind=N] [--rewind-budget=MB] [--boot-cache=DIR] <bios.bin> game.psx", NULL); exit(-1);
+        }
+    }
+    if ( psx.dump_prefix == NULL ) { psx.dump_prefix = "frame_"; }
+    if ( psx.rewind_budget == 0 ) { psx.rewind_budget = (size_t) REWIND_BUDGET_DEFAULT << 20; }
+
+    // headless runs have no window for the render thread or a debugger to attach to
+    if ( psx.headless )
+    {
+        psx.gpu_thread = false;
+        psx.gdb_stub   = false;
+        pacing         = PACER_TURBO;
+    }
+    renderer_configure( backend, workers, psx.headless );
+    pacer_reset( pacing, frame_skip, report );
 }
 
 int 
@@ -215,6 +542,11 @@ main
 ( int argc , char **argv )
 {
     psx.gdb_stub = true;
+    /** parse options, the create functions only see the program name and positional arguments */
+    psx_parse_options(argc, argv);
+    argv[optind - 1] = argv[0];
+    argc -= optind - 1;
+    argv += optind - 1;
     /** create and initialise the PSX */
     ((psx.gdb_stub) ? psx_debug_create: psx_create)(argc, argv);
     /** if gdb_stub mode do psx_debug else psx_main */
@@ -0,0 +1,228 @@
+#include "rewind.h"
+
+// named so it does not clash with rewind() from stdio
+static struct REWIND history;
+
+// delta helpers
+static void rewind_capture(void);
+static size_t rewind_encode(const uint64_t *a, const uint64_t *b, size_t first, size_t last, size_t *position, uint8_t *out);
+static void rewind_apply(uint64_t *head, const uint8_t *delta, size_t size);
+static void rewind_push(const uint8_t *delta, size_t size, uint32_t frame);
+static void rewind_drop(void);
+static uint64_t rewind_now(void);
+
+struct REWIND *get_rewind(void) { return &history; }
+
+void rewind_create(uint32_t interval, size_t budget) {
+    history.interval = interval;
+    if (interval == 0)
+        return;
+
+    history.frames     = 0;
+    history.frame      = 0;
+    history.head_frame = 0;
+    history.have_head  = false;
+    history.first      = 0;
+    history.count      = 0;
+    history.used       = 0;
+    history.ring_end   = 0;
+    history.captures   = 0;
+    history.capture_ns = 0;
+
+    // padding past the snapshot stays zero in both buffers so it never shows up in a delta
+    history.snapshot_size = (savestate_size() + 7) & ~7;
+    history.ring_size     = budget & ~7;
+    history.head          = calloc(1, history.snapshot_size);
+    history.previous      = calloc(1, history.snapshot_size);
+    history.scratch       = malloc(history.snapshot_size + SAVESTATE_SPANS_MAX * sizeof(struct REWIND_RUN));
+    history.ring          = malloc(history.ring_size);
+
+    if (history.head == NULL || history.previous == NULL || history.scratch == NULL || history.ring == NULL) {
+        print_rewind_error("rewind_create", "Cannot allocate %zu bytes of history", budget);
+        exit(1);
+    }
+
+    // the first capture has to copy everything
+    memory_dirty_all();
+}
+
+void rewind_destroy(void) {
+    if (history.interval == 0)
+        return;
+
+    if (history.captures > 0)
+        printf("[LOG]: rewind kept %u snapshots in %.1f MiB, %.3f ms a capture\n",
+               history.count + history.have_head, history.used / 1048576.0, history.capture_ns / 1e6 / history.captures);
+
+    free(history.head);
+    free(history.previous);
+    free(history.scratch);
+    free(history.ring);
+    history.interval = 0;
+}
+
+void rewind_frame(void) {
+    if (history.interval == 0)
+        return;
+
+    history.frame++;
+    if (++history.frames >= history.interval) {
+        history.frames = 0;
+        rewind_capture();
+    }
+}
+
+bool rewind_step(void) {
+    // restore the newest snapshot, then turn the head into the one before it
+    // so the next step goes further back, false once there is nothing older
+    if (history.interval == 0 || !history.have_head)
+        return false;
+
+    if (savestate_load((const uint8_t *) history.head, savestate_size()) != NO_ERROR) {
+        print_rewind_error("rewind_step", "Cannot restore the snapshot of frame %u", history.head_frame);
+        exit(1);
+    }
+    history.frames = 0;
+
+    if (history.count == 0)
+        return false;
+
+    struct REWIND_ENTRY *entry = &history.entries[(history.first + history.count - 1) % REWIND_ENTRIES_MAX];
+
+    rewind_apply(history.head, history.ring + entry->offset, entry->size);
+    history.head_frame = entry->frame;
+    history.ring_end   = entry->offset;
+    history.used      -= entry->size;
+    history.count--;
+
+    return true;
+}
+
+// delta helpers
+void rewind_capture(void) {
+    uint64_t start = rewind_now();
+
+    if (!history.have_head) {
+        savestate_update((uint8_t *) history.head, history.snapshot_size);
+        history.have_head = true;
+    } else {
+        // only the spans can change, keep what they hold, update them and
+        // diff just those words. a capture costs the working set, not 3 MiB
+        uint32_t count = savestate_spans(history.spans);
+        for (uint32_t i = 0; i < count; i++) {
+            size_t first = history.spans[i].offset / sizeof(uint64_t);
+            size_t last  = (history.spans[i].offset + history.spans[i].size + 7) / sizeof(uint64_t);
+            memcpy(history.previous + first, history.head + first, (last - first) * sizeof(uint64_t));
+        }
+
+        savestate_update((uint8_t *) history.head, history.snapshot_size);
+
+        size_t size = 0, position = 0;
+        for (uint32_t i = 0; i < count; i++) {
+            size_t first = history.spans[i].offset / sizeof(uint64_t);
+            size_t last  = (history.spans[i].offset + history.spans[i].size + 7) / sizeof(uint64_t);
+            size += rewind_encode(history.head, history.previous, first, last, &position, history.scratch + size);
+        }
+        rewind_push(history.scratch, size, history.head_frame);
+    }
+    history.head_frame = history.frame;
+
+    history.captures++;
+    history.capture_ns += rewind_now() - start;
+}
+
+size_t rewind_encode(const uint64_t *a, const uint64_t *b, size_t first, size_t last, size_t *position, uint8_t *out) {
+    // runs over words first to last, skips count on from the end of the previous run
+    uint8_t *cursor = out;
+    size_t i = (first > *position) ? first: *position;
+
+    while (i < last) {
+        while (i < last && a[i] == b[i])
+            i++;
+        if (i == last)
+            break;
+
+        // a lone unchanged word stays in the run, a new run header costs as much as it
+        uint64_t *literal = (uint64_t *) (cursor + sizeof(struct REWIND_RUN));
+        size_t changed = i;
+        while (i < last && (a[i] != b[i] || (i + 1 < last && a[i + 1] != b[i + 1]))) {
+            *literal++ = a[i] ^ b[i];
+            i++;
+        }
+
+        struct REWIND_RUN run = { .skip = changed - *position, .count = i - changed };
+        memcpy(cursor, &run, sizeof(run));
+        cursor = (uint8_t *) literal;
+        *position = i;
+    }
+
+    return cursor - out;
+}
+
+void rewind_apply(uint64_t *head, const uint8_t *delta, size_t size) {
+    const uint8_t *end = delta + size;
+    size_t i = 0;
+
+    while (delta < end) {
+        struct REWIND_RUN run;
+        memcpy(&run, delta, sizeof(run));
+        delta += sizeof(run);
+
+        const uint64_t *literal = (const uint64_t *) delta;
+        i += run.skip;
+        for (uint32_t k = 0; k < run.count; k++)
+            head[i++] ^= literal[k];
+        delta += run.count * sizeof(uint64_t);
+    }
+}
+
+void rewind_push(const uint8_t *delta, size_t size, uint32_t frame) {
+    // a delta bigger than the whole ring breaks the chain, start over from the head
+    if (size > history.ring_size) {
+        while (history.count > 0)
+            rewind_drop();
+        history.ring_end = 0;
+        return;
+    }
+
+    size_t start = history.ring_end;
+    if (start + size > history.ring_size) {
+        // wrapping, whatever is left past the end is older than everything before it
+        while (history.count > 0 && history.entries[history.first].offset >= start)
+            rewind_drop();
+        start = 0;
+    }
+
+    while (history.count > 0) {
+        struct REWIND_ENTRY *oldest = &history.entries[history.first];
+        bool overlaps = oldest->offset < start + size && start < oldest->offset + oldest->size;
+
+        if (!overlaps && history.count < REWIND_ENTRIES_MAX)
+            break;
+        rewind_drop();
+    }
+
+    memcpy(history.ring + start, delta, size);
+
+    history.entries[(history.first + history.count) % REWIND_ENTRIES_MAX] = (struct REWIND_ENTRY) {
+        .offset = start,
+        .size   = size,
+        .frame  = frame
+    };
+    history.count++;
+    history.used    += size;
+    history.ring_end = start + size;
+}
+
+void rewind_drop(void) {
+    history.used -= history.entries[history.first].size;
+    history.first = (history.first + 1) % REWIND_ENTRIES_MAX;
+    history.count--;
+}
+
+uint64_t rewind_now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
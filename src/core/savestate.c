@@ -0,0 +1,379 @@
+#include "savestate.h"
+#include "mdec_thread.h"
+
+// everything in struct MEMORY that the machine can change. the bios and
+// expansion roms are left out, as is kseg2 apart from the cache control register
+static const struct SAVESTATE_REGION savestate_regions[] = {
+    { offsetof(struct MEMORY, MAIN),                  sizeof(MEM_MAIN),                  memory_ram_dirty },
+    { offsetof(struct MEMORY, SCRATCH_PAD),           sizeof(MEM_SCRATCH_PAD),           NULL },
+    { offsetof(struct MEMORY, IO_PORTS),              sizeof(MEM_IO_PORTS),              NULL },
+    { offsetof(struct MEMORY, EXPANSION_2),           sizeof(MEM_EXPANSION_2),           NULL },
+    { offsetof(struct MEMORY, KSEG2.cache_control),   sizeof(uint32_t),                  NULL },
+    { offsetof(struct MEMORY, VRAM),                  sizeof(MEM_VRAM),                  memory_vram_dirty },
+    { offsetof(struct MEMORY, SOUND),                 sizeof(MEM_SOUND),                 NULL },
+    { offsetof(struct MEMORY, CDROM_CONTROLLER_RAM),  sizeof(MEM_CDROM_CONTROLLER_RAM),  NULL },
+    { offsetof(struct MEMORY, CDROM_BUFFER),          sizeof(MEM_CDROM_BUFFER),          NULL },
+    { offsetof(struct MEMORY, EXTERNAL_MEMORY_CARDS), sizeof(MEM_EXTERNAL_MEMORY_CARDS), NULL }
+};
+#define SAVESTATE_REGIONS (sizeof(savestate_regions) / sizeof(savestate_regions[0]))
+
+// bump the version of a chunk whenever its layout changes
+static const uint32_t savestate_chunk_versions[SAVESTATE_CHUNKS] = {
+    [SAVESTATE_CPU]       = 2,
+    [SAVESTATE_GPU]       = 1,
+    [SAVESTATE_DMA]       = 1,
+    [SAVESTATE_TIMERS]    = 1,
+    [SAVESTATE_SCHEDULER] = 3,
+    [SAVESTATE_MEMORY]    = 1,
+    [SAVESTATE_MDEC]      = 1,
+    [SAVESTATE_CDROM]     = 1
+};
+
+// chunk helpers
+static size_t savestate_chunk_size(enum SAVESTATE_CHUNK_ID id);
+static void savestate_chunk_save(enum SAVESTATE_CHUNK_ID id, uint8_t *data, bool incremental);
+static size_t savestate_write(uint8_t *buffer, size_t size, bool incremental);
+static void savestate_span(struct SAVESTATE_SPAN *spans, uint32_t *count, size_t offset, size_t size);
+static void savestate_chunk_load(enum SAVESTATE_CHUNK_ID id, const uint8_t *data);
+
+size_t savestate_size(void) {
+    size_t size = sizeof(struct SAVESTATE_HEADER);
+
+    for (int id = 0; id < SAVESTATE_CHUNKS; id++)
+        size += sizeof(struct SAVESTATE_CHUNK) + savestate_chunk_size(id);
+
+    return size;
+}
+
+size_t savestate_save(uint8_t *buffer, size_t size) {
+    return savestate_write(buffer, size, false);
+}
+
+size_t savestate_update(uint8_t *buffer, size_t size) {
+    // the buffer holds the snapshot of the last update, only what was written
+    // since then is copied again. there can be one such buffer at a time as
+    // updating clears the dirty pages
+    size_t total = savestate_write(buffer, size, true);
+
+    for (size_t i = 0; i < SAVESTATE_REGIONS && total != 0; i++) {
+        if (savestate_regions[i].dirty != NULL)
+            memset(savestate_regions[i].dirty(), false, savestate_regions[i].size >> MEMORY_DIRTY_PAGE_SHIFT);
+    }
+
+    return total;
+}
+
+uint32_t savestate_spans(struct SAVESTATE_SPAN *spans) {
+    // everything but the clean pages of the tracked regions, neighbours merged
+    uint32_t count = 0;
+    size_t offset = sizeof(struct SAVESTATE_HEADER);
+
+    savestate_span(spans, &count, 0, offset);
+
+    for (int id = 0; id < SAVESTATE_CHUNKS; id++) {
+        savestate_span(spans, &count, offset, sizeof(struct SAVESTATE_CHUNK));
+        offset += sizeof(struct SAVESTATE_CHUNK);
+
+        if (id != SAVESTATE_MEMORY) {
+            savestate_span(spans, &count, offset, savestate_chunk_size(id));
+            offset += savestate_chunk_size(id);
+            continue;
+        }
+
+        for (size_t i = 0; i < SAVESTATE_REGIONS; i++) {
+            const struct SAVESTATE_REGION *region = &savestate_regions[i];
+
+            if (region->dirty == NULL)
+                savestate_span(spans, &count, offset, region->size);
+            else {
+                const bool *dirty = region->dirty();
+                for (size_t page = 0; page < region->size >> MEMORY_DIRTY_PAGE_SHIFT; page++) {
+                    if (dirty[page])
+                        savestate_span(spans, &count, offset + (page << MEMORY_DIRTY_PAGE_SHIFT), MEMORY_DIRTY_PAGE_SIZE);
+                }
+            }
+            offset += region->size;
+        }
+    }
+
+    return count;
+}
+
+PSX_ERROR savestate_load(const uint8_t *buffer, size_t size) {
+    struct SAVESTATE_HEADER header;
+    const uint8_t *chunks[SAVESTATE_CHUNKS] = { NULL };
+
+    if (size < sizeof(header))
+        return set_PSX_error(SAVESTATE_INVALID);
+
+    memcpy(&header, buffer, sizeof(header));
+    if (header.magic != SAVESTATE_MAGIC || header.size > size)
+        return set_PSX_error(SAVESTATE_INVALID);
+    if (header.version != SAVESTATE_VERSION)
+        return set_PSX_error(SAVESTATE_VERSION_MISMATCH);
+
+    // check every chunk before touching the machine, a bad snapshot leaves it as it was
+    size_t offset = sizeof(header);
+    for (uint32_t i = 0; i < header.chunks; i++) {
+        struct SAVESTATE_CHUNK chunk;
+
+        if (header.size - offset < sizeof(chunk))
+            return set_PSX_error(SAVESTATE_INVALID);
+        memcpy(&chunk, buffer + offset, sizeof(chunk));
+        offset += sizeof(chunk);
+
+        if (header.size - offset < chunk.size)
+            return set_PSX_error(SAVESTATE_INVALID);
+
+        if (chunk.id < SAVESTATE_CHUNKS) {
+            if (chunk.version != savestate_chunk_versions[chunk.id] || chunk.size != savestate_chunk_size(chunk.id))
+                return set_PSX_error(SAVESTATE_VERSION_MISMATCH);
+            chunks[chunk.id] = buffer + offset;
+        }
+        offset += chunk.size;
+    }
+
+    for (int id = 0; id < SAVESTATE_CHUNKS; id++) {
+        if (chunks[id] == NULL)
+            return set_PSX_error(SAVESTATE_INVALID);
+    }
+
+    // draws still queued belong to the state being replaced
+    gpu_vram_sync();
+
+    // the cpu goes first, rebuilding the memory map depends on cop0
+    for (int id = 0; id < SAVESTATE_CHUNKS; id++)
+        savestate_chunk_load(id, chunks[id]);
+
+    memory_create();
+    cpu_cache_flush();
+    gpu_restore();
+
+    return set_PSX_error(NO_ERROR);
+}
+
+PSX_ERROR savestate_save_file(const char *path) {
+    size_t size = savestate_size();
+    uint8_t *buffer;
+    FILE *fp;
+
+    if ((buffer = malloc(size)) == NULL) {
+        print_savestate_error("savestate_save_file", "Cannot allocate %zu bytes", size);
+        exit(1);
+    }
+    savestate_save(buffer, size);
+
+    if ((fp = fopen(path, "wb")) == NULL) {
+        free(buffer);
+        return set_PSX_error(SAVESTATE_FILE_NOT_FOUND);
+    }
+    size_t written = fwrite(buffer, 1, size, fp);
+    fclose(fp);
+    free(buffer);
+
+    return set_PSX_error((written == size) ? NO_ERROR: SAVESTATE_FILE_UNREADABLE);
+}
+
+PSX_ERROR savestate_load_file(const char *path) {
+    uint8_t *buffer;
+    long size;
+    FILE *fp;
+
+    if ((fp = fopen(path, "rb")) == NULL)
+        return set_PSX_error(SAVESTATE_FILE_NOT_FOUND);
+
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+
+    if (size <= 0 || (buffer = malloc(size)) == NULL || fread(buffer, 1, size, fp) != (size_t) size) {
+        fclose(fp);
+        return set_PSX_error(SAVESTATE_FILE_UNREADABLE);
+    }
+    fclose(fp);
+
+    PSX_ERROR error = savestate_load(buffer, size);
+    free(buffer);
+
+    return error;
+}
+
+// chunk helpers
+size_t savestate_write(uint8_t *buffer, size_t size, bool incremental) {
+    size_t total = savestate_size();
+    if (size < total)
+        return 0;
+
+    // everything queued for the renderer has to be in vram first
+    gpu_vram_sync();
+
+    struct SAVESTATE_HEADER header = {
+        .magic   = SAVESTATE_MAGIC,
+        .version = SAVESTATE_VERSION,
+        .chunks  = SAVESTATE_CHUNKS,
+        .size    = total
+    };
+    memcpy(buffer, &header, sizeof(header));
+    uint8_t *cursor = buffer + sizeof(header);
+
+    for (int id = 0; id < SAVESTATE_CHUNKS; id++) {
+        struct SAVESTATE_CHUNK chunk = {
+            .id      = id,
+            .version = savestate_chunk_versions[id],
+            .size    = savestate_chunk_size(id)
+        };
+        memcpy(cursor, &chunk, sizeof(chunk));
+        cursor += sizeof(chunk);
+
+        savestate_chunk_save(id, cursor, incremental);
+        cursor += chunk.size;
+    }
+
+    return total;
+}
+
+void savestate_span(struct SAVESTATE_SPAN *spans, uint32_t *count, size_t offset, size_t size) {
+    if (*count > 0 && spans[*count - 1].offset + spans[*count - 1].size == offset)
+        spans[*count - 1].size += size;
+    else
+        spans[(*count)++] = (struct SAVESTATE_SPAN) { .offset = offset, .size = size };
+}
+
+size_t savestate_chunk_size(enum SAVESTATE_CHUNK_ID id) {
+    size_t size = 0;
+
+    switch (id) {
+        case SAVESTATE_CPU:       return sizeof(struct CPU);
+        case SAVESTATE_GPU:       return sizeof(struct GPU);
+        case SAVESTATE_DMA:       return sizeof(struct DMA);
+        case SAVESTATE_TIMERS:    return sizeof(struct TIMERS);
+        case SAVESTATE_SCHEDULER: return sizeof(struct SCHEDULER);
+        case SAVESTATE_MDEC:      return sizeof(struct MDEC);
+        case SAVESTATE_CDROM:     return sizeof(struct CDROM);
+        case SAVESTATE_MEMORY:
+            for (size_t i = 0; i < SAVESTATE_REGIONS; i++)
+                size += savestate_regions[i].size;
+            return size;
+        default:
+            return 0;
+    }
+}
+
+void savestate_chunk_save(enum SAVESTATE_CHUNK_ID id, uint8_t *data, bool incremental) {
+    // structs are written whole, the pointers in them are ignored on load
+    switch (id) {
+        case SAVESTATE_CPU:       memcpy(data, get_cpu(),       sizeof(struct CPU));       break;
+        case SAVESTATE_GPU:       memcpy(data, get_gpu(),       sizeof(struct GPU));       break;
+        case SAVESTATE_DMA:       memcpy(data, get_dma(),       sizeof(struct DMA));       break;
+        case SAVESTATE_TIMERS:    memcpy(data, get_timers(),    sizeof(struct TIMERS));    break;
+        case SAVESTATE_SCHEDULER: memcpy(data, get_scheduler(), sizeof(struct SCHEDULER)); break;
+        case SAVESTATE_MDEC:      memcpy(data, get_mdec(),      sizeof(struct MDEC));      break;
+        case SAVESTATE_CDROM:     memcpy(data, get_cdrom(),     sizeof(struct CDROM));     break;
+        case SAVESTATE_MEMORY: {
+            const uint8_t *memory = (const uint8_t *) get_memory();
+            for (size_t i = 0; i < SAVESTATE_REGIONS; i++) {
+                const struct SAVESTATE_REGION *region = &savestate_regions[i];
+
+                if (!incremental || region->dirty == NULL)
+                    memcpy(data, memory + region->offset, region->size);
+                else {
+                    const bool *dirty = region->dirty();
+                    for (size_t page = 0; page < region->size >> MEMORY_DIRTY_PAGE_SHIFT; page++) {
+                        size_t at = page << MEMORY_DIRTY_PAGE_SHIFT;
+                        if (dirty[page])
+                            memcpy(data + at, memory + region->offset + at, MEMORY_DIRTY_PAGE_SIZE);
+                    }
+                }
+                data += region->size;
+            }
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+void savestate_chunk_load(enum SAVESTATE_CHUNK_ID id, const uint8_t *data) {
+    // pointers into the live machine, callbacks and host settings such as
+    // the cpu mode keep their current values, everything else is replaced
+    switch (id) {
+        case SAVESTATE_CPU: {
+            struct CPU *cpu = get_cpu();
+            struct CPU live = *cpu;
+
+            memcpy(cpu, data, sizeof(struct CPU));
+            memcpy(cpu->cop0.R, live.cop0.R, sizeof(live.cop0.R));
+            cpu->mode = live.mode;
+            break;
+        }
+        case SAVESTATE_GPU:
+            memcpy(get_gpu(), data, sizeof(struct GPU));
+            break;
+        case SAVESTATE_DMA: {
+            struct DMA saved;
+
+            memcpy(&saved, data, sizeof(saved));
+            get_dma()->interrupt_request = saved.interrupt_request;
+            break;
+        }
+        case SAVESTATE_TIMERS: {
+            struct TIMERS saved;
+            struct TIMER *timers[3] = { &get_timers()->T0, &get_timers()->T1, &get_timers()->T2 };
+            struct TIMER *from[3]   = { &saved.T0, &saved.T1, &saved.T2 };
+
+            memcpy(&saved, data, sizeof(saved));
+            for (int i = 0; i < 3; i++) {
+                timers[i]->sync_cycles = from[i]->sync_cycles;
+                timers[i]->sync_count  = from[i]->sync_count;
+                timers[i]->irq_fired   = from[i]->irq_fired;
+            }
+            break;
+        }
+        case SAVESTATE_SCHEDULER: {
+            struct SCHEDULER *scheduler = get_scheduler();
+            struct SCHEDULER saved;
+
+            memcpy(&saved, data, sizeof(saved));
+            scheduler->cycles    = saved.cycles;
+            scheduler->heap_size = saved.heap_size;
+            memcpy(scheduler->heap, saved.heap, sizeof(saved.heap));
+            for (int i = 0; i < EVENT_COUNT; i++) {
+                scheduler->entries[i].timestamp  = saved.entries[i].timestamp;
+                scheduler->entries[i].heap_index = saved.entries[i].heap_index;
+            }
+            break;
+        }
+        case SAVESTATE_MDEC: {
+            struct MDEC *mdec = get_mdec();
+            mdec_idct_t idct = mdec->idct;
+            mdec_rgb_t  rgb  = mdec->rgb;
+
+            // a frame decoded ahead belongs to the state being replaced
+            mdec_thread_cancel();
+            memcpy(mdec, data, sizeof(struct MDEC));
+            mdec->idct = idct;
+            mdec->rgb  = rgb;
+            break;
+        }
+        case SAVESTATE_CDROM: {
+            // the state is only valid with the disc it was saved with
+            struct CDROM *cdrom = get_cdrom();
+            struct CDROM_DISC disc = cdrom->disc;
+
+            memcpy(cdrom, data, sizeof(struct CDROM));
+            cdrom->disc = disc;
+            break;
+        }
+        case SAVESTATE_MEMORY: {
+            uint8_t *memory = (uint8_t *) get_memory();
+            for (size_t i = 0; i < SAVESTATE_REGIONS; i++) {
+                memcpy(memory + savestate_regions[i].offset, data, savestate_regions[i].size);
+                data += savestate_regions[i].size;
+            }
+            break;
+        }
+        default:
+            break;
+    }
+}
+
@@ -0,0 +1,136 @@
+#include "scheduler.h"
+
+static struct SCHEDULER scheduler;
+
+// heap helpers
+static void scheduler_heap_swap(uint32_t a, uint32_t b);
+static void scheduler_heap_up(uint32_t index);
+static void scheduler_heap_down(uint32_t index);
+static void scheduler_heap_remove(uint32_t index);
+
+struct SCHEDULER *get_scheduler(void) { return &scheduler; }
+
+uint64_t scheduler_cycles(void) { return scheduler.cycles; }
+
+void scheduler_reset(void) {
+    scheduler.cycles    = 0;
+    scheduler.heap_size = 0;
+
+    for (int i = 0; i < EVENT_COUNT; i++) {
+        scheduler.entries[i].timestamp  = 0;
+        scheduler.entries[i].heap_index = -1;
+    }
+}
+
+void scheduler_register(enum SCHEDULER_EVENT event, void (*callback)(uint64_t timestamp)) {
+    scheduler.entries[event].callback = callback;
+}
+
+void scheduler_schedule(enum SCHEDULER_EVENT event, uint64_t cycles) {
+    scheduler_schedule_at(event, scheduler.cycles + cycles);
+}
+
+void scheduler_schedule_at(enum SCHEDULER_EVENT event, uint64_t timestamp) {
+    struct SCHEDULER_ENTRY *entry = &scheduler.entries[event];
+
+    if (entry->callback == NULL) {
+        print_scheduler_error("scheduler_schedule_at", "No callback registered for event %d", event);
+        exit(1);
+    }
+
+    // already pending, move it
+    if (entry->heap_index >= 0) {
+        uint64_t old = entry->timestamp;
+        entry->timestamp = timestamp;
+        if (timestamp < old) scheduler_heap_up(entry->heap_index);
+        else                 scheduler_heap_down(entry->heap_index);
+        return;
+    }
+
+    entry->timestamp  = timestamp;
+    entry->heap_index = scheduler.heap_size;
+    scheduler.heap[scheduler.heap_size++] = event;
+    scheduler_heap_up(entry->heap_index);
+}
+
+void scheduler_cancel(enum SCHEDULER_EVENT event) {
+    if (scheduler.entries[event].heap_index >= 0)
+        scheduler_heap_remove(scheduler.entries[event].heap_index);
+}
+
+bool scheduler_pending(enum SCHEDULER_EVENT event) {
+    return scheduler.entries[event].heap_index >= 0;
+}
+
+uint64_t scheduler_next_event(void) {
+    if (scheduler.heap_size == 0)
+        return UINT64_MAX;
+    return scheduler.entries[scheduler.heap[0]].timestamp;
+}
+
+void scheduler_advance(uint32_t cycles) {
+    scheduler.cycles += cycles;
+}
+
+void scheduler_run_events(void) {
+    // callbacks may schedule new events, including ones that are already due
+    while (scheduler.heap_size > 0) {
+        enum SCHEDULER_EVENT event = scheduler.heap[0];
+        struct SCHEDULER_ENTRY *entry = &scheduler.entries[event];
+
+        if (entry->timestamp > scheduler.cycles)
+            break;
+
+        scheduler_heap_remove(0);
+        entry->callback(entry->timestamp);
+    }
+}
+
+// heap helpers
+void scheduler_heap_swap(uint32_t a, uint32_t b) {
+    enum SCHEDULER_EVENT event = scheduler.heap[a];
+    scheduler.heap[a] = scheduler.heap[b];
+    scheduler.heap[b] = event;
+
+    scheduler.entries[scheduler.heap[a]].heap_index = a;
+    scheduler.entries[scheduler.heap[b]].heap_index = b;
+}
+
+void scheduler_heap_up(uint32_t index) {
+    while (index > 0) {
+        uint32_t parent = (index - 1) / 2;
+        if (scheduler.entries[scheduler.heap[parent]].timestamp <= scheduler.entries[scheduler.heap[index]].timestamp)
+            break;
+        scheduler_heap_swap(index, parent);
+        index = parent;
+    }
+}
+
+void scheduler_heap_down(uint32_t index) {
+    for (;;) {
+        uint32_t smallest = index;
+        uint32_t left = 2 * index + 1, right = 2 * index + 2;
+
+        if (left  < scheduler.heap_size && scheduler.entries[scheduler.heap[left]].timestamp  < scheduler.entries[scheduler.heap[smallest]].timestamp)
+            smallest = left;
+        if (right < scheduler.heap_size && scheduler.entries[scheduler.heap[right]].timestamp < scheduler.entries[scheduler.heap[smallest]].timestamp)
+            smallest = right;
+        if (smallest == index)
+            break;
+
+        scheduler_heap_swap(index, smallest);
+        index = smallest;
+    }
+}
+
+void scheduler_heap_remove(uint32_t index) {
+    enum SCHEDULER_EVENT event = scheduler.heap[index];
+
+    scheduler.heap_size--;
+    if (index != scheduler.heap_size) {
+        scheduler_heap_swap(index, scheduler.heap_size);
+        scheduler_heap_down(index);
+        scheduler_heap_up(index);
+    }
+    scheduler.entries[event].heap_index = -1;
+}
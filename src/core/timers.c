@@ -5,71 +5,205 @@ static struct TIMERS timers;
 struct TIMERS *get_timers(void) { return &timers; }
 
 // helpers
-static void timer_reset(struct TIMER *timer);
+static void timer_create(struct TIMER *timer, uint32_t address, enum SCHEDULER_EVENT event, enum IRQ irq);
+static struct TIMER *timer_get(uint32_t address);
+static void timer_clock(struct TIMER *timer, uint32_t *cycles, uint32_t *ticks);
+static uint64_t timer_ticks(struct TIMER *timer, uint64_t now);
+static uint32_t timer_count(struct TIMER *timer, uint64_t now);
+static void timer_sync(struct TIMER *timer, uint32_t count, uint64_t now);
+static void timer_schedule(struct TIMER *timer);
+static void timer_event(struct TIMER *timer, uint64_t timestamp);
+static void timer_irq(struct TIMER *timer);
+static void timer0_event(uint64_t timestamp);
+static void timer1_event(uint64_t timestamp);
+static void timer2_event(uint64_t timestamp);
 
 PSX_ERROR timers_create(void) {
-    timers.T0.current = (union TIMER_CURRENT *) memory_pointer(0X1F801100);
-    timers.T0.mode    = (union TIMER_MODE *)    memory_pointer(0X1F801104);
-    timers.T0.target  = (union TIMER_TARGET *)  memory_pointer(0X1F801108);
-    timers.T0.old_mode = timers.T0.mode->value;
+    timer_create(&timers.T0, ADDR_TIMER_0, EVENT_TIMER0, IRQ_TIMER0);
+    timer_create(&timers.T1, ADDR_TIMER_1, EVENT_TIMER1, IRQ_TIMER1);
+    timer_create(&timers.T2, ADDR_TIMER_2, EVENT_TIMER2, IRQ_TIMER2);
 
-    timers.T1.current = (union TIMER_CURRENT *) memory_pointer(0X1F801110);
-    timers.T1.mode    = (union TIMER_MODE *)    memory_pointer(0X1F801114);
-    timers.T1.target  = (union TIMER_TARGET *)  memory_pointer(0X1F801118);
-    timers.T1.old_mode = timers.T1.mode->value;
+    scheduler_register(EVENT_TIMER0, timer0_event);
+    scheduler_register(EVENT_TIMER1, timer1_event);
+    scheduler_register(EVENT_TIMER2, timer2_event);
 
-    timers.T2.current = (union TIMER_CURRENT *) memory_pointer(0X1F801120);
-    timers.T2.mode    = (union TIMER_MODE *)    memory_pointer(0X1F801124);
-    timers.T2.target  = (union TIMER_TARGET *)  memory_pointer(0X1F801128);
-    timers.T2.old_mode = timers.T2.mode->value;
+    timer_schedule(&timers.T0);
+    timer_schedule(&timers.T1);
+    timer_schedule(&timers.T2);
 
     return set_PSX_error(NO_ERROR);
 }
 
-PSX_ERROR timers_step(void) {
-    timers.T0.current->count++;
-    timers.T1.current->count++;
-    timers.T2.current->count++;
-    
-    timer_reset(&timers.T0);
-    timer_reset(&timers.T1);
-    timer_reset(&timers.T2);
+/* Counters are not stepped, their value is worked out from the cycle counter when read.     *
+ * Reaching the target or 0XFFFF is a scheduled event which sets the flags and raises the IRQ */
+uint32_t timers_read(uint32_t address) {
+    struct TIMER *timer = timer_get(address);
 
-    return set_PSX_error(NO_ERROR);
+    switch (address & 0XC) {
+        case 0X0:
+            timer->current->count = timer_count(timer, scheduler_cycles());
+            return timer->current->value;
+        case 0X4: {
+            // the reached flags are reset after reading
+            uint32_t value = timer->mode->value;
+            timer->mode->hit_target = 0;
+            timer->mode->hit_max    = 0;
+            return value;
+        }
+        case 0X8:
+            return timer->target->value;
+    }
+    return 0;
 }
 
-void timer_reset(struct TIMER *timer) {
-    union TIMER_CURRENT current = *timer->current;
-    union TIMER_MODE    mode    = *timer->mode;
-    union TIMER_TARGET  target  = *timer->target;
-    
-    if (mode.value != timer->old_mode) {
-        timer->current->count = 0;
-        timer->old_mode = timer->mode->value;
-        return;
-    }
+void timers_write(uint32_t address) {
+    struct TIMER *timer = timer_get(address);
+    uint64_t now = scheduler_cycles();
 
-    switch (mode.reset_after) {
-        case MAXVAL: 
-            if (current.count >= 0XFFFF) {
-                timer->current->count = 0;
-                timer->mode->hit_max  = 1;
-                
-                // handle interrupt
-                if (mode.irq_when_max) {
-                }
-            }
+    switch (address & 0XC) {
+        case 0X0:
+            timer_sync(timer, timer->current->count, now);
+            break;
+        case 0X4:
+            // writing the mode restarts the counter and rearms the interrupt
+            timer->mode->interrupt_request = 1;
+            timer->mode->hit_target = 0;
+            timer->mode->hit_max    = 0;
+            timer->irq_fired = false;
+            timer_sync(timer, 0, now);
             break;
-        case TARGET: 
-            if (current.count == target.count) {
-                timer->current->count   = 0;
-                timer->mode->hit_target = 1;
-
-                // handle interrupt
-                if (mode.irq_when_target) {
-                }
-            }
+        case 0X8:
+            timer_sync(timer, timer_count(timer, now), now);
             break;
     }
+    timer_schedule(timer);
+}
+
+void timer_create(struct TIMER *timer, uint32_t address, enum SCHEDULER_EVENT event, enum IRQ irq) {
+    timer->current = (union TIMER_CURRENT *) memory_pointer(address + 0);
+    timer->mode    = (union TIMER_MODE *)    memory_pointer(address + 4);
+    timer->target  = (union TIMER_TARGET *)  memory_pointer(address + 8);
+
+    timer->current->value = 0;
+    timer->mode->value    = 0;
+    timer->target->value  = 0;
+    timer->mode->interrupt_request = 1;
+
+    timer->event = event;
+    timer->irq   = irq;
+    timer->irq_fired = false;
+    timer_sync(timer, 0, scheduler_cycles());
+}
+
+struct TIMER *timer_get(uint32_t address) {
+    switch ((address - ADDR_TIMER_0) >> 4) {
+        case 0:  return &timers.T0;
+        case 1:  return &timers.T1;
+        default: return &timers.T2;
+    }
+}
+
+void timer_clock(struct TIMER *timer, uint32_t *cycles, uint32_t *ticks) {
+    // the counter advances ticks times every cycles cpu cycles
+    uint32_t source = timer->mode->clock_source;
+    *cycles = 1;
+    *ticks  = 1;
+
+    if (timer == &timers.T0 && (source & 1)) {
+        *cycles = TIMER_DOTCLOCK_CYCLES;
+        *ticks  = TIMER_DOTCLOCK_TICKS;
+    } 
+    else if (timer == &timers.T1 && (source & 1)) {
+        *cycles = (get_gpu()->gpustat.video_mode == PAL50HZ) ? GPU_PAL_CYCLES_PER_SCANLINE: GPU_NTSC_CYCLES_PER_SCANLINE;
+    }
+    else if (timer == &timers.T2 && (source & 2)) {
+        *cycles = 8;
+    }
+}
+
+uint64_t timer_ticks(struct TIMER *timer, uint64_t now) {
+    uint32_t cycles, ticks;
+    timer_clock(timer, &cycles, &ticks);
+    return timer->sync_count + (now - timer->sync_cycles) * ticks / cycles;
+}
+
+uint32_t timer_count(struct TIMER *timer, uint64_t now) {
+    uint64_t count  = timer_ticks(timer, now);
+    uint32_t target = timer->target->count;
+
+    // events resync the counter as it wraps, this only covers cpu steps that ran past one
+    if (timer->mode->reset_after == TARGET && target != 0 && timer->sync_count < target) {
+        if (count >= target)
+            count %= target;
+    } else if (count >= 0XFFFF) {
+        count %= 0XFFFF;
+    }
+    return count;
+}
+
+void timer_sync(struct TIMER *timer, uint32_t count, uint64_t now) {
+    timer->sync_count  = count;
+    timer->sync_cycles = now;
+    timer->current->count = count;
+}
+
+void timer_schedule(struct TIMER *timer) {
+    uint32_t count  = timer->sync_count;
+    uint32_t target = timer->target->count;
+
+    // ticks until the target or 0XFFFF, whichever comes first
+    uint32_t distance = (count < 0XFFFF) ? 0XFFFF - count: 0XFFFF;
+    if (target > count && target - count < distance)
+        distance = target - count;
+
+    uint32_t cycles, ticks;
+    timer_clock(timer, &cycles, &ticks);
+    scheduler_schedule_at(timer->event, timer->sync_cycles + ((uint64_t) distance * cycles + ticks - 1) / ticks);
+}
+
+void timer_event(struct TIMER *timer, uint64_t timestamp) {
+    uint64_t count  = timer_ticks(timer, timestamp);
+    uint32_t target = timer->target->count;
+
+    if (timer->sync_count < target && count >= target) {
+        timer->mode->hit_target = 1;
+
+        if (timer->mode->irq_when_target)
+            timer_irq(timer);
+
+        if (timer->mode->reset_after == TARGET)
+            count -= target;
+    }
+
+    if (count >= 0XFFFF) {
+        timer->mode->hit_max = 1;
+
+        if (timer->mode->irq_when_max)
+            timer_irq(timer);
+
+        count -= 0XFFFF;
+    }
+
+    timer_sync(timer, count, timestamp);
+    timer_schedule(timer);
+}
+
+void timer_irq(struct TIMER *timer) {
+    // one shot mode only interrupts once until the mode is written
+    if (!timer->mode->irq_once_or_repeat && timer->irq_fired)
+        return;
+    timer->irq_fired = true;
+
+    // toggle mode flips the request bit and interrupts on its falling edge,
+    // pulse mode drops it so briefly that it always reads back as 1
+    if (timer->mode->irq_pulse_or_toggle) {
+        timer->mode->interrupt_request ^= 1;
+        if (timer->mode->interrupt_request)
+            return;
+    }
+    interrupts_request(timer->irq);
 }
 
+void timer0_event(uint64_t timestamp) { timer_event(&timers.T0, timestamp); }
+void timer1_event(uint64_t timestamp) { timer_event(&timers.T1, timestamp); }
+void timer2_event(uint64_t timestamp) { timer_event(&timers.T2, timestamp); }
@@ -820,9 +820,9 @@ debugger_gpu PARAMS((char *args)) {
 
     struct GP0 gp0 = debugger.psx->gpu->gp0;
     printf("[GPU]                GP0\n");
-    for (int i = gp0.fifo.head; i != gp0.fifo.tail; i++, i %= 8) {
-        union COMMAND_PACKET cmd = gp0.fifo.commands[i];
-        printf("[GPU]  GP0: FIFO: command number = %02X: parameters = %06X\n", cmd.number, cmd.parameters);
+    for (uint32_t i = 0; i < gp0.count; i++) {
+        union COMMAND_PACKET cmd = { .value = gp0.packet[i] };
+        printf("[GPU]  GP0: PACKET: %2u/%2u = %02X: parameters = %06X\n", i + 1, gp0.length, cmd.number, cmd.parameters);
     }
 
     struct GP1 gp1 = debugger.psx->gpu->gp1;
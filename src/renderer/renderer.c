@@ -1,86 +1,402 @@
 #include <assert.h>
+#include <unistd.h>
 #include "renderer.h"
+#include "software.h"
 
 static struct RENDERER_CONTEXT renderer;
 
 static void renderer_load_shaders(GLuint *program, const char **files, uint32_t files_count);
 static GLuint renderer_load_shader(const char *file);
+static void renderer_software_present(void);
+static void renderer_upload_vram(void);
+static void renderer_upload_vertices(void);
+static void renderer_vertex_buffer(uint32_t capacity);
+static struct RENDERER_BATCH *renderer_batch(uint32_t blend);
+static void renderer_draw_batch(const struct RENDERER_BATCH *batch);
+static struct SOFTWARE_VERTEX renderer_software_vertex(vertex_t v);
+
+void renderer_configure(enum RENDERER_BACKEND backend, uint32_t workers, bool headless) {
+    // without a gl context only the software rasterizer can draw
+    renderer.backend  = (headless) ? RENDERER_SOFTWARE: backend;
+    renderer.workers  = workers;
+    renderer.headless = headless;
+}
 
 void renderer_create(const char **shaders, uint32_t shader_count) {
-    // create vertex buffers and allocate memory for verticies
-    glGenBuffers(1, &renderer.vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, renderer.vbo);
-    glBufferData(GL_ARRAY_BUFFER, MAX_VERTICIES * sizeof(vertex_t), NULL, GL_DYNAMIC_DRAW);
+    if (renderer.backend == RENDERER_SOFTWARE) {
+        // one worker per core unless told otherwise
+        if (renderer.workers == 0)
+            renderer.workers = sysconf(_SC_NPROCESSORS_ONLN);
+        software_create((uint16_t *) memory_VRAM_pointer(), renderer.workers);
+    }
+
+    if (renderer.headless)
+        return;
+
+    // the vertex arena grows on the cpu, the vbo follows it at the end of a frame
+    renderer.vertex_capacity = RENDERER_VERTICES_MIN;
+    renderer.vertices        = malloc(renderer.vertex_capacity * sizeof(vertex_t));
+    renderer.batch_capacity  = RENDERER_BATCHES_MIN;
+    renderer.batches         = malloc(renderer.batch_capacity * sizeof(struct RENDERER_BATCH));
+    if (renderer.vertices == NULL || renderer.batches == NULL) {
+        print_renderer_error("renderer_create", "Cannot allocate the vertex arena", NULL);
+        exit(1);
+    }
+    renderer.area_right  = 1023;
+    renderer.area_bottom = 511;
 
-    // create vertex arrays and set the attribute locations
     glGenVertexArrays(1, &renderer.vao);
-    glBindVertexArray(renderer.vao);
-    glVertexAttribPointer(0, 2, GL_SHORT, GL_FALSE, sizeof(vertex_t), (void *) offsetof(vertex_t, position));
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(vertex_t), (void *) offsetof(vertex_t, color));
-    glVertexAttribPointer(2, 2, GL_UNSIGNED_BYTE, GL_FALSE, sizeof(vertex_t), (void *) offsetof(vertex_t, texpos));
-    glVertexAttribPointer(3, 2, GL_UNSIGNED_SHORT, GL_FALSE, sizeof(vertex_t), (void *) offsetof(vertex_t, texpage));
-    glVertexAttribPointer(4, 2, GL_UNSIGNED_SHORT, GL_FALSE, sizeof(vertex_t), (void *) offsetof(vertex_t, clutpos));
-    glVertexAttribPointer(5, 1, GL_UNSIGNED_INT, GL_FALSE, sizeof(vertex_t), (void *) offsetof(vertex_t, blend));
-    glVertexAttribPointer(6, 1, GL_UNSIGNED_INT, GL_FALSE, sizeof(vertex_t), (void *) offsetof(vertex_t, depth));
-    glVertexAttribPointer(7, 1, GL_UNSIGNED_INT, GL_FALSE, sizeof(vertex_t), (void *) offsetof(vertex_t, draw_texture));
-    glVertexAttribPointer(8, 1, GL_UNSIGNED_INT, GL_FALSE, sizeof(vertex_t), (void *) offsetof(vertex_t, semi_transparent));
-    glEnableVertexAttribArray(0);
-    glEnableVertexAttribArray(1);
-    glEnableVertexAttribArray(2);
-    glEnableVertexAttribArray(3);
-    glEnableVertexAttribArray(4);
-    glEnableVertexAttribArray(5);
-    glEnableVertexAttribArray(6);
-    glEnableVertexAttribArray(7);
-    glEnableVertexAttribArray(8);
+    renderer_vertex_buffer(RENDERER_VERTICES_MIN);
     
     // create vram texture
     glGenTextures(1, &renderer.texture);
     glBindTexture(GL_TEXTURE_2D, renderer.texture);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 512, 1024, 0, GL_RGBA, GL_UNSIGNED_SHORT_5_5_5_1, memory_VRAM_pointer());
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1024, 512, 0, GL_RGBA, GL_UNSIGNED_SHORT_1_5_5_5_REV, memory_VRAM_pointer());
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
+    // staging buffer laid out like vram, dirty tiles are copied in and
+    // transferred to the texture by the driver without stalling
+    GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    glGenBuffers(1, &renderer.pbo);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, renderer.pbo);
+    glBufferStorage(GL_PIXEL_UNPACK_BUFFER, sizeof(MEM_VRAM), NULL, flags);
+    renderer.pbo_map = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, sizeof(MEM_VRAM), flags);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    renderer.pbo_fence = NULL;
+
+    if (renderer.pbo_map == NULL) {
+        print_renderer_error("renderer_create", "Cannot map the vram upload buffer", NULL);
+        exit(1);
+    }
+    renderer_vram_dirty(0, 0, 1024, 512);
+
     // load and compile shaders
     // renderer_load_shaders(&renderer.shader, shaders, shader_count);
     renderer.shader = renderer_load_shader("screen");
     renderer.offset = glGetUniformLocation(renderer.shader, "offset");
+
+    if (renderer.backend == RENDERER_SOFTWARE) {
+        glGenFramebuffers(1, &renderer.framebuffer);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, renderer.framebuffer);
+        glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, renderer.texture, 0);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+    }
+}
+
+void renderer_destroy(void) {
+    if (renderer.backend == RENDERER_SOFTWARE)
+        software_destroy();
+
+    free(renderer.vertices);
+    free(renderer.batches);
+    renderer.vertices = NULL;
+    renderer.batches  = NULL;
+}
+
+void renderer_flush(void) {
+    // finish every queued draw before vram is touched elsewhere
+    if (renderer.backend == RENDERER_SOFTWARE)
+        software_flush();
+}
+
+void renderer_attribute(uint32_t command) {
+    switch ((command >> 24) & 0XF) {
+        case 0X01:
+            renderer.semi_mode = (command >> 5) & 0X3;
+            break;
+        case 0X03:
+            renderer.area_left = (command >>  0) & 0X3FF;
+            renderer.area_top  = (command >> 10) & 0X1FF;
+            break;
+        case 0X04:
+            renderer.area_right  = (command >>  0) & 0X3FF;
+            renderer.area_bottom = (command >> 10) & 0X1FF;
+            break;
+    }
+
+    if (renderer.backend == RENDERER_SOFTWARE)
+        software_attribute(command);
+}
+
+void renderer_texpage(uint32_t texpage) {
+    renderer.semi_mode = (texpage >> 5) & 0X3;
+
+    if (renderer.backend == RENDERER_SOFTWARE)
+        software_texpage(texpage);
+}
+
+void renderer_vram_dirty(uint32_t x, uint32_t y, uint32_t w, uint32_t h) {
+    // rectangles wrap around the edges of vram like the gpu does
+    if (w == 0 || h == 0)
+        return;
+
+    uint32_t columns = 0;
+    uint32_t first = x / RENDERER_TILE_WIDTH, last = (x + w - 1) / RENDERER_TILE_WIDTH;
+    for (uint32_t column = first; column <= last && column < first + RENDERER_TILE_COLUMNS; column++)
+        columns |= 1 << (column % RENDERER_TILE_COLUMNS);
+
+    first = y / RENDERER_TILE_HEIGHT, last = (y + h - 1) / RENDERER_TILE_HEIGHT;
+    for (uint32_t row = first; row <= last && row < first + RENDERER_TILE_ROWS; row++)
+        atomic_fetch_or_explicit(&renderer.dirty[row % RENDERER_TILE_ROWS], columns, memory_order_relaxed);
 }
 
 void renderer_start_frame(void) {
-    glClear(GL_COLOR_BUFFER_BIT);
-    renderer.triangle_count = 0;
+    if (!renderer.headless)
+        glClear(GL_COLOR_BUFFER_BIT);
+    renderer.vertex_count = 0;
+    renderer.batch_count  = 0;
 }
 
 void renderer_end_frame(void) {
-    glBindBuffer(GL_ARRAY_BUFFER, renderer.vbo);
-    glBufferSubData(GL_ARRAY_BUFFER, 0, 3 * renderer.triangle_count * sizeof(vertex_t), renderer.render_vertcies);
+    if (renderer.headless) {
+        software_flush();
+        return;
+    }
+
+    if (renderer.backend == RENDERER_SOFTWARE) {
+        renderer_software_present();
+        return;
+    }
+
+    renderer_upload_vertices();
+    renderer_upload_vram();
 
     glUseProgram(renderer.shader);
     glUniform2ui(renderer.offset, gpu_display_vram_x_start(), gpu_display_vram_y_start());
     glBindVertexArray(renderer.vao);
 
-    glBindTexture(GL_TEXTURE_2D, renderer.texture);
-    glTexSubImage2D(GL_TEXTURE_2D, 0,0,0, 512, 1024, GL_RGBA, GL_UNSIGNED_SHORT_5_5_5_1, memory_VRAM_pointer());
+    for (uint32_t i = 0; i < renderer.batch_count; i++)
+        renderer_draw_batch(&renderer.batches[i]);
 
-    glDrawArrays(GL_TRIANGLES, 0, renderer.triangle_count * 3);
+    glDisable(GL_BLEND);
+    glDisable(GL_SCISSOR_TEST);
 
-    glDeleteTextures(1, &renderer.texture);
+    // the vbo is written again next frame once this frame is drawn
+    if (renderer.batch_count > 0)
+        renderer.vbo_fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
 }
 
 void renderer_push_triangle(vertex_t v1, vertex_t v2, vertex_t v3) {
-    if (renderer.triangle_count == MAX_TRIANGLES) {
-        renderer_end_frame();
-        renderer_start_frame();
+    if (renderer.backend == RENDERER_SOFTWARE) {
+        struct SOFTWARE_VERTEX s1 = renderer_software_vertex(v1);
+        struct SOFTWARE_VERTEX s2 = renderer_software_vertex(v2);
+        struct SOFTWARE_VERTEX s3 = renderer_software_vertex(v3);
+
+        software_push_triangle(&s1, &s2, &s3, v1.draw_texture, v1.blend == OPENGL_RAW_TEXTURE, v1.semi_transparent, v1.shaded, v1.clutpos);
+        return;
     }
-    
-    renderer.render_vertcies[renderer.triangle_count * 3 + 0] = v1;
-    renderer.render_vertcies[renderer.triangle_count * 3 + 1] = v2;
-    renderer.render_vertcies[renderer.triangle_count * 3 + 2] = v3;
 
-    renderer.triangle_count++;
+    struct RENDERER_BATCH *batch = renderer_batch((v1.semi_transparent) ? renderer.semi_mode + 1: 0);
+
+    if (renderer.vertex_count + 3 > renderer.vertex_capacity) {
+        renderer.vertex_capacity *= 2;
+        renderer.vertices = realloc(renderer.vertices, renderer.vertex_capacity * sizeof(vertex_t));
+        if (renderer.vertices == NULL) {
+            print_renderer_error("renderer_push_triangle", "Cannot grow the vertex arena to %u", renderer.vertex_capacity);
+            exit(1);
+        }
+    }
+
+    renderer.vertices[renderer.vertex_count++] = v1;
+    renderer.vertices[renderer.vertex_count++] = v2;
+    renderer.vertices[renderer.vertex_count++] = v3;
+    batch->count += 3;
+}
+
+static void renderer_software_present(void) {
+    struct GPU *gpu = get_gpu();
+    uint32_t x = gpu->display_vram_x_start, y = gpu->display_vram_y_start;
+    uint32_t w = gpu_display_width(), h = gpu_display_height();
+
+    software_flush();
+    renderer_upload_vram();
+
+    // vram line 0 is the top of the screen, the window counts lines from the bottom
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, renderer.framebuffer);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+    glBlitFramebuffer(x, y, x + w, y + h, 0, WIN_HEIGHT, WIN_WIDTH, 0, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+}
+
+static void renderer_upload_vram(void) {
+    uint8_t *vram = memory_VRAM_pointer();
+    bool uploaded = false;
+
+    // the previous transfer has to be out of the pbo before it is overwritten
+    if (renderer.pbo_fence != NULL) {
+        glClientWaitSync(renderer.pbo_fence, GL_SYNC_FLUSH_COMMANDS_BIT, UINT64_MAX);
+        glDeleteSync(renderer.pbo_fence);
+        renderer.pbo_fence = NULL;
+    }
+
+    glBindTexture(GL_TEXTURE_2D, renderer.texture);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, renderer.pbo);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 1024);
+
+    for (uint32_t row = 0; row < RENDERER_TILE_ROWS; row++) {
+        uint32_t columns = atomic_exchange_explicit(&renderer.dirty[row], 0, memory_order_acquire);
+
+        // one transfer per run of neighbouring dirty tiles
+        while (columns != 0) {
+            uint32_t first = __builtin_ctz(columns);
+            uint32_t count = __builtin_ctz(~(columns >> first));
+            columns &= ~(((1 << count) - 1) << first);
+
+            uint32_t x = first * RENDERER_TILE_WIDTH, w = count * RENDERER_TILE_WIDTH;
+            uint32_t y = row * RENDERER_TILE_HEIGHT;
+            size_t offset = (y * 1024 + x) * 2;
+
+            for (uint32_t line = 0; line < RENDERER_TILE_HEIGHT; line++)
+                memcpy(renderer.pbo_map + offset + line * 2048, vram + offset + line * 2048, w * 2);
+
+            glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, w, RENDERER_TILE_HEIGHT, GL_RGBA, GL_UNSIGNED_SHORT_1_5_5_5_REV, (void *) offset);
+            uploaded = true;
+        }
+    }
+
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    if (uploaded)
+        renderer.pbo_fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+static void renderer_upload_vertices(void) {
+    // wait for last frame's draws, then copy the arena into the mapped vbo
+    if (renderer.vbo_fence != NULL) {
+        glClientWaitSync(renderer.vbo_fence, GL_SYNC_FLUSH_COMMANDS_BIT, UINT64_MAX);
+        glDeleteSync(renderer.vbo_fence);
+        renderer.vbo_fence = NULL;
+    }
+
+    if (renderer.vertex_count > renderer.vbo_capacity)
+        renderer_vertex_buffer(renderer.vertex_capacity);
+
+    memcpy(renderer.vbo_map, renderer.vertices, renderer.vertex_count * sizeof(vertex_t));
+}
+
+static void renderer_vertex_buffer(uint32_t capacity) {
+    // (re)create the vbo with room for capacity vertices and point the vao at it
+    GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+    if (renderer.vbo != 0) {
+        glBindBuffer(GL_ARRAY_BUFFER, renderer.vbo);
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+        glDeleteBuffers(1, &renderer.vbo);
+    }
+
+    glGenBuffers(1, &renderer.vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, renderer.vbo);
+    glBufferStorage(GL_ARRAY_BUFFER, capacity * sizeof(vertex_t), NULL, flags);
+    renderer.vbo_map      = glMapBufferRange(GL_ARRAY_BUFFER, 0, capacity * sizeof(vertex_t), flags);
+    renderer.vbo_capacity = capacity;
+
+    if (renderer.vbo_map == NULL) {
+        print_renderer_error("renderer_vertex_buffer", "Cannot map %u vertices", capacity);
+        exit(1);
+    }
+
+    // create vertex arrays and set the attribute locations, clut, texpage and flags
+    // are read as one uvec3 and unpacked in the shader
+    glBindVertexArray(renderer.vao);
+    glVertexAttribIPointer(0, 2, GL_SHORT, sizeof(vertex_t), (void *) offsetof(vertex_t, position));
+    glVertexAttribPointer(1, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(vertex_t), (void *) offsetof(vertex_t, color));
+    glVertexAttribIPointer(2, 2, GL_UNSIGNED_BYTE, sizeof(vertex_t), (void *) offsetof(vertex_t, texpos));
+    glVertexAttribIPointer(3, 3, GL_UNSIGNED_SHORT, sizeof(vertex_t), (void *) offsetof(vertex_t, clutpos));
+    glEnableVertexAttribArray(0);
+    glEnableVertexAttribArray(1);
+    glEnableVertexAttribArray(2);
+    glEnableVertexAttribArray(3);
+}
+
+static struct RENDERER_BATCH *renderer_batch(uint32_t blend) {
+    // keep adding to the open batch unless the blend mode or drawing area moved
+    if (renderer.batch_count > 0) {
+        struct RENDERER_BATCH *batch = &renderer.batches[renderer.batch_count - 1];
+
+        if (batch->blend == blend &&
+            batch->area_left  == renderer.area_left  && batch->area_top    == renderer.area_top &&
+            batch->area_right == renderer.area_right && batch->area_bottom == renderer.area_bottom)
+            return batch;
+    }
+
+    if (renderer.batch_count == renderer.batch_capacity) {
+        renderer.batch_capacity *= 2;
+        renderer.batches = realloc(renderer.batches, renderer.batch_capacity * sizeof(struct RENDERER_BATCH));
+        if (renderer.batches == NULL) {
+            print_renderer_error("renderer_batch", "Cannot grow the batch list to %u", renderer.batch_capacity);
+            exit(1);
+        }
+    }
+
+    struct RENDERER_BATCH *batch = &renderer.batches[renderer.batch_count++];
+    *batch = (struct RENDERER_BATCH) {
+        .first       = renderer.vertex_count,
+        .count       = 0,
+        .blend       = blend,
+        .area_left   = renderer.area_left,
+        .area_top    = renderer.area_top,
+        .area_right  = renderer.area_right,
+        .area_bottom = renderer.area_bottom
+    };
+    return batch;
+}
+
+static void renderer_draw_batch(const struct RENDERER_BATCH *batch) {
+    // the window shows all of vram, scale the drawing area to it and flip y
+    GLint left   = batch->area_left * WIN_WIDTH / 1024;
+    GLint right  = (batch->area_right + 1) * WIN_WIDTH / 1024;
+    GLint top    = batch->area_top * WIN_HEIGHT / 512;
+    GLint bottom = (batch->area_bottom + 1) * WIN_HEIGHT / 512;
+
+    glEnable(GL_SCISSOR_TEST);
+    glScissor(left, WIN_HEIGHT - bottom, right - left, bottom - top);
+
+    // 0=B/2+F/2, 1=B+F, 2=B-F, 3=B+F/4
+    switch (batch->blend) {
+        case 0:
+            glDisable(GL_BLEND);
+            break;
+        case 1:
+            glEnable(GL_BLEND);
+            glBlendColor(0.0f, 0.0f, 0.0f, 0.5f);
+            glBlendEquation(GL_FUNC_ADD);
+            glBlendFunc(GL_CONSTANT_ALPHA, GL_CONSTANT_ALPHA);
+            break;
+        case 2:
+            glEnable(GL_BLEND);
+            glBlendEquation(GL_FUNC_ADD);
+            glBlendFunc(GL_ONE, GL_ONE);
+            break;
+        case 3:
+            glEnable(GL_BLEND);
+            glBlendEquation(GL_FUNC_REVERSE_SUBTRACT);
+            glBlendFunc(GL_ONE, GL_ONE);
+            break;
+        case 4:
+            glEnable(GL_BLEND);
+            glBlendColor(0.25f, 0.25f, 0.25f, 1.0f);
+            glBlendEquation(GL_FUNC_ADD);
+            glBlendFunc(GL_CONSTANT_COLOR, GL_ONE);
+            break;
+    }
+
+    glDrawArrays(GL_TRIANGLES, batch->first, batch->count);
+}
+
+static struct SOFTWARE_VERTEX renderer_software_vertex(vertex_t v) {
+    return (struct SOFTWARE_VERTEX) {
+        .x = v.position.x,
+        .y = v.position.y,
+        .r = v.color.r,
+        .g = v.color.g,
+        .b = v.color.b,
+        .u = v.texpos.x,
+        .v = v.texpos.y
+    };
 }
 
 static GLuint renderer_load_shader(const char *file) {
@@ -247,10 +563,7 @@ static Color_t col_from_gp0(uint32_t c) {
     col.r = (c >>  0) & 0xff;
     col.g = (c >>  8) & 0xff;
     col.b = (c >> 16) & 0xff;
-
-    col.r = col.r / 255.0f;
-    col.g = col.g / 255.0f;
-    col.b = col.b / 255.0f;
+    col.a = 0;
 
     // PRINT_COL(col);
 
@@ -261,41 +574,18 @@ static Texpos_t texpos_from_gp0(uint32_t p) {
     Texpos_t texpos;
 
     texpos.x = (p >> 0) & 0xff;
-    texpos.y = (p >> 4) & 0xff;
+    texpos.y = (p >> 8) & 0xff;
 
     return texpos;
 }
 
-static Texpage_t texpage_from_gp0(uint32_t p) {
-    Texpage_t page;
-    
-    p >>= 16;
-
-    page.x_base = ((p >> 0) & 0xf) * 64;
-    page.y_base = ((p >> 4) & 0x1) *256;
-
-    return page;
-}
-
-static Texdepth_e texdepth_from_gp0(uint32_t p) {
-    Texdepth_e depth;
-
-    // p >>= 16;
-
-    depth = (p >> 7) & 0x3;
-
-    return depth;
+static GLushort texpage_from_gp0(uint32_t p) {
+    // base and depth bits of the texpage attribute, the shader splits them up
+    return (p >> 16) & 0x1ff;
 }
 
-static Clutpos_t clutpos_from_gp0(uint32_t c) {
-    Clutpos_t clut;
-
-    c >>= 16;
-    
-    clut.x = ((c >> 0) & 0x3f) * 16;
-    clut.y = ((c >> 6) & 0x1ff) * 1;
-    
-    return clut;
+static GLushort clutpos_from_gp0(uint32_t c) {
+    return (c >> 16) & 0x7fff;
 }
 
 // renderer functions
@@ -381,7 +671,6 @@ void RENDER_THREE_POINT_POLYGON_TEXTURED(
         .texpos   = texpos_from_gp0(gp0_t1_clut),
         .texpage  = texpage_from_gp0(gp0_t2_page),
         .clutpos  = clutpos_from_gp0(gp0_t1_clut),
-        .depth    = texdepth_from_gp0(gp0_t2_page),
         .blend    = texture_blending + 1,
         .semi_transparent = semi_transparent
     };
@@ -393,7 +682,6 @@ void RENDER_THREE_POINT_POLYGON_TEXTURED(
         .texpos   = texpos_from_gp0(gp0_t2_page),
         .texpage  = texpage_from_gp0(gp0_t2_page),
         .clutpos  = clutpos_from_gp0(gp0_t1_clut),
-        .depth    = texdepth_from_gp0(gp0_t2_page),
         .blend    = texture_blending + 1,
         .semi_transparent = semi_transparent
     };
@@ -405,11 +693,13 @@ void RENDER_THREE_POINT_POLYGON_TEXTURED(
         .texpos   = texpos_from_gp0(gp0_t3),
         .texpage  = texpage_from_gp0(gp0_t2_page),
         .clutpos  = clutpos_from_gp0(gp0_t1_clut),
-        .depth    = texdepth_from_gp0(gp0_t2_page),
         .blend    = texture_blending + 1,
         .semi_transparent = semi_transparent
     };
 
+    // the texpage word also carries the blend mode and depth for the whole polygon
+    renderer_texpage(gp0_t2_page >> 16);
+
     renderer_push_triangle(v1, v2, v3);
 }
 void RENDER_FOUR_POINT_POLYGON_TEXTURED(
@@ -429,7 +719,6 @@ void RENDER_FOUR_POINT_POLYGON_TEXTURED(
         .texpos   = texpos_from_gp0(gp0_t1_clut),
         .texpage  = texpage_from_gp0(gp0_t2_page),
         .clutpos  = clutpos_from_gp0(gp0_t1_clut),
-        .depth    = texdepth_from_gp0(gp0_t2_page),
         .blend    = texture_blending + 1,
         .semi_transparent = semi_transparent
     };
@@ -441,7 +730,6 @@ void RENDER_FOUR_POINT_POLYGON_TEXTURED(
         .texpos   = texpos_from_gp0(gp0_t2_page),
         .texpage  = texpage_from_gp0(gp0_t2_page),
         .clutpos  = clutpos_from_gp0(gp0_t1_clut),
-        .depth    = texdepth_from_gp0(gp0_t2_page),
         .blend    = texture_blending + 1,
         .semi_transparent = semi_transparent
     };
@@ -453,7 +741,6 @@ void RENDER_FOUR_POINT_POLYGON_TEXTURED(
         .texpos   = texpos_from_gp0(gp0_t3),
         .texpage  = texpage_from_gp0(gp0_t2_page),
         .clutpos  = clutpos_from_gp0(gp0_t1_clut),
-        .depth    = texdepth_from_gp0(gp0_t2_page),
         .blend    = texture_blending + 1,
         .semi_transparent = semi_transparent
     };
@@ -465,7 +752,6 @@ void RENDER_FOUR_POINT_POLYGON_TEXTURED(
         .texpos   = texpos_from_gp0(gp0_t4),
         .texpage  = texpage_from_gp0(gp0_t2_page),
         .clutpos  = clutpos_from_gp0(gp0_t1_clut),
-        .depth    = texdepth_from_gp0(gp0_t2_page),
         .blend    = texture_blending + 1,
         .semi_transparent = semi_transparent
     };
@@ -475,6 +761,8 @@ void RENDER_FOUR_POINT_POLYGON_TEXTURED(
     PRINT_VERTEX(v3);
     PRINT_VERTEX(v4);
 
+    renderer_texpage(gp0_t2_page >> 16);
+
     renderer_push_triangle(v1, v2, v3);
     renderer_push_triangle(v2, v3, v4);
 }
@@ -490,19 +778,22 @@ void RENDER_THREE_POINT_POLYGON_SHADED(
     v1 = (vertex_t) {
         .position = pos_from_gp0(gp0_v1),
         .color    = col_from_gp0(gp0_c1),
-        .semi_transparent = semi_transparent
+        .semi_transparent = semi_transparent,
+        .shaded = true
     };
 
     v2 = (vertex_t) {
         .position = pos_from_gp0(gp0_v2),
         .color    = col_from_gp0(gp0_c2),
-        .semi_transparent = semi_transparent
+        .semi_transparent = semi_transparent,
+        .shaded = true
     };
 
     v3 = (vertex_t) {
         .position = pos_from_gp0(gp0_v3),
         .color    = col_from_gp0(gp0_c3),
-        .semi_transparent = semi_transparent
+        .semi_transparent = semi_transparent,
+        .shaded = true
     };
 
     renderer_push_triangle(v1, v2, v3);
@@ -520,25 +811,29 @@ void RENDER_FOUR_POINT_POLYGON_SHADED(
     v1 = (vertex_t) {
         .position = pos_from_gp0(gp0_v1),
         .color    = col_from_gp0(gp0_c1),
-        .semi_transparent = semi_transparent
+        .semi_transparent = semi_transparent,
+        .shaded = true
     };
 
     v2 = (vertex_t) {
         .position = pos_from_gp0(gp0_v2),
         .color    = col_from_gp0(gp0_c2),
-        .semi_transparent = semi_transparent
+        .semi_transparent = semi_transparent,
+        .shaded = true
     };
 
     v3 = (vertex_t) {
         .position = pos_from_gp0(gp0_v3),
         .color    = col_from_gp0(gp0_c3),
-        .semi_transparent = semi_transparent
+        .semi_transparent = semi_transparent,
+        .shaded = true
     };
 
     v4 = (vertex_t) {
         .position = pos_from_gp0(gp0_v4),
         .color    = col_from_gp0(gp0_c4),
-        .semi_transparent = semi_transparent
+        .semi_transparent = semi_transparent,
+        .shaded = true
     };
 
     renderer_push_triangle(v1, v2, v3);
@@ -560,9 +855,9 @@ void RENDER_THREE_POINT_POLYGON_SHADED_TEXTURED(
         .texpos   = texpos_from_gp0(gp0_t1_clut),
         .texpage  = texpage_from_gp0(gp0_t2_page),
         .clutpos  = clutpos_from_gp0(gp0_t1_clut),
-        .depth    = texdepth_from_gp0(gp0_t2_page),
         .blend    = texture_blending + 1,
-        .semi_transparent = semi_transparent
+        .semi_transparent = semi_transparent,
+        .shaded = true
     };
 
     v2 = (vertex_t) {
@@ -572,9 +867,9 @@ void RENDER_THREE_POINT_POLYGON_SHADED_TEXTURED(
         .texpos   = texpos_from_gp0(gp0_t2_page),
         .texpage  = texpage_from_gp0(gp0_t2_page),
         .clutpos  = clutpos_from_gp0(gp0_t1_clut),
-        .depth    = texdepth_from_gp0(gp0_t2_page),
         .blend    = texture_blending + 1,
-        .semi_transparent = semi_transparent
+        .semi_transparent = semi_transparent,
+        .shaded = true
     };
 
     v3 = (vertex_t) {
@@ -584,11 +879,13 @@ void RENDER_THREE_POINT_POLYGON_SHADED_TEXTURED(
         .texpos   = texpos_from_gp0(gp0_t3),
         .texpage  = texpage_from_gp0(gp0_t2_page),
         .clutpos  = clutpos_from_gp0(gp0_t1_clut),
-        .depth    = texdepth_from_gp0(gp0_t2_page),
         .blend    = texture_blending + 1,
-        .semi_transparent = semi_transparent
+        .semi_transparent = semi_transparent,
+        .shaded = true
     };
 
+    renderer_texpage(gp0_t2_page >> 16);
+
     renderer_push_triangle(v1, v2, v3);
 }
 void RENDER_FOUR_POINT_POLYGON_SHADED_TEXTURED(
@@ -608,9 +905,9 @@ void RENDER_FOUR_POINT_POLYGON_SHADED_TEXTURED(
         .texpos   = texpos_from_gp0(gp0_t1_clut),
         .texpage  = texpage_from_gp0(gp0_t2_page),
         .clutpos  = clutpos_from_gp0(gp0_t1_clut),
-        .depth    = texdepth_from_gp0(gp0_t2_page),
         .blend    = texture_blending + 1,
-        .semi_transparent = semi_transparent
+        .semi_transparent = semi_transparent,
+        .shaded = true
     };
 
     v2 = (vertex_t) {
@@ -620,9 +917,9 @@ void RENDER_FOUR_POINT_POLYGON_SHADED_TEXTURED(
         .texpos   = texpos_from_gp0(gp0_t2_page),
         .texpage  = texpage_from_gp0(gp0_t2_page),
         .clutpos  = clutpos_from_gp0(gp0_t1_clut),
-        .depth    = texdepth_from_gp0(gp0_t2_page),
         .blend    = texture_blending + 1,
-        .semi_transparent = semi_transparent
+        .semi_transparent = semi_transparent,
+        .shaded = true
     };
 
     v3 = (vertex_t) {
@@ -632,9 +929,9 @@ void RENDER_FOUR_POINT_POLYGON_SHADED_TEXTURED(
         .texpos   = texpos_from_gp0(gp0_t3),
         .texpage  = texpage_from_gp0(gp0_t2_page),
         .clutpos  = clutpos_from_gp0(gp0_t1_clut),
-        .depth    = texdepth_from_gp0(gp0_t2_page),
         .blend    = texture_blending + 1,
-        .semi_transparent = semi_transparent
+        .semi_transparent = semi_transparent,
+        .shaded = true
     };
 
     v4 = (vertex_t) {
@@ -643,12 +940,14 @@ void RENDER_FOUR_POINT_POLYGON_SHADED_TEXTURED(
         .color    = col_from_gp0(gp0_c4),
         .texpos   = texpos_from_gp0(gp0_t4),
         .texpage  = texpage_from_gp0(gp0_t2_page),
-        .depth    = texdepth_from_gp0(gp0_t2_page),
         .clutpos  = clutpos_from_gp0(gp0_t1_clut),
         .blend    = texture_blending + 1,
-        .semi_transparent = semi_transparent
+        .semi_transparent = semi_transparent,
+        .shaded = true
     };
 
+    renderer_texpage(gp0_t2_page >> 16);
+
     renderer_push_triangle(v1, v2, v3);
     renderer_push_triangle(v2, v3, v4);
 }
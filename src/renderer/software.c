@@ -0,0 +1,355 @@
+#include "software.h"
+#include "renderer.h"
+
+static struct SOFTWARE software;
+
+// rasterizer helpers
+static void *software_worker(void *arg);
+static void software_raster(uint32_t band, uint32_t bands);
+static void software_row(const struct SOFTWARE_TRIANGLE *triangle, int32_t y);
+static int32_t software_floor_div(int32_t n, int32_t d);
+static uint16_t software_tile_columns(int32_t x, int32_t width);
+static bool software_samples_drawn(uint16_t clut);
+
+struct SOFTWARE *get_software(void) { return &software; }
+
+void software_create(uint16_t *vram, uint32_t workers) {
+    if (workers < 1)                    workers = 1;
+    if (workers > SOFTWARE_WORKERS_MAX) workers = SOFTWARE_WORKERS_MAX;
+
+    software.vram        = vram;
+    software.span        = software_span_select();
+    software.workers     = workers;
+    software.batch_count = 0;
+    memset(software.drawn, 0, sizeof(software.drawn));
+    software.generation  = 0;
+    software.pending     = 0;
+    software.stopping    = false;
+
+    memset(&software.state, 0, sizeof(software.state));
+    software.state.area_right  = SOFTWARE_VRAM_WIDTH - 1;
+    software.state.area_bottom = SOFTWARE_VRAM_HEIGHT - 1;
+
+    software.batch = malloc(SOFTWARE_BATCH_MAX * sizeof(struct SOFTWARE_TRIANGLE));
+    if (software.batch == NULL) {
+        print_software_error("software_create", "Cannot allocate the triangle batch", NULL);
+        exit(1);
+    }
+
+    pthread_mutex_init(&software.lock, NULL);
+    pthread_cond_init(&software.start, NULL);
+    pthread_cond_init(&software.done, NULL);
+
+    for (uintptr_t i = 1; i < workers; i++) {
+        if (pthread_create(&software.threads[i], NULL, software_worker, (void *) i) != 0) {
+            print_software_error("software_create", "Cannot create worker %lu", i);
+            exit(1);
+        }
+    }
+}
+
+void software_destroy(void) {
+    software_flush();
+
+    pthread_mutex_lock(&software.lock);
+    software.stopping = true;
+    pthread_cond_broadcast(&software.start);
+    pthread_mutex_unlock(&software.lock);
+
+    for (uint32_t i = 1; i < software.workers; i++)
+        pthread_join(software.threads[i], NULL);
+
+    pthread_cond_destroy(&software.done);
+    pthread_cond_destroy(&software.start);
+    pthread_mutex_destroy(&software.lock);
+
+    free(software.batch);
+    software.batch = NULL;
+}
+
+void software_attribute(uint32_t command) {
+    // gp0(E1h..E6h), same layout as GP0_RENDERING_ATTRIBUTES
+    struct SOFTWARE_STATE *state = &software.state;
+
+    switch ((command >> 24) & 0XF) {
+        case 0X01:
+            software_texpage(command);
+            state->dither = (command >> 9) & 0X1;
+            break;
+        case 0X02:
+            state->window_mask_x   = (command >>  0) & 0X1F;
+            state->window_mask_y   = (command >>  5) & 0X1F;
+            state->window_offset_x = (command >> 10) & 0X1F;
+            state->window_offset_y = (command >> 15) & 0X1F;
+            break;
+        case 0X03:
+            state->area_left = (command >>  0) & 0X3FF;
+            state->area_top  = (command >> 10) & 0X1FF;
+            break;
+        case 0X04:
+            state->area_right  = (command >>  0) & 0X3FF;
+            state->area_bottom = (command >> 10) & 0X1FF;
+            break;
+        case 0X05:
+            // 11 bit signed offsets
+            state->offset_x = ((int32_t) (command << 21)) >> 21;
+            state->offset_y = ((int32_t) (command << 10)) >> 21;
+            break;
+        case 0X06:
+            state->mask_set   = (command >> 0) & 0X1;
+            state->mask_check = (command >> 1) & 0X1;
+            break;
+    }
+}
+
+void software_texpage(uint32_t texpage) {
+    // texpage attribute of a textured polygon, the low bits of gp0(E1h)
+    struct SOFTWARE_STATE *state = &software.state;
+
+    state->texpage_x = ((texpage >> 0) & 0XF) * 64;
+    state->texpage_y = ((texpage >> 4) & 0X1) * 256;
+    state->semi_mode = (texpage >> 5) & 0X3;
+    state->depth     = (texpage >> 7) & 0X3;
+}
+
+void software_push_triangle(const struct SOFTWARE_VERTEX *v1, const struct SOFTWARE_VERTEX *v2, const struct SOFTWARE_VERTEX *v3, bool textured, bool raw, bool semi, bool shaded, uint16_t clut) {
+    const struct SOFTWARE_STATE *state = &software.state;
+    const struct SOFTWARE_VERTEX *v[3] = { v1, v2, v3 };
+    int32_t x[3], y[3];
+
+    for (int i = 0; i < 3; i++) {
+        // vertices are 11 bit signed, the drawing offset is added afterwards
+        x[i] = (((int32_t) (v[i]->x << 21)) >> 21) + state->offset_x;
+        y[i] = (((int32_t) (v[i]->y << 21)) >> 21) + state->offset_y;
+    }
+
+    int32_t min_x = x[0], max_x = x[0], min_y = y[0], max_y = y[0];
+    for (int i = 1; i < 3; i++) {
+        if (x[i] < min_x) min_x = x[i];
+        if (x[i] > max_x) max_x = x[i];
+        if (y[i] < min_y) min_y = y[i];
+        if (y[i] > max_y) max_y = y[i];
+    }
+
+    // the gpu drops polygons that span more than 1023x511
+    if (max_x - min_x > 1023 || max_y - min_y > 511)
+        return;
+
+    int32_t area = (x[1] - x[0]) * (y[2] - y[0]) - (y[1] - y[0]) * (x[2] - x[0]);
+    if (area == 0)
+        return;
+
+    // wind the triangle so the inside of every edge is positive
+    if (area < 0) {
+        const struct SOFTWARE_VERTEX *vt = v[1]; v[1] = v[2]; v[2] = vt;
+        int32_t t;
+        t = x[1]; x[1] = x[2]; x[2] = t;
+        t = y[1]; y[1] = y[2]; y[2] = t;
+        area = -area;
+    }
+
+    // pixels outside the drawing area are never touched
+    if (min_x < state->area_left)   min_x = state->area_left;
+    if (min_y < state->area_top)    min_y = state->area_top;
+    if (max_x > state->area_right)  max_x = state->area_right;
+    if (max_y > state->area_bottom) max_y = state->area_bottom;
+    if (min_x > max_x || min_y > max_y)
+        return;
+
+    // a texture drawn to earlier in the batch has to be finished before it is sampled
+    if (software.batch_count == SOFTWARE_BATCH_MAX || (textured && software_samples_drawn(clut)))
+        software_flush();
+
+    uint16_t columns = software_tile_columns(min_x, max_x - min_x + 1);
+    for (int32_t row = min_y >> SOFTWARE_TILE_Y_SHIFT; row <= max_y >> SOFTWARE_TILE_Y_SHIFT; row++)
+        software.drawn[row] |= columns;
+
+    struct SOFTWARE_TRIANGLE *triangle = &software.batch[software.batch_count++];
+
+    triangle->min_x = min_x;
+    triangle->min_y = min_y;
+    triangle->max_x = max_x;
+    triangle->max_y = max_y;
+    renderer_vram_dirty(min_x, min_y, max_x - min_x + 1, max_y - min_y + 1);
+    memory_vram_written(min_y, max_y - min_y + 1);
+
+    for (int i = 0; i < 3; i++) {
+        int a = i, b = (i + 1) % 3;
+
+        triangle->edge_a[i] = -(y[b] - y[a]);
+        triangle->edge_b[i] =  (x[b] - x[a]);
+        triangle->edge_c[i] = -(triangle->edge_a[i] * x[a] + triangle->edge_b[i] * y[a]);
+
+        // top left rule, pixels on right and bottom edges belong to the neighbour
+        if (!(triangle->edge_a[i] > 0 || (triangle->edge_a[i] == 0 && triangle->edge_b[i] > 0)))
+            triangle->edge_c[i] -= 1;
+    }
+
+    int32_t f[SOFTWARE_ATTRIBUTES][3];
+    for (int i = 0; i < 3; i++) {
+        f[SOFTWARE_R][i] = v[i]->r;
+        f[SOFTWARE_G][i] = v[i]->g;
+        f[SOFTWARE_B][i] = v[i]->b;
+        f[SOFTWARE_U][i] = v[i]->u;
+        f[SOFTWARE_V][i] = v[i]->v;
+    }
+
+    triangle->origin_x = x[0];
+    triangle->origin_y = y[0];
+    for (int i = 0; i < SOFTWARE_ATTRIBUTES; i++) {
+        int64_t d1 = f[i][1] - f[i][0], d2 = f[i][2] - f[i][0];
+
+        triangle->attribute[i] = (f[i][0] << 16) + 0X8000;
+        triangle->ddx[i] = ((d1 * (y[2] - y[0]) - d2 * (y[1] - y[0])) << 16) / area;
+        triangle->ddy[i] = ((d2 * (x[1] - x[0]) - d1 * (x[2] - x[0])) << 16) / area;
+    }
+
+    triangle->texpage_x = state->texpage_x;
+    triangle->texpage_y = state->texpage_y;
+    triangle->clut_x    = (clut & 0X3F) * 16;
+    triangle->clut_y    = (clut >> 6) & 0X1FF;
+    triangle->depth     = state->depth;
+    triangle->semi_mode = state->semi_mode;
+
+    triangle->window_and_u = ~(state->window_mask_x * 8);
+    triangle->window_or_u  = (state->window_offset_x & state->window_mask_x) * 8;
+    triangle->window_and_v = ~(state->window_mask_y * 8);
+    triangle->window_or_v  = (state->window_offset_y & state->window_mask_y) * 8;
+
+    triangle->flags = 0;
+    if (textured)                                        triangle->flags |= SOFTWARE_TEXTURED;
+    if (textured && raw)                                 triangle->flags |= SOFTWARE_RAW;
+    if (semi)                                            triangle->flags |= SOFTWARE_SEMI;
+    if (state->dither && (shaded || (textured && !raw))) triangle->flags |= SOFTWARE_DITHER;
+    if (state->mask_set)                                 triangle->flags |= SOFTWARE_MASK_SET;
+    if (state->mask_check)                               triangle->flags |= SOFTWARE_MASK_CHECK;
+}
+
+void software_flush(void) {
+    if (software.batch_count == 0)
+        return;
+
+    memset(software.drawn, 0, sizeof(software.drawn));
+
+    if (software.workers == 1) {
+        software_raster(0, 1);
+        software.batch_count = 0;
+        return;
+    }
+
+    pthread_mutex_lock(&software.lock);
+    software.generation++;
+    software.pending = software.workers - 1;
+    pthread_cond_broadcast(&software.start);
+    pthread_mutex_unlock(&software.lock);
+
+    // the flushing thread takes the first share itself
+    software_raster(0, software.workers);
+
+    pthread_mutex_lock(&software.lock);
+    while (software.pending > 0)
+        pthread_cond_wait(&software.done, &software.lock);
+    pthread_mutex_unlock(&software.lock);
+
+    software.batch_count = 0;
+}
+
+// rasterizer helpers
+void *software_worker(void *arg) {
+    uint32_t band = (uintptr_t) arg;
+    uint32_t generation = 0;
+
+    for (;;) {
+        pthread_mutex_lock(&software.lock);
+        while (software.generation == generation && !software.stopping)
+            pthread_cond_wait(&software.start, &software.lock);
+        if (software.stopping) {
+            pthread_mutex_unlock(&software.lock);
+            return NULL;
+        }
+        generation = software.generation;
+        pthread_mutex_unlock(&software.lock);
+
+        software_raster(band, software.workers);
+
+        pthread_mutex_lock(&software.lock);
+        if (--software.pending == 0)
+            pthread_cond_signal(&software.done);
+        pthread_mutex_unlock(&software.lock);
+    }
+}
+
+void software_raster(uint32_t band, uint32_t bands) {
+    // each worker walks the whole batch in order but only fills its own rows,
+    // so overlapping triangles still land in submission order
+    for (uint32_t i = 0; i < software.batch_count; i++) {
+        const struct SOFTWARE_TRIANGLE *triangle = &software.batch[i];
+
+        for (int32_t y = triangle->min_y; y <= triangle->max_y; y++) {
+            if ((uint32_t) (y >> SOFTWARE_BAND_SHIFT) % bands != band) {
+                y |= (1 << SOFTWARE_BAND_SHIFT) - 1;
+                continue;
+            }
+            software_row(triangle, y);
+        }
+    }
+}
+
+void software_row(const struct SOFTWARE_TRIANGLE *triangle, int32_t y) {
+    int32_t x0 = triangle->min_x, x1 = triangle->max_x;
+
+    // solve a * x + b * y + c >= 0 for x on every edge
+    for (int i = 0; i < 3; i++) {
+        int32_t a = triangle->edge_a[i];
+        int32_t k = triangle->edge_b[i] * y + triangle->edge_c[i];
+
+        if (a > 0) {
+            int32_t x = -software_floor_div(k, a);
+            if (x > x0) x0 = x;
+        }
+        else if (a < 0) {
+            int32_t x = software_floor_div(k, -a);
+            if (x < x1) x1 = x;
+        }
+        else if (k < 0)
+            return;
+    }
+
+    if (x0 <= x1)
+        software.span(triangle, software.vram, y, x0, x1);
+}
+
+int32_t software_floor_div(int32_t n, int32_t d) {
+    // d is positive
+    int32_t q = n / d;
+    return (n % d != 0 && n < 0) ? q - 1 : q;
+}
+
+uint16_t software_tile_columns(int32_t x, int32_t width) {
+    // columns of tiles covered by x..x + width - 1, wrapping at the right edge of vram
+    uint32_t first = (x >> SOFTWARE_TILE_X_SHIFT) & 0XF;
+    uint32_t count = ((x + width - 1) >> SOFTWARE_TILE_X_SHIFT) - (x >> SOFTWARE_TILE_X_SHIFT) + 1;
+    uint32_t mask  = (count >= 16) ? 0XFFFF: (1U << count) - 1;
+
+    return (uint16_t) ((mask << first) | (mask >> (16 - first)));
+}
+
+bool software_samples_drawn(uint16_t clut) {
+    // the texpage is 256 lines of 64, 128 or 256 halfwords by depth, the clut
+    // one line of 16 or 256 entries, the texture window is not worth narrowing it
+    const struct SOFTWARE_STATE *state = &software.state;
+    static const int32_t widths[4] = { 64, 128, 256, 256 };
+
+    uint16_t columns = software_tile_columns(state->texpage_x, widths[state->depth]);
+    for (int32_t row = state->texpage_y >> SOFTWARE_TILE_Y_SHIFT; row < (state->texpage_y + 256) >> SOFTWARE_TILE_Y_SHIFT; row++) {
+        if (software.drawn[row] & columns)
+            return true;
+    }
+
+    if (state->depth < 2) {
+        int32_t clut_x = (clut & 0X3F) * 16, clut_y = (clut >> 6) & 0X1FF;
+        if (software.drawn[clut_y >> SOFTWARE_TILE_Y_SHIFT] & software_tile_columns(clut_x, (state->depth == 0) ? 16: 256))
+            return true;
+    }
+    return false;
+}
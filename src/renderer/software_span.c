@@ -0,0 +1,414 @@
+#include "software.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+// 4x4 ordered dither added to 8 bit colors before they are cut to 5 bits
+static const int8_t software_dither[4][4] = {
+    { -4,  0, -3,  1 },
+    {  2, -2,  3, -1 },
+    { -3,  1, -4,  0 },
+    {  3, -1,  2, -2 }
+};
+
+// pixel helpers
+static uint16_t software_texel(const struct SOFTWARE_TRIANGLE *triangle, const uint16_t *vram, uint32_t u, uint32_t v);
+static uint16_t software_blend(uint16_t back, uint16_t front, uint8_t mode);
+
+software_span_t software_span_select(void) {
+    // picked once at startup, every kernel writes the same pixels
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        printf("[LOG]: software rasterizer using avx2 spans\n");
+        return software_span_avx2;
+    }
+    if (__builtin_cpu_supports("sse4.1")) {
+        printf("[LOG]: software rasterizer using sse4.1 spans\n");
+        return software_span_sse41;
+    }
+#endif
+    printf("[LOG]: software rasterizer using scalar spans\n");
+    return software_span_scalar;
+}
+
+void software_span_scalar(const struct SOFTWARE_TRIANGLE *triangle, uint16_t *vram, int32_t y, int32_t x0, int32_t x1) {
+    int32_t attribute[SOFTWARE_ATTRIBUTES];
+    int64_t dx = x0 - triangle->origin_x, dy = y - triangle->origin_y;
+    uint32_t flags = triangle->flags;
+    uint16_t *row = &vram[y * SOFTWARE_VRAM_WIDTH];
+    const int8_t *dither = software_dither[y & 3];
+
+    for (int i = 0; i < SOFTWARE_ATTRIBUTES; i++)
+        attribute[i] = triangle->attribute[i] + triangle->ddx[i] * dx + triangle->ddy[i] * dy;
+
+    for (int32_t x = x0; x <= x1; x++) {
+        int32_t r = attribute[SOFTWARE_R] >> 16;
+        int32_t g = attribute[SOFTWARE_G] >> 16;
+        int32_t b = attribute[SOFTWARE_B] >> 16;
+        uint32_t u = attribute[SOFTWARE_U] >> 16;
+        uint32_t v = attribute[SOFTWARE_V] >> 16;
+
+        for (int i = 0; i < SOFTWARE_ATTRIBUTES; i++)
+            attribute[i] += triangle->ddx[i];
+
+        uint16_t back = row[x];
+        if ((flags & SOFTWARE_MASK_CHECK) && (back & 0X8000))
+            continue;
+
+        bool semi = flags & SOFTWARE_SEMI;
+        uint16_t front, mask = 0;
+
+        if (flags & SOFTWARE_TEXTURED) {
+            uint16_t texel = software_texel(triangle, vram, u, v);
+
+            // texel 0000h is see through
+            if (texel == 0)
+                continue;
+
+            mask = texel & 0X8000;
+            semi = semi && mask;
+
+            if (flags & SOFTWARE_RAW) {
+                front = texel & 0X7FFF;
+                goto write;
+            }
+
+            // texel * color / 80h, kept in 8 bits until the dither
+            r = ((texel >>  0) & 0X1F) * r >> 4;
+            g = ((texel >>  5) & 0X1F) * g >> 4;
+            b = ((texel >> 10) & 0X1F) * b >> 4;
+        }
+
+        if (flags & SOFTWARE_DITHER) {
+            r += dither[x & 3];
+            g += dither[x & 3];
+            b += dither[x & 3];
+        }
+
+        r = (r < 0) ? 0 : (r > 255) ? 255 : r;
+        g = (g < 0) ? 0 : (g > 255) ? 255 : g;
+        b = (b < 0) ? 0 : (b > 255) ? 255 : b;
+        front = (r >> 3) | ((g >> 3) << 5) | ((b >> 3) << 10);
+
+    write:
+        if (semi)
+            front = software_blend(back, front, triangle->semi_mode);
+        if (flags & SOFTWARE_MASK_SET)
+            mask = 0X8000;
+
+        row[x] = front | mask;
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+// vector helpers
+__attribute__((target("sse4.1"), always_inline)) static inline __m128i software_pixels_sse41(const struct SOFTWARE_TRIANGLE *triangle, const uint16_t *vram, __m128i back, const __m128i attribute[], __m128i dither);
+__attribute__((target("sse4.1"))) static __m128i software_blend_channel_sse41(__m128i back, __m128i front, uint8_t mode);
+__attribute__((target("avx2")))   static __m256i software_texel_avx2(const struct SOFTWARE_TRIANGLE *triangle, const uint16_t *vram, __m256i u, __m256i v);
+__attribute__((target("avx2")))   static __m256i software_blend_channel_avx2(__m256i back, __m256i front, uint8_t mode);
+
+__attribute__((target("sse4.1")))
+void software_span_sse41(const struct SOFTWARE_TRIANGLE *triangle, uint16_t *vram, int32_t y, int32_t x0, int32_t x1) {
+    // eight pixels per step as two halves of four 32 bit lanes, each with its own
+    // attribute accumulators so the two dependency chains overlap
+    uint16_t *row = &vram[y * SOFTWARE_VRAM_WIDTH];
+    int64_t dx = x0 - triangle->origin_x, dy = y - triangle->origin_y;
+    const int8_t *d = software_dither[y & 3];
+
+    const __m128i lane = _mm_setr_epi32(0, 1, 2, 3);
+    // both halves and every step are a multiple of four pixels, the dither phase holds
+    const __m128i dither = _mm_setr_epi32(d[(x0 + 0) & 3], d[(x0 + 1) & 3], d[(x0 + 2) & 3], d[(x0 + 3) & 3]);
+
+    __m128i low[SOFTWARE_ATTRIBUTES], high[SOFTWARE_ATTRIBUTES], step[SOFTWARE_ATTRIBUTES];
+    for (int i = 0; i < SOFTWARE_ATTRIBUTES; i++) {
+        int32_t start = triangle->attribute[i] + triangle->ddx[i] * dx + triangle->ddy[i] * dy;
+        low[i]  = _mm_add_epi32(_mm_set1_epi32(start), _mm_mullo_epi32(lane, _mm_set1_epi32(triangle->ddx[i])));
+        high[i] = _mm_add_epi32(low[i], _mm_set1_epi32(triangle->ddx[i] * 4));
+        step[i] = _mm_set1_epi32(triangle->ddx[i] * 8);
+    }
+
+    int32_t x = x0;
+    for (; x + 7 <= x1; x += 8) {
+        __m128i back = _mm_loadu_si128((const __m128i *) &row[x]);
+        __m128i out_low  = software_pixels_sse41(triangle, vram, _mm_cvtepu16_epi32(back), low, dither);
+        __m128i out_high = software_pixels_sse41(triangle, vram, _mm_cvtepu16_epi32(_mm_srli_si128(back, 8)), high, dither);
+
+        _mm_storeu_si128((__m128i *) &row[x], _mm_packus_epi32(out_low, out_high));
+
+        for (int i = 0; i < SOFTWARE_ATTRIBUTES; i++) {
+            low[i]  = _mm_add_epi32(low[i],  step[i]);
+            high[i] = _mm_add_epi32(high[i], step[i]);
+        }
+    }
+
+    // four more on the low half leave at most three to the scalar kernel
+    if (x + 3 <= x1) {
+        __m128i back = _mm_cvtepu16_epi32(_mm_loadl_epi64((const __m128i *) &row[x]));
+        __m128i out  = software_pixels_sse41(triangle, vram, back, low, dither);
+
+        _mm_storel_epi64((__m128i *) &row[x], _mm_packus_epi32(out, out));
+        x += 4;
+    }
+
+    if (x <= x1)
+        software_span_scalar(triangle, vram, y, x, x1);
+}
+
+__attribute__((target("avx2")))
+void software_span_avx2(const struct SOFTWARE_TRIANGLE *triangle, uint16_t *vram, int32_t y, int32_t x0, int32_t x1) {
+    // eight pixels per step in 32 bit lanes, texels and clut entries are gathered
+    uint32_t flags = triangle->flags;
+    uint16_t *row = &vram[y * SOFTWARE_VRAM_WIDTH];
+    int64_t dx = x0 - triangle->origin_x, dy = y - triangle->origin_y;
+    const int8_t *d = software_dither[y & 3];
+
+    const __m256i lane  = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256i zero  = _mm256_setzero_si256();
+    const __m256i ones  = _mm256_set1_epi32(-1);
+    const __m256i max8  = _mm256_set1_epi32(0XFF);
+    const __m256i low5  = _mm256_set1_epi32(0X1F);
+    const __m256i bit15 = _mm256_set1_epi32(0X8000);
+    const __m256i dither = _mm256_setr_epi32(
+        d[(x0 + 0) & 3], d[(x0 + 1) & 3], d[(x0 + 2) & 3], d[(x0 + 3) & 3],
+        d[(x0 + 4) & 3], d[(x0 + 5) & 3], d[(x0 + 6) & 3], d[(x0 + 7) & 3]
+    );
+
+    __m256i attribute[SOFTWARE_ATTRIBUTES], step[SOFTWARE_ATTRIBUTES];
+    for (int i = 0; i < SOFTWARE_ATTRIBUTES; i++) {
+        int32_t start = triangle->attribute[i] + triangle->ddx[i] * dx + triangle->ddy[i] * dy;
+        attribute[i] = _mm256_add_epi32(_mm256_set1_epi32(start), _mm256_mullo_epi32(lane, _mm256_set1_epi32(triangle->ddx[i])));
+        step[i]      = _mm256_set1_epi32(triangle->ddx[i] * 8);
+    }
+
+    int32_t x = x0;
+    for (; x + 7 <= x1; x += 8) {
+        __m256i back = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *) &row[x]));
+        __m256i live = ones, mask = zero, front = zero;
+        __m256i semi = (flags & SOFTWARE_SEMI) ? ones : zero;
+        __m256i r = _mm256_srai_epi32(attribute[SOFTWARE_R], 16);
+        __m256i g = _mm256_srai_epi32(attribute[SOFTWARE_G], 16);
+        __m256i b = _mm256_srai_epi32(attribute[SOFTWARE_B], 16);
+
+        if (flags & SOFTWARE_MASK_CHECK)
+            live = _mm256_cmpeq_epi32(_mm256_and_si256(back, bit15), zero);
+
+        if (flags & SOFTWARE_TEXTURED) {
+            __m256i texel = software_texel_avx2(triangle, vram,
+                _mm256_srai_epi32(attribute[SOFTWARE_U], 16),
+                _mm256_srai_epi32(attribute[SOFTWARE_V], 16));
+
+            live = _mm256_andnot_si256(_mm256_cmpeq_epi32(texel, zero), live);
+            mask = _mm256_and_si256(texel, bit15);
+            semi = _mm256_and_si256(semi, _mm256_cmpeq_epi32(mask, bit15));
+
+            if (flags & SOFTWARE_RAW)
+                front = _mm256_and_si256(texel, _mm256_set1_epi32(0X7FFF));
+            else {
+                r = _mm256_srai_epi32(_mm256_mullo_epi32(_mm256_and_si256(texel, low5), r), 4);
+                g = _mm256_srai_epi32(_mm256_mullo_epi32(_mm256_and_si256(_mm256_srli_epi32(texel,  5), low5), g), 4);
+                b = _mm256_srai_epi32(_mm256_mullo_epi32(_mm256_and_si256(_mm256_srli_epi32(texel, 10), low5), b), 4);
+            }
+        }
+
+        if (!(flags & SOFTWARE_RAW)) {
+            if (flags & SOFTWARE_DITHER) {
+                r = _mm256_add_epi32(r, dither);
+                g = _mm256_add_epi32(g, dither);
+                b = _mm256_add_epi32(b, dither);
+            }
+            r = _mm256_min_epi32(_mm256_max_epi32(r, zero), max8);
+            g = _mm256_min_epi32(_mm256_max_epi32(g, zero), max8);
+            b = _mm256_min_epi32(_mm256_max_epi32(b, zero), max8);
+            front = _mm256_or_si256(_mm256_srli_epi32(r, 3), _mm256_or_si256(
+                _mm256_slli_epi32(_mm256_srli_epi32(g, 3),  5),
+                _mm256_slli_epi32(_mm256_srli_epi32(b, 3), 10)));
+        }
+
+        if (flags & SOFTWARE_SEMI) {
+            __m256i blended = _mm256_or_si256(
+                software_blend_channel_avx2(_mm256_and_si256(back, low5), _mm256_and_si256(front, low5), triangle->semi_mode), _mm256_or_si256(
+                _mm256_slli_epi32(software_blend_channel_avx2(_mm256_and_si256(_mm256_srli_epi32(back,  5), low5), _mm256_and_si256(_mm256_srli_epi32(front,  5), low5), triangle->semi_mode),  5),
+                _mm256_slli_epi32(software_blend_channel_avx2(_mm256_and_si256(_mm256_srli_epi32(back, 10), low5), _mm256_and_si256(_mm256_srli_epi32(front, 10), low5), triangle->semi_mode), 10)));
+            front = _mm256_blendv_epi8(front, blended, semi);
+        }
+        if (flags & SOFTWARE_MASK_SET)
+            mask = bit15;
+
+        // pack the lanes back to halfwords, packus works per 128 bit half
+        __m256i out = _mm256_blendv_epi8(back, _mm256_or_si256(front, mask), live);
+        out = _mm256_permute4x64_epi64(_mm256_packus_epi32(out, out), 0XD8);
+        _mm_storeu_si128((__m128i *) &row[x], _mm256_castsi256_si128(out));
+
+        for (int i = 0; i < SOFTWARE_ATTRIBUTES; i++)
+            attribute[i] = _mm256_add_epi32(attribute[i], step[i]);
+    }
+
+    if (x <= x1)
+        software_span_scalar(triangle, vram, y, x, x1);
+}
+
+// vector helpers
+__m128i software_pixels_sse41(const struct SOFTWARE_TRIANGLE *triangle, const uint16_t *vram, __m128i back, const __m128i attribute[], __m128i dither) {
+    // four pixels of a span over back, texels are fetched lane by lane
+    uint32_t flags = triangle->flags;
+
+    const __m128i zero  = _mm_setzero_si128();
+    const __m128i ones  = _mm_set1_epi32(-1);
+    const __m128i max8  = _mm_set1_epi32(0XFF);
+    const __m128i low5  = _mm_set1_epi32(0X1F);
+    const __m128i bit15 = _mm_set1_epi32(0X8000);
+
+    __m128i live = ones, mask = zero, front = zero;
+    __m128i semi = (flags & SOFTWARE_SEMI) ? ones : zero;
+    __m128i r = _mm_srai_epi32(attribute[SOFTWARE_R], 16);
+    __m128i g = _mm_srai_epi32(attribute[SOFTWARE_G], 16);
+    __m128i b = _mm_srai_epi32(attribute[SOFTWARE_B], 16);
+
+    if (flags & SOFTWARE_MASK_CHECK)
+        live = _mm_cmpeq_epi32(_mm_and_si128(back, bit15), zero);
+
+    if (flags & SOFTWARE_TEXTURED) {
+        uint32_t u[4], v[4];
+        _mm_storeu_si128((__m128i *) u, _mm_srai_epi32(attribute[SOFTWARE_U], 16));
+        _mm_storeu_si128((__m128i *) v, _mm_srai_epi32(attribute[SOFTWARE_V], 16));
+
+        __m128i texel = _mm_setr_epi32(
+            software_texel(triangle, vram, u[0], v[0]), software_texel(triangle, vram, u[1], v[1]),
+            software_texel(triangle, vram, u[2], v[2]), software_texel(triangle, vram, u[3], v[3])
+        );
+
+        live = _mm_andnot_si128(_mm_cmpeq_epi32(texel, zero), live);
+        mask = _mm_and_si128(texel, bit15);
+        semi = _mm_and_si128(semi, _mm_cmpeq_epi32(mask, bit15));
+
+        if (flags & SOFTWARE_RAW)
+            front = _mm_and_si128(texel, _mm_set1_epi32(0X7FFF));
+        else {
+            r = _mm_srai_epi32(_mm_mullo_epi32(_mm_and_si128(texel, low5), r), 4);
+            g = _mm_srai_epi32(_mm_mullo_epi32(_mm_and_si128(_mm_srli_epi32(texel,  5), low5), g), 4);
+            b = _mm_srai_epi32(_mm_mullo_epi32(_mm_and_si128(_mm_srli_epi32(texel, 10), low5), b), 4);
+        }
+    }
+
+    if (!(flags & SOFTWARE_RAW)) {
+        if (flags & SOFTWARE_DITHER) {
+            r = _mm_add_epi32(r, dither);
+            g = _mm_add_epi32(g, dither);
+            b = _mm_add_epi32(b, dither);
+        }
+        r = _mm_min_epi32(_mm_max_epi32(r, zero), max8);
+        g = _mm_min_epi32(_mm_max_epi32(g, zero), max8);
+        b = _mm_min_epi32(_mm_max_epi32(b, zero), max8);
+        front = _mm_or_si128(_mm_srli_epi32(r, 3), _mm_or_si128(
+            _mm_slli_epi32(_mm_srli_epi32(g, 3),  5),
+            _mm_slli_epi32(_mm_srli_epi32(b, 3), 10)));
+    }
+
+    if (flags & SOFTWARE_SEMI) {
+        __m128i blended = _mm_or_si128(
+            software_blend_channel_sse41(_mm_and_si128(back, low5), _mm_and_si128(front, low5), triangle->semi_mode), _mm_or_si128(
+            _mm_slli_epi32(software_blend_channel_sse41(_mm_and_si128(_mm_srli_epi32(back,  5), low5), _mm_and_si128(_mm_srli_epi32(front,  5), low5), triangle->semi_mode),  5),
+            _mm_slli_epi32(software_blend_channel_sse41(_mm_and_si128(_mm_srli_epi32(back, 10), low5), _mm_and_si128(_mm_srli_epi32(front, 10), low5), triangle->semi_mode), 10)));
+        front = _mm_blendv_epi8(front, blended, semi);
+    }
+    if (flags & SOFTWARE_MASK_SET)
+        mask = bit15;
+
+    return _mm_blendv_epi8(back, _mm_or_si128(front, mask), live);
+}
+
+__m128i software_blend_channel_sse41(__m128i back, __m128i front, uint8_t mode) {
+    switch (mode) {
+        case 0:  return _mm_srli_epi32(_mm_add_epi32(back, front), 1);
+        case 1:  return _mm_min_epi32(_mm_add_epi32(back, front), _mm_set1_epi32(0X1F));
+        case 2:  return _mm_max_epi32(_mm_sub_epi32(back, front), _mm_setzero_si128());
+        default: return _mm_min_epi32(_mm_add_epi32(back, _mm_srli_epi32(front, 2)), _mm_set1_epi32(0X1F));
+    }
+}
+
+__m256i software_texel_avx2(const struct SOFTWARE_TRIANGLE *triangle, const uint16_t *vram, __m256i u, __m256i v) {
+    // a gather loads 32 bits at a halfword offset and the low half is kept,
+    // the last pixel of vram reads two bytes past it
+    const int *base = (const int *) vram;
+    const __m256i low16  = _mm256_set1_epi32(0XFFFF);
+    const __m256i column = _mm256_set1_epi32(SOFTWARE_VRAM_WIDTH - 1);
+
+    u = _mm256_and_si256(_mm256_or_si256(_mm256_and_si256(u, _mm256_set1_epi32(triangle->window_and_u)), _mm256_set1_epi32(triangle->window_or_u)), _mm256_set1_epi32(0XFF));
+    v = _mm256_and_si256(_mm256_or_si256(_mm256_and_si256(v, _mm256_set1_epi32(triangle->window_and_v)), _mm256_set1_epi32(triangle->window_or_v)), _mm256_set1_epi32(0XFF));
+
+    __m256i line    = _mm256_slli_epi32(_mm256_and_si256(_mm256_add_epi32(v, _mm256_set1_epi32(triangle->texpage_y)), _mm256_set1_epi32(SOFTWARE_VRAM_HEIGHT - 1)), 10);
+    __m256i texpage = _mm256_set1_epi32(triangle->texpage_x);
+    __m256i clut    = _mm256_set1_epi32(triangle->clut_y * SOFTWARE_VRAM_WIDTH);
+    __m256i clut_x  = _mm256_set1_epi32(triangle->clut_x);
+    __m256i indices, index;
+
+    switch (triangle->depth) {
+        case 0:
+            indices = _mm256_i32gather_epi32(base, _mm256_add_epi32(line, _mm256_and_si256(_mm256_add_epi32(texpage, _mm256_srli_epi32(u, 2)), column)), 2);
+            index   = _mm256_and_si256(_mm256_srlv_epi32(indices, _mm256_slli_epi32(_mm256_and_si256(u, _mm256_set1_epi32(3)), 2)), _mm256_set1_epi32(0XF));
+            return _mm256_and_si256(_mm256_i32gather_epi32(base, _mm256_add_epi32(clut, _mm256_and_si256(_mm256_add_epi32(clut_x, index), column)), 2), low16);
+        case 1:
+            indices = _mm256_i32gather_epi32(base, _mm256_add_epi32(line, _mm256_and_si256(_mm256_add_epi32(texpage, _mm256_srli_epi32(u, 1)), column)), 2);
+            index   = _mm256_and_si256(_mm256_srlv_epi32(indices, _mm256_slli_epi32(_mm256_and_si256(u, _mm256_set1_epi32(1)), 3)), _mm256_set1_epi32(0XFF));
+            return _mm256_and_si256(_mm256_i32gather_epi32(base, _mm256_add_epi32(clut, _mm256_and_si256(_mm256_add_epi32(clut_x, index), column)), 2), low16);
+        default:
+            return _mm256_and_si256(_mm256_i32gather_epi32(base, _mm256_add_epi32(line, _mm256_and_si256(_mm256_add_epi32(texpage, u), column)), 2), low16);
+    }
+}
+
+__m256i software_blend_channel_avx2(__m256i back, __m256i front, uint8_t mode) {
+    switch (mode) {
+        case 0:  return _mm256_srli_epi32(_mm256_add_epi32(back, front), 1);
+        case 1:  return _mm256_min_epi32(_mm256_add_epi32(back, front), _mm256_set1_epi32(0X1F));
+        case 2:  return _mm256_max_epi32(_mm256_sub_epi32(back, front), _mm256_setzero_si256());
+        default: return _mm256_min_epi32(_mm256_add_epi32(back, _mm256_srli_epi32(front, 2)), _mm256_set1_epi32(0X1F));
+    }
+}
+#endif
+
+// pixel helpers
+uint16_t software_texel(const struct SOFTWARE_TRIANGLE *triangle, const uint16_t *vram, uint32_t u, uint32_t v) {
+    u = ((u & triangle->window_and_u) | triangle->window_or_u) & 0XFF;
+    v = ((v & triangle->window_and_v) | triangle->window_or_v) & 0XFF;
+
+    uint32_t line = ((triangle->texpage_y + v) & (SOFTWARE_VRAM_HEIGHT - 1)) * SOFTWARE_VRAM_WIDTH;
+    uint32_t clut = triangle->clut_y * SOFTWARE_VRAM_WIDTH;
+
+    switch (triangle->depth) {
+        case 0: {
+            uint16_t indices = vram[line + ((triangle->texpage_x + (u >> 2)) & (SOFTWARE_VRAM_WIDTH - 1))];
+            uint32_t index   = (indices >> ((u & 3) * 4)) & 0XF;
+            return vram[clut + ((triangle->clut_x + index) & (SOFTWARE_VRAM_WIDTH - 1))];
+        }
+        case 1: {
+            uint16_t indices = vram[line + ((triangle->texpage_x + (u >> 1)) & (SOFTWARE_VRAM_WIDTH - 1))];
+            uint32_t index   = (indices >> ((u & 1) * 8)) & 0XFF;
+            return vram[clut + ((triangle->clut_x + index) & (SOFTWARE_VRAM_WIDTH - 1))];
+        }
+        default:
+            return vram[line + ((triangle->texpage_x + u) & (SOFTWARE_VRAM_WIDTH - 1))];
+    }
+}
+
+uint16_t software_blend(uint16_t back, uint16_t front, uint8_t mode) {
+    // per 5 bit channel, 0=B/2+F/2, 1=B+F, 2=B-F, 3=B+F/4
+    uint16_t result = 0;
+
+    for (int shift = 0; shift < 15; shift += 5) {
+        int32_t b = (back  >> shift) & 0X1F;
+        int32_t f = (front >> shift) & 0X1F;
+        int32_t c;
+
+        switch (mode) {
+            case 0:  c = (b + f) >> 1; break;
+            case 1:  c = b + f; break;
+            case 2:  c = b - f; break;
+            default: c = b + (f >> 2); break;
+        }
+        c = (c < 0) ? 0 : (c > 0X1F) ? 0X1F : c;
+        result |= c << shift;
+    }
+    return result;
+}